@@ -14,9 +14,13 @@ LOCAL_SRC_FILES:= \
     src/MutexLock.cpp \
     src/NSysDep.cpp \
     src/NUtil.cpp \
+    src/PeerConnector.cpp \
+    src/PeerServer.cpp \
     src/Pipe.cpp \
     src/PipeWatch.cpp \
+    src/PreparedMessage.cpp \
     src/RequestContext.cpp \
+    src/ResponseCache.cpp \
     src/ScopedLock.cpp \
     src/Semaphore.cpp \
     src/Semaphore_POSIX.cpp \
@@ -26,8 +30,10 @@ LOCAL_SRC_FILES:= \
     src/svcipc_error.c \
     src/Thread.cpp \
     src/Timeout.cpp \
+    src/TraceRing.cpp \
     src/trace.cpp \
-    src/Watch.cpp
+    src/Watch.cpp \
+    src/Watchdog.cpp
 
 
 
@@ -10,6 +10,7 @@ extern "C" {
 #include "dbusipc/dbusipc_types.h"
 #include "dbusipc/dbusipc_error.h"
 #include "dbusipc/dbusipc_api.h"
+#include "dbusipc/dbusipc_trace.h"
 
 
 #ifdef __cplusplus
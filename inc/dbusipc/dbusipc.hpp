@@ -0,0 +1,961 @@
+#ifndef _DBUSIPC_HPP_
+#define _DBUSIPC_HPP_
+
+//
+// C++17 interface to the library. These are thin, header-only wrappers
+// around the C API that manage the lifetime of connections, services,
+// subscriptions, requests and responses and deliver callbacks to any
+// callable (lambdas included) instead of a function and an untyped token.
+// The library itself doesn't need to be built as C++17.
+//
+
+#if !defined(__cplusplus) || (__cplusplus < 201703L)
+#error "dbusipc/dbusipc.hpp requires C++17 (use dbusipc/dbusipc.h instead)"
+#endif
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "dbusipc/dbusipc.h"
+
+namespace dbusipc
+{
+
+//
+// A NUL terminated string argument. The C API needs the terminator so
+// std::string_view isn't accepted here, but both C strings and
+// std::string are without copying them.
+//
+class CStr
+{
+public:
+   CStr(const char* str) noexcept : mStr(str) {}
+   CStr(const std::string& str) noexcept : mStr(str.c_str()) {}
+
+   const char* c_str() const noexcept { return mStr; }
+
+private:
+   const char* mStr;
+};
+
+
+//
+// The outcome of an asynchronous operation. The strings are only valid
+// for the duration of the callback.
+//
+struct Status
+{
+   DBUSIPC_tError    error;
+   std::string_view  name;
+   std::string_view  message;
+
+   bool ok() const noexcept { return !DBUSIPC_IS_ERROR(error); }
+};
+
+
+namespace detail
+{
+
+inline std::string_view view(const char* str) noexcept
+{
+   return (nullptr != str) ? std::string_view(str) : std::string_view();
+}
+
+inline Status toStatus(const DBUSIPC_tCallbackStatus* status) noexcept
+{
+   return Status{ status->errCode, view(status->errName),
+                  view(status->errMsg) };
+}
+
+} // namespace detail
+
+
+//
+// A move-only callable. Callables no bigger than Capacity (a lambda
+// capturing a few pointers, say) are stored in place so wrapping them
+// doesn't allocate. Bigger ones are moved to the heap.
+//
+template <typename Signature, std::size_t Capacity = 4U * sizeof(void*)>
+class Callback;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class Callback<R(Args...), Capacity>
+{
+public:
+   Callback() noexcept : mOps(nullptr) {}
+   Callback(std::nullptr_t) noexcept : mOps(nullptr) {}
+
+   template <typename F, typename Fn = std::decay_t<F>,
+             typename = std::enable_if_t<!std::is_same_v<Fn, Callback> &&
+                        std::is_invocable_r_v<R, Fn&, Args...>>>
+   Callback(F&& f)
+      : mOps(&Ops<Fn>::OPS)
+   {
+      if constexpr ( isInline<Fn>() )
+      {
+         ::new (static_cast<void*>(mStorage)) Fn(std::forward<F>(f));
+      }
+      else
+      {
+         ::new (static_cast<void*>(mStorage)) Fn*(new Fn(std::forward<F>(f)));
+      }
+   }
+
+   Callback(Callback&& other) noexcept
+      : mOps(other.mOps)
+   {
+      if ( nullptr != mOps )
+      {
+         mOps->move(other.mStorage, mStorage);
+         other.mOps = nullptr;
+      }
+   }
+
+   Callback& operator=(Callback&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         reset();
+         mOps = rhs.mOps;
+         if ( nullptr != mOps )
+         {
+            mOps->move(rhs.mStorage, mStorage);
+            rhs.mOps = nullptr;
+         }
+      }
+
+      return *this;
+   }
+
+   ~Callback() { reset(); }
+
+   Callback(const Callback&) = delete;
+   Callback& operator=(const Callback&) = delete;
+
+   explicit operator bool() const noexcept { return nullptr != mOps; }
+
+   R operator()(Args... args)
+   {
+      return mOps->invoke(mStorage, std::forward<Args>(args)...);
+   }
+
+   void reset() noexcept
+   {
+      if ( nullptr != mOps )
+      {
+         mOps->destroy(mStorage);
+         mOps = nullptr;
+      }
+   }
+
+private:
+   struct tOps
+   {
+      R (*invoke)(void* storage, Args&&... args);
+      void (*move)(void* from, void* to) noexcept;
+      void (*destroy)(void* storage) noexcept;
+   };
+
+   template <typename Fn>
+   static constexpr bool isInline()
+   {
+      return (sizeof(Fn) <= Capacity) &&
+             (alignof(Fn) <= alignof(std::max_align_t)) &&
+             std::is_nothrow_move_constructible_v<Fn>;
+   }
+
+   template <typename Fn>
+   struct Ops
+   {
+      static Fn* get(void* storage) noexcept
+      {
+         if constexpr ( isInline<Fn>() )
+         {
+            return std::launder(static_cast<Fn*>(storage));
+         }
+         else
+         {
+            return *static_cast<Fn**>(storage);
+         }
+      }
+
+      static R invoke(void* storage, Args&&... args)
+      {
+         return std::invoke(*get(storage), std::forward<Args>(args)...);
+      }
+
+      static void move(void* from, void* to) noexcept
+      {
+         if constexpr ( isInline<Fn>() )
+         {
+            ::new (to) Fn(std::move(*get(from)));
+            get(from)->~Fn();
+         }
+         else
+         {
+            // Only the pointer moves
+            ::new (to) Fn*(get(from));
+         }
+      }
+
+      static void destroy(void* storage) noexcept
+      {
+         if constexpr ( isInline<Fn>() )
+         {
+            get(storage)->~Fn();
+         }
+         else
+         {
+            delete get(storage);
+         }
+      }
+
+      static constexpr tOps OPS = { invoke, move, destroy };
+   };
+
+   alignas(std::max_align_t) unsigned char mStorage[Capacity];
+   const tOps* mOps;
+};
+
+
+//
+// The reply to a synchronous invocation. It owns the reply (and frees it)
+// and gives access to the payload without copying it again. The length of
+// the payload is only measured once.
+//
+class Response
+{
+public:
+   Response() noexcept
+      : mResponse(nullptr)
+      , mError(DBUSIPC_ERROR_NONE)
+      , mSize(0U)
+   {
+   }
+
+   // Takes ownership of the response
+   Response(DBUSIPC_tError error, DBUSIPC_tResponse* response) noexcept
+      : mResponse(response)
+      , mError(error)
+      , mSize(0U)
+   {
+      if ( nullptr != mResponse )
+      {
+         mError = mResponse->status.errCode;
+         if ( nullptr != mResponse->result )
+         {
+            mSize = std::char_traits<char>::length(mResponse->result);
+         }
+      }
+   }
+
+   Response(Response&& other) noexcept
+      : mResponse(std::exchange(other.mResponse, nullptr))
+      , mError(other.mError)
+      , mSize(std::exchange(other.mSize, 0U))
+   {
+   }
+
+   Response& operator=(Response&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         DBUSIPC_freeResponse(mResponse);
+         mResponse = std::exchange(rhs.mResponse, nullptr);
+         mError = rhs.mError;
+         mSize = std::exchange(rhs.mSize, 0U);
+      }
+
+      return *this;
+   }
+
+   ~Response() { DBUSIPC_freeResponse(mResponse); }
+
+   Response(const Response&) = delete;
+   Response& operator=(const Response&) = delete;
+
+   DBUSIPC_tError error() const noexcept { return mError; }
+   bool ok() const noexcept { return !DBUSIPC_IS_ERROR(mError); }
+   explicit operator bool() const noexcept { return ok(); }
+
+   // The JSON encoded result (empty if there is none)
+   const char* data() const noexcept
+   {
+      return ((nullptr != mResponse) && (nullptr != mResponse->result)) ?
+             mResponse->result : "";
+   }
+   std::size_t size() const noexcept { return mSize; }
+   std::string_view result() const noexcept
+   {
+      return std::string_view(data(), mSize);
+   }
+
+   std::string_view errorName() const noexcept
+   {
+      return (nullptr != mResponse) ?
+             detail::view(mResponse->status.errName) : std::string_view();
+   }
+   std::string_view errorMessage() const noexcept
+   {
+      return (nullptr != mResponse) ?
+             detail::view(mResponse->status.errMsg) : std::string_view();
+   }
+
+   // Hands the response over to the caller (who must free it)
+   DBUSIPC_tResponse* release() noexcept
+   {
+      mSize = 0U;
+      return std::exchange(mResponse, nullptr);
+   }
+
+private:
+   DBUSIPC_tResponse*   mResponse;
+   DBUSIPC_tError       mError;
+   std::size_t          mSize;
+};
+
+
+//
+// A request received by a service. Replying frees the request context in
+// the same trip through the dispatcher. A request that is destroyed
+// without a reply is simply freed (the client will time out) so a handler
+// that replies later must move the request somewhere.
+//
+class Request
+{
+public:
+   Request() noexcept : mContext(nullptr) {}
+   explicit Request(DBUSIPC_tReqContext context) noexcept
+      : mContext(context)
+   {
+   }
+
+   Request(Request&& other) noexcept
+      : mContext(std::exchange(other.mContext, nullptr))
+   {
+   }
+
+   Request& operator=(Request&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         free();
+         mContext = std::exchange(rhs.mContext, nullptr);
+      }
+
+      return *this;
+   }
+
+   ~Request() { free(); }
+
+   Request(const Request&) = delete;
+   Request& operator=(const Request&) = delete;
+
+   DBUSIPC_tReqContext context() const noexcept { return mContext; }
+   explicit operator bool() const noexcept { return nullptr != mContext; }
+
+   DBUSIPC_tError reply(CStr result) noexcept
+   {
+      return DBUSIPC_asyncReturnResultAndFree(release(), result.c_str(),
+                                              nullptr, nullptr);
+   }
+
+   DBUSIPC_tError replyError(CStr name, CStr message) noexcept
+   {
+      return DBUSIPC_asyncReturnErrorAndFree(release(), name.c_str(),
+                                             message.c_str(), nullptr,
+                                             nullptr);
+   }
+
+   // See DBUSIPC_getReqDeadline()
+   DBUSIPC_tError remaining(DBUSIPC_tUInt32& msecRemaining) const noexcept
+   {
+      return DBUSIPC_getReqDeadline(mContext, &msecRemaining);
+   }
+
+   DBUSIPC_tReqContext release() noexcept
+   {
+      return std::exchange(mContext, nullptr);
+   }
+
+private:
+   void free() noexcept
+   {
+      if ( nullptr != mContext )
+      {
+         DBUSIPC_freeReqContext(std::exchange(mContext, nullptr));
+      }
+   }
+
+   DBUSIPC_tReqContext  mContext;
+};
+
+
+using ResultCallback = Callback<void(const Status& status,
+                                     std::string_view result)>;
+using RequestCallback = Callback<void(Request&& request,
+                                      std::string_view method,
+                                      std::string_view parameters,
+                                      bool noReplyExpected)>;
+using SignalCallback = Callback<void(std::string_view sigName,
+                                     std::string_view data)>;
+
+
+namespace detail
+{
+
+inline void onResult
+   (
+   const DBUSIPC_tCallbackStatus*   status,
+   DBUSIPC_tConstStr                result,
+   DBUSIPC_tUserToken               token
+   )
+{
+   std::unique_ptr<ResultCallback> onResult(
+                                       static_cast<ResultCallback*>(token));
+   (*onResult)(toStatus(status), view(result));
+}
+
+inline void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   (*static_cast<RequestCallback*>(token))(Request(context), view(method),
+                                           view(parms),
+                                           DBUSIPC_FALSE != noReplyExpected);
+}
+
+} // namespace detail
+
+
+class Service;
+class Subscription;
+
+using RegisterCallback = Callback<void(const Status& status,
+                                       Service&& service)>;
+using SubscribeCallback = Callback<void(const Status& status,
+                                        Subscription&& subscription)>;
+
+
+//
+// A registered service. Destroying it unregisters the service, after
+// which none of its handlers is called again. When that happens on the
+// dispatcher thread (which can't wait for itself) the service is
+// unregistered asynchronously instead and a request already on its way
+// might still be handled.
+//
+class Service
+{
+public:
+   Service() noexcept : mRegHnd(nullptr) {}
+
+   Service(Service&& other) noexcept
+      : mRegHnd(std::exchange(other.mRegHnd, nullptr))
+      , mState(std::move(other.mState))
+   {
+   }
+
+   Service& operator=(Service&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         (void)unregister();
+         mRegHnd = std::exchange(rhs.mRegHnd, nullptr);
+         mState = std::move(rhs.mState);
+      }
+
+      return *this;
+   }
+
+   ~Service() { (void)unregister(); }
+
+   Service(const Service&) = delete;
+   Service& operator=(const Service&) = delete;
+
+   DBUSIPC_tSvcRegHnd handle() const noexcept { return mRegHnd; }
+   explicit operator bool() const noexcept { return nullptr != mRegHnd; }
+
+   // Handles a method separately (see DBUSIPC_registerMethod()). An empty
+   // callback removes the handler.
+   DBUSIPC_tError setMethod(CStr method, RequestCallback onRequest)
+   {
+      DBUSIPC_tError status(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                               DBUSIPC_DOMAIN_IPC_LIB,
+                                               DBUSIPC_ERR_BAD_ARGS));
+      if ( (nullptr != mRegHnd) && (nullptr != method.c_str()) )
+      {
+         std::unique_ptr<RequestCallback> handler;
+         if ( onRequest )
+         {
+            handler = std::make_unique<RequestCallback>(std::move(onRequest));
+         }
+
+         status = DBUSIPC_registerMethod(mRegHnd, method.c_str(),
+                                         handler ? detail::onRequest : nullptr,
+                                         handler.get());
+         // The dispatcher has stopped using the old handler by now
+         if ( !DBUSIPC_IS_ERROR(status) && handler )
+         {
+            mState->methods[method.c_str()] = std::move(handler);
+         }
+         else if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            (void)mState->methods.erase(method.c_str());
+         }
+      }
+
+      return status;
+   }
+
+   DBUSIPC_tError emit(CStr sigName, CStr data) const noexcept
+   {
+      return DBUSIPC_emit(mRegHnd, sigName.c_str(), data.c_str());
+   }
+
+   DBUSIPC_tError unregister() noexcept
+   {
+      DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+      if ( nullptr != mRegHnd )
+      {
+         DBUSIPC_tSvcRegHnd regHnd = std::exchange(mRegHnd, nullptr);
+         status = DBUSIPC_unregisterService(regHnd);
+         if ( DBUSIPC_ERR_DEADLOCK == DBUSIPC_ERR_GET_CODE(status) )
+         {
+            status = DBUSIPC_asyncUnregisterService(regHnd, onUnregistered,
+                                                    mState.get());
+            if ( !DBUSIPC_IS_ERROR(status) )
+            {
+               (void)mState.release();
+            }
+         }
+      }
+
+      // The handlers are leaked rather than freed while the library might
+      // still call them
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         (void)mState.release();
+      }
+      mState.reset();
+
+      return status;
+   }
+
+private:
+   friend class Connection;
+
+   // The handlers are passed to the library as tokens so they mustn't
+   // move when the service does
+   struct tState
+   {
+      RequestCallback                                          onRequest;
+      RegisterCallback                                         onRegister;
+      std::map<std::string, std::unique_ptr<RequestCallback>>  methods;
+   };
+
+   static void onRequest
+      (
+      DBUSIPC_tReqContext  context,
+      DBUSIPC_tConstStr    method,
+      DBUSIPC_tConstStr    parms,
+      DBUSIPC_tBool        noReplyExpected,
+      DBUSIPC_tUserToken   token
+      )
+   {
+      static_cast<tState*>(token)->onRequest(Request(context),
+                                             detail::view(method),
+                                             detail::view(parms),
+                                             DBUSIPC_FALSE != noReplyExpected);
+   }
+
+   static void onRegistered
+      (
+      const DBUSIPC_tCallbackStatus*   status,
+      DBUSIPC_tSvcRegHnd               regHnd,
+      DBUSIPC_tUserToken               token
+      )
+   {
+      std::unique_ptr<tState> state(static_cast<tState*>(token));
+      RegisterCallback onRegister(std::move(state->onRegister));
+      Service svc;
+
+      if ( !DBUSIPC_IS_ERROR(status->errCode) )
+      {
+         svc.mRegHnd = regHnd;
+         svc.mState = std::move(state);
+      }
+      onRegister(detail::toStatus(status), std::move(svc));
+   }
+
+   static void onUnregistered
+      (
+      const DBUSIPC_tCallbackStatus*   status,
+      DBUSIPC_tUserToken               token
+      )
+   {
+      (void)status;
+      delete static_cast<tState*>(token);
+   }
+
+   DBUSIPC_tSvcRegHnd         mRegHnd;
+   std::unique_ptr<tState>    mState;
+};
+
+
+//
+// A signal subscription. Destroying it unsubscribes, after which the
+// callback isn't called again (but see Service for what happens on the
+// dispatcher thread).
+//
+class Subscription
+{
+public:
+   Subscription() noexcept : mSubHnd(nullptr) {}
+
+   Subscription(Subscription&& other) noexcept
+      : mSubHnd(std::exchange(other.mSubHnd, nullptr))
+      , mState(std::move(other.mState))
+   {
+   }
+
+   Subscription& operator=(Subscription&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         (void)unsubscribe();
+         mSubHnd = std::exchange(rhs.mSubHnd, nullptr);
+         mState = std::move(rhs.mState);
+      }
+
+      return *this;
+   }
+
+   ~Subscription() { (void)unsubscribe(); }
+
+   Subscription(const Subscription&) = delete;
+   Subscription& operator=(const Subscription&) = delete;
+
+   DBUSIPC_tSigSubHnd handle() const noexcept { return mSubHnd; }
+   explicit operator bool() const noexcept { return nullptr != mSubHnd; }
+
+   DBUSIPC_tError unsubscribe() noexcept
+   {
+      DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+      if ( nullptr != mSubHnd )
+      {
+         DBUSIPC_tSigSubHnd subHnd = std::exchange(mSubHnd, nullptr);
+         status = DBUSIPC_unsubscribe(subHnd);
+         if ( DBUSIPC_ERR_DEADLOCK == DBUSIPC_ERR_GET_CODE(status) )
+         {
+            status = DBUSIPC_asyncUnsubscribe(subHnd, onUnsubscribed,
+                                              mState.get());
+            if ( !DBUSIPC_IS_ERROR(status) )
+            {
+               (void)mState.release();
+            }
+         }
+      }
+
+      // Leaked rather than freed while the library might still call it
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         (void)mState.release();
+      }
+      mState.reset();
+
+      return status;
+   }
+
+private:
+   friend class Connection;
+
+   struct tState
+   {
+      SignalCallback    onSignal;
+      SubscribeCallback onSubscribe;
+   };
+
+   static void onSignal
+      (
+      DBUSIPC_tConstStr    sigName,
+      DBUSIPC_tConstStr    data,
+      DBUSIPC_tUserToken   token
+      )
+   {
+      static_cast<tState*>(token)->onSignal(detail::view(sigName),
+                                            detail::view(data));
+   }
+
+   static void onSubscribed
+      (
+      const DBUSIPC_tCallbackStatus*   status,
+      DBUSIPC_tSigSubHnd               subHnd,
+      DBUSIPC_tUserToken               token
+      )
+   {
+      std::unique_ptr<tState> state(static_cast<tState*>(token));
+      SubscribeCallback onSubscribe(std::move(state->onSubscribe));
+      Subscription sub;
+
+      if ( !DBUSIPC_IS_ERROR(status->errCode) )
+      {
+         sub.mSubHnd = subHnd;
+         sub.mState = std::move(state);
+      }
+      onSubscribe(detail::toStatus(status), std::move(sub));
+   }
+
+   static void onUnsubscribed
+      (
+      const DBUSIPC_tCallbackStatus*   status,
+      DBUSIPC_tUserToken               token
+      )
+   {
+      (void)status;
+      delete static_cast<tState*>(token);
+   }
+
+   DBUSIPC_tSigSubHnd         mSubHnd;
+   std::unique_ptr<tState>    mState;
+};
+
+
+//
+// A connection to a bus (or peer). Destroying it closes the connection.
+// The functions reporting an error through an optional pointer return an
+// empty object on failure. The asynchronous ones call back exactly once
+// (on the dispatcher thread) unless they return an error.
+//
+class Connection
+{
+public:
+   Connection() noexcept : mConn(nullptr) {}
+
+   // Takes ownership of the connection
+   explicit Connection(DBUSIPC_tConnection conn) noexcept : mConn(conn) {}
+
+   Connection(Connection&& other) noexcept
+      : mConn(std::exchange(other.mConn, nullptr))
+   {
+   }
+
+   Connection& operator=(Connection&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         (void)close();
+         mConn = std::exchange(rhs.mConn, nullptr);
+      }
+
+      return *this;
+   }
+
+   ~Connection() { (void)close(); }
+
+   Connection(const Connection&) = delete;
+   Connection& operator=(const Connection&) = delete;
+
+   static Connection get(DBUSIPC_tConnType connType,
+                         DBUSIPC_tError* error = nullptr,
+                         bool openPrivate = true) noexcept
+   {
+      DBUSIPC_tConnection conn(nullptr);
+      DBUSIPC_tError status = DBUSIPC_getConnection(connType,
+                                 openPrivate ? DBUSIPC_TRUE : DBUSIPC_FALSE,
+                                 &conn);
+      setError(error, status);
+      return Connection(DBUSIPC_IS_ERROR(status) ? nullptr : conn);
+   }
+
+   static Connection open(CStr address, DBUSIPC_tError* error = nullptr,
+                          bool openPrivate = true) noexcept
+   {
+      DBUSIPC_tConnection conn(nullptr);
+      DBUSIPC_tError status = DBUSIPC_openConnection(address.c_str(),
+                                 openPrivate ? DBUSIPC_TRUE : DBUSIPC_FALSE,
+                                 &conn);
+      setError(error, status);
+      return Connection(DBUSIPC_IS_ERROR(status) ? nullptr : conn);
+   }
+
+   DBUSIPC_tConnection handle() const noexcept { return mConn; }
+   explicit operator bool() const noexcept { return nullptr != mConn; }
+
+   DBUSIPC_tConnection release() noexcept
+   {
+      return std::exchange(mConn, nullptr);
+   }
+
+   DBUSIPC_tError close() noexcept
+   {
+      DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+      if ( nullptr != mConn )
+      {
+         status = DBUSIPC_closeConnection(std::exchange(mConn, nullptr));
+      }
+
+      return status;
+   }
+
+   // Synchronously invokes a method (see DBUSIPC_invoke())
+   Response invoke(CStr busName, CStr objPath, CStr method,
+                   CStr parameters, DBUSIPC_tUInt32 msecTimeout) const noexcept
+   {
+      DBUSIPC_tResponse* response(nullptr);
+      DBUSIPC_tError status = DBUSIPC_invoke(mConn, busName.c_str(),
+                                 objPath.c_str(), method.c_str(),
+                                 parameters.c_str(), msecTimeout, &response);
+      return Response(status, response);
+   }
+
+   // Asynchronously invokes a method (see DBUSIPC_asyncInvokeWithFlags())
+   DBUSIPC_tError asyncInvoke(CStr busName, CStr objPath, CStr method,
+                              CStr parameters, DBUSIPC_tUInt32 msecTimeout,
+                              ResultCallback onResult,
+                              DBUSIPC_tHandle* handle = nullptr,
+                              DBUSIPC_tUInt32 flags = 0U) const
+   {
+      DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+      if ( !onResult )
+      {
+         status = DBUSIPC_asyncInvokeWithFlags(mConn, busName.c_str(),
+                     objPath.c_str(), method.c_str(), parameters.c_str(),
+                     flags, msecTimeout, nullptr, handle, nullptr);
+      }
+      else
+      {
+         // Small callables are stored in place so this is the only
+         // allocation
+         auto token = std::make_unique<ResultCallback>(std::move(onResult));
+         status = DBUSIPC_asyncInvokeWithFlags(mConn, busName.c_str(),
+                     objPath.c_str(), method.c_str(), parameters.c_str(),
+                     flags, msecTimeout, detail::onResult, handle,
+                     token.get());
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            // The callback now owns it
+            (void)token.release();
+         }
+      }
+
+      return status;
+   }
+
+   Subscription subscribe(CStr objPath, CStr sigName,
+                          SignalCallback onSignal,
+                          DBUSIPC_tError* error = nullptr) const
+   {
+      Subscription sub;
+      sub.mState = std::make_unique<Subscription::tState>();
+      sub.mState->onSignal = std::move(onSignal);
+
+      DBUSIPC_tError status = DBUSIPC_subscribe(mConn, objPath.c_str(),
+                                 sigName.c_str(), Subscription::onSignal,
+                                 sub.mState.get(), &sub.mSubHnd);
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         sub.mSubHnd = nullptr;
+         sub.mState.reset();
+      }
+      setError(error, status);
+
+      return sub;
+   }
+
+   // The subscription is handed to the callback (see
+   // DBUSIPC_asyncSubscribe())
+   DBUSIPC_tError asyncSubscribe(CStr objPath, CStr sigName,
+                                 SignalCallback onSignal,
+                                 SubscribeCallback onSubscribe) const
+   {
+      auto state = std::make_unique<Subscription::tState>();
+      state->onSignal = std::move(onSignal);
+      state->onSubscribe = std::move(onSubscribe);
+
+      DBUSIPC_tError status = DBUSIPC_asyncSubscribe(mConn, objPath.c_str(),
+                                 sigName.c_str(), Subscription::onSignal,
+                                 Subscription::onSubscribed, state.get());
+      if ( !DBUSIPC_IS_ERROR(status) )
+      {
+         (void)state.release();
+      }
+
+      return status;
+   }
+
+   // An empty callback means every method is handled separately (see
+   // Service::setMethod())
+   Service registerService(CStr busName, CStr objPath, DBUSIPC_tUInt32 flags,
+                           RequestCallback onRequest,
+                           DBUSIPC_tError* error = nullptr) const
+   {
+      Service svc;
+      svc.mState = std::make_unique<Service::tState>();
+      svc.mState->onRequest = std::move(onRequest);
+
+      bool catchAll(svc.mState->onRequest);
+      DBUSIPC_tError status = DBUSIPC_registerService(mConn, busName.c_str(),
+                                 objPath.c_str(), flags,
+                                 catchAll ? Service::onRequest : nullptr,
+                                 svc.mState.get(), &svc.mRegHnd);
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         svc.mRegHnd = nullptr;
+         svc.mState.reset();
+      }
+      setError(error, status);
+
+      return svc;
+   }
+
+   // The service is handed to the callback (see
+   // DBUSIPC_asyncRegisterService())
+   DBUSIPC_tError asyncRegisterService(CStr busName, CStr objPath,
+                                       DBUSIPC_tUInt32 flags,
+                                       RequestCallback onRequest,
+                                       RegisterCallback onRegister) const
+   {
+      auto state = std::make_unique<Service::tState>();
+      bool catchAll(onRequest);
+      state->onRequest = std::move(onRequest);
+      state->onRegister = std::move(onRegister);
+
+      DBUSIPC_tError status = DBUSIPC_asyncRegisterService(mConn,
+                                 busName.c_str(), objPath.c_str(), flags,
+                                 catchAll ? Service::onRequest : nullptr,
+                                 Service::onRegistered, state.get());
+      if ( !DBUSIPC_IS_ERROR(status) )
+      {
+         (void)state.release();
+      }
+
+      return status;
+   }
+
+private:
+   static void setError(DBUSIPC_tError* error, DBUSIPC_tError status) noexcept
+   {
+      if ( nullptr != error )
+      {
+         *error = status;
+      }
+   }
+
+   DBUSIPC_tConnection  mConn;
+};
+
+} // namespace dbusipc
+
+#endif /* Guard for _DBUSIPC_HPP_ */
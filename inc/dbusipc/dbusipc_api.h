@@ -24,6 +24,96 @@ extern "C" {
 DBUSIPC_API DBUSIPC_tError DBUSIPC_initialize(void);
 
 
+/**
+ * @brief Initializes the service IPC library with options.
+ *
+ * Same as DBUSIPC_initialize() unless DBUSIPC_INIT_FLAG_INTEGRATED is given.
+ * Then no dispatcher thread is started. Instead the calling thread takes
+ * its place and runs the dispatch loop from its own event loop: it waits
+ * for the descriptor returned by DBUSIPC_getEventFd() to become readable
+ * (for at most DBUSIPC_getNextTimeout() milliseconds) and then calls
+ * DBUSIPC_processEvents(). All the commands and callbacks are executed
+ * there, so a single-threaded application makes no thread hops.
+ *
+ * The rules for the dispatcher thread apply to this thread while it runs
+ * the loop: the synchronous functions return DBUSIPC_ERR_DEADLOCK from a
+ * callback. Called outside the loop they run it themselves until they're
+ * done, which may call other callbacks meanwhile. Other threads may keep
+ * using the library but wait on the loop as they would on the dispatcher
+ * thread. Integration is only supported on Linux.
+ *
+ * @param flags A combination of the DBUSIPC_INIT_FLAG_* values.
+ *
+ * @returns Test return value for error with DBUSIPC_IS_ERROR() macro.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: No
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_initializeWithFlags(DBUSIPC_tUInt32 flags);
+
+
+/**
+ * @brief Returns the descriptor to wait on when the loop is integrated.
+ *
+ * The descriptor becomes readable whenever the library has something to
+ * process (see DBUSIPC_initializeWithFlags()). It's only ever read by
+ * DBUSIPC_processEvents() and stays the same until DBUSIPC_shutdown().
+ *
+ * @param fd Returns the descriptor.
+ *
+ * @returns Returns DBUSIPC_ERR_NOT_SUPPORTED unless the loop is integrated.
+ *          Use the DBUSIPC_IS_ERROR() macro to detect errors in the
+ *          returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getEventFd(DBUSIPC_tInt32* fd);
+
+
+/**
+ * @brief Returns how long the integrated loop may wait on its descriptor.
+ *
+ * Call this right before waiting since calling the library (from a
+ * callback of the application's own or not) may leave work that doesn't
+ * make the descriptor readable.
+ *
+ * @param msecTimeout Returns the number of milliseconds until
+ *                    DBUSIPC_processEvents() must be called (0 if right
+ *                    away) or -1 if only once the descriptor is readable.
+ *
+ * @returns Returns DBUSIPC_ERR_NOT_SUPPORTED unless called on the
+ *          integrated loop's thread. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: No
+ * ThreadSafe: No
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getNextTimeout(DBUSIPC_tInt32* msecTimeout);
+
+
+/**
+ * @brief Runs the integrated loop without blocking.
+ *
+ * Each pass executes the submitted commands, dispatches the messages of
+ * the ready connections (within their budgets), handles the expired
+ * timeouts and reads from the ready descriptors. Passes are made until
+ * there is nothing left to do or the budget is used up, in which case
+ * DBUSIPC_getNextTimeout() returns 0.
+ *
+ * @param budget The maximum number of passes. 0 is the same as 1.
+ *
+ * @returns Returns DBUSIPC_ERR_NOT_SUPPORTED unless called on the
+ *          integrated loop's thread and DBUSIPC_ERR_DEADLOCK from one of
+ *          its callbacks. Use the DBUSIPC_IS_ERROR() macro to detect errors
+ *          in the returned value.
+ *
+ * Re-entrant: No
+ * ThreadSafe: No
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_processEvents(DBUSIPC_tUInt32 budget);
+
+
 /**
  * @brief Uninitializes the IPC library and frees any allocated resources.
  *
@@ -49,6 +139,10 @@ DBUSIPC_API void DBUSIPC_shutdown(void);
  * opening the connection is returned via the callback. If successfull then
  * the connection is returned as well.
  *
+ * A connection that isn't private is shared with the other callers opening
+ * the same address through this library (but not with other users of D-Bus
+ * in the process).
+ *
  * @param address The address of the IPC server.
  * @param openPrivate Indicator of whether to open a private connection (true)
  *                    or not (false).
@@ -78,7 +172,9 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncOpenConnection(DBUSIPC_tConstStr address
  * Opens a connection to the designated message bus at the specified
  * address. This function will also attempt register with the message bus and
  * if successful, receive a unique name. The status (success/failure) of
- * getting the connection is indicated via the return code.
+ * getting the connection is indicated via the return code. Connections
+ * that aren't private are shared as described for
+ * DBUSIPC_asyncOpenConnection().
  *
  * @param address The address of the IPC server.
  * @param openPrivate Indicator of whether to open a private connection (true)
@@ -105,6 +201,12 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_openConnection(DBUSIPC_tConstStr address,
  * name. The status (success/failure) of getting the connection is returned
  * via the callback. If successfull then the connection is returned as well.
  *
+ * The registration is done without holding up the dispatcher when the
+ * address of the bus is known from the environment (DBUS_SESSION_BUS_ADDRESS,
+ * DBUS_SYSTEM_BUS_ADDRESS or DBUS_STARTER_ADDRESS). The system bus is
+ * otherwise found at its default address. Other buses (e.g. an auto-launched
+ * session bus) are still located and registered synchronously by D-Bus.
+ *
  * @param connType The type of well-known message bus connection to establish.
  * @param openPrivate Indicator of whether to open a private connection (true)
  *                    or not (false).
@@ -160,6 +262,16 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_getConnection(DBUSIPC_tConnType connType,
  * message bus connection. Once closed this connection should no longer
  * be used.
  *
+ * When the last reference to a connection is released its socket is closed
+ * which makes the bus drop its subscriptions and names. A bus connection
+ * that D-Bus shares with the rest of the process is left open so the bus is
+ * asked to drop them all at once instead. The dispatcher then waits on the
+ * answers and for queued messages to be sent in the background (without
+ * holding up other connections) for at most the number of msec given by the
+ * DBUSIPC_TEARDOWN_TIMEOUT_MSEC environment variable (1000 unless set).
+ * DBUSIPC_shutdown() does the same for all the connections at once and
+ * returns once they are closed.
+ *
  * @param conn The connection to close (if private) or unreference if
  *             shared.
  *
@@ -234,6 +346,117 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncInvoke(DBUSIPC_tConnection conn,
                                             DBUSIPC_tUserToken token);
 
 
+/**
+ * @brief Asynchronously invokes a method on a service with extra options.
+ *
+ * This function behaves exactly like DBUSIPC_asyncInvoke() except that the
+ * options are passed as a set of flags:
+ *
+ *    DBUSIPC_INVOKE_FLAG_NO_REPLY - Same as setting noReplyExpected to TRUE
+ *                                  for DBUSIPC_asyncInvoke().
+ *    DBUSIPC_INVOKE_FLAG_COALESCE - If an identical request (same connection,
+ *                                  bus name, object path, method and
+ *                                  parameters) that was also made with this
+ *                                  flag is still waiting on a reply then no
+ *                                  new request is sent. Instead the reply to
+ *                                  the earlier request is delivered to both
+ *                                  callbacks. This should only be used for
+ *                                  methods that have no side effects. The
+ *                                  timeout of the request actually sent
+ *                                  applies to everyone sharing it.
+ *    DBUSIPC_INVOKE_FLAG_DIRECT   - The request is sent from the calling
+ *                                  thread instead of being handed to the
+ *                                  dispatcher thread first. This saves a
+ *                                  thread switch but the call may block
+ *                                  while the dispatcher is busy handling
+ *                                  other events. The result is still
+ *                                  delivered on the dispatcher thread unless
+ *                                  the request fails before it's sent, in
+ *                                  which case the callback is invoked on the
+ *                                  calling thread before this returns.
+ *
+ * Cancelling one of the invokes sharing a request only cancels delivery of
+ * the result to its own callback.
+ *
+ * @param flags A combination of the DBUSIPC_INVOKE_FLAG_* values.
+ *
+ * See DBUSIPC_asyncInvoke() for a description of the remaining parameters
+ * and the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncInvokeWithFlags(DBUSIPC_tConnection conn,
+                                            DBUSIPC_tConstStr busName,
+                                            DBUSIPC_tConstStr objPath,
+                                            DBUSIPC_tConstStr method,
+                                            DBUSIPC_tConstStr parameters,
+                                            DBUSIPC_tUInt32 flags,
+                                            DBUSIPC_tUInt32 msecTimeout,
+                                            DBUSIPC_tResultCallback onResult,
+                                            DBUSIPC_tHandle* handle,
+                                            DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Prepares method invocations on a service object.
+ *
+ * The D-Bus method call addressed to the given bus name and object path is
+ * built and validated once. Invoking methods with
+ * DBUSIPC_asyncInvokePrepared() then only has to copy it and add the
+ * method name and parameters which is cheaper for frequently made calls.
+ * The connection isn't checked until a method is actually invoked.
+ *
+ * @param conn The connection on which methods will be invoked.
+ * @param busName The bus name where the methods should be directed. This
+ *                must not be NULL.
+ * @param objPath The object path that will receive the requests. If this
+ *                parameter is NULL then the default object path will be used
+ *                based on the bus name.
+ * @param prepared Filled in with the handle of the prepared call. It must
+ *                 be freed with DBUSIPC_freePrepared().
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the call was prepared or
+ *          DBUSIPC_ERR_BAD_ARGS if the bus name or object path is invalid.
+ *          Use the DBUSIPC_IS_ERROR() macro to detect errors in the returned
+ *          value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_prepareInvoke(DBUSIPC_tConnection conn,
+                                            DBUSIPC_tConstStr busName,
+                                            DBUSIPC_tConstStr objPath,
+                                            DBUSIPC_tPreparedMsg* prepared);
+
+
+/**
+ * @brief Asynchronously invokes a method using a prepared call.
+ *
+ * This function behaves exactly like DBUSIPC_asyncInvokeWithFlags() except
+ * that the connection, bus name and object path are taken from a call
+ * prepared with DBUSIPC_prepareInvoke(). The prepared call may be freed
+ * while requests made with it are still outstanding.
+ *
+ * @param prepared The handle of the prepared call.
+ *
+ * See DBUSIPC_asyncInvokeWithFlags() for a description of the remaining
+ * parameters and the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncInvokePrepared(
+                                            DBUSIPC_tPreparedMsg prepared,
+                                            DBUSIPC_tConstStr method,
+                                            DBUSIPC_tConstStr parameters,
+                                            DBUSIPC_tUInt32 flags,
+                                            DBUSIPC_tUInt32 msecTimeout,
+                                            DBUSIPC_tResultCallback onResult,
+                                            DBUSIPC_tHandle* handle,
+                                            DBUSIPC_tUserToken token);
+
+
 /**
  * @brief Synchronously invokes a method on a service.
  *
@@ -295,6 +518,118 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_invoke(DBUSIPC_tConnection conn,
 DBUSIPC_API void DBUSIPC_freeResponse(DBUSIPC_tResponse* response);
 
 
+/**
+ * @brief Sets the size of the response cache of a connection.
+ *
+ * Results of method invocations declared cacheable (either with
+ * DBUSIPC_setCacheable() or by the service returning the result with
+ * DBUSIPC_returnCacheableResult()) are kept for the duration of their TTL.
+ * While a result is cached DBUSIPC_invoke() returns it immediately without
+ * sending a request to the service. Results are cached based on the bus
+ * name, object path, method and (exact) parameters of the request.
+ *
+ * @param conn The connection whose results are cached.
+ * @param maxBytes The maximum number of bytes of results (and their keys)
+ *                 to cache. The least recently used results are dropped to
+ *                 stay within this limit. Zero (the default) disables
+ *                 the cache.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE on success. A DBUSIPC_ERR_NOT_CONNECTED
+ *          error is returned if the connection has been closed. Use the
+ *          DBUSIPC_IS_ERROR() macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setResponseCacheLimit(DBUSIPC_tConnection conn,
+                                             DBUSIPC_tUInt32 maxBytes);
+
+
+/**
+ * @brief Declares the results of a method cacheable.
+ *
+ * @param conn The connection whose results are cached.
+ * @param busName The bus name of the service implementing the method.
+ * @param objPath The object path of the service. If this parameter is NULL
+ *                then the default object path will be used based on the
+ *                bus name.
+ * @param method The method whose results may be cached.
+ * @param msecTtl The time (in milliseconds) a result stays valid. This
+ *                overrides any TTL returned by the service. Zero removes
+ *                the declaration.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE on success. Use the DBUSIPC_IS_ERROR()
+ *          macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setCacheable(DBUSIPC_tConnection conn,
+                                             DBUSIPC_tConstStr busName,
+                                             DBUSIPC_tConstStr objPath,
+                                             DBUSIPC_tConstStr method,
+                                             DBUSIPC_tUInt32 msecTtl);
+
+
+/**
+ * @brief Names a signal that evicts the cached results of a service.
+ *
+ * Whenever the service emits the named signal all the results cached for
+ * it on this connection are dropped. This function subscribes to the
+ * signal so it must not be called from a library callback. Naming the same
+ * signal of a service again has no further effect. The subscription is
+ * dropped by DBUSIPC_clearCacheInvalidationSignal() or when the connection
+ * is closed.
+ *
+ * @param conn The connection whose results are cached.
+ * @param busName The bus name of the service.
+ * @param objPath The object path of the service (and the signal). If this
+ *                parameter is NULL then the default object path will be
+ *                used based on the bus name.
+ * @param sigName The name of the signal.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setCacheInvalidationSignal(
+                                             DBUSIPC_tConnection conn,
+                                             DBUSIPC_tConstStr busName,
+                                             DBUSIPC_tConstStr objPath,
+                                             DBUSIPC_tConstStr sigName);
+
+
+/**
+ * @brief Stops a signal from evicting the cached results of a service.
+ *
+ * Undoes DBUSIPC_setCacheInvalidationSignal(). This function unsubscribes
+ * from the signal so it must not be called from a library callback.
+ *
+ * @param conn The connection whose results are cached.
+ * @param busName The bus name of the service.
+ * @param objPath The object path of the service (and the signal). If this
+ *                parameter is NULL then the default object path will be
+ *                used based on the bus name.
+ * @param sigName The name of the signal.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. A DBUSIPC_ERR_NOT_FOUND error is returned
+ *          if the signal was never named. Use the DBUSIPC_IS_ERROR() macro
+ *          to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_clearCacheInvalidationSignal(
+                                             DBUSIPC_tConnection conn,
+                                             DBUSIPC_tConstStr busName,
+                                             DBUSIPC_tConstStr objPath,
+                                             DBUSIPC_tConstStr sigName);
+
+
 /**
  * @brief Synchronously attempts to cancel a pending method invocation.
  *
@@ -370,6 +705,88 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_emit(DBUSIPC_tSvcRegHnd regHnd,
                                      DBUSIPC_tConstStr sigName,
                                      DBUSIPC_tConstStr parameters);
 
+/**
+ * @brief Emits a signal directly from the calling thread.
+ *
+ * This function is used to emit a signal from a specific object on the
+ * designated bus without handing the request to the internal dispatch
+ * thread. The signal is queued on the underlying D-Bus connection (and
+ * usually written out) before this function returns. The dispatch thread
+ * is only woken if the signal could not be written immediately. Signals
+ * emitted this way are not ordered with respect to requests still waiting
+ * to be processed by the dispatch thread.
+ *
+ * @param regHnd The handle for the registered service from which this
+ *               signal will be emitted.
+ * @param sigName The name of the signal to emit.
+ * @param parameters JSON encoded parameters associated with the signal.
+ *                   If NULL is specified then the library will substitute an
+ *                   JSON expression for an empty object '{}'.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the signal was queued for delivery.
+ *          Use the DBUSIPC_IS_ERROR() macro to detect errors in the returned
+ *          value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_emitDirect(DBUSIPC_tSvcRegHnd regHnd,
+                                           DBUSIPC_tConstStr sigName,
+                                           DBUSIPC_tConstStr parameters);
+
+/**
+ * @brief Prepares signals emitted by a registered service.
+ *
+ * The D-Bus signal sent from the object of the service is built once.
+ * Emitting signals with DBUSIPC_emitPrepared() then only has to copy it and
+ * add the signal name and parameters.
+ *
+ * @param regHnd The handle for the registered service from which the
+ *               signals will be emitted.
+ * @param prepared Filled in with the handle of the prepared signal. It must
+ *                 be freed with DBUSIPC_freePrepared().
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the signal was prepared or
+ *          DBUSIPC_ERR_NOT_FOUND if the service isn't registered. Use the
+ *          DBUSIPC_IS_ERROR() macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_prepareEmit(DBUSIPC_tSvcRegHnd regHnd,
+                                            DBUSIPC_tPreparedMsg* prepared);
+
+/**
+ * @brief Emits a signal directly from the calling thread using a prepared
+ *        signal.
+ *
+ * This function behaves exactly like DBUSIPC_emitDirect() except that the
+ * service is taken from a signal prepared with DBUSIPC_prepareEmit().
+ *
+ * @param prepared The handle of the prepared signal.
+ *
+ * See DBUSIPC_emitDirect() for a description of the remaining parameters
+ * and the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_emitPrepared(DBUSIPC_tPreparedMsg prepared,
+                                            DBUSIPC_tConstStr sigName,
+                                            DBUSIPC_tConstStr parameters);
+
+/**
+ * @brief Frees a prepared call or signal.
+ *
+ * @param prepared The handle returned by DBUSIPC_prepareInvoke() or
+ *                 DBUSIPC_prepareEmit(). The handle must not be used once
+ *                 this function is called.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API void DBUSIPC_freePrepared(DBUSIPC_tPreparedMsg prepared);
+
 /**
  * @brief Asynchronously subscribes to a signal on a service.
  *
@@ -496,7 +913,19 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_unsubscribe(DBUSIPC_tSigSubHnd subHnd);
  *                the bus name. This is created by prefixing the bus name
  *                with '/' and then substituting '-' with '_' and substituting
  *                '.' with '/'.
- * @param flag Reserved for the future. Set to 0 for now.
+ * @param flag A bitmask of DBUSIPC_REG_FLAG_xxx values. Specify
+ *             DBUSIPC_REG_FLAG_PEER_LISTEN to additionally listen for
+ *             direct peer-to-peer connections from clients. Requests
+ *             arriving over a peer connection bypass the bus daemon but
+ *             are otherwise delivered (and replied to) identically.
+ *             Clients only use the peer connection if the environment
+ *             variable DBUSIPC_ENABLE_PEER_TO_PEER is set to 1 (or to a
+ *             comma separated list of the bus names to connect to
+ *             directly) and silently fall back to the bus when it's
+ *             unavailable.
+ *             Specify DBUSIPC_REG_FLAG_DROP_EXPIRED to have the library
+ *             silently drop requests whose client has already stopped
+ *             waiting for the reply (see DBUSIPC_getReqDeadline()).
  * @param onRequest This callback function that will receive requests from
  *                  clients of the service.
  * @param onRegister The callback function that will be invoked if the
@@ -538,9 +967,23 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncRegisterService(DBUSIPC_tConnection conn
  *                the bus name. This is created by prefixing the bus name
  *                with '/' and then substituting '-' with '_' and substituting
  *                '.' with '/'.
- * @param flag Reserved for the future. Set to 0 for now.
+ * @param flag A bitmask of DBUSIPC_REG_FLAG_xxx values. Specify
+ *             DBUSIPC_REG_FLAG_PEER_LISTEN to additionally listen for
+ *             direct peer-to-peer connections from clients. Requests
+ *             arriving over a peer connection bypass the bus daemon but
+ *             are otherwise delivered (and replied to) identically.
+ *             Clients only use the peer connection if the environment
+ *             variable DBUSIPC_ENABLE_PEER_TO_PEER is set to 1 (or to a
+ *             comma separated list of the bus names to connect to
+ *             directly) and silently fall back to the bus when it's
+ *             unavailable.
+ *             Specify DBUSIPC_REG_FLAG_DROP_EXPIRED to have the library
+ *             silently drop requests whose client has already stopped
+ *             waiting for the reply (see DBUSIPC_getReqDeadline()).
  * @param onRequest This callback function that will receive requests from
- *                  clients of the service.
+ *                  clients of the service. It can be NULL if the service
+ *                  handles each of its methods separately (see
+ *                  DBUSIPC_registerMethod()).
  * @param token A user defined token to be returned with the callback.
  * @param regHnd A pointer to a registration handle that will be initialized
  *               if the registration is successfull.
@@ -604,12 +1047,231 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncUnregisterService(DBUSIPC_tSvcRegHnd reg
 DBUSIPC_API DBUSIPC_tError DBUSIPC_unregisterService(DBUSIPC_tSvcRegHnd regHnd);
 
 
+/**
+ * @brief Synchronously sets the admission limits of a registered service.
+ *
+ * Once the service has maxInFlight requests it has not yet replied to
+ * (or freed the request context of) further requests are queued. When
+ * maxQueued requests are also waiting the library turns new requests
+ * away by replying with a DBUSIPC_ERR_NAME_BUSY error without calling the
+ * service's request handler. Clients see this as a DBUSIPC_ERR_BUSY error.
+ *
+ * @param regHnd The service registration handle obtained when the service
+ *               was registered.
+ * @param maxInFlight The maximum number of outstanding requests delivered
+ *                    to the service. Zero (the default) means unlimited.
+ * @param maxQueued The maximum number of requests waiting to be delivered
+ *                  once maxInFlight is reached. Zero (the default) means
+ *                  unlimited. Requests still waiting when the service is
+ *                  unregistered are answered with a DBUSIPC_ERR_NAME_NOT_FOUND
+ *                  error.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setServiceLimits(DBUSIPC_tSvcRegHnd regHnd,
+                                             DBUSIPC_tUInt32 maxInFlight,
+                                             DBUSIPC_tUInt32 maxQueued);
+
+
+/**
+ * @brief Synchronously retrieves the admission counters of a service.
+ *
+ * @param regHnd The service registration handle obtained when the service
+ *               was registered.
+ * @param stats Filled in with the number of accepted, shed and expired
+ *              requests along with the current in-flight and queued counts.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getServiceStats(DBUSIPC_tSvcRegHnd regHnd,
+                                             DBUSIPC_tServiceStats* stats);
+
+
+/**
+ * @brief Synchronously registers the handler of a single method of a
+ *        service.
+ *
+ * Requests for the method are delivered straight to this handler instead
+ * of the one the service was registered with, sparing the service from
+ * comparing method names itself. Requests for a method that has no handler
+ * of its own (when the service was registered without a handler) are
+ * answered by the library with a DBUSIPC_ERR_NAME_UNKNOWN_METHOD error
+ * which clients see as a DBUSIPC_ERR_UNKNOWN_METHOD error.
+ *
+ * @param regHnd The service registration handle obtained when the service
+ *               was registered.
+ * @param method The name of the method.
+ * @param onRequest This callback function that will receive the requests
+ *                  for the method. NULL removes the method's handler.
+ * @param token A user defined token to be returned with the callback.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_registerMethod(DBUSIPC_tSvcRegHnd regHnd,
+                                             DBUSIPC_tConstStr method,
+                                             DBUSIPC_tRequestCallback onRequest,
+                                             DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Synchronously retrieves the counters of a registered method.
+ *
+ * @param regHnd The service registration handle obtained when the service
+ *               was registered.
+ * @param method The name of a method registered with
+ *               DBUSIPC_registerMethod().
+ * @param stats Filled in with the number of requests handed to the
+ *              method's handler and the time spent in it.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getMethodStats(DBUSIPC_tSvcRegHnd regHnd,
+                                             DBUSIPC_tConstStr method,
+                                             DBUSIPC_tMethodStats* stats);
+
+
+/**
+ * @brief Synchronously retrieves the timing counters of the dispatcher.
+ *
+ * The dispatcher times every command from the moment it's queued until it
+ * starts executing and while it executes, along with each stage of its
+ * dispatch loop. This tells the time spent waiting behind other commands
+ * apart from the time spent on the bus.
+ *
+ * @param stats Filled in with the queue depth and high-water mark, the
+ *              per-command queueing delay and execution time histograms
+ *              and the dispatch loop stage histograms.
+ * @param reset If DBUSIPC_TRUE the counters are cleared once copied (the
+ *              high-water mark restarts at the current queue depth).
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getDispatcherStats(
+                                          DBUSIPC_tDispatcherStats* stats,
+                                          DBUSIPC_tBool reset);
+
+
+/**
+ * @brief Retrieves the state of the out-going message queue of a connection.
+ *
+ * libdbus queues the messages that can't be written out right away (e.g.
+ * because a peer is slow to read) without any bound. This reports how much
+ * is waiting along with the watermarks set with
+ * DBUSIPC_setOutgoingQueueLimits(). It doesn't involve the dispatcher.
+ *
+ * @param conn The connection to query.
+ * @param stats Filled in with the queued bytes and file descriptors, the
+ *              watermarks, whether the queue is congested and the number
+ *              of messages refused because of it.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the connection exists. Use the
+ *          DBUSIPC_IS_ERROR() macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getOutgoingQueueStats(
+                                          DBUSIPC_tConnection conn,
+                                          DBUSIPC_tOutgoingQueueStats* stats);
+
+
+/**
+ * @brief Synchronously sets the watermarks of a connection's out-going queue.
+ *
+ * The queue becomes congested once it holds highWater bytes and stays
+ * congested until it drains to lowWater bytes. While it's congested, if
+ * no callback is given, invokes and emits on the connection (and on the
+ * services registered with it) fail with DBUSIPC_ERR_WOULD_BLOCK. This
+ * happens either right away or, for requests already queued, when the
+ * dispatcher gets to them. If a callback is given, nothing is refused and
+ * the callback is invoked on the dispatcher thread each time the queue
+ * becomes congested or drains, so the application can throttle itself.
+ *
+ * @param conn The connection to limit.
+ * @param highWater The queued bytes at which the queue is congested (zero
+ *                  removes the limits).
+ * @param lowWater The queued bytes at which congestion clears (cannot be
+ *                 more than highWater).
+ * @param onBackpressure The (optional) callback told of congestion changes.
+ * @param token The user token passed to the callback.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setOutgoingQueueLimits(
+                                    DBUSIPC_tConnection conn,
+                                    DBUSIPC_tUInt32 highWater,
+                                    DBUSIPC_tUInt32 lowWater,
+                                    DBUSIPC_tBackpressureCallback onBackpressure,
+                                    DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Synchronously sets how the dispatcher services a connection.
+ *
+ * Each pass of the dispatch loop delivers at most msgBudget of the messages
+ * waiting on a connection before moving on to the next ready connection
+ * (round-robin) so a flooded connection can't starve the others. Ready
+ * connections of a higher priority class are always serviced before those
+ * of a lower class, e.g. a control connection before a bulk-data one.
+ *
+ * @param conn The connection to configure.
+ * @param priority The priority class of the connection (the default is
+ *                 DBUSIPC_CONN_PRIORITY_NORMAL).
+ * @param msgBudget The most messages delivered on the connection per pass
+ *                  of the dispatch loop (zero restores the default).
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if there is no error enqueuing and
+ *          executing the request. Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_setConnectionPriority(
+                                    DBUSIPC_tConnection conn,
+                                    DBUSIPC_tConnPriority priority,
+                                    DBUSIPC_tUInt32 msgBudget);
+
+
 /**
  * @brief Asynchronously provides a mechanism to return the result of a
  *        service request.
  *
  * This function, coupled with the requesting context, provides a mechanism
  * to return a JSON encoded result string to the client who made the request.
+ * When called from a handler (i.e. on the dispatcher thread) the result is
+ * sent as soon as the handler returns rather than on the next pass of the
+ * dispatch loop. The same holds for all the asynchronous functions.
  *
  * @param context The context of the request that will be associated with
  *                the reply. Once this function is called the context data
@@ -663,6 +1325,54 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncReturnResult(DBUSIPC_tReqContext context
 DBUSIPC_API DBUSIPC_tError DBUSIPC_returnResult(DBUSIPC_tReqContext context,
                                              DBUSIPC_tConstStr result);
 
+
+/**
+ * @brief Asynchronously returns a result the client may cache.
+ *
+ * This function behaves exactly like DBUSIPC_asyncReturnResult() except
+ * that clients with a response cache (see DBUSIPC_setResponseCacheLimit())
+ * may keep the result and reuse it for identical requests for up to
+ * msecTtl milliseconds.
+ *
+ * @param msecTtl The time (in milliseconds) the result stays valid. Zero
+ *                means the result must not be cached.
+ *
+ * See DBUSIPC_asyncReturnResult() for a description of the remaining
+ * parameters and the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncReturnCacheableResult(
+                                              DBUSIPC_tReqContext context,
+                                              DBUSIPC_tConstStr result,
+                                              DBUSIPC_tUInt32 msecTtl,
+                                              DBUSIPC_tStatusCallback onStatus,
+                                              DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Synchronously returns a result the client may cache.
+ *
+ * This function behaves exactly like DBUSIPC_returnResult() except
+ * that clients with a response cache (see DBUSIPC_setResponseCacheLimit())
+ * may keep the result and reuse it for identical requests for up to
+ * msecTtl milliseconds.
+ *
+ * @param msecTtl The time (in milliseconds) the result stays valid. Zero
+ *                means the result must not be cached.
+ *
+ * See DBUSIPC_returnResult() for a description of the remaining parameters
+ * and the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_returnCacheableResult(
+                                             DBUSIPC_tReqContext context,
+                                             DBUSIPC_tConstStr result,
+                                             DBUSIPC_tUInt32 msecTtl);
+
 /**
  * @brief Asynchronously provides a mechanism to return an error to a service
  *        request.
@@ -739,6 +1449,87 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_returnError(DBUSIPC_tReqContext context,
                                             DBUSIPC_tConstStr name,
                                             DBUSIPC_tConstStr msg);
 
+/**
+ * @brief Asynchronously returns the result of a service request and frees
+ *        its context.
+ *
+ * This function behaves like DBUSIPC_asyncReturnResult() followed by
+ * DBUSIPC_freeReqContext() but takes a single trip through the dispatcher.
+ * The context must not be used (or freed) once this function is called.
+ *
+ * See DBUSIPC_asyncReturnResult() for a description of the parameters and
+ * the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncReturnResultAndFree(
+                                              DBUSIPC_tReqContext context,
+                                              DBUSIPC_tConstStr result,
+                                              DBUSIPC_tStatusCallback onStatus,
+                                              DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Synchronously returns the result of a service request and frees
+ *        its context.
+ *
+ * This function behaves like DBUSIPC_returnResult() followed by
+ * DBUSIPC_freeReqContext() but takes a single trip through the dispatcher.
+ * The context must not be used (or freed) once this function is called.
+ *
+ * See DBUSIPC_returnResult() for a description of the parameters and the
+ * return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_returnResultAndFree(
+                                             DBUSIPC_tReqContext context,
+                                             DBUSIPC_tConstStr result);
+
+
+/**
+ * @brief Asynchronously returns an error to a service request and frees
+ *        its context.
+ *
+ * This function behaves like DBUSIPC_asyncReturnError() followed by
+ * DBUSIPC_freeReqContext() but takes a single trip through the dispatcher.
+ * The context must not be used (or freed) once this function is called.
+ *
+ * See DBUSIPC_asyncReturnError() for a description of the parameters and
+ * the return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_asyncReturnErrorAndFree(
+                                      DBUSIPC_tReqContext context,
+                                      DBUSIPC_tConstStr name,
+                                      DBUSIPC_tConstStr msg,
+                                      DBUSIPC_tStatusCallback onStatus,
+                                      DBUSIPC_tUserToken token);
+
+
+/**
+ * @brief Synchronously returns an error to a service request and frees
+ *        its context.
+ *
+ * This function behaves like DBUSIPC_returnError() followed by
+ * DBUSIPC_freeReqContext() but takes a single trip through the dispatcher.
+ * The context must not be used (or freed) once this function is called.
+ *
+ * See DBUSIPC_returnError() for a description of the parameters and the
+ * return value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_returnErrorAndFree(
+                                            DBUSIPC_tReqContext context,
+                                            DBUSIPC_tConstStr name,
+                                            DBUSIPC_tConstStr msg);
+
 /**
  * @brief Frees the resources associated with request context.
  *
@@ -757,6 +1548,35 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_returnError(DBUSIPC_tReqContext context,
 DBUSIPC_API void DBUSIPC_freeReqContext(DBUSIPC_tReqContext context);
 
 
+/**
+ * @brief Retrieves the time remaining before the client stops waiting for
+ *        the reply to a request.
+ *
+ * Clients pass along the deadline derived from the timeout given to
+ * DBUSIPC_invoke() or DBUSIPC_asyncInvoke(). Services can use this to skip
+ * (or cut short) work whose result will never be seen by the client. The
+ * deadline is based on the system's monotonic clock so it's only meaningful
+ * when the client and service run on the same host.
+ *
+ * @param context The context of the request.
+ * @param msecRemaining A pointer to a variable that will be set to the
+ *                      number of milliseconds remaining before the deadline
+ *                      expires. This is zero if the deadline has already
+ *                      passed.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the client specified a deadline.
+ *          Returns DBUSIPC_ERR_NOT_FOUND if there is no deadline (e.g. the
+ *          client doesn't expect a reply, waits indefinitely or predates
+ *          deadline propagation). Use the DBUSIPC_IS_ERROR() macro to
+ *          detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_getReqDeadline(DBUSIPC_tReqContext context,
+                                               DBUSIPC_tUInt32* msecRemaining);
+
+
 /**
  * @brief Provides a mechanism to synchronously determine whether an
  *        advertised bus name has an owner and is thus present.
@@ -902,6 +1722,54 @@ DBUSIPC_API DBUSIPC_tError DBUSIPC_subscribeOwnerChanged(DBUSIPC_tConnection con
 DBUSIPC_API DBUSIPC_tError DBUSIPC_validateUtf8( DBUSIPC_tConstStr str);
 
 
+/**
+ * @brief Writes the recorded binary trace events to a file.
+ *
+ * The library records its message flow (see dbusipc_trace.h) in a small
+ * ring buffer per thread. This function writes the events still in the
+ * buffers to a file which can be decoded offline. Threads keep recording
+ * while the dump is made.
+ *
+ * @param fileName The name of the file to (over)write.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the events were written. Use the
+ *          DBUSIPC_IS_ERROR() macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_dumpTrace(DBUSIPC_tConstStr fileName);
+
+
+/**
+ * @brief Writes the reports of stalled callbacks to a file.
+ *
+ * When the DBUSIPC_MAX_DISPATCH_PROC_TIME_MSEC environment variable gives
+ * the dispatcher a budget for running a method, signal or name change
+ * callback then a watchdog thread checks on the callbacks while they run.
+ * A callback still running past the budget is interrupted with a real-time
+ * signal (SIGRTMIN + 4 unless DBUSIPC_WATCHDOG_SIGNAL names another one)
+ * so the stack of the dispatcher can be captured. The identity of the
+ * callback and its stack are kept in a small ring buffer. This function
+ * writes the reports still in the buffer to a text file with the stack
+ * frames resolved to symbols where possible. Stacks are not captured if
+ * the application already handles the signal. The signal is installed with
+ * SA_RESTART but system calls that are never restarted (such as poll(),
+ * epoll_wait(), nanosleep() and calls with a timeout) fail with EINTR when
+ * the callback making them is interrupted, so callbacks that block in them
+ * should retry.
+ *
+ * @param fileName The name of the file to (over)write.
+ *
+ * @returns Returns DBUSIPC_ERROR_NONE if the reports were written. Use the
+ *          DBUSIPC_IS_ERROR() macro to detect errors in the returned value.
+ *
+ * Re-entrant: Yes
+ * ThreadSafe: Yes
+ */
+DBUSIPC_API DBUSIPC_tError DBUSIPC_dumpStalls(DBUSIPC_tConstStr fileName);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,596 @@
+#ifndef _DBUSIPC_CORO_HPP_
+#define _DBUSIPC_CORO_HPP_
+
+//
+// C++20 coroutine support built on dbusipc/dbusipc.hpp. A coroutine can
+// co_await an invocation, a subscription or a registration instead of
+// handing the library a callback:
+//
+//    dbusipc::co::Task<> handle(const dbusipc::Connection& conn,
+//                               dbusipc::Request req)
+//    {
+//       dbusipc::co::Result user = co_await dbusipc::co::invoke(conn,
+//                                  "com.hsae.Users", nullptr, "get", "{}",
+//                                  1000U);
+//       ...
+//       (void)req.reply(user.result);
+//    }
+//
+//    dbusipc::co::spawn(handle(conn, std::move(req)));
+//
+// The coroutine is resumed from the library's completion callback, i.e. on
+// the dispatcher thread, unless an Executor is given to resume it on. A
+// waiting coroutine holds no thread so any number of request flows can be
+// in progress at once for the cost of their coroutine frames.
+//
+// The arguments of an awaitable are only used when it is awaited, so the
+// awaitable must be co_await'ed in the expression that creates it.
+//
+
+#if !defined(__cplusplus) || (__cplusplus < 202002L) || \
+    !defined(__cpp_impl_coroutine)
+#error "dbusipc/dbusipc_coro.hpp requires C++20 coroutines"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include "dbusipc/dbusipc.hpp"
+
+namespace dbusipc
+{
+namespace co
+{
+
+//
+// Resumes coroutines on a thread of the application's choosing rather than
+// the dispatcher thread.
+//
+class Executor
+{
+public:
+   virtual ~Executor() = default;
+
+   // Called on the dispatcher thread. Must not resume the coroutine there.
+   virtual void post(std::coroutine_handle<> handle) = 0;
+};
+
+
+//
+// An executor resuming the coroutines on whichever thread calls run() or
+// poll().
+//
+class QueueExecutor : public Executor
+{
+public:
+   QueueExecutor() : mStopped(false) {}
+
+   QueueExecutor(const QueueExecutor&) = delete;
+   QueueExecutor& operator=(const QueueExecutor&) = delete;
+
+   void post(std::coroutine_handle<> handle) override
+   {
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+         mQueue.push_back(handle);
+      }
+      mReady.notify_one();
+   }
+
+   // Resumes coroutines as they are posted until stop() is called
+   void run()
+   {
+      std::unique_lock<std::mutex> lock(mLock);
+      while ( !mStopped )
+      {
+         if ( mQueue.empty() )
+         {
+            mReady.wait(lock);
+         }
+         else
+         {
+            std::coroutine_handle<> handle = mQueue.front();
+            mQueue.pop_front();
+            lock.unlock();
+            handle.resume();
+            lock.lock();
+         }
+      }
+   }
+
+   // Resumes the coroutines posted so far and returns how many there were
+   std::size_t poll()
+   {
+      std::deque<std::coroutine_handle<>> ready;
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+         ready.swap(mQueue);
+      }
+
+      for ( std::coroutine_handle<> handle : ready )
+      {
+         handle.resume();
+      }
+
+      return ready.size();
+   }
+
+   void stop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+         mStopped = true;
+      }
+      mReady.notify_all();
+   }
+
+private:
+   std::mutex                          mLock;
+   std::condition_variable             mReady;
+   std::deque<std::coroutine_handle<>> mQueue;
+   bool                                mStopped;
+};
+
+
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+
+inline void resume(Executor* executor, std::coroutine_handle<> handle)
+{
+   if ( nullptr != executor )
+   {
+      executor->post(handle);
+   }
+   else
+   {
+      handle.resume();
+   }
+}
+
+class PromiseBase
+{
+public:
+   std::suspend_always initial_suspend() const noexcept { return {}; }
+
+   // Returns to whoever awaited the task (if anyone did)
+   struct FinalAwaiter
+   {
+      bool await_ready() const noexcept { return false; }
+
+      template <typename Promise>
+      std::coroutine_handle<> await_suspend(
+                           std::coroutine_handle<Promise> handle) noexcept
+      {
+         PromiseBase& promise = handle.promise();
+         std::coroutine_handle<> next = promise.mContinuation ?
+                                        promise.mContinuation :
+                                        std::noop_coroutine();
+         if ( promise.mDetached )
+         {
+            // Nobody is left to see the exception
+            if ( promise.mException )
+            {
+               std::terminate();
+            }
+            handle.destroy();
+         }
+
+         return next;
+      }
+
+      void await_resume() const noexcept {}
+   };
+
+   FinalAwaiter final_suspend() const noexcept { return {}; }
+
+   void unhandled_exception() noexcept
+   {
+      mException = std::current_exception();
+   }
+
+   void setContinuation(std::coroutine_handle<> continuation) noexcept
+   {
+      mContinuation = continuation;
+   }
+
+   void detach() noexcept { mDetached = true; }
+
+protected:
+   void rethrow() const
+   {
+      if ( mException )
+      {
+         std::rethrow_exception(mException);
+      }
+   }
+
+private:
+   std::coroutine_handle<>    mContinuation;
+   std::exception_ptr         mException;
+   bool                       mDetached = false;
+};
+
+template <typename T>
+class Promise : public PromiseBase
+{
+public:
+   Task<T> get_return_object() noexcept;
+
+   template <typename U>
+   void return_value(U&& value)
+   {
+      mValue.emplace(std::forward<U>(value));
+   }
+
+   T take()
+   {
+      rethrow();
+      return std::move(*mValue);
+   }
+
+private:
+   std::optional<T>  mValue;
+};
+
+template <>
+class Promise<void> : public PromiseBase
+{
+public:
+   Task<void> get_return_object() noexcept;
+
+   void return_void() const noexcept {}
+
+   void take() const { rethrow(); }
+};
+
+} // namespace detail
+
+
+//
+// A lazily started coroutine. Awaiting it runs it and resumes the awaiting
+// coroutine with its value once it completes. An exception escaping the
+// coroutine is rethrown to the one awaiting it.
+//
+template <typename T>
+class Task
+{
+public:
+   using promise_type = detail::Promise<T>;
+
+   Task() noexcept = default;
+   explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+      : mHandle(handle)
+   {
+   }
+
+   Task(Task&& other) noexcept
+      : mHandle(std::exchange(other.mHandle, nullptr))
+   {
+   }
+
+   Task& operator=(Task&& rhs) noexcept
+   {
+      if ( this != &rhs )
+      {
+         destroy();
+         mHandle = std::exchange(rhs.mHandle, nullptr);
+      }
+
+      return *this;
+   }
+
+   ~Task() { destroy(); }
+
+   Task(const Task&) = delete;
+   Task& operator=(const Task&) = delete;
+
+   bool await_ready() const noexcept { return false; }
+
+   std::coroutine_handle<> await_suspend(
+                           std::coroutine_handle<> continuation) noexcept
+   {
+      mHandle.promise().setContinuation(continuation);
+      return mHandle;
+   }
+
+   T await_resume() { return mHandle.promise().take(); }
+
+   // Hands the coroutine over to the caller
+   std::coroutine_handle<promise_type> release() noexcept
+   {
+      return std::exchange(mHandle, nullptr);
+   }
+
+private:
+   void destroy() noexcept
+   {
+      if ( mHandle )
+      {
+         std::exchange(mHandle, nullptr).destroy();
+      }
+   }
+
+   std::coroutine_handle<promise_type> mHandle;
+};
+
+namespace detail
+{
+
+template <typename T>
+inline Task<T> Promise<T>::get_return_object() noexcept
+{
+   return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+   return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(
+                                                                  *this));
+}
+
+} // namespace detail
+
+
+//
+// Starts a task on the calling thread without waiting for it. Its frame is
+// freed when it completes (its value is discarded) and an exception
+// escaping it terminates the process.
+//
+template <typename T>
+inline void spawn(Task<T> task)
+{
+   std::coroutine_handle<detail::Promise<T>> handle = task.release();
+   if ( handle )
+   {
+      handle.promise().detach();
+      handle.resume();
+   }
+}
+
+
+//
+// The outcome of an invocation. Unlike the views passed to callbacks the
+// strings are owned since the coroutine may look at them much later.
+//
+struct Result
+{
+   DBUSIPC_tError    error = DBUSIPC_ERROR_NONE;
+   std::string       name;
+   std::string       message;
+   std::string       result;
+
+   bool ok() const noexcept { return !DBUSIPC_IS_ERROR(error); }
+};
+
+
+class InvokeAwaiter
+{
+public:
+   InvokeAwaiter(const Connection& conn, CStr busName, CStr objPath,
+                 CStr method, CStr parameters, DBUSIPC_tUInt32 msecTimeout,
+                 Executor* executor, DBUSIPC_tUInt32 flags) noexcept
+      : mConn(conn)
+      , mBusName(busName)
+      , mObjPath(objPath)
+      , mMethod(method)
+      , mParameters(parameters)
+      , mMsecTimeout(msecTimeout)
+      , mExecutor(executor)
+      , mFlags(flags)
+   {
+   }
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> handle)
+   {
+      mHandle = handle;
+      DBUSIPC_tError status = mConn.asyncInvoke(mBusName, mObjPath, mMethod,
+                                 mParameters, mMsecTimeout,
+                                 [this](const Status& status,
+                                        std::string_view result)
+                                 {
+                                    mResult.error = status.error;
+                                    mResult.name = status.name;
+                                    mResult.message = status.message;
+                                    mResult.result = result;
+                                    detail::resume(mExecutor, mHandle);
+                                 }, nullptr, mFlags);
+
+      // Once submitted the coroutine may already be running elsewhere so
+      // nothing but the status may be touched
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         mResult.error = status;
+      }
+
+      return !DBUSIPC_IS_ERROR(status);
+   }
+
+   Result await_resume() { return std::move(mResult); }
+
+private:
+   const Connection&          mConn;
+   CStr                       mBusName;
+   CStr                       mObjPath;
+   CStr                       mMethod;
+   CStr                       mParameters;
+   DBUSIPC_tUInt32            mMsecTimeout;
+   Executor*                  mExecutor;
+   DBUSIPC_tUInt32            mFlags;
+   std::coroutine_handle<>    mHandle;
+   Result                     mResult;
+};
+
+
+class SubscribeAwaiter
+{
+public:
+   SubscribeAwaiter(const Connection& conn, CStr objPath, CStr sigName,
+                    SignalCallback onSignal, DBUSIPC_tError* error,
+                    Executor* executor) noexcept
+      : mConn(conn)
+      , mObjPath(objPath)
+      , mSigName(sigName)
+      , mOnSignal(std::move(onSignal))
+      , mError(error)
+      , mExecutor(executor)
+      , mStatus(DBUSIPC_ERROR_NONE)
+   {
+   }
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> handle)
+   {
+      mHandle = handle;
+      DBUSIPC_tError status = mConn.asyncSubscribe(mObjPath, mSigName,
+                                 std::move(mOnSignal),
+                                 [this](const Status& status,
+                                        Subscription&& subscription)
+                                 {
+                                    mStatus = status.error;
+                                    mSubscription = std::move(subscription);
+                                    detail::resume(mExecutor, mHandle);
+                                 });
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         mStatus = status;
+      }
+
+      return !DBUSIPC_IS_ERROR(status);
+   }
+
+   Subscription await_resume()
+   {
+      if ( nullptr != mError )
+      {
+         *mError = mStatus;
+      }
+
+      return std::move(mSubscription);
+   }
+
+private:
+   const Connection&          mConn;
+   CStr                       mObjPath;
+   CStr                       mSigName;
+   SignalCallback             mOnSignal;
+   DBUSIPC_tError*            mError;
+   Executor*                  mExecutor;
+   std::coroutine_handle<>    mHandle;
+   DBUSIPC_tError             mStatus;
+   Subscription               mSubscription;
+};
+
+
+class RegisterAwaiter
+{
+public:
+   RegisterAwaiter(const Connection& conn, CStr busName, CStr objPath,
+                   DBUSIPC_tUInt32 flags, RequestCallback onRequest,
+                   DBUSIPC_tError* error, Executor* executor) noexcept
+      : mConn(conn)
+      , mBusName(busName)
+      , mObjPath(objPath)
+      , mFlags(flags)
+      , mOnRequest(std::move(onRequest))
+      , mError(error)
+      , mExecutor(executor)
+      , mStatus(DBUSIPC_ERROR_NONE)
+   {
+   }
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> handle)
+   {
+      mHandle = handle;
+      DBUSIPC_tError status = mConn.asyncRegisterService(mBusName, mObjPath,
+                                 mFlags, std::move(mOnRequest),
+                                 [this](const Status& status,
+                                        Service&& service)
+                                 {
+                                    mStatus = status.error;
+                                    mService = std::move(service);
+                                    detail::resume(mExecutor, mHandle);
+                                 });
+      if ( DBUSIPC_IS_ERROR(status) )
+      {
+         mStatus = status;
+      }
+
+      return !DBUSIPC_IS_ERROR(status);
+   }
+
+   Service await_resume()
+   {
+      if ( nullptr != mError )
+      {
+         *mError = mStatus;
+      }
+
+      return std::move(mService);
+   }
+
+private:
+   const Connection&          mConn;
+   CStr                       mBusName;
+   CStr                       mObjPath;
+   DBUSIPC_tUInt32            mFlags;
+   RequestCallback            mOnRequest;
+   DBUSIPC_tError*            mError;
+   Executor*                  mExecutor;
+   std::coroutine_handle<>    mHandle;
+   DBUSIPC_tError             mStatus;
+   Service                    mService;
+};
+
+
+// Invokes a method (see Connection::asyncInvoke())
+inline InvokeAwaiter invoke(const Connection& conn, CStr busName,
+                            CStr objPath, CStr method, CStr parameters,
+                            DBUSIPC_tUInt32 msecTimeout,
+                            Executor* executor = nullptr,
+                            DBUSIPC_tUInt32 flags = 0U) noexcept
+{
+   return InvokeAwaiter(conn, busName, objPath, method, parameters,
+                        msecTimeout, executor, flags);
+}
+
+// Subscribes to a signal (see Connection::asyncSubscribe()). The
+// subscription is empty if it failed.
+inline SubscribeAwaiter subscribe(const Connection& conn, CStr objPath,
+                                  CStr sigName, SignalCallback onSignal,
+                                  DBUSIPC_tError* error = nullptr,
+                                  Executor* executor = nullptr) noexcept
+{
+   return SubscribeAwaiter(conn, objPath, sigName, std::move(onSignal),
+                           error, executor);
+}
+
+// Registers a service (see Connection::asyncRegisterService()). The
+// service is empty if the registration failed.
+inline RegisterAwaiter registerService(const Connection& conn, CStr busName,
+                                       CStr objPath, DBUSIPC_tUInt32 flags,
+                                       RequestCallback onRequest,
+                                       DBUSIPC_tError* error = nullptr,
+                                       Executor* executor = nullptr) noexcept
+{
+   return RegisterAwaiter(conn, busName, objPath, flags,
+                          std::move(onRequest), error, executor);
+}
+
+} // namespace co
+} // namespace dbusipc
+
+#endif /* Guard for _DBUSIPC_CORO_HPP_ */
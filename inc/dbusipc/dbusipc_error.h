@@ -66,7 +66,10 @@ typedef enum {
   DBUSIPC_ERR_CONN_SEND,
   DBUSIPC_ERR_NOT_FOUND,
   DBUSIPC_ERR_DEADLOCK,
-  DBUSIPC_ERR_FORMAT
+  DBUSIPC_ERR_FORMAT,
+  DBUSIPC_ERR_BUSY,
+  DBUSIPC_ERR_WOULD_BLOCK,
+  DBUSIPC_ERR_UNKNOWN_METHOD
 } DBUSIPC_tErrorCode;
 
 extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_OK;
@@ -82,6 +85,9 @@ extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_CONN_SEND;
 extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_NOT_FOUND;
 extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_DEADLOCK;
 extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_FORMAT;
+extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_BUSY;
+extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_WOULD_BLOCK;
+extern DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_UNKNOWN_METHOD;
 
 /*
  * Convenience defintion for no errors
@@ -0,0 +1,526 @@
+#ifndef _DBUSIPC_IDL_HPP_
+#define _DBUSIPC_IDL_HPP_
+
+//
+// Support for the proxy and skeleton classes generated by dbusipc-idlgen.
+// The generated code encodes and decodes the JSON payloads of each method
+// directly with these helpers rather than building a document first. Only
+// flat objects with boolean, integer, floating point and string members
+// are supported. Numbers are always written and read in the "C" locale
+// whatever the locale of the application.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <string>
+#include "dbusipc/dbusipc.h"
+
+namespace dbusipc
+{
+namespace idl
+{
+
+// FNV-1a hash of a method name. dbusipc-idlgen computes the same hash for
+// each method when generating the code so a skeleton can switch on it.
+inline DBUSIPC_tUInt32 hash
+   (
+   const char* str
+   )
+{
+   DBUSIPC_tUInt32 h(2166136261U);
+   for ( ; '\0' != *str; ++str )
+   {
+      h ^= static_cast<unsigned char>(*str);
+      h *= 16777619U;
+   }
+
+   return h;
+}
+
+
+// JSON has no representation for NaN or the infinities
+inline bool isFinite(double value)
+{
+   // NaN fails the first test and (inf - inf) is NaN
+   return (value == value) && ((value - value) == 0.0);
+}
+
+
+//
+// Switches the calling thread to the "C" locale while in scope so that the
+// decimal separator is always '.'
+//
+class CLocaleScope
+{
+public:
+   CLocaleScope()
+      : mPrev(0)
+   {
+      static locale_t cLocale = newlocale(LC_NUMERIC_MASK, "C",
+                                          static_cast<locale_t>(0));
+      if ( 0 != cLocale )
+      {
+         mPrev = uselocale(cLocale);
+      }
+   }
+
+   ~CLocaleScope()
+   {
+      if ( 0 != mPrev )
+      {
+         (void)uselocale(mPrev);
+      }
+   }
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   CLocaleScope(const CLocaleScope& other);
+   CLocaleScope& operator=(const CLocaleScope& rhs);
+
+   locale_t mPrev;
+};
+
+
+//
+// Appends a JSON value to the encoded payload. Returns false if the value
+// can't be represented in JSON, in which case the payload must not be used.
+//
+inline bool append(std::string& out, bool value)
+{
+   out.append(value ? "true" : "false");
+   return true;
+}
+
+inline bool append(std::string& out, DBUSIPC_tInt32 value)
+{
+   char buf[16];
+   (void)snprintf(buf, sizeof(buf), "%d", static_cast<int>(value));
+   out.append(buf);
+   return true;
+}
+
+inline bool append(std::string& out, DBUSIPC_tUInt32 value)
+{
+   char buf[16];
+   (void)snprintf(buf, sizeof(buf), "%u", static_cast<unsigned int>(value));
+   out.append(buf);
+   return true;
+}
+
+inline bool append(std::string& out, int64_t value)
+{
+   char buf[24];
+   (void)snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value));
+   out.append(buf);
+   return true;
+}
+
+inline bool append(std::string& out, DBUSIPC_tUInt64 value)
+{
+   char buf[24];
+   (void)snprintf(buf, sizeof(buf), "%llu",
+                  static_cast<unsigned long long>(value));
+   out.append(buf);
+   return true;
+}
+
+inline bool append(std::string& out, double value)
+{
+   bool ok(isFinite(value));
+   if ( ok )
+   {
+      CLocaleScope scope;
+      char buf[32];
+      (void)snprintf(buf, sizeof(buf), "%.17g", value);
+      out.append(buf);
+   }
+
+   return ok;
+}
+
+inline bool append(std::string& out, const std::string& value)
+{
+   static const char HEX[] = "0123456789abcdef";
+
+   out.push_back('"');
+   for ( std::string::const_iterator it = value.begin(); it != value.end();
+      ++it )
+   {
+      unsigned char c = static_cast<unsigned char>(*it);
+      switch ( c )
+      {
+         case '"':  out.append("\\\""); break;
+         case '\\': out.append("\\\\"); break;
+         case '\b': out.append("\\b"); break;
+         case '\f': out.append("\\f"); break;
+         case '\n': out.append("\\n"); break;
+         case '\r': out.append("\\r"); break;
+         case '\t': out.append("\\t"); break;
+         default:
+            if ( c < 0x20U )
+            {
+               out.append("\\u00");
+               out.push_back(HEX[c >> 4U]);
+               out.push_back(HEX[c & 0x0FU]);
+            }
+            else
+            {
+               out.push_back(static_cast<char>(c));
+            }
+            break;
+      }
+   }
+   out.push_back('"');
+
+   return true;
+}
+
+
+//
+// Walks the members of a flat JSON object. The generated decoders call
+// nextKey() until it returns false, read the members they know and skip
+// the others. Any syntax error makes the reader fail from then on.
+//
+class Reader
+{
+public:
+   explicit Reader(const char* json)
+      : mPos((0 != json) ? json : "")
+      , mOk(true)
+      , mFirst(true)
+   {
+      skipSpace();
+      mOk = ('{' == *mPos);
+      if ( mOk )
+      {
+         ++mPos;
+      }
+   }
+
+   bool ok() const { return mOk; }
+
+   // Returns false at the end of the object (or on error)
+   bool nextKey(std::string& key)
+   {
+      bool found(false);
+
+      skipSpace();
+      if ( mOk && ('}' == *mPos) )
+      {
+         ++mPos;
+      }
+      else if ( mOk )
+      {
+         if ( !mFirst )
+         {
+            mOk = expect(',');
+            skipSpace();
+         }
+         mFirst = false;
+         mOk = mOk && readString(key);
+         skipSpace();
+         mOk = mOk && expect(':');
+         skipSpace();
+         found = mOk;
+      }
+
+      return found;
+   }
+
+   bool read(bool& value)
+   {
+      if ( !mOk )
+      {
+         // Already failed
+      }
+      else if ( 0 == strncmp(mPos, "true", 4U) )
+      {
+         value = true;
+         mPos += 4;
+      }
+      else if ( 0 == strncmp(mPos, "false", 5U) )
+      {
+         value = false;
+         mPos += 5;
+      }
+      else
+      {
+         mOk = false;
+      }
+
+      return mOk;
+   }
+
+   bool read(DBUSIPC_tInt32& value)
+   {
+      int64_t wide(0);
+      if ( read(wide) && (wide >= -2147483647LL - 1LL) &&
+         (wide <= 2147483647LL) )
+      {
+         value = static_cast<DBUSIPC_tInt32>(wide);
+      }
+      else
+      {
+         mOk = false;
+      }
+
+      return mOk;
+   }
+
+   bool read(DBUSIPC_tUInt32& value)
+   {
+      DBUSIPC_tUInt64 wide(0U);
+      if ( read(wide) && (wide <= 0xFFFFFFFFULL) )
+      {
+         value = static_cast<DBUSIPC_tUInt32>(wide);
+      }
+      else
+      {
+         mOk = false;
+      }
+
+      return mOk;
+   }
+
+   bool read(int64_t& value)
+   {
+      char* end(0);
+      errno = 0;
+      long long n = strtoll(mPos, &end, 10);
+      mOk = mOk && (end != mPos) && (0 == errno);
+      if ( mOk )
+      {
+         value = static_cast<int64_t>(n);
+         mPos = end;
+      }
+
+      return mOk;
+   }
+
+   bool read(DBUSIPC_tUInt64& value)
+   {
+      char* end(0);
+      errno = 0;
+      unsigned long long n = strtoull(mPos, &end, 10);
+      mOk = mOk && ('-' != *mPos) && (end != mPos) && (0 == errno);
+      if ( mOk )
+      {
+         value = static_cast<DBUSIPC_tUInt64>(n);
+         mPos = end;
+      }
+
+      return mOk;
+   }
+
+   bool read(double& value)
+   {
+      CLocaleScope scope;
+      char* end(0);
+      double n = strtod(mPos, &end);
+      mOk = mOk && (end != mPos) && isFinite(n);
+      if ( mOk )
+      {
+         value = n;
+         mPos = end;
+      }
+
+      return mOk;
+   }
+
+   bool read(std::string& value)
+   {
+      mOk = mOk && readString(value);
+      return mOk;
+   }
+
+   // Skips the value of a member the decoder doesn't know
+   bool skip()
+   {
+      std::string ignored;
+      uint32_t depth(0U);
+      bool done(false);
+
+      while ( mOk && !done )
+      {
+         char c = *mPos;
+         if ( '"' == c )
+         {
+            mOk = readString(ignored);
+            done = (0U == depth);
+         }
+         else if ( ('{' == c) || ('[' == c) )
+         {
+            ++depth;
+            ++mPos;
+         }
+         else if ( (0U != depth) && (('}' == c) || (']' == c)) )
+         {
+            --depth;
+            ++mPos;
+            done = (0U == depth);
+         }
+         else if ( 0U != depth )
+         {
+            // Separators and scalars inside the skipped container
+            mOk = ('\0' != c);
+            if ( mOk )
+            {
+               ++mPos;
+            }
+         }
+         else
+         {
+            const char* start(mPos);
+            while ( ('\0' != *mPos) && (0 == strchr(",}] \t\r\n", *mPos)) )
+            {
+               ++mPos;
+            }
+            mOk = (start != mPos);
+            done = true;
+         }
+      }
+
+      return mOk;
+   }
+
+private:
+   bool expect(char c)
+   {
+      bool ok(c == *mPos);
+      if ( ok )
+      {
+         ++mPos;
+      }
+
+      return ok;
+   }
+
+   void skipSpace()
+   {
+      while ( (' ' == *mPos) || ('\t' == *mPos) || ('\r' == *mPos) ||
+         ('\n' == *mPos) )
+      {
+         ++mPos;
+      }
+   }
+
+   static int32_t hexDigit(char c)
+   {
+      int32_t d(-1);
+      if ( (c >= '0') && (c <= '9') )
+      {
+         d = c - '0';
+      }
+      else if ( (c >= 'a') && (c <= 'f') )
+      {
+         d = c - 'a' + 10;
+      }
+      else if ( (c >= 'A') && (c <= 'F') )
+      {
+         d = c - 'A' + 10;
+      }
+
+      return d;
+   }
+
+   bool readString(std::string& value)
+   {
+      bool ok('"' == *mPos);
+
+      value.clear();
+      if ( ok )
+      {
+         ++mPos;
+      }
+
+      while ( ok && ('"' != *mPos) )
+      {
+         if ( '\0' == *mPos )
+         {
+            ok = false;
+         }
+         else if ( '\\' != *mPos )
+         {
+            value.push_back(*mPos++);
+         }
+         else
+         {
+            ++mPos;
+            switch ( *mPos++ )
+            {
+               case '"':  value.push_back('"'); break;
+               case '\\': value.push_back('\\'); break;
+               case '/':  value.push_back('/'); break;
+               case 'b':  value.push_back('\b'); break;
+               case 'f':  value.push_back('\f'); break;
+               case 'n':  value.push_back('\n'); break;
+               case 'r':  value.push_back('\r'); break;
+               case 't':  value.push_back('\t'); break;
+               case 'u':
+                  ok = readEscapedChar(value);
+                  break;
+               default:
+                  ok = false;
+                  break;
+            }
+         }
+      }
+
+      if ( ok )
+      {
+         ++mPos;
+      }
+
+      return ok;
+   }
+
+   // Decodes the four hex digits after "\u" to UTF-8
+   bool readEscapedChar(std::string& value)
+   {
+      uint32_t cp(0U);
+      bool ok(true);
+
+      for ( uint32_t i = 0U; ok && (i < 4U); ++i )
+      {
+         int32_t d = hexDigit(*mPos);
+         ok = (d >= 0);
+         if ( ok )
+         {
+            cp = (cp << 4U) | static_cast<uint32_t>(d);
+            ++mPos;
+         }
+      }
+
+      // Surrogate pairs aren't combined
+      if ( ok && (cp < 0x80U) )
+      {
+         value.push_back(static_cast<char>(cp));
+      }
+      else if ( ok && (cp < 0x800U) )
+      {
+         value.push_back(static_cast<char>(0xC0U | (cp >> 6U)));
+         value.push_back(static_cast<char>(0x80U | (cp & 0x3FU)));
+      }
+      else if ( ok )
+      {
+         value.push_back(static_cast<char>(0xE0U | (cp >> 12U)));
+         value.push_back(static_cast<char>(0x80U | ((cp >> 6U) & 0x3FU)));
+         value.push_back(static_cast<char>(0x80U | (cp & 0x3FU)));
+      }
+
+      return ok;
+   }
+
+   const char* mPos;
+   bool        mOk;
+   bool        mFirst;
+};
+
+} // namespace idl
+} // namespace dbusipc
+
+#endif /* Guard for _DBUSIPC_IDL_HPP_ */
@@ -0,0 +1,90 @@
+#ifndef _DBUSIPC_TRACE_H_
+#define _DBUSIPC_TRACE_H_
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dbusipc/dbusipc_types.h"
+
+/**
+ * @brief Define the events recorded in the binary trace
+ *
+ * The meaning of the arguments of each event is given in parentheses.
+ */
+typedef enum
+{
+   DBUSIPC_TRACE_NONE = 0,
+   /* A message arrived (connection, message type, serial, reply serial) */
+   DBUSIPC_TRACE_MSG_RECEIVED,
+   /* The bus daemon disconnected us (connection) */
+   DBUSIPC_TRACE_DISCONNECTED,
+   /* A command was queued for the dispatcher (command handle) */
+   DBUSIPC_TRACE_CMD_SUBMITTED,
+   /* The dispatcher started executing a command (command handle) */
+   DBUSIPC_TRACE_CMD_EXECUTED,
+   /* A method call was sent (command handle, serial) */
+   DBUSIPC_TRACE_INVOKE_SENT,
+   /* The result of a method call was delivered (command handle, error) */
+   DBUSIPC_TRACE_INVOKE_DONE,
+   /* A request was handed to a service (registration, serial) */
+   DBUSIPC_TRACE_REQUEST_RECEIVED,
+   /* A service replied to a request (reply serial, error) */
+   DBUSIPC_TRACE_REPLY_SENT,
+   /* A service emitted a signal (registration, serial) */
+   DBUSIPC_TRACE_SIGNAL_EMITTED,
+   /* A callback ran past its budget (kind, elapsed msec, budget msec,
+    * stack frames captured) */
+   DBUSIPC_TRACE_HANDLER_STALLED,
+   DBUSIPC_TRACE_NUM_EVENTS
+} DBUSIPC_tTraceEvent;
+
+/**
+ * @brief Define the number of arguments recorded with each event
+ */
+#define DBUSIPC_TRACE_NUM_ARGS   (4U)
+
+/**
+ * @brief Define a single event in the binary trace
+ */
+typedef struct DBUSIPC_tTraceRecord
+{
+   uint64_t   timestamp;  /* Monotonic time (nsec) the event was recorded */
+   uint32_t   sequence;   /* Per-thread count of recorded events */
+   uint16_t   event;      /* One of DBUSIPC_tTraceEvent */
+   uint16_t   reserved;
+   uint64_t   args[DBUSIPC_TRACE_NUM_ARGS];
+} DBUSIPC_tTraceRecord;
+
+/**
+ * @brief Define the layout of a file written by DBUSIPC_dumpTrace()
+ *
+ * The file starts with a DBUSIPC_tTraceFileHeader followed by one block
+ * per thread that recorded events. Each block is a DBUSIPC_tTraceThread
+ * followed by its records (oldest first). All values are in the byte order
+ * of the machine that wrote the file.
+ */
+#define DBUSIPC_TRACE_FILE_MAGIC    (0x43504942U)  /* "BIPC" */
+#define DBUSIPC_TRACE_FILE_VERSION  (1U)
+
+typedef struct DBUSIPC_tTraceFileHeader
+{
+   uint32_t   magic;        /* DBUSIPC_TRACE_FILE_MAGIC */
+   uint32_t   version;      /* DBUSIPC_TRACE_FILE_VERSION */
+   uint32_t   recordSize;   /* sizeof(DBUSIPC_tTraceRecord) */
+   uint32_t   numThreads;   /* Number of thread blocks that follow */
+} DBUSIPC_tTraceFileHeader;
+
+typedef struct DBUSIPC_tTraceThread
+{
+   uint64_t   threadId;     /* Identifies the thread that recorded them */
+   uint32_t   numRecords;   /* Number of records that follow */
+   uint32_t   numLost;      /* Older events overwritten before the dump */
+} DBUSIPC_tTraceThread;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* Guard for _DBUSIPC_TRACE_H_ */
@@ -32,6 +32,7 @@ typedef char                        DBUSIPC_tChar;
 typedef DBUSIPC_tChar*              DBUSIPC_tString;
 typedef const DBUSIPC_tChar*        DBUSIPC_tConstStr;
 typedef uint32_t                    DBUSIPC_tUInt32;
+typedef uint64_t                    DBUSIPC_tUInt64;
 typedef int32_t                     DBUSIPC_tInt32;
 typedef int32_t                     DBUSIPC_tBool;
 typedef void*                       DBUSIPC_tUserToken;
@@ -39,6 +40,7 @@ typedef void*                       DBUSIPC_tConnection;
 typedef void*                       DBUSIPC_tReqContext;
 typedef void*                       DBUSIPC_tSvcRegHnd;
 typedef void*                       DBUSIPC_tSigSubHnd;
+typedef void*                       DBUSIPC_tPreparedMsg;
 typedef uint32_t                    DBUSIPC_tError;
 typedef uint32_t                    DBUSIPC_tHandle;
 
@@ -83,6 +85,132 @@ typedef struct DBUSIPC_tResponse
    DBUSIPC_tString     result;
 } DBUSIPC_tResponse;
 
+/*
+ * @brief Define the admission control counters kept for a registered
+ *        service.
+ */
+typedef struct DBUSIPC_tServiceStats
+{
+   DBUSIPC_tUInt32  accepted;  /* Requests handed to the service handler */
+   DBUSIPC_tUInt32  shed;      /* Requests rejected with a Busy error */
+   DBUSIPC_tUInt32  expired;   /* Requests dropped after their deadline */
+   DBUSIPC_tUInt32  inFlight;  /* Requests the handler hasn't replied to */
+   DBUSIPC_tUInt32  queued;    /* Requests waiting for an in-flight slot */
+   DBUSIPC_tUInt32  unknown;   /* Requests for a method without a handler */
+} DBUSIPC_tServiceStats;
+
+/*
+ * @brief Define the kinds of commands executed by the dispatcher
+ */
+typedef enum
+{
+   DBUSIPC_CMD_OPEN_CONNECTION = 0,
+   DBUSIPC_CMD_GET_CONNECTION,
+   DBUSIPC_CMD_CLOSE_CONNECTION,
+   DBUSIPC_CMD_SUBSCRIBE,
+   DBUSIPC_CMD_UNSUBSCRIBE,
+   DBUSIPC_CMD_REGISTER_SERVICE,
+   DBUSIPC_CMD_UNREGISTER_SERVICE,
+   DBUSIPC_CMD_INVOKE,
+   DBUSIPC_CMD_EMIT,
+   DBUSIPC_CMD_CANCEL,
+   DBUSIPC_CMD_RETURN_RESULT,
+   DBUSIPC_CMD_RETURN_ERROR,
+   DBUSIPC_CMD_FREE_REQUEST_CONTEXT,
+   DBUSIPC_CMD_SHUTDOWN,
+   DBUSIPC_CMD_NAME_HAS_OWNER,
+   DBUSIPC_CMD_SUBSCRIBE_OWNER_CHANGED,
+   DBUSIPC_CMD_SERVICE_LIMITS,
+   DBUSIPC_CMD_SERVICE_STATS,
+   DBUSIPC_CMD_DISPATCHER_STATS,
+   DBUSIPC_CMD_OUTGOING_LIMITS,
+   DBUSIPC_CMD_CONNECTION_PRIORITY,
+   DBUSIPC_CMD_REGISTER_METHOD,
+   DBUSIPC_CMD_METHOD_STATS,
+   DBUSIPC_CMD_PEER_CONNECTED,
+   DBUSIPC_CMD_DRAIN_QUEUE,
+   DBUSIPC_CMD_NUM_TYPES
+} DBUSIPC_tCmdType;
+
+/*
+ * @brief Define the number of buckets in a latency histogram. Bucket 0
+ *        counts the samples under 1 usec and bucket N (N > 0) the ones
+ *        from 2^(N-1) up to 2^N usec. The last bucket also counts all the
+ *        longer samples.
+ */
+#define DBUSIPC_HISTOGRAM_NUM_BUCKETS  (24U)
+
+typedef struct DBUSIPC_tHistogram
+{
+   DBUSIPC_tUInt32  buckets[DBUSIPC_HISTOGRAM_NUM_BUCKETS];
+   DBUSIPC_tUInt32  count;     /* Number of samples */
+   DBUSIPC_tUInt64  totalUsec; /* Sum of all the samples */
+   DBUSIPC_tUInt64  maxUsec;   /* Longest sample */
+} DBUSIPC_tHistogram;
+
+/*
+ * @brief Define the counters kept for a method registered with
+ *        DBUSIPC_registerMethod()
+ */
+typedef struct DBUSIPC_tMethodStats
+{
+   DBUSIPC_tUInt32     calls;        /* Requests handed to the handler */
+   DBUSIPC_tHistogram  handlerTime;  /* Time spent in the handler */
+} DBUSIPC_tMethodStats;
+
+/*
+ * @brief Define the timing of one kind of command
+ */
+typedef struct DBUSIPC_tCmdStats
+{
+   DBUSIPC_tHistogram  queueDelay;  /* From submission to execution */
+   DBUSIPC_tHistogram  execTime;    /* Time spent executing */
+} DBUSIPC_tCmdStats;
+
+/*
+ * @brief Define the counters kept by the dispatcher. Each pass of the
+ *        dispatch loop waits in poll(), handles the expired timers, handles
+ *        the active watches (which includes executing queued commands) and
+ *        then dispatches the messages pending on the connections.
+ */
+typedef struct DBUSIPC_tDispatcherStats
+{
+   DBUSIPC_tUInt32     queueDepth;     /* Commands currently queued */
+   DBUSIPC_tUInt32     queueHighWater; /* Most commands queued at once */
+   DBUSIPC_tUInt64     iterations;     /* Passes of the dispatch loop */
+   DBUSIPC_tHistogram  pollWait;
+   DBUSIPC_tHistogram  timerHandling;
+   DBUSIPC_tHistogram  watchHandling;
+   DBUSIPC_tHistogram  dispatchPending;
+   DBUSIPC_tCmdStats   commands[DBUSIPC_CMD_NUM_TYPES];
+} DBUSIPC_tDispatcherStats;
+
+/*
+ * @brief Define the order in which the dispatcher services the connections
+ *        with messages waiting. Every pass of the dispatch loop services
+ *        all the ready connections of a class before any of a lower class.
+ */
+typedef enum
+{
+   DBUSIPC_CONN_PRIORITY_CONTROL = 0,  /* Serviced first */
+   DBUSIPC_CONN_PRIORITY_NORMAL,       /* The default */
+   DBUSIPC_CONN_PRIORITY_BULK,         /* Serviced last */
+   DBUSIPC_CONN_PRIORITY_NUM_CLASSES
+} DBUSIPC_tConnPriority;
+
+/*
+ * @brief Define the state of the out-going message queue of a connection
+ */
+typedef struct DBUSIPC_tOutgoingQueueStats
+{
+   DBUSIPC_tUInt32  bytes;      /* Bytes waiting to be written */
+   DBUSIPC_tUInt32  unixFds;    /* Unix file descriptors waiting to be sent */
+   DBUSIPC_tUInt32  highWater;  /* Bytes at which the queue is congested */
+   DBUSIPC_tUInt32  lowWater;   /* Bytes at which congestion clears */
+   DBUSIPC_tBool    congested;  /* Whether the queue is above the watermark */
+   DBUSIPC_tUInt32  rejected;   /* Messages refused with DBUSIPC_ERR_WOULD_BLOCK */
+} DBUSIPC_tOutgoingQueueStats;
+
 /**
  * @brief Define the basic callback types
  */
@@ -91,6 +219,13 @@ typedef struct DBUSIPC_tResponse
 typedef void (*DBUSIPC_tStatusCallback)(const DBUSIPC_tCallbackStatus* status,
                                        DBUSIPC_tUserToken token);
 
+/* @brief Called when the out-going queue of a connection becomes (or is no
+ *        longer) congested */
+typedef void (*DBUSIPC_tBackpressureCallback)(DBUSIPC_tConnection conn,
+                                         DBUSIPC_tBool congested,
+                                         DBUSIPC_tUInt32 queuedBytes,
+                                         DBUSIPC_tUserToken token);
+
 /* @brief Called to return a newly allocated connection */
 typedef void (*DBUSIPC_tConnectionCallback)(const DBUSIPC_tCallbackStatus* status,
                                       DBUSIPC_tConnection conn,
@@ -148,6 +283,33 @@ typedef enum
    DBUSIPC_CONNECTION_STARTER     /* Message bus that started/launched service */
 } DBUSIPC_tConnType;
 
+/**
+ * @brief Define the flags accepted when initializing the library
+ */
+#define DBUSIPC_INIT_FLAG_NONE         (0x0U)
+/* Run the dispatch loop from the application's own event loop */
+#define DBUSIPC_INIT_FLAG_INTEGRATED   (0x1U)
+
+/**
+ * @brief Define the flags accepted when registering a service
+ */
+#define DBUSIPC_REG_FLAG_NONE          (0x0U)
+/* Also accept direct (peer-to-peer) connections that bypass the bus daemon */
+#define DBUSIPC_REG_FLAG_PEER_LISTEN   (0x1U)
+/* Drop (without calling the handler) requests the client stopped waiting on */
+#define DBUSIPC_REG_FLAG_DROP_EXPIRED  (0x2U)
+
+/**
+ * @brief Define the flags accepted when invoking a method asynchronously
+ */
+#define DBUSIPC_INVOKE_FLAG_NONE       (0x0U)
+/* Hint to the service that the client doesn't care about the result */
+#define DBUSIPC_INVOKE_FLAG_NO_REPLY   (0x1U)
+/* Share the reply of an identical invoke that is already in-flight */
+#define DBUSIPC_INVOKE_FLAG_COALESCE   (0x2U)
+/* Send from the calling thread rather than via the dispatcher thread */
+#define DBUSIPC_INVOKE_FLAG_DIRECT     (0x4U)
+
 /**
  * @brief Define an invalid handle value
  */
@@ -14,6 +14,8 @@
 #include "RequestContext.hpp"
 #include "Dispatcher.hpp"
 #include "NUtil.hpp"
+#include "NSysDep.hpp"
+#include "ResponseCache.hpp"
 
 // An empty object value returned if user passes in NULL for either
 // method parameters, a signal payload, returned result, or
@@ -28,6 +30,7 @@ static DBUSIPC_tConstStr EMPTY_OBJECT = "{}";
 
 BaseCommand::BaseCommand()
    : mHandle(DBUSIPC_INVALID_HANDLE)
+   , mSubmitTime(0U)
 {
 }
 
@@ -38,63 +41,67 @@ BaseCommand::~BaseCommand()
 
 //==================================
 //
-// OpenConnectionCmd Implementation
+// ConnectCmd Implementation
 //
 //==================================
 
-OpenConnectionCmd::OpenConnectionCmd
+ConnectCmd::ConnectCmd
    (
-   DBUSIPC_tConstStr           address,
    DBUSIPC_tBool               openPrivate,
    DBUSIPC_tConnectionCallback onConnect,
    DBUSIPC_tUserToken          token
    )
    : BaseCommand()
-   , mAddress(address ? address : "")
    , mPrivConn(openPrivate)
    , mOnConnect(onConnect)
    , mToken(token)
    , mSem(0)
    , mStatus(0)
    , mConn(0)
+   , mWaitConn(0)
 {  
 }
 
 
-OpenConnectionCmd::OpenConnectionCmd
+ConnectCmd::ConnectCmd
    (
-   DBUSIPC_tConstStr     address,
    DBUSIPC_tBool         openPrivate,
    Semaphore*           sem,
    DBUSIPC_tError*       status,
    DBUSIPC_tConnection*  conn
    )
    : BaseCommand()
-   , mAddress(address ? address : "")
    , mPrivConn(openPrivate)
    , mOnConnect(0)
    , mToken(0)
    , mSem(sem)
    , mStatus(status)
    , mConn(conn)
+   , mWaitConn(0)
 {  
 }
 
 
-OpenConnectionCmd::~OpenConnectionCmd()
+ConnectCmd::~ConnectCmd()
 {   
-	if (NULL != mToken)
-	{
-		mToken = NULL;
-	}
 }
 
 
-void OpenConnectionCmd::cancel
+void ConnectCmd::cancel
    (
    Dispatcher& dispatcher
    )
 {
+   // If the user gave up waiting on the bus then give back our reference
+   // to the connection. When the connection itself is going away it
+   // no longer exists by the time we're cancelled.
+   Connection* conn = Connection::fromHandle(mWaitConn);
+   if ( 0 != conn )
+   {
+      conn->scheduleRelease();
+   }
+   mWaitConn = 0;
+   
    DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                     DBUSIPC_ERROR_LEVEL_ERROR,
                                     DBUSIPC_DOMAIN_IPC_LIB,
@@ -104,34 +111,50 @@ void OpenConnectionCmd::cancel
 }
 
 
-void OpenConnectionCmd::execute
+bool ConnectCmd::execAndDestroy() const
+{
+   // The connection deletes us once the bus has answered
+   return 0 == mWaitConn;
+}
+
+
+void ConnectCmd::connect
    (
-   Dispatcher& dispatcher
+   Connection* conn
    )
 {
-   Connection* conn(0);
+   assert( 0 != conn );
    try
    {
-      conn = Connection::create(mAddress.c_str(), mPrivConn, &dispatcher);
-      assert( 0 != conn );
-      DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
-                                       DBUSIPC_ERR_NAME_OK, 0};
-      dispatch(status, conn);
+      // Direct peer connections have no bus to register with
+      if ( conn->registerOnBus(this) )
+      {
+         DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
+                                          DBUSIPC_ERR_NAME_OK, 0};
+         dispatch(status, conn->getHandle());
+      }
+      else
+      {
+         mWaitConn = conn->getHandle();
+      }
    }
    catch ( const DBUSIPCError& e )
    {
+      Connection::release(conn);
       DBUSIPC_tCallbackStatus status = {e.getError(), 0, e.what()};
       dispatch(status, 0);
    }
 }
 
 
-void OpenConnectionCmd::dispatch
+void ConnectCmd::dispatch
    (
    const DBUSIPC_tCallbackStatus& status,
    DBUSIPC_tConnection            conn
    )
 {
+   mWaitConn = 0;
+   
    if ( 0 != mSem )
    {
       if ( 0 != mStatus )
@@ -156,81 +179,50 @@ void OpenConnectionCmd::dispatch
 
 //==================================
 //
-// GetConnectionCmd Implementation
+// OpenConnectionCmd Implementation
 //
 //==================================
 
-GetConnectionCmd::GetConnectionCmd
+OpenConnectionCmd::OpenConnectionCmd
    (
-   DBUSIPC_tConnType           connType,
+   DBUSIPC_tConstStr           address,
    DBUSIPC_tBool               openPrivate,
    DBUSIPC_tConnectionCallback onConnect,
    DBUSIPC_tUserToken          token
    )
-   : BaseCommand()
-   , mConnType(connType)
-   , mPrivConn(openPrivate)
-   , mOnConnect(onConnect)
-   , mToken(token)
-   , mSem(0)
-   , mStatus(0)
-   , mConn(0)
+   : ConnectCmd(openPrivate, onConnect, token)
+   , mAddress(address ? address : "")
 {  
 }
 
 
-GetConnectionCmd::GetConnectionCmd
+OpenConnectionCmd::OpenConnectionCmd
    (
-   DBUSIPC_tConnType     connType,
+   DBUSIPC_tConstStr     address,
    DBUSIPC_tBool         openPrivate,
    Semaphore*           sem,
    DBUSIPC_tError*       status,
    DBUSIPC_tConnection*  conn
    )
-   : BaseCommand()
-   , mConnType(connType)
-   , mPrivConn(openPrivate)
-   , mOnConnect(0)
-   , mToken(0)
-   , mSem(sem)
-   , mStatus(status)
-   , mConn(conn)
+   : ConnectCmd(openPrivate, sem, status, conn)
+   , mAddress(address ? address : "")
 {  
 }
 
 
-GetConnectionCmd::~GetConnectionCmd()
+OpenConnectionCmd::~OpenConnectionCmd()
 {   
 }
 
 
-void GetConnectionCmd::cancel
-   (
-   Dispatcher& dispatcher
-   )
-{
-   DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
-                                    DBUSIPC_ERROR_LEVEL_ERROR,
-                                    DBUSIPC_DOMAIN_IPC_LIB,
-                                    DBUSIPC_ERR_CANCELLED),
-                                    DBUSIPC_ERR_NAME_CANCELLED, 0};
-   dispatch(status, 0);
-}
-
-
-void GetConnectionCmd::execute
+void OpenConnectionCmd::execute
    (
    Dispatcher& dispatcher
    )
 {
-   Connection* conn(0);
    try
    {
-      conn = Connection::create(mConnType, mPrivConn, &dispatcher);
-      assert( 0 != conn );
-      DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
-                                       DBUSIPC_ERR_NAME_OK, 0};
-      dispatch(status, conn);
+      connect(Connection::create(mAddress.c_str(), mPrivConn, &dispatcher));
    }
    catch ( const DBUSIPCError& e )
    {
@@ -240,30 +232,57 @@ void GetConnectionCmd::execute
 }
 
 
-void GetConnectionCmd::dispatch
+//==================================
+//
+// GetConnectionCmd Implementation
+//
+//==================================
+
+GetConnectionCmd::GetConnectionCmd
    (
-   const DBUSIPC_tCallbackStatus& status,
-   DBUSIPC_tConnection            conn
+   DBUSIPC_tConnType           connType,
+   DBUSIPC_tBool               openPrivate,
+   DBUSIPC_tConnectionCallback onConnect,
+   DBUSIPC_tUserToken          token
+   )
+   : ConnectCmd(openPrivate, onConnect, token)
+   , mConnType(connType)
+{  
+}
+
+
+GetConnectionCmd::GetConnectionCmd
+   (
+   DBUSIPC_tConnType     connType,
+   DBUSIPC_tBool         openPrivate,
+   Semaphore*           sem,
+   DBUSIPC_tError*       status,
+   DBUSIPC_tConnection*  conn
+   )
+   : ConnectCmd(openPrivate, sem, status, conn)
+   , mConnType(connType)
+{  
+}
+
+
+GetConnectionCmd::~GetConnectionCmd()
+{   
+}
+
+
+void GetConnectionCmd::execute
+   (
+   Dispatcher& dispatcher
    )
 {
-   if ( 0 != mSem )
+   try
    {
-      if ( 0 != mStatus )
-      {
-         *mStatus = status.errCode;
-      }
-      
-      if ( 0 != mConn )
-      {
-         *mConn = conn;
-      }
-      
-      mSem->post();
+      connect(Connection::create(mConnType, mPrivConn, &dispatcher));
    }
-   
-   if ( 0 != mOnConnect )
+   catch ( const DBUSIPCError& e )
    {
-      mOnConnect(&status, conn, mToken);
+      DBUSIPC_tCallbackStatus status = {e.getError(), 0, e.what()};
+      dispatch(status, 0);
    }
 }
 
@@ -312,7 +331,7 @@ void CloseConnectionCmd::execute
 {
    try
    {
-      Connection::release(static_cast<Connection*>(mConn));
+      Connection::release(Connection::fromHandle(mConn));
       dispatch(DBUSIPC_ERROR_NONE);
    }
    catch ( const DBUSIPCError& e )
@@ -356,7 +375,8 @@ SubscribeCmd::SubscribeCmd
    DBUSIPC_tUserToken             token
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mObjectPath()
    , mSignalName(sigName ? sigName : "")
    , mOnSignal(onSignal)
@@ -378,7 +398,7 @@ SubscribeCmd::SubscribeCmd
       mObjectPath = std::string(objPath);
    }
    
-   mSigSub.reset(new DBUSIPCSubscription(mConn, mObjectPath, mSignalName,
+   mSigSub.reset(new DBUSIPCSubscription(mConnHnd, mObjectPath, mSignalName,
                                              mOnSignal, mUserToken));
 }
 
@@ -395,7 +415,8 @@ SubscribeCmd::SubscribeCmd
    DBUSIPC_tSigSubHnd*      subHnd
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mObjectPath()
    , mSignalName(sigName ? sigName : "")
    , mOnSignal(onSignal)
@@ -417,7 +438,7 @@ SubscribeCmd::SubscribeCmd
       mObjectPath = std::string(objPath);
    }
 
-   mSigSub.reset(new DBUSIPCSubscription(mConn, mObjectPath, mSignalName,
+   mSigSub.reset(new DBUSIPCSubscription(mConnHnd, mObjectPath, mSignalName,
                                              mOnSignal, mUserToken));
 }
 
@@ -473,8 +494,9 @@ void SubscribeCmd::execute
    Dispatcher& dispatcher
    )
 {
-   DBusConnection* dbusConn = Connection::getDBusConnection(mConn);
-   if ( !dbus_connection_get_is_connected(dbusConn) )
+   mConn = Connection::fromHandle(mConnHnd);
+   DBusConnection* dbusConn = (0 != mConn) ? mConn->getDBusConn() : 0;
+   if ( (0 == dbusConn) || !dbus_connection_get_is_connected(dbusConn) )
    {
       DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                        DBUSIPC_ERROR_LEVEL_ERROR,
@@ -616,7 +638,7 @@ void SubscribeCmd::onPendingCallNotify
    SubscribeCmd* cmd = static_cast<SubscribeCmd*>(userData);
    assert( 0 != cmd );
 
-   DBusConnection* dbusConn = Connection::getDBusConnection(cmd->mConn);
+   DBusConnection* dbusConn = cmd->mConn->getDBusConn();
    DBusMessage* reply = dbus_pending_call_steal_reply(call);
    if ( (0 == reply) || !dbus_connection_get_is_connected(dbusConn) )
    {
@@ -658,7 +680,7 @@ void SubscribeCmd::onPendingCallNotify
             cmd->mConn->subscribeSignal(cmd->mSigSub.get());
             DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
                                              DBUSIPC_ERR_NAME_OK, 0};
-            cmd->dispatch(status, cmd->mSigSub.get());
+            cmd->dispatch(status, cmd->mSigSub->getHandle());
             cmd->mSigSub.release();
          }
          catch ( ... )
@@ -736,12 +758,13 @@ void SubscribeCmd::onPendingCallNotify
 
 UnsubscribeCmd::UnsubscribeCmd
    (
-   SignalSubscription*     sub,
+   DBUSIPC_tSigSubHnd       subHnd,
    DBUSIPC_tStatusCallback  onStatus,
    DBUSIPC_tUserToken       token
    )
    : BaseCommand()
-   , mSigSub(sub)
+   , mSubHnd(subHnd)
+   , mSigSub(0)
    , mOnStatus(onStatus)
    , mUserToken(token)
    , mSem(0)
@@ -754,12 +777,13 @@ UnsubscribeCmd::UnsubscribeCmd
 
 UnsubscribeCmd::UnsubscribeCmd
    (
-   SignalSubscription*     sub,
+   DBUSIPC_tSigSubHnd       subHnd,
    Semaphore*              sem,
    DBUSIPC_tError*          status
    )
    : BaseCommand()
-   , mSigSub(sub)
+   , mSubHnd(subHnd)
+   , mSigSub(0)
    , mOnStatus(0)
    , mUserToken(0)
    , mSem(sem)
@@ -845,7 +869,8 @@ void UnsubscribeCmd::execute
    )
 {
    // See if we still have a record of this subscription
-   if ( !Connection::signalSubExists(mSigSub) )
+   mSigSub = Connection::findSignalSub(mSubHnd);
+   if ( 0 == mSigSub )
    {
       DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                              DBUSIPC_ERROR_LEVEL_ERROR,
@@ -858,7 +883,7 @@ void UnsubscribeCmd::execute
    else
    {
       Connection* conn = mSigSub->getConnection();
-      DBusConnection* dbusConn = Connection::getDBusConnection(conn);
+      DBusConnection* dbusConn = conn->getDBusConn();
       if ( !dbus_connection_get_is_connected(dbusConn) )
       {
          DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
@@ -1065,7 +1090,8 @@ RegisterServiceCmd::RegisterServiceCmd
    DBUSIPC_tUserToken             token
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mObjectPath()
    , mFlag(flag)
@@ -1088,7 +1114,7 @@ RegisterServiceCmd::RegisterServiceCmd
       mObjectPath = std::string(objPath);
    }
    
-   mSvcReg.reset(new ServiceRegistration(mConn, mBusName, mObjectPath,
+   mSvcReg.reset(new ServiceRegistration(mConnHnd, mBusName, mObjectPath,
                                          mFlag, mOnRequest, mUserToken));
 }
 
@@ -1106,7 +1132,8 @@ RegisterServiceCmd::RegisterServiceCmd
    DBUSIPC_tSvcRegHnd*         regHnd
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mObjectPath()
    , mFlag(flag)
@@ -1129,7 +1156,7 @@ RegisterServiceCmd::RegisterServiceCmd
       mObjectPath = std::string(objPath);
    }
    
-   mSvcReg.reset(new ServiceRegistration(mConn, mBusName, mObjectPath,
+   mSvcReg.reset(new ServiceRegistration(mConnHnd, mBusName, mObjectPath,
                                       mFlag, mOnRequest, mUserToken));
 }
 
@@ -1185,8 +1212,9 @@ void RegisterServiceCmd::execute
    Dispatcher& dispatcher
    )
 {
-   DBusConnection* dbusConn = Connection::getDBusConnection(mConn);
-   if ( !dbus_connection_get_is_connected(dbusConn) )
+   mConn = Connection::fromHandle(mConnHnd);
+   DBusConnection* dbusConn = (0 != mConn) ? mConn->getDBusConn() : 0;
+   if ( (0 == dbusConn) || !dbus_connection_get_is_connected(dbusConn) )
    {
       DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                        DBUSIPC_ERROR_LEVEL_ERROR,
@@ -1331,7 +1359,7 @@ void RegisterServiceCmd::onPendingCallNotify
    RegisterServiceCmd* cmd = static_cast<RegisterServiceCmd*>(userData);
    assert( 0 != cmd );
 
-   DBusConnection* dbusConn = Connection::getDBusConnection(cmd->mConn);
+   DBusConnection* dbusConn = cmd->mConn->getDBusConn();
    DBusMessage* reply = dbus_pending_call_steal_reply(call);
    if ( (0 == reply) || !dbus_connection_get_is_connected(dbusConn) )
    {
@@ -1388,7 +1416,7 @@ void RegisterServiceCmd::onPendingCallNotify
                cmd->mConn->registerService(cmd->mSvcReg.get());
                DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
                                                 DBUSIPC_ERR_NAME_OK, 0};
-               cmd->dispatch(status, cmd->mSvcReg.get());
+               cmd->dispatch(status, cmd->mSvcReg->getHandle());
                cmd->mSvcReg.release();
             }
             else
@@ -1476,12 +1504,13 @@ void RegisterServiceCmd::onPendingCallNotify
 
 UnregisterServiceCmd::UnregisterServiceCmd
    (
-   ServiceRegistration*    reg,
+   DBUSIPC_tSvcRegHnd       regHnd,
    DBUSIPC_tStatusCallback  onStatus,
    DBUSIPC_tUserToken       token
    )
    : BaseCommand()
-   , mSvcReg(reg)
+   , mRegHnd(regHnd)
+   , mSvcReg(0)
    , mOnStatus(onStatus)
    , mUserToken(token)
    , mSem(0)
@@ -1494,12 +1523,13 @@ UnregisterServiceCmd::UnregisterServiceCmd
 
 UnregisterServiceCmd::UnregisterServiceCmd
    (
-   ServiceRegistration*    reg,
+   DBUSIPC_tSvcRegHnd       regHnd,
    Semaphore*              sem,
    DBUSIPC_tError*          status
    )
    : BaseCommand()
-   , mSvcReg(reg)
+   , mRegHnd(regHnd)
+   , mSvcReg(0)
    , mOnStatus(0)
    , mUserToken(0)
    , mSem(sem)
@@ -1585,7 +1615,8 @@ void UnregisterServiceCmd::execute
    )
 {
    // See if we still have a record of this service reservation
-   if ( !Connection::serviceRegExists(mSvcReg) )
+   mSvcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 == mSvcReg )
    {
       DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                        DBUSIPC_ERROR_LEVEL_ERROR,
@@ -1598,7 +1629,7 @@ void UnregisterServiceCmd::execute
    else
    {
       Connection* conn = mSvcReg->getConnection();
-      DBusConnection* dbusConn = Connection::getDBusConnection(conn);
+      DBusConnection* dbusConn = conn->getDBusConn();
       if ( !dbus_connection_get_is_connected(dbusConn) )
       {
          DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
@@ -1823,10 +1854,12 @@ InvokeCmd::InvokeCmd
    bool                    noReplyExpected,
    DBUSIPC_tUInt32          msecTimeout,
    DBUSIPC_tResultCallback  onResult,
-   DBUSIPC_tUserToken       token
+   DBUSIPC_tUserToken       token,
+   bool                    coalesce
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName)
    , mObjectPath()
    , mMethod(method)
@@ -1838,8 +1871,15 @@ InvokeCmd::InvokeCmd
    , mResponse(0)
    , mSem(0)
    , mPendingCall(0)
+   , mCarrier(0)
    , mExecAndDestroy(true)
    , mSerialNum(0U)
+   , mCoalesce(coalesce && !noReplyExpected)
+   , mCoalesceKey()
+   , mSharing(false)
+   , mLeader(0)
+   , mFollowers()
+   , mPrepared(0)
 {
    if ( 0 == objPath )
    {
@@ -1849,6 +1889,13 @@ InvokeCmd::InvokeCmd
    {
       mObjectPath = std::string(objPath);
    }
+   
+   if ( mCoalesce )
+   {
+      // The parameters go last since they're the only free-form part
+      mCoalesceKey = mBusName + '\n' + mObjectPath + '\n' + mMethod +
+                     '\n' + mParms;
+   }
 }
 
 
@@ -1865,7 +1912,8 @@ InvokeCmd::InvokeCmd
    Semaphore*              sem
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName)
    , mObjectPath()
    , mMethod(method)
@@ -1877,8 +1925,15 @@ InvokeCmd::InvokeCmd
    , mResponse(response)
    , mSem(sem)
    , mPendingCall(0)
+   , mCarrier(0)
    , mExecAndDestroy(true)
    , mSerialNum(0U)
+   , mCoalesce(false)
+   , mCoalesceKey()
+   , mSharing(false)
+   , mLeader(0)
+   , mFollowers()
+   , mPrepared(0)
 {
    if ( 0 == objPath )
    {
@@ -1919,6 +1974,27 @@ InvokeCmd::~InvokeCmd()
    {
       dbus_pending_call_unref(mPendingCall);
    }
+   
+   if ( 0 != mPrepared )
+   {
+      dbus_message_unref(mPrepared);
+   }
+}
+
+
+void InvokeCmd::usePrepared
+   (
+   DBusMessage*   prepared
+   )
+{
+   assert( 0 != prepared );
+   
+   // The client may free the prepared call while we're still queued
+   if ( 0 != mPrepared )
+   {
+      dbus_message_unref(mPrepared);
+   }
+   mPrepared = dbus_message_ref(prepared);
 }
 
 
@@ -1927,16 +2003,36 @@ void InvokeCmd::execute
    Dispatcher& dispatcher
    )
 {
-   DBusConnection* dbusConn = Connection::getDBusConnection(mConn);
-   if ( !dbus_connection_get_is_connected(dbusConn) )
+   mConn = Connection::fromHandle(mConnHnd);
+   DBusConnection* dbusConn = (0 != mConn) ? mConn->getDBusConn() : 0;
+   if ( (0 == dbusConn) || !dbus_connection_get_is_connected(dbusConn) )
    {
       dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                      DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_CONNECTED),
                      DBUSIPC_ERR_NAME_NOT_CONNECTED, "Not connected", 0);
    }
+   // If an identical request is already waiting on a reply then ...
+   else if ( joinCoalesced() )
+   {
+      // Nothing else to do - we'll be handed the same reply
+   }
+   // Else if the out-going queue is backed up then fail fast
+   else if ( !mConn->admitOutgoing() )
+   {
+      dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_WOULD_BLOCK),
+                     DBUSIPC_ERR_NAME_WOULD_BLOCK,
+                     "Out-going queue is full", 0);
+   }
    else
    {
-      DBusMessage* reqMsg = dbus_message_new_method_call(mBusName.c_str(),
+      // Prefer a direct connection to the service if one is available.
+      // Otherwise the request is routed through the bus as usual.
+      dbusConn = mConn->getPeerConnection(mBusName)->getDBusConn();
+      
+      // Copying a prepared call skips validating the header again
+      DBusMessage* reqMsg = (0 != mPrepared) ? dbus_message_copy(mPrepared)
+                        : dbus_message_new_method_call(mBusName.c_str(),
                         mObjectPath.c_str(), DBUSIPC_INTERFACE_NAME,
                         DBUSIPC_INTERFACE_METHOD_NAME);
       if ( 0 == reqMsg )
@@ -1949,12 +2045,16 @@ void InvokeCmd::execute
       {
          dbus_message_set_no_reply(reqMsg, mNoReplyExpected);
          
-         // Pack in the arguments
+         // Pack in the arguments. If we're waiting on a reply then also
+         // tell the service when we'll give up on it.
          DBUSIPC_tConstStr dbusMethod = mMethod.c_str();
          DBUSIPC_tConstStr dbusParms = mParms.c_str();
+         dbus_uint64_t deadline = mNoReplyExpected ? 0U : getDeadline();
          if ( !dbus_message_append_args(reqMsg, DBUS_TYPE_STRING,
             &dbusMethod, DBUS_TYPE_STRING, &dbusParms,
-            DBUS_TYPE_INVALID) )
+            DBUS_TYPE_INVALID) ||
+            ((0U != deadline) && !dbus_message_append_args(reqMsg,
+            DBUS_TYPE_UINT64, &deadline, DBUS_TYPE_INVALID)) )
          {
             dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                            DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NO_MEMORY),
@@ -1971,6 +2071,11 @@ void InvokeCmd::execute
                                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NO_MEMORY),
                                  DBUSIPC_ERR_NAME_NO_MEMORY, "Out of memory", 0);
                }
+               else
+               {
+                  TRACE_EVENT(DBUSIPC_TRACE_INVOKE_SENT, getHandle(),
+                              mSerialNum, 0U, 0U);
+               }
             }
             else
             {
@@ -1983,6 +2088,8 @@ void InvokeCmd::execute
                }
                else
                {
+                  TRACE_EVENT(DBUSIPC_TRACE_INVOKE_SENT, getHandle(),
+                              dbus_message_get_serial(reqMsg), 0U, 0U);
                   if ( !dbus_pending_call_set_notify(mPendingCall,
                      InvokeCmd::onPendingCallNotify, this, 0) )
                   {
@@ -1997,11 +2104,26 @@ void InvokeCmd::execute
                         // Register this pending command so we can
                         // remove it later
                         mConn->registerPending(this);
+                        mCarrier = dbusConn;
                         
                         // We don't want the command dispatcher to
                         // destroy this command after a request has been
                         // made and we're waiting on the result.
                         mExecAndDestroy = false;
+                        
+                        if ( mCoalesce )
+                        {
+                           try
+                           {
+                              // Let identical requests share our reply
+                              mConn->addCoalescedInvoke(mCoalesceKey, this);
+                              mSharing = true;
+                           }
+                           catch ( ... )
+                           {
+                              // Sharing is only an optimization
+                           }
+                        }
                      }
                      catch ( ... )
                      {
@@ -2029,7 +2151,19 @@ void InvokeCmd::cancel
    Dispatcher& dispatcher
    )
 {
-   if ( 0 != mPendingCall )
+   // If we're sharing another request's reply then just stop waiting on it
+   if ( 0 != mLeader )
+   {
+      mLeader->mFollowers.remove(this);
+      mLeader = 0;
+   }
+   // Else if others are still waiting on our request then let one of
+   // them take it over rather than cancelling it
+   else if ( handOver() )
+   {
+      // The request is no longer ours
+   }
+   else if ( 0 != mPendingCall )
    {
       // If the call already completed by the time cancel was called then ...
       if ( dbus_pending_call_get_completed(mPendingCall) )
@@ -2053,6 +2187,21 @@ void InvokeCmd::cancel
 }
 
 
+void InvokeCmd::failCarrier()
+{
+   // D-Bus doesn't complete the calls left on a private connection when
+   // it's disconnected so the reply would never arrive
+   if ( 0 != mPendingCall )
+   {
+      dbus_pending_call_cancel(mPendingCall);
+   }
+   
+   dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_CONNECTED),
+                  DBUSIPC_ERR_NAME_NOT_CONNECTED, "Peer disconnected", 0);
+}
+
+
 void InvokeCmd::dispatchResult
    (
    DBUSIPC_tError     errCode,
@@ -2061,6 +2210,15 @@ void InvokeCmd::dispatchResult
    DBUSIPC_tConstStr  result
    )
 {
+   TRACE_EVENT(DBUSIPC_TRACE_INVOKE_DONE, getHandle(), errCode, 0U, 0U);
+   
+   // Identical requests made from now on need a call of their own
+   if ( mSharing )
+   {
+      mConn->removeCoalescedInvoke(mCoalesceKey);
+      mSharing = false;
+   }
+   
    // If this is a synchronous request then ...
    if ( 0 != mSem )
    {
@@ -2081,6 +2239,95 @@ void InvokeCmd::dispatchResult
       DBUSIPC_tCallbackStatus status = { errCode, errName, errMsg };
       mOnResult(&status, result, mUserToken);
    }   
+   
+   // Everyone sharing our request gets the same outcome
+   releaseFollowers(errCode, errName, errMsg, result);
+}
+
+
+bool InvokeCmd::joinCoalesced()
+{
+   InvokeCmd* leader = mCoalesce ? mConn->findCoalescedInvoke(mCoalesceKey)
+                                 : 0;
+   if ( 0 != leader )
+   {
+      try
+      {
+         // Register this pending command so it's cancelled along with
+         // the connection
+         mConn->registerPending(this);
+         leader->mFollowers.push_back(this);
+         mLeader = leader;
+         mExecAndDestroy = false;
+      }
+      catch ( ... )
+      {
+         // Fall back to making the request ourselves
+         mConn->unregisterPending(this);
+      }
+   }
+   
+   return 0 != mLeader;
+}
+
+
+bool InvokeCmd::handOver()
+{
+   bool handedOver(false);
+   
+   if ( (0 != mPendingCall) && !mFollowers.empty() &&
+      !dbus_pending_call_get_completed(mPendingCall) )
+   {
+      InvokeCmd* heir = mFollowers.front();
+      if ( dbus_pending_call_set_notify(mPendingCall,
+         InvokeCmd::onPendingCallNotify, heir, 0) )
+      {
+         mFollowers.pop_front();
+         heir->mLeader = 0;
+         heir->mFollowers.swap(mFollowers);
+         for ( std::list<InvokeCmd*>::iterator it = heir->mFollowers.begin();
+            it != heir->mFollowers.end(); ++it )
+         {
+            (*it)->mLeader = heir;
+         }
+         
+         heir->mPendingCall = mPendingCall;
+         heir->mCarrier = mCarrier;
+         mPendingCall = 0;
+         
+         if ( mSharing )
+         {
+            mConn->addCoalescedInvoke(mCoalesceKey, heir);
+            heir->mSharing = true;
+            mSharing = false;
+         }
+         handedOver = true;
+      }
+   }
+   
+   return handedOver;
+}
+
+
+void InvokeCmd::releaseFollowers
+   (
+   DBUSIPC_tError     errCode,
+   DBUSIPC_tConstStr  errName,
+   DBUSIPC_tConstStr  errMsg,
+   DBUSIPC_tConstStr  result
+   )
+{
+   while ( !mFollowers.empty() )
+   {
+      InvokeCmd* follower = mFollowers.front();
+      mFollowers.pop_front();
+      follower->mLeader = 0;
+      follower->dispatchResult(errCode, errName, errMsg, result);
+      
+      // The follower is done - destroy it
+      mConn->unregisterPending(follower);
+      delete follower;
+   }
 }
 
 
@@ -2117,8 +2364,29 @@ void InvokeCmd::onPendingCallNotify
                        "message");
          }
          
-         cmd->dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-               DBUSIPC_DOMAIN_DBUS_LIB, DBUSIPC_ERR_DBUS), errName, errMsg, 0);
+         // A service turning the request away under load is reported
+         // as a library error so clients can easily back off and retry
+         if ( (0 != errName) &&
+            (0 == strcmp(errName, DBUSIPC_ERR_NAME_BUSY)) )
+         {
+            cmd->dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_BUSY), errName, errMsg,
+                  0);
+         }
+         // As is a request for a method the service doesn't handle
+         else if ( (0 != errName) &&
+            (0 == strcmp(errName, DBUSIPC_ERR_NAME_UNKNOWN_METHOD)) )
+         {
+            cmd->dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_UNKNOWN_METHOD), errName,
+                  errMsg, 0);
+         }
+         else
+         {
+            cmd->dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_DBUS_LIB, DBUSIPC_ERR_DBUS), errName, errMsg,
+                  0);
+         }
       }
       else if ( DBUS_MESSAGE_TYPE_METHOD_RETURN == replyType )
       {
@@ -2128,6 +2396,22 @@ void InvokeCmd::onPendingCallNotify
          {
             TRACE_INFO("onPendingCallNotify: Failed to extract results");
          }
+         else
+         {
+            // Services can mark a result as cacheable by appending the
+            // time (msec) it remains valid
+            dbus_uint32_t msecTtl(0U);
+            DBusMessageIter iter;
+            if ( dbus_message_iter_init(reply, &iter) &&
+               dbus_message_iter_next(&iter) &&
+               (DBUS_TYPE_UINT32 == dbus_message_iter_get_arg_type(&iter)) )
+            {
+               dbus_message_iter_get_basic(&iter, &msecTtl);
+            }
+            ResponseCache::store(cmd->mConnHnd, cmd->mBusName.c_str(),
+                        cmd->mObjectPath.c_str(), cmd->mMethod.c_str(),
+                        cmd->mParms.c_str(), result, msecTtl);
+         }
          
          cmd->dispatchResult(DBUSIPC_ERROR_NONE, DBUSIPC_ERR_NAME_OK, 0,
                               result);
@@ -2136,6 +2420,10 @@ void InvokeCmd::onPendingCallNotify
       {
          TRACE_WARN("onPendingCallNotify: Received unexpected D-Bus "
                     "message type (%d)", replyType);
+         cmd->dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                        DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL),
+                        DBUSIPC_ERR_NAME_INTERNAL,
+                        "Unexpected reply message type", 0);
       }
 
       // Unregister the pending command
@@ -2156,6 +2444,26 @@ bool InvokeCmd::execAndDestroy() const
 }
 
 
+uint64_t InvokeCmd::getDeadline() const
+{
+   uint64_t deadline(0U);
+   int32_t msecTimeout = static_cast<int32_t>(mMsecTimeout);
+   
+   // An "infinite" timeout has no deadline
+   if ( DBUS_TIMEOUT_INFINITE != msecTimeout )
+   {
+      if ( 0 > msecTimeout )
+      {
+         msecTimeout = DEFAULT_DBUS_MSEC_TIMEOUT;
+      }
+      deadline = NSysDep::DBUSIPC_getSystemTime() +
+                 static_cast<uint64_t>(msecTimeout);
+   }
+   
+   return deadline;
+}
+
+
 //=====================================
 //
 // EmitCmd Implementation
@@ -2171,7 +2479,7 @@ EmitCmd::EmitCmd
    DBUSIPC_tUserToken       token
    )
    : BaseCommand()
-   , mSvcReg(static_cast<ServiceRegistration*>(regHnd))
+   , mRegHnd(regHnd)
    , mSignalName(sigName ? sigName : "")
    , mParams(parameters ? parameters : EMPTY_OBJECT)
    , mOnStatus(onStatus)
@@ -2192,7 +2500,7 @@ EmitCmd::EmitCmd
    DBUSIPC_tError*          status
    )
    : BaseCommand()
-   , mSvcReg(static_cast<ServiceRegistration*>(regHnd))
+   , mRegHnd(regHnd)
    , mSignalName(sigName ? sigName : "")
    , mParams(parameters ? parameters : EMPTY_OBJECT)
    , mOnStatus(0)
@@ -2253,9 +2561,28 @@ void EmitCmd::execute
    Dispatcher& dispatcher
    )
 {
-   if ( 0 != mSvcReg )
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 == svcReg )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(
+                     DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB,
+                     DBUSIPC_ERR_NOT_FOUND),
+                     DBUSIPC_ERR_NAME_NOT_FOUND,
+                     "Service registration does not exist");
+   }
+   else if ( !svcReg->getConnection()->admitOutgoing() )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(
+                     DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB,
+                     DBUSIPC_ERR_WOULD_BLOCK),
+                     DBUSIPC_ERR_NAME_WOULD_BLOCK,
+                     "Out-going queue is full");
+   }
+   else
    {
-      DBusMessage* pSignal = dbus_message_new_signal(mSvcReg->getObjectPath(),
+      DBusMessage* pSignal = dbus_message_new_signal(svcReg->getObjectPath(),
                                        DBUSIPC_INTERFACE_NAME,
                                        DBUSIPC_INTERFACE_SIGNAL_NAME);
       if ( 0 == pSignal )
@@ -2285,8 +2612,8 @@ void EmitCmd::execute
          else
          {
             dbus_uint32_t serialNum;
-            DBusConnection* dbusConn = Connection::getDBusConnection(
-                                                   mSvcReg->getConnection());
+            DBusConnection* dbusConn =
+                                    svcReg->getConnection()->getDBusConn();
             // If we're not connected then ...
             if ( (0 == dbusConn) ||
                !dbus_connection_get_is_connected(dbusConn) )
@@ -2309,6 +2636,8 @@ void EmitCmd::execute
             }
             else
             {
+               TRACE_EVENT(DBUSIPC_TRACE_SIGNAL_EMITTED, TRACE_PTR(mRegHnd),
+                           serialNum, 0U, 0U);
                dispatchStatus(DBUSIPC_ERROR_NONE, DBUSIPC_ERR_NAME_OK, 0);
             }
          }
@@ -2399,11 +2728,15 @@ ReturnResultCmd::ReturnResultCmd
    DBUSIPC_tReqContext      context,
    DBUSIPC_tConstStr        result,
    DBUSIPC_tStatusCallback  onStatus,
-   DBUSIPC_tUserToken       token
+   DBUSIPC_tUserToken       token,
+   DBUSIPC_tUInt32          msecTtl,
+   bool                    freeContext
    )
    : BaseCommand()
    , mReqContext(static_cast<RequestContext*>(context))
+   , mFreeContext(freeContext)
    , mResult(result ? result : EMPTY_OBJECT)
+   , mMsecTtl(msecTtl)
    , mOnStatus(onStatus)
    , mUserToken(token)
    , mSem(0)
@@ -2417,11 +2750,15 @@ ReturnResultCmd::ReturnResultCmd
    DBUSIPC_tReqContext      context,
    DBUSIPC_tConstStr        result,
    Semaphore*              sem,
-   DBUSIPC_tError*          status
+   DBUSIPC_tError*          status,
+   DBUSIPC_tUInt32          msecTtl,
+   bool                    freeContext
    )
    : BaseCommand()
    , mReqContext(static_cast<RequestContext*>(context))
+   , mFreeContext(freeContext)
    , mResult(result ? result : EMPTY_OBJECT)
+   , mMsecTtl(msecTtl)
    , mOnStatus(0)
    , mUserToken(0)
    , mSem(sem)
@@ -2490,7 +2827,14 @@ void ReturnResultCmd::execute
    }
    else
    {
-      DBUSIPC_tError status = mReqContext->sendReply(mResult.c_str());
+      DBUSIPC_tError status = mReqContext->sendReply(mResult.c_str(),
+                                                    mMsecTtl);
+      // Saves the client another trip through the dispatcher to free it
+      if ( mFreeContext )
+      {
+         delete mReqContext;
+         mReqContext = 0;
+      }
       dispatchStatus(status, 0, 0);
    }
 }
@@ -2508,10 +2852,12 @@ ReturnErrorCmd::ReturnErrorCmd
    DBUSIPC_tConstStr        name,
    DBUSIPC_tConstStr        msg,
    DBUSIPC_tStatusCallback  onStatus,
-   DBUSIPC_tUserToken       token
+   DBUSIPC_tUserToken       token,
+   bool                    freeContext
    )
    : BaseCommand()
    , mReqContext(static_cast<RequestContext*>(context))
+   , mFreeContext(freeContext)
    , mErrName(name ? name : "")
    , mErrMsg(msg ? msg : EMPTY_OBJECT)
    , mOnStatus(onStatus)
@@ -2528,10 +2874,12 @@ ReturnErrorCmd::ReturnErrorCmd
    DBUSIPC_tConstStr        name,
    DBUSIPC_tConstStr        msg,
    Semaphore*              sem,
-   DBUSIPC_tError*          status
+   DBUSIPC_tError*          status,
+   bool                    freeContext
    )
    : BaseCommand()
    , mReqContext(static_cast<RequestContext*>(context))
+   , mFreeContext(freeContext)
    , mErrName(name ? name : "")
    , mErrMsg(msg ? msg : EMPTY_OBJECT)
    , mOnStatus(0)
@@ -2603,6 +2951,12 @@ void ReturnErrorCmd::execute
    {
       DBUSIPC_tError status = mReqContext->sendError(mErrName.c_str(),
                                                     mErrMsg.c_str());
+      // Saves the client another trip through the dispatcher to free it
+      if ( mFreeContext )
+      {
+         delete mReqContext;
+         mReqContext = 0;
+      }
       dispatchStatus(status, 0, 0);
    }
 }
@@ -2671,13 +3025,11 @@ void ShutdownCmd::execute
    // Release all the connections
    Connection::forceReleaseAll();
    
-   // Tell the dispatcher thread to stop. We CANNOT wait for it
-   // to stop since we're running inside this thread and a
+   // Tell the dispatcher thread to stop once they're closed (and then
+   // wake up the shutdown function in the client thread). We CANNOT wait
+   // for it to stop since we're running inside this thread and a
    // deadlock condition would occur.
-   dispatcher.stop();
-   
-   // Wake up the shutdown function in the client thread
-   mSem->post();
+   dispatcher.stopWhenClosed(mSem);
 }
 
 
@@ -2696,7 +3048,8 @@ NameHasOwnerCmd::NameHasOwnerCmd
    DBUSIPC_tError*       status
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mHasOwner(hasOwner)
    , mOnHasOwner(0)
@@ -2718,7 +3071,8 @@ NameHasOwnerCmd::NameHasOwnerCmd
    DBUSIPC_tUserToken             token
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mHasOwner(0)
    , mOnHasOwner(onHasOwner)
@@ -2745,8 +3099,9 @@ void NameHasOwnerCmd::execute
    Dispatcher& dispatcher
    )
 {
-   DBusConnection* dbusConn = Connection::getDBusConnection(mConn);
-   if ( !dbus_connection_get_is_connected(dbusConn) )
+   mConn = Connection::fromHandle(mConnHnd);
+   DBusConnection* dbusConn = (0 != mConn) ? mConn->getDBusConn() : 0;
+   if ( (0 == dbusConn) || !dbus_connection_get_is_connected(dbusConn) )
    {
       dispatchResult(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                      DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_CONNECTED),
@@ -2975,7 +3330,8 @@ SubscribeOwnerChangedCmd::SubscribeOwnerChangedCmd
    DBUSIPC_tUserToken                token
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mOnOwnerChanged(onOwnerChanged)
    , mOnSubscription(onSubscription)
@@ -2987,7 +3343,7 @@ SubscribeOwnerChangedCmd::SubscribeOwnerChangedCmd
    , mExecAndDestroy(true)
    , mSigSub()
 {
-   mSigSub.reset(new NameOwnerChangedSubscription(mConn, mBusName,
+   mSigSub.reset(new NameOwnerChangedSubscription(mConnHnd, mBusName,
                         mOnOwnerChanged, mUserToken));
 }
 
@@ -3003,7 +3359,8 @@ SubscribeOwnerChangedCmd::SubscribeOwnerChangedCmd
    DBUSIPC_tError*                   status
    )
    : BaseCommand()
-   , mConn(static_cast<Connection*>(conn))
+   , mConnHnd(conn)
+   , mConn(0)
    , mBusName(busName ? busName : "")
    , mOnOwnerChanged(onOwnerChanged)
    , mOnSubscription(0)
@@ -3015,7 +3372,7 @@ SubscribeOwnerChangedCmd::SubscribeOwnerChangedCmd
    , mExecAndDestroy(true)
    , mSigSub()
 {
-   mSigSub.reset(new NameOwnerChangedSubscription(mConn, mBusName,
+   mSigSub.reset(new NameOwnerChangedSubscription(mConnHnd, mBusName,
                            mOnOwnerChanged, mUserToken));
 }
 
@@ -3054,9 +3411,10 @@ void SubscribeOwnerChangedCmd::execute
    Dispatcher& dispatcher
    )
 {
-   DBusConnection* dbusConn = Connection::getDBusConnection(mConn);
    // Let's make sure this connection is still open/exists
-   if ( !Connection::connectionExists(mConn) )
+   mConn = Connection::fromHandle(mConnHnd);
+   DBusConnection* dbusConn = (0 != mConn) ? mConn->getDBusConn() : 0;
+   if ( 0 == mConn )
    {
       DBUSIPC_tCallbackStatus status = {DBUSIPC_MAKE_ERROR(
                                        DBUSIPC_ERROR_LEVEL_ERROR,
@@ -3198,7 +3556,7 @@ void SubscribeOwnerChangedCmd::onPendingCallNotify
                         static_cast<SubscribeOwnerChangedCmd*>(userData);
    assert( 0 != cmd );
 
-   DBusConnection* dbusConn = Connection::getDBusConnection(cmd->mConn);
+   DBusConnection* dbusConn = cmd->mConn->getDBusConn();
    DBusMessage* reply = dbus_pending_call_steal_reply(call);
    if ( (0 == reply) || !dbus_connection_get_is_connected(dbusConn) )
    {
@@ -3240,7 +3598,7 @@ void SubscribeOwnerChangedCmd::onPendingCallNotify
             cmd->mConn->subscribeSignal(cmd->mSigSub.get());
             DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
                                              DBUSIPC_ERR_NAME_OK, 0};
-            cmd->dispatch(status, cmd->mSigSub.get());
+            cmd->dispatch(status, cmd->mSigSub->getHandle());
             // The connection now owns the subscription
             cmd->mSigSub.release();
          }
@@ -3311,3 +3669,594 @@ void SubscribeOwnerChangedCmd::onPendingCallNotify
 }
 
 
+//======================================
+//
+// ServiceLimitsCmd Implementation
+//
+//======================================
+
+ServiceLimitsCmd::ServiceLimitsCmd
+   (
+   DBUSIPC_tSvcRegHnd regHnd,
+   DBUSIPC_tUInt32    maxInFlight,
+   DBUSIPC_tUInt32    maxQueued,
+   Semaphore*        sem,
+   DBUSIPC_tError*    status
+   )
+   : BaseCommand()
+   , mRegHnd(regHnd)
+   , mMaxInFlight(maxInFlight)
+   , mMaxQueued(maxQueued)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+ServiceLimitsCmd::~ServiceLimitsCmd()
+{
+}
+
+
+void ServiceLimitsCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void ServiceLimitsCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void ServiceLimitsCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   // See if we still have a record of this service registration
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 == svcReg )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      svcReg->setLimits(mMaxInFlight, mMaxQueued);
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+//======================================
+//
+// ServiceStatsCmd Implementation
+//
+//======================================
+
+ServiceStatsCmd::ServiceStatsCmd
+   (
+   DBUSIPC_tSvcRegHnd     regHnd,
+   DBUSIPC_tServiceStats* stats,
+   Semaphore*            sem,
+   DBUSIPC_tError*        status
+   )
+   : BaseCommand()
+   , mRegHnd(regHnd)
+   , mStats(stats)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+ServiceStatsCmd::~ServiceStatsCmd()
+{
+}
+
+
+void ServiceStatsCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void ServiceStatsCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void ServiceStatsCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   assert( 0 != mStats );
+   
+   // See if we still have a record of this service registration
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 == svcReg )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      svcReg->getStats(*mStats);
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+DispatcherStatsCmd::DispatcherStatsCmd
+   (
+   DBUSIPC_tDispatcherStats*  stats,
+   bool                      reset,
+   Semaphore*                sem,
+   DBUSIPC_tError*            status
+   )
+   : BaseCommand()
+   , mStats(stats)
+   , mReset(reset)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+DispatcherStatsCmd::~DispatcherStatsCmd()
+{
+}
+
+
+void DispatcherStatsCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void DispatcherStatsCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void DispatcherStatsCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   assert( 0 != mStats );
+   
+   dispatcher.getStats(*mStats, mReset);
+   dispatchStatus(DBUSIPC_ERROR_NONE);
+}
+
+
+//=====================================
+//
+// OutgoingLimitsCmd Implementation
+//
+//=====================================
+
+OutgoingLimitsCmd::OutgoingLimitsCmd
+   (
+   DBUSIPC_tConnection           conn,
+   DBUSIPC_tUInt32               highWater,
+   DBUSIPC_tUInt32               lowWater,
+   DBUSIPC_tBackpressureCallback onBackpressure,
+   DBUSIPC_tUserToken            token,
+   Semaphore*                   sem,
+   DBUSIPC_tError*               status
+   )
+   : BaseCommand()
+   , mConnHnd(conn)
+   , mHighWater(highWater)
+   , mLowWater(lowWater)
+   , mOnBackpressure(onBackpressure)
+   , mToken(token)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+OutgoingLimitsCmd::~OutgoingLimitsCmd()
+{
+}
+
+
+void OutgoingLimitsCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void OutgoingLimitsCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void OutgoingLimitsCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   Connection* conn = Connection::fromHandle(mConnHnd);
+   if ( 0 == conn )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      conn->setOutgoingLimits(mHighWater, mLowWater, mOnBackpressure, mToken);
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+//=====================================
+//
+// ConnectionPriorityCmd Implementation
+//
+//=====================================
+
+ConnectionPriorityCmd::ConnectionPriorityCmd
+   (
+   DBUSIPC_tConnection    conn,
+   DBUSIPC_tConnPriority  priority,
+   DBUSIPC_tUInt32        msgBudget,
+   Semaphore*            sem,
+   DBUSIPC_tError*        status
+   )
+   : BaseCommand()
+   , mConnHnd(conn)
+   , mPriority(priority)
+   , mMsgBudget(msgBudget)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+ConnectionPriorityCmd::~ConnectionPriorityCmd()
+{
+}
+
+
+void ConnectionPriorityCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void ConnectionPriorityCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void ConnectionPriorityCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   Connection* conn = Connection::fromHandle(mConnHnd);
+   if ( 0 == conn )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      conn->setDispatchPriority(mPriority, mMsgBudget);
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+RegisterMethodCmd::RegisterMethodCmd
+   (
+   DBUSIPC_tSvcRegHnd        regHnd,
+   DBUSIPC_tConstStr         method,
+   DBUSIPC_tRequestCallback  onRequest,
+   DBUSIPC_tUserToken        token,
+   Semaphore*               sem,
+   DBUSIPC_tError*           status
+   )
+   : BaseCommand()
+   , mRegHnd(regHnd)
+   , mMethod(method)
+   , mOnRequest(onRequest)
+   , mUserToken(token)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+RegisterMethodCmd::~RegisterMethodCmd()
+{
+}
+
+
+void RegisterMethodCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void RegisterMethodCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void RegisterMethodCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   // See if we still have a record of this service registration
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 == svcReg )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      svcReg->setMethod(mMethod, mOnRequest, mUserToken);
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+MethodStatsCmd::MethodStatsCmd
+   (
+   DBUSIPC_tSvcRegHnd     regHnd,
+   DBUSIPC_tConstStr      method,
+   DBUSIPC_tMethodStats*  stats,
+   Semaphore*            sem,
+   DBUSIPC_tError*        status
+   )
+   : BaseCommand()
+   , mRegHnd(regHnd)
+   , mMethod(method)
+   , mStats(stats)
+   , mSem(sem)
+   , mStatus(status)
+{
+}
+
+
+MethodStatsCmd::~MethodStatsCmd()
+{
+}
+
+
+void MethodStatsCmd::cancel
+   (
+   Dispatcher& dispatcher
+   )
+{
+   dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                  DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_CANCELLED));
+}
+
+
+void MethodStatsCmd::dispatchStatus
+   (
+   DBUSIPC_tError errCode
+   )
+{
+   if ( 0 != mStatus )
+   {
+      *mStatus = errCode;
+   }
+   
+   if ( 0 != mSem )
+   {
+      mSem->post();
+   }
+}
+
+
+void MethodStatsCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   assert( 0 != mStats );
+   
+   // Both the service and the method must still be registered
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( (0 == svcReg) || !svcReg->getMethodStats(mMethod, *mStats) )
+   {
+      dispatchStatus(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                     DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND));
+   }
+   else
+   {
+      dispatchStatus(DBUSIPC_ERROR_NONE);
+   }
+}
+
+
+//======================================
+//
+// PeerConnectedCmd Implementation
+//
+//======================================
+
+PeerConnectedCmd::PeerConnectedCmd
+   (
+   DBUSIPC_tConnection   owner,
+   const std::string&   busName,
+   DBusConnection*      dbusConn
+   )
+   : BaseCommand()
+   , mOwner(owner)
+   , mBusName(busName)
+   , mDBusConn(dbusConn)
+{
+   assert( 0 != mDBusConn );
+}
+
+
+PeerConnectedCmd::~PeerConnectedCmd()
+{
+   // Nobody adopted the connection (e.g. the dispatcher shut down first)
+   if ( 0 != mDBusConn )
+   {
+      dbus_connection_close(mDBusConn);
+      dbus_connection_unref(mDBusConn);
+   }
+}
+
+
+void PeerConnectedCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   // The owner may have been closed while the peer was connecting
+   Connection* owner = Connection::fromHandle(mOwner);
+   if ( 0 != owner )
+   {
+      // Adopting the connection passes on our reference to it
+      DBusConnection* dbusConn = mDBusConn;
+      mDBusConn = 0;
+      owner->adoptPeerConnection(mBusName, dbusConn);
+   }
+}
+
+
+//======================================
+//
+// DrainQueueCmd Implementation
+//
+//======================================
+
+DrainQueueCmd::DrainQueueCmd
+   (
+   DBUSIPC_tSvcRegHnd   regHnd
+   )
+   : BaseCommand()
+   , mRegHnd(regHnd)
+{
+}
+
+
+DrainQueueCmd::~DrainQueueCmd()
+{
+}
+
+
+void DrainQueueCmd::execute
+   (
+   Dispatcher& dispatcher
+   )
+{
+   // The service may have been unregistered since
+   ServiceRegistration* svcReg = Connection::findServiceReg(mRegHnd);
+   if ( 0 != svcReg )
+   {
+      svcReg->drainQueue();
+   }
+}
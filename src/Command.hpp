@@ -3,6 +3,7 @@
 
 #include <string>
 #include <memory>
+#include <list>
 #include "dbusipc/dbusipc.h"
 
 //
@@ -16,6 +17,8 @@ class ServiceRegistration;
 class DBUSIPCSubscription;
 class NameOwnerChangedSubscription;
 struct DBusPendingCall;
+struct DBusMessage;
+struct DBusConnection;
 class RequestContext;
 
 class BaseCommand
@@ -26,9 +29,13 @@ public:
 	
 	void setHandle(DBUSIPC_tHandle hnd) { mHandle = hnd; }
 	DBUSIPC_tHandle getHandle() const { return mHandle; }
+	// When (usec) the command was queued for the dispatcher
+	void setSubmitTime(uint64_t usecTime) { mSubmitTime = usecTime; }
+	uint64_t getSubmitTime() const { return mSubmitTime; }
 	virtual void execute(Dispatcher& dispatcher) = 0;
 	virtual void cancel(Dispatcher& dispatcher) {}
 	virtual bool execAndDestroy() const { return true; }
+	virtual DBUSIPC_tCmdType getType() const = 0;
 	
 private:
    // Private copy constructor and assignment operator to prevent misuse
@@ -36,9 +43,54 @@ private:
    BaseCommand& operator=(const BaseCommand& rhs);
    
    DBUSIPC_tHandle mHandle;
+   uint64_t mSubmitTime;
 };
 
-class OpenConnectionCmd : public BaseCommand
+// Base of the commands that open a connection. The connection is handed
+// to the caller once it has been registered on the bus which happens
+// asynchronously (see Connection::registerOnBus()).
+class ConnectCmd : public BaseCommand
+{
+public:
+   ConnectCmd(DBUSIPC_tBool openPrivate,
+              DBUSIPC_tConnectionCallback onConnect,
+              DBUSIPC_tUserToken token);
+   
+   ConnectCmd(DBUSIPC_tBool openPrivate,
+              Semaphore* sem,
+              DBUSIPC_tError* status,
+              DBUSIPC_tConnection* conn);
+   virtual ~ConnectCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual bool execAndDestroy() const;
+   
+   void dispatch(const DBUSIPC_tCallbackStatus& status,
+                 DBUSIPC_tConnection conn);
+   
+protected:
+   // Completes the command once the (new) connection is registered
+   void connect(Connection* conn);
+   
+   DBUSIPC_tBool               mPrivConn;
+   
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   ConnectCmd(const ConnectCmd& other);
+   ConnectCmd& operator=(const ConnectCmd& rhs);
+   
+   DBUSIPC_tConnectionCallback mOnConnect;
+   DBUSIPC_tUserToken          mToken;
+   Semaphore*                 mSem;
+   DBUSIPC_tError*             mStatus;
+   DBUSIPC_tConnection*        mConn;
+   // The connection being registered (if non-NULL)
+   DBUSIPC_tConnection         mWaitConn;
+};
+
+
+class OpenConnectionCmd : public ConnectCmd
 {
 public:
    OpenConnectionCmd(DBUSIPC_tConstStr address,
@@ -54,28 +106,19 @@ public:
    ~OpenConnectionCmd();
 
    virtual void execute(Dispatcher& dispatcher);
-   virtual void cancel(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_OPEN_CONNECTION; }
    
 private:
    // (Unimplemented) private copy constructor and assignment operator
    // to prevent misuse
    OpenConnectionCmd(const OpenConnectionCmd& other);
    OpenConnectionCmd& operator=(const OpenConnectionCmd& rhs);
-
-   void dispatch(const DBUSIPC_tCallbackStatus& status,
-                 DBUSIPC_tConnection conn);
    
    std::string                mAddress;
-   DBUSIPC_tBool               mPrivConn;
-   DBUSIPC_tConnectionCallback mOnConnect;
-   DBUSIPC_tUserToken          mToken;
-   Semaphore*                 mSem;
-   DBUSIPC_tError*             mStatus;
-   DBUSIPC_tConnection*        mConn;
 };
 
 
-class GetConnectionCmd : public BaseCommand
+class GetConnectionCmd : public ConnectCmd
 {
 public:
    GetConnectionCmd(DBUSIPC_tConnType connType,
@@ -92,7 +135,7 @@ public:
    ~GetConnectionCmd();
 
    virtual void execute(Dispatcher& dispatcher);
-   virtual void cancel(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_GET_CONNECTION; }
    
 private:
    // (Unimplemented) private copy constructor and assignment operator
@@ -100,16 +143,7 @@ private:
    GetConnectionCmd(const GetConnectionCmd& other);
    GetConnectionCmd& operator=(const GetConnectionCmd& rhs);
    
-   void dispatch(const DBUSIPC_tCallbackStatus& status,
-                    DBUSIPC_tConnection conn);
-   
    DBUSIPC_tConnType           mConnType;
-   DBUSIPC_tBool               mPrivConn;
-   DBUSIPC_tConnectionCallback mOnConnect;
-   DBUSIPC_tUserToken          mToken;
-   Semaphore*                 mSem;
-   DBUSIPC_tError*             mStatus;
-   DBUSIPC_tConnection*        mConn;
 };
 
 
@@ -123,6 +157,7 @@ public:
 
    virtual void cancel(Dispatcher& dispatcher);
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_CLOSE_CONNECTION; }
    
 private:
    // (Unimplemented) private copy constructor and assignment operator
@@ -159,6 +194,7 @@ public:
    
    ~SubscribeCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_SUBSCRIBE; }
    virtual void cancel(Dispatcher& dispatcher);
    virtual bool execAndDestroy() const;
    
@@ -173,6 +209,7 @@ private:
                   DBUSIPC_tSigSubHnd subHnd);   
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tConnection                  mConnHnd;
    Connection*                         mConn;
    std::string                         mObjectPath;
    std::string                         mSignalName;
@@ -191,16 +228,17 @@ private:
 class UnsubscribeCmd : public BaseCommand
 {
 public:
-   UnsubscribeCmd(SignalSubscription* sub,
+   UnsubscribeCmd(DBUSIPC_tSigSubHnd subHnd,
                   DBUSIPC_tStatusCallback onStatus,
                   DBUSIPC_tUserToken token);
-   UnsubscribeCmd(SignalSubscription* sub,
+   UnsubscribeCmd(DBUSIPC_tSigSubHnd subHnd,
                   Semaphore* sem,
                   DBUSIPC_tError* status);
    
    ~UnsubscribeCmd();
    virtual void cancel(Dispatcher& dispatcher);
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_UNSUBSCRIBE; }
    virtual bool execAndDestroy() const;
    
 private:
@@ -213,6 +251,7 @@ private:
    void dispatch(const DBUSIPC_tCallbackStatus& status);
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tSigSubHnd       mSubHnd;
    SignalSubscription*     mSigSub;
    DBUSIPC_tStatusCallback  mOnStatus;
    DBUSIPC_tUserToken       mUserToken;
@@ -246,6 +285,7 @@ public:
    
    ~RegisterServiceCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_REGISTER_SERVICE; }
    virtual void cancel(Dispatcher& dispatcher);
    virtual bool execAndDestroy() const;
    
@@ -260,6 +300,7 @@ private:
                   DBUSIPC_tSvcRegHnd regHnd);
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tConnection                  mConnHnd;
    Connection*                         mConn;
    std::string                         mBusName;
    std::string                         mObjectPath;
@@ -279,17 +320,18 @@ private:
 class UnregisterServiceCmd : public BaseCommand
 {
 public:
-   UnregisterServiceCmd(ServiceRegistration* reg,
+   UnregisterServiceCmd(DBUSIPC_tSvcRegHnd regHnd,
                         DBUSIPC_tStatusCallback onStatus,
                         DBUSIPC_tUserToken token);
    
-   UnregisterServiceCmd(ServiceRegistration* reg,
+   UnregisterServiceCmd(DBUSIPC_tSvcRegHnd regHnd,
                         Semaphore* sem,
                         DBUSIPC_tError* status);
    
    ~UnregisterServiceCmd();
    virtual void cancel(Dispatcher& dispatcher);
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_UNREGISTER_SERVICE; }
    virtual bool execAndDestroy() const;
    
 private:
@@ -302,6 +344,7 @@ private:
    void dispatch(const DBUSIPC_tCallbackStatus& status);
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tSvcRegHnd             mRegHnd;
    ServiceRegistration*          mSvcReg;
    DBUSIPC_tStatusCallback        mOnStatus;
    DBUSIPC_tUserToken             mUserToken;
@@ -324,7 +367,8 @@ public:
             bool noReplyExpected,
             DBUSIPC_tUInt32 msecTimeout,
             DBUSIPC_tResultCallback onResult,
-            DBUSIPC_tUserToken token);
+            DBUSIPC_tUserToken token,
+            bool coalesce = false);
 
    // Constructor for the synchronous command
    InvokeCmd(DBUSIPC_tConnection conn,
@@ -338,12 +382,22 @@ public:
    
    ~InvokeCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_INVOKE; }
    virtual void cancel(Dispatcher& dispatcher);
    virtual bool execAndDestroy() const;
    
    void dispatchResult(DBUSIPC_tError errCode, DBUSIPC_tConstStr errName,
                        DBUSIPC_tConstStr errMsg, DBUSIPC_tConstStr result);
    
+   // Copy the request from a prepared method call rather than building it
+   void usePrepared(DBusMessage* prepared);
+   
+   // The connection the request went out on (a direct peer connection or
+   // the bus connection) and failing the request (and those sharing it)
+   // once the peer it went out on has gone away
+   DBusConnection* getCarrier() const;
+   void failCarrier();
+   
 private:
    
    // (Unimplemented) private copy constructor and assignment operator
@@ -351,8 +405,17 @@ private:
    InvokeCmd(const InvokeCmd& other);
    InvokeCmd& operator=(const InvokeCmd& rhs);
    
+   // Timeout (msec) D-Bus applies when told to use its default
+   enum { DEFAULT_DBUS_MSEC_TIMEOUT = 25000 };
+   
+   uint64_t getDeadline() const;
+   bool joinCoalesced();
+   bool handOver();
+   void releaseFollowers(DBUSIPC_tError errCode, DBUSIPC_tConstStr errName,
+                         DBUSIPC_tConstStr errMsg, DBUSIPC_tConstStr result);
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tConnection            mConnHnd;
    Connection*                   mConn;
    std::string                   mBusName;
    std::string                   mObjectPath;
@@ -366,8 +429,15 @@ private:
    //bool                          mAsync;
    Semaphore*                    mSem;
    DBusPendingCall*              mPendingCall;
+   DBusConnection*               mCarrier;
    bool                          mExecAndDestroy;
    DBUSIPC_tUInt32                mSerialNum;
+   bool                          mCoalesce;
+   std::string                   mCoalesceKey;
+   bool                          mSharing;
+   InvokeCmd*                    mLeader;
+   std::list<InvokeCmd*>         mFollowers;
+   DBusMessage*                  mPrepared;
 };
 
 
@@ -388,6 +458,7 @@ public:
    
    ~EmitCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_EMIT; }
    virtual void cancel(Dispatcher& dispatcher);
    
 private:
@@ -401,7 +472,7 @@ private:
                        DBUSIPC_tConstStr errName,
                        DBUSIPC_tConstStr errMsg);
    
-   ServiceRegistration*          mSvcReg;
+   DBUSIPC_tSvcRegHnd             mRegHnd;
    std::string                   mSignalName;
    std::string                   mParams;
    DBUSIPC_tStatusCallback        mOnStatus;
@@ -419,6 +490,7 @@ public:
              DBUSIPC_tError* status = 0);
    ~CancelCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_CANCEL; }
    virtual void cancel(Dispatcher& dispatcher);
    
 private:
@@ -439,20 +511,26 @@ private:
 class ReturnResultCmd : public BaseCommand
 {
 public:
+   // The context is freed along with sending the reply if asked to
    ReturnResultCmd(DBUSIPC_tReqContext context,
                    DBUSIPC_tConstStr result,
                    DBUSIPC_tStatusCallback onStatus,
-                   DBUSIPC_tUserToken token);
+                   DBUSIPC_tUserToken token,
+                   DBUSIPC_tUInt32 msecTtl = 0U,
+                   bool freeContext = false);
    
    ReturnResultCmd(DBUSIPC_tReqContext context,
                    DBUSIPC_tConstStr result,
                    Semaphore* sem,
-                   DBUSIPC_tError* status);
+                   DBUSIPC_tError* status,
+                   DBUSIPC_tUInt32 msecTtl = 0U,
+                   bool freeContext = false);
    
    ~ReturnResultCmd();
    
    virtual void cancel(Dispatcher& dispatcher);
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_RETURN_RESULT; }
    
 private:
    
@@ -465,7 +543,9 @@ private:
                        DBUSIPC_tConstStr errMsg);
    
    RequestContext*         mReqContext;
+   bool                    mFreeContext;
    std::string             mResult;
+   DBUSIPC_tUInt32          mMsecTtl;
    DBUSIPC_tStatusCallback  mOnStatus;
    DBUSIPC_tUserToken       mUserToken;
    Semaphore*              mSem;
@@ -476,22 +556,26 @@ private:
 class ReturnErrorCmd : public BaseCommand
 {
 public:
+   // The context is freed along with sending the error if asked to
    ReturnErrorCmd(DBUSIPC_tReqContext context,
                   DBUSIPC_tConstStr name,
                   DBUSIPC_tConstStr msg,
                   DBUSIPC_tStatusCallback onStatus,
-                  DBUSIPC_tUserToken token);
+                  DBUSIPC_tUserToken token,
+                  bool freeContext = false);
    
    ReturnErrorCmd(DBUSIPC_tReqContext context,
                   DBUSIPC_tConstStr name,
                   DBUSIPC_tConstStr msg,
                   Semaphore* sem,
-                  DBUSIPC_tError* status);
+                  DBUSIPC_tError* status,
+                  bool freeContext = false);
    
    ~ReturnErrorCmd();
    
    virtual void cancel(Dispatcher& dispatcher);
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_RETURN_ERROR; }
    
 private:
    
@@ -504,6 +588,7 @@ private:
                        DBUSIPC_tConstStr errMsg);
    
    RequestContext*         mReqContext;
+   bool                    mFreeContext;
    std::string             mErrName;
    std::string             mErrMsg;
    DBUSIPC_tStatusCallback  mOnStatus;
@@ -519,6 +604,7 @@ public:
    FreeRequestContextCmd(DBUSIPC_tReqContext context);
    ~FreeRequestContextCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_FREE_REQUEST_CONTEXT; }
    
 private:
    
@@ -537,6 +623,7 @@ public:
    ShutdownCmd(Semaphore* sem);
    ~ShutdownCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_SHUTDOWN; }
    
 private:
    
@@ -565,6 +652,7 @@ public:
    
    ~NameHasOwnerCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_NAME_HAS_OWNER; }
    virtual void cancel(Dispatcher& dispatcher);
    virtual bool execAndDestroy() const;
    
@@ -580,6 +668,7 @@ private:
    
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tConnection            mConnHnd;
    Connection*                   mConn;
    std::string                   mBusName;
    DBUSIPC_tBool*                 mHasOwner;
@@ -611,6 +700,7 @@ public:
    
    ~SubscribeOwnerChangedCmd();
    virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_SUBSCRIBE_OWNER_CHANGED; }
    virtual void cancel(Dispatcher& dispatcher);
    virtual bool execAndDestroy() const;
    
@@ -626,6 +716,7 @@ private:
    
    static void onPendingCallNotify(DBusPendingCall* call, void* userData);
    
+   DBUSIPC_tConnection                           mConnHnd;
    Connection*                                  mConn;
    std::string                                  mBusName;
    DBUSIPC_tNameOwnerChangedCallback             mOnOwnerChanged;
@@ -639,4 +730,283 @@ private:
    std::auto_ptr<NameOwnerChangedSubscription>  mSigSub;
 };
 
+class ServiceLimitsCmd : public BaseCommand
+{
+public:
+   ServiceLimitsCmd(DBUSIPC_tSvcRegHnd regHnd,
+                    DBUSIPC_tUInt32 maxInFlight,
+                    DBUSIPC_tUInt32 maxQueued,
+                    Semaphore* sem,
+                    DBUSIPC_tError* status);
+   
+   ~ServiceLimitsCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_SERVICE_LIMITS; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   ServiceLimitsCmd(const ServiceLimitsCmd& other);
+   ServiceLimitsCmd& operator=(const ServiceLimitsCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tSvcRegHnd       mRegHnd;
+   DBUSIPC_tUInt32          mMaxInFlight;
+   DBUSIPC_tUInt32          mMaxQueued;
+   Semaphore*              mSem;
+   DBUSIPC_tError*          mStatus;
+};
+
+
+class ServiceStatsCmd : public BaseCommand
+{
+public:
+   ServiceStatsCmd(DBUSIPC_tSvcRegHnd regHnd,
+                   DBUSIPC_tServiceStats* stats,
+                   Semaphore* sem,
+                   DBUSIPC_tError* status);
+   
+   ~ServiceStatsCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_SERVICE_STATS; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   ServiceStatsCmd(const ServiceStatsCmd& other);
+   ServiceStatsCmd& operator=(const ServiceStatsCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tSvcRegHnd       mRegHnd;
+   DBUSIPC_tServiceStats*   mStats;
+   Semaphore*              mSem;
+   DBUSIPC_tError*          mStatus;
+};
+
+
+class DispatcherStatsCmd : public BaseCommand
+{
+public:
+   DispatcherStatsCmd(DBUSIPC_tDispatcherStats* stats,
+                      bool reset,
+                      Semaphore* sem,
+                      DBUSIPC_tError* status);
+   
+   ~DispatcherStatsCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_DISPATCHER_STATS; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   DispatcherStatsCmd(const DispatcherStatsCmd& other);
+   DispatcherStatsCmd& operator=(const DispatcherStatsCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tDispatcherStats*   mStats;
+   bool                       mReset;
+   Semaphore*                 mSem;
+   DBUSIPC_tError*             mStatus;
+};
+
+
+class OutgoingLimitsCmd : public BaseCommand
+{
+public:
+   OutgoingLimitsCmd(DBUSIPC_tConnection conn,
+                     DBUSIPC_tUInt32 highWater,
+                     DBUSIPC_tUInt32 lowWater,
+                     DBUSIPC_tBackpressureCallback onBackpressure,
+                     DBUSIPC_tUserToken token,
+                     Semaphore* sem,
+                     DBUSIPC_tError* status);
+   
+   ~OutgoingLimitsCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_OUTGOING_LIMITS; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   OutgoingLimitsCmd(const OutgoingLimitsCmd& other);
+   OutgoingLimitsCmd& operator=(const OutgoingLimitsCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tConnection            mConnHnd;
+   DBUSIPC_tUInt32                mHighWater;
+   DBUSIPC_tUInt32                mLowWater;
+   DBUSIPC_tBackpressureCallback  mOnBackpressure;
+   DBUSIPC_tUserToken             mToken;
+   Semaphore*                    mSem;
+   DBUSIPC_tError*                mStatus;
+};
+
+
+class ConnectionPriorityCmd : public BaseCommand
+{
+public:
+   ConnectionPriorityCmd(DBUSIPC_tConnection conn,
+                         DBUSIPC_tConnPriority priority,
+                         DBUSIPC_tUInt32 msgBudget,
+                         Semaphore* sem,
+                         DBUSIPC_tError* status);
+   
+   ~ConnectionPriorityCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_CONNECTION_PRIORITY; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   ConnectionPriorityCmd(const ConnectionPriorityCmd& other);
+   ConnectionPriorityCmd& operator=(const ConnectionPriorityCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tConnection            mConnHnd;
+   DBUSIPC_tConnPriority          mPriority;
+   DBUSIPC_tUInt32                mMsgBudget;
+   Semaphore*                    mSem;
+   DBUSIPC_tError*                mStatus;
+};
+
+
+class RegisterMethodCmd : public BaseCommand
+{
+public:
+   RegisterMethodCmd(DBUSIPC_tSvcRegHnd regHnd,
+                     DBUSIPC_tConstStr method,
+                     DBUSIPC_tRequestCallback onRequest,
+                     DBUSIPC_tUserToken token,
+                     Semaphore* sem,
+                     DBUSIPC_tError* status);
+   
+   ~RegisterMethodCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_REGISTER_METHOD; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   RegisterMethodCmd(const RegisterMethodCmd& other);
+   RegisterMethodCmd& operator=(const RegisterMethodCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tSvcRegHnd             mRegHnd;
+   std::string                   mMethod;
+   DBUSIPC_tRequestCallback       mOnRequest;
+   DBUSIPC_tUserToken             mUserToken;
+   Semaphore*                    mSem;
+   DBUSIPC_tError*                mStatus;
+};
+
+
+class MethodStatsCmd : public BaseCommand
+{
+public:
+   MethodStatsCmd(DBUSIPC_tSvcRegHnd regHnd,
+                  DBUSIPC_tConstStr method,
+                  DBUSIPC_tMethodStats* stats,
+                  Semaphore* sem,
+                  DBUSIPC_tError* status);
+   
+   ~MethodStatsCmd();
+   
+   virtual void cancel(Dispatcher& dispatcher);
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_METHOD_STATS; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   MethodStatsCmd(const MethodStatsCmd& other);
+   MethodStatsCmd& operator=(const MethodStatsCmd& rhs);
+   
+   void dispatchStatus(DBUSIPC_tError errCode);
+   
+   DBUSIPC_tSvcRegHnd             mRegHnd;
+   std::string                   mMethod;
+   DBUSIPC_tMethodStats*          mStats;
+   Semaphore*                    mSem;
+   DBUSIPC_tError*                mStatus;
+};
+
+
+class PeerConnectedCmd : public BaseCommand
+{
+public:
+   // Takes ownership of the (private) D-Bus connection
+   PeerConnectedCmd(DBUSIPC_tConnection owner,
+                    const std::string& busName,
+                    DBusConnection* dbusConn);
+   
+   ~PeerConnectedCmd();
+   
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_PEER_CONNECTED; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   PeerConnectedCmd(const PeerConnectedCmd& other);
+   PeerConnectedCmd& operator=(const PeerConnectedCmd& rhs);
+   
+   DBUSIPC_tConnection            mOwner;
+   std::string                   mBusName;
+   DBusConnection*               mDBusConn;
+};
+
+
+
+class DrainQueueCmd : public BaseCommand
+{
+public:
+   DrainQueueCmd(DBUSIPC_tSvcRegHnd regHnd);
+   
+   ~DrainQueueCmd();
+   
+   virtual void execute(Dispatcher& dispatcher);
+   virtual DBUSIPC_tCmdType getType() const { return DBUSIPC_CMD_DRAIN_QUEUE; }
+   
+private:
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   DrainQueueCmd(const DrainQueueCmd& other);
+   DrainQueueCmd& operator=(const DrainQueueCmd& rhs);
+   
+   DBUSIPC_tSvcRegHnd             mRegHnd;
+};
+
+
+inline DBusConnection* InvokeCmd::getCarrier() const
+{
+   return mCarrier;
+}
+
 #endif /*COMMAND_HPP_*/
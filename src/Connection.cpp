@@ -2,6 +2,8 @@
 #include "Connection.hpp"
 
 #include <list>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <assert.h>
@@ -13,13 +15,36 @@
 #include "InterfaceDefs.hpp"
 #include "Command.hpp"
 #include "NSysDep.hpp"
+#include "ResponseCache.hpp"
+#include "ScopedLock.hpp"
 #include "trace.h"
 
+// The parameters assumed when none are given (see EmitCmd)
+static DBUSIPC_tConstStr EMPTY_OBJECT = "{}";
+
+// The longest timeout (msec) D-Bus accepts
+static const uint64_t MAX_MSEC_TIMEOUT = 0x7fffffffU;
+
+// Where the system bus is found unless DBUS_SYSTEM_BUS_ADDRESS says
+// otherwise (should match the default D-Bus was built with)
+#ifndef DBUSIPC_SYSTEM_BUS_DEFAULT_ADDRESS
+#define DBUSIPC_SYSTEM_BUS_DEFAULT_ADDRESS \
+   "unix:path=/var/run/dbus/system_bus_socket"
+#endif
+
 
 //
 // Static initialization
 //
 Connection::tConnCache Connection::msConnCache;
+Connection::tDBusConnIndex Connection::msDBusConnIndex;
+Connection::tAddressIndex Connection::msSharedConnIndex;
+HandleTable<Connection> Connection::msConnHandles;
+HandleTable<SignalSubscription> Connection::msSigSubHandles;
+HandleTable<ServiceRegistration> Connection::msSvcRegHandles;
+MutexLock Connection::msHandleLock;
+Connection::tConnContainer Connection::msLimitedConns;
+Connection::tConnContainer Connection::msClosingConns;
 
 
 Connection* Connection::create
@@ -32,61 +57,45 @@ Connection* Connection::create
    DBusErrorHolder dbusError;
    DBusConnection* dbusConn(0);
    Connection* conn(0);
-   tConnCache::iterator it;
+   std::string key(address ? address : "");
    
-   if ( openPrivate )
-   {
-      dbusConn = dbus_connection_open_private(address ? address : "",
-                                             dbusError.getInst());
-      
-   }
-   else
+   // A connection D-Bus shares could be handed to (and registered by)
+   // others in the process while we're registering it ourselves, so
+   // shared connections are only shared between our own callers
+   if ( !openPrivate )
    {
-      dbusConn = dbus_connection_open(address ? address : "",
-                                    dbusError.getInst());
+      tAddressIndex::iterator it = msSharedConnIndex.find(key);
+      if ( (msSharedConnIndex.end() != it) &&
+         dbus_connection_get_is_connected((*it).second->mDBusConn) )
+      {
+         // Like D-Bus would have for a connection it shares
+         conn = (*it).second;
+         (void)dbus_connection_ref(conn->mDBusConn);
+         conn->incRef();
+      }
    }
    
-   if ( 0 == dbusConn )
-   {
-      DBusException e(dbusError.getName(), dbusError.getMessage());
-      throw e;
-   }
-   else
+   if ( 0 == conn )
    {
-      // If we fail to register the connection then ...
-      if ( !dbus_bus_register(dbusConn, dbusError.getInst()) )
+      // Only the socket is connected here. Authenticating (and registering
+      // on a bus) is driven by the dispatcher's watches afterwards.
+      dbusConn = dbus_connection_open_private(key.c_str(),
+                                              dbusError.getInst());
+      if ( 0 == dbusConn )
       {
-         if ( openPrivate )
-         {
-            dbus_connection_close(dbusConn);
-         }
-         dbus_connection_unref(dbusConn);
-         
          DBusException e(dbusError.getName(), dbusError.getMessage());
-         throw e;   
+         throw e;
       }
-   }
-   
-   // See if an existing connection already exists
-   for ( it = msConnCache.begin(); it != msConnCache.end(); ++it )
-   {
-      if ( dbusConn == (*it).second )
+      
+      // Either way the socket is ours to close
+      conn = new Connection(dbusConn, true, disp);
+      if ( !openPrivate )
       {
-         break;
+         conn->mSharedAddress = key;
+         msSharedConnIndex[key] = conn;
       }
    }
    
-   // If this connection doesn NOT already exist in the cache then ...
-   if ( msConnCache.end() == it )
-   {
-      conn = new Connection(dbusConn, openPrivate, disp);
-   }
-   else  /* Else this is a shared connection */
-   {
-      conn = (*it).first;
-      conn->incRef();
-   }
-   
    return conn;
 }
 
@@ -101,20 +110,28 @@ Connection* Connection::create
    DBusBusType busType(DBUS_BUS_SESSION); 
    DBusConnection* dbusConn(0);
    Connection* conn(0);
-   tConnCache::iterator it;
+   tDBusConnIndex::iterator it;
+   std::string address;
    
    switch ( connType )
    {
       case DBUSIPC_CONNECTION_SESSION:
          busType = DBUS_BUS_SESSION;
+         address = NSysDep::DBUSIPC_getenv("DBUS_SESSION_BUS_ADDRESS");
          break;
          
       case DBUSIPC_CONNECTION_SYSTEM:
          busType = DBUS_BUS_SYSTEM;
+         address = NSysDep::DBUSIPC_getenv("DBUS_SYSTEM_BUS_ADDRESS");
+         if ( address.empty() )
+         {
+            address = DBUSIPC_SYSTEM_BUS_DEFAULT_ADDRESS;
+         }
          break;
          
       case DBUSIPC_CONNECTION_STARTER:
          busType = DBUS_BUS_STARTER;
+         address = NSysDep::DBUSIPC_getenv("DBUS_STARTER_ADDRESS");
          break;
       
       default:
@@ -124,46 +141,74 @@ Connection* Connection::create
          break;
    }
    
-   if ( openPrivate )
+   // Open the bus like any other address so that the connection can be
+   // registered without blocking (see registerOnBus())
+   if ( !address.empty() )
    {
-      dbusConn = dbus_bus_get_private(busType, dbusError.getInst());
-      
+      conn = create(address.c_str(), openPrivate, disp);
    }
    else
    {
-      dbusConn = dbus_bus_get(busType, dbusError.getInst());
-   }
-   
-   if ( 0 == dbusConn )
-   {
-      DBusException e(dbusError.getName(), dbusError.getMessage());
-      throw e;
-   }
-   
-   // See if an existing connection already exists
-   for ( it = msConnCache.begin(); it != msConnCache.end(); ++it )
-   {
-      if ( dbusConn == (*it).second )
+      // Only D-Bus knows how to find this bus (e.g. by auto-launching
+      // the session bus) and it registers the connection before returning.
+      TRACE_INFO("create: no address for bus type %d, registering "
+                 "synchronously", busType);
+      if ( openPrivate )
       {
-         break;
+         dbusConn = dbus_bus_get_private(busType, dbusError.getInst());
+         
+      }
+      else
+      {
+         dbusConn = dbus_bus_get(busType, dbusError.getInst());
+      }
+      
+      if ( 0 == dbusConn )
+      {
+         DBusException e(dbusError.getName(), dbusError.getMessage());
+         throw e;
+      }
+      
+      // See if an existing connection already exists
+      it = msDBusConnIndex.find(dbusConn);
+      
+      // If this connection doesn NOT already exist in the cache then ...
+      if ( msDBusConnIndex.end() == it )
+      {
+         conn = new Connection(dbusConn, openPrivate, disp);
+      }
+      else  /* Else this is a shared connection */
+      {
+         conn = (*it).second;
+         conn->incRef();
       }
-   }
-   
-   // If this connection doesn NOT already exist in the cache then ...
-   if ( msConnCache.end() == it )
-   {
-      conn = new Connection(dbusConn, openPrivate, disp);
-   }
-   else  /* Else this is a shared connection */
-   {
-      conn = (*it).first;
-      conn->incRef();
    }
    
    return conn;   
 }
 
 
+Connection* Connection::adoptPeer
+   (
+   DBusConnection*      dbusConn,
+   ServiceRegistration* reg,
+   Dispatcher*          disp
+   )
+{
+   assert( 0 != dbusConn );
+   assert( 0 != reg );
+   
+   // The new connection belongs to the peer server until we take our own
+   // reference to it. Requests arriving on it are routed to the service
+   // registration that accepted the peer.
+   Connection* conn = new Connection(dbus_connection_ref(dbusConn), true,
+                                     disp);
+   conn->mPeerService = reg;
+   
+   return conn;
+}
+
+
 void Connection::release
    (
    Connection* conn
@@ -180,10 +225,43 @@ void Connection::release
 }
 
 
+void Connection::releasePeers
+   (
+   ServiceRegistration* reg
+   )
+{
+   std::list<Connection*> peers;
+   
+   // Collect the peers first since releasing them modifies the cache
+   for ( tConnCache::iterator it = msConnCache.begin();
+      it != msConnCache.end(); ++it )
+   {
+      if ( reg == (*it).first->mPeerService )
+      {
+         peers.push_back((*it).first);
+      }
+   }
+   
+   for ( std::list<Connection*>::iterator it = peers.begin();
+      it != peers.end(); ++it )
+   {
+      (*it)->mPeerService = 0;
+      release(*it);
+   }
+}
+
+
 void Connection::forceReleaseAll()
 {
    tConnCache::const_iterator it;
    
+   // Clean up on all the connections at once so that shutting down takes
+   // one round trip rather than one per connection
+   for ( it = msConnCache.begin(); it != msConnCache.end(); ++it )
+   {
+      (*it).first->startTeardown();
+   }
+   
    while ( !msConnCache.empty() )
    {
       it = msConnCache.begin();
@@ -191,7 +269,7 @@ void Connection::forceReleaseAll()
       {
          (*it).first->decRef();
       }
-      // Do the final decrement which deletes the connection
+      // Do the final decrement which closes the connection
       (*it).first->decRef();
    }
 }
@@ -214,79 +292,312 @@ DBusConnection* Connection::getDBusConnection
 }
 
 
-DBUSIPC_tError Connection::cancelPendingByHandle
+DBUSIPC_tError Connection::emitDirect
    (
-   DBUSIPC_tHandle hnd
+   DBUSIPC_tSvcRegHnd regHnd,
+   DBUSIPC_tConstStr  sigName,
+   DBUSIPC_tConstStr  parameters,
+   DBusMessage*       prepared
    )
 {
-   DBUSIPC_tError status(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                          DBUSIPC_DOMAIN_IPC_LIB,
-                                          DBUSIPC_ERR_NOT_FOUND));
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBusConnection* dbusConn(0);
+   Dispatcher* disp(0);
+   std::string objPath;
+   bool blocked(false);
    
-   for ( tConnCache::iterator it = msConnCache.begin();
-      (it != msConnCache.end()) && (status != DBUSIPC_ERROR_NONE); ++it )
+   // We're not on the dispatcher thread so take our own reference to the
+   // D-Bus connection in case the service is unregistered (or the
+   // connection closed) while we're sending.
    {
-      Connection* conn = (*it).first;
-      for ( tPendingContainer::iterator cmdIt = conn->mPendingCmds.begin();
-      cmdIt != conn->mPendingCmds.end(); ++cmdIt )
+      ScopedLock lock(msHandleLock);
+      ServiceRegistration* reg = msSvcRegHandles.lookup(regHnd);
+      Connection* conn = (0 != reg) ? reg->getConnection() : 0;
+      if ( (0 != conn) && conn->isOutgoingBlocked() )
+      {
+         (void)__sync_fetch_and_add(&conn->mOutRejected, 1U);
+         blocked = true;
+      }
+      else if ( 0 != conn )
       {
-         if ( (*cmdIt)->getHandle() == hnd )
+         dbusConn = dbus_connection_ref(conn->mDBusConn);
+         disp = conn->mDispatcher;
+         if ( 0 == prepared )
          {
-            // Cancel the pending command
-            (*cmdIt)->cancel(*(conn->mDispatcher));
-            // Destroy it
-            delete *cmdIt;
-            // Remove it from the collection of pending commands
-            conn->mPendingCmds.erase(cmdIt);
-            status = DBUSIPC_ERROR_NONE;
-            break;
+            objPath = reg->getObjectPath();
+         }
+      }
+   }
+   
+   if ( blocked )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_WOULD_BLOCK);
+   }
+   else if ( 0 == dbusConn )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_NOT_FOUND);
+   }
+   else
+   {
+      if ( !dbus_connection_get_is_connected(dbusConn) )
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_NOT_CONNECTED);
+      }
+      else
+      {
+         // Copying a prepared signal skips validating the header again
+         DBusMessage* pSignal = (0 != prepared) ? dbus_message_copy(prepared)
+                                 : dbus_message_new_signal(objPath.c_str(),
+                                          DBUSIPC_INTERFACE_NAME,
+                                          DBUSIPC_INTERFACE_SIGNAL_NAME);
+         DBUSIPC_tConstStr dbusSignal = sigName ? sigName : "";
+         DBUSIPC_tConstStr dbusParams = parameters ? parameters :
+                                                     EMPTY_OBJECT;
+         if ( (0 == pSignal) || !dbus_message_append_args(pSignal,
+            DBUS_TYPE_STRING, &dbusSignal, DBUS_TYPE_STRING, &dbusParams,
+            DBUS_TYPE_INVALID) )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NO_MEMORY);
+         }
+         else
+         {
+            dbus_uint32_t serialNum(0U);
+            if ( !disp->sendDirect(dbusConn, pSignal, &serialNum) )
+            {
+               status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                          DBUSIPC_DOMAIN_IPC_LIB,
+                                          DBUSIPC_ERR_CONN_SEND);
+            }
+            else
+            {
+               TRACE_EVENT(DBUSIPC_TRACE_SIGNAL_EMITTED, TRACE_PTR(regHnd),
+                           serialNum, 0U, 0U);
+            }
+         }
+         
+         if ( 0 != pSignal )
+         {
+            dbus_message_unref(pSignal);
          }
       }
+      
+      dbus_connection_unref(dbusConn);
    }
+   
    return status;
 }
 
-bool Connection::signalSubExists
+
+bool Connection::getServiceObjectPath
    (
-   SignalSubscription*  sigSub
+   DBUSIPC_tSvcRegHnd regHnd,
+   std::string&       objPath
    )
 {
-   bool found(false);
+   ScopedLock lock(msHandleLock);
+   ServiceRegistration* reg = msSvcRegHandles.lookup(regHnd);
+   if ( 0 != reg )
+   {
+      objPath = reg->getObjectPath();
+   }
    
-   for ( tConnCache::iterator it = msConnCache.begin();
-      (it != msConnCache.end()) && !found; ++it )
+   return 0 != reg;
+}
+
+
+bool Connection::handleExists
+   (
+   DBUSIPC_tConnection hnd
+   )
+{
+   ScopedLock lock(msHandleLock);
+   return 0 != msConnHandles.lookup(hnd);
+}
+
+
+bool Connection::acceptsOutgoing
+   (
+   DBUSIPC_tConnection hnd
+   )
+{
+   ScopedLock lock(msHandleLock);
+   Connection* conn = msConnHandles.lookup(hnd);
+   
+   // A stale handle is reported by whoever uses it next
+   bool accepted = (0 == conn) || !conn->isOutgoingBlocked();
+   if ( !accepted )
    {
-      Connection* conn = (*it).first;
-      if ( conn->mSigSubscriptions.end() !=
-         conn->mSigSubscriptions.find(sigSub) )
-      {
-         found = true;
-      }
+      (void)__sync_fetch_and_add(&conn->mOutRejected, 1U);
    }
    
-   return found;
+   return accepted;
 }
 
 
-bool Connection::serviceRegExists
+bool Connection::serviceAcceptsOutgoing
    (
-   ServiceRegistration* svcReg
+   DBUSIPC_tSvcRegHnd regHnd
    )
 {
-   bool found(false);
+   ScopedLock lock(msHandleLock);
+   ServiceRegistration* reg = msSvcRegHandles.lookup(regHnd);
+   Connection* conn = (0 != reg) ? reg->getConnection() : 0;
    
-   for ( tConnCache::iterator it = msConnCache.begin();
-      (it != msConnCache.end()) && !found; ++it )
+   bool accepted = (0 == conn) || !conn->isOutgoingBlocked();
+   if ( !accepted )
+   {
+      (void)__sync_fetch_and_add(&conn->mOutRejected, 1U);
+   }
+   
+   return accepted;
+}
+
+
+bool Connection::getOutgoingStats
+   (
+   DBUSIPC_tConnection          hnd,
+   DBUSIPC_tOutgoingQueueStats& stats
+   )
+{
+   ScopedLock lock(msHandleLock);
+   Connection* conn = msConnHandles.lookup(hnd);
+   if ( 0 != conn )
+   {
+      stats.bytes = static_cast<DBUSIPC_tUInt32>(
+                     dbus_connection_get_outgoing_size(conn->mDBusConn));
+      stats.unixFds = static_cast<DBUSIPC_tUInt32>(
+                     dbus_connection_get_outgoing_unix_fds(conn->mDBusConn));
+      stats.highWater = conn->mOutHighWater;
+      stats.lowWater = conn->mOutLowWater;
+      // The dispatcher may not have noticed the queue filling up yet
+      stats.congested = (conn->mCongested || ((0U != conn->mOutHighWater) &&
+                        (stats.bytes >= conn->mOutHighWater))) ?
+                        DBUSIPC_TRUE : DBUSIPC_FALSE;
+      stats.rejected = conn->mOutRejected;
+   }
+   
+   return 0 != conn;
+}
+
+
+bool Connection::isOutgoingBlocked() const
+{
+   bool blocked(false);
+   
+   // With a backpressure callback the application throttles itself
+   if ( (0U != mOutHighWater) && (0 == mOnBackpressure) )
    {
-      Connection* conn = (*it).first;
-      if ( conn->mSvcRegistrations.end() !=
-         conn->mSvcRegistrations.find(svcReg) )
+      // Client threads can fill the queue (see emitDirect) faster than
+      // the dispatcher notices so look at its size as well
+      blocked = mCongested ||
+         (static_cast<uint32_t>(dbus_connection_get_outgoing_size(mDBusConn))
+          >= mOutHighWater);
+   }
+   
+   return blocked;
+}
+
+
+void Connection::setOutgoingLimits
+   (
+   uint32_t                      highWater,
+   uint32_t                      lowWater,
+   DBUSIPC_tBackpressureCallback onBackpressure,
+   DBUSIPC_tUserToken            token
+   )
+{
+   {
+      ScopedLock lock(msHandleLock);
+      mOutHighWater = highWater;
+      mOutLowWater = std::min(lowWater, highWater);
+      mOnBackpressure = onBackpressure;
+      mBackpressureToken = token;
+      if ( 0U == mOutHighWater )
+      {
+         mCongested = false;
+      }
+   }
+   
+   if ( 0U == mOutHighWater )
+   {
+      msLimitedConns.erase(this);
+   }
+   else
+   {
+      msLimitedConns.insert(this);
+      updateCongestion();
+   }
+}
+
+
+bool Connection::admitOutgoing()
+{
+   bool admit(true);
+   
+   if ( 0U != mOutHighWater )
+   {
+      updateCongestion();
+      if ( mCongested && (0 == mOnBackpressure) )
       {
-         found = true;
+         (void)__sync_fetch_and_add(&mOutRejected, 1U);
+         admit = false;
       }
    }
    
-   return found;   
+   return admit;
+}
+
+
+void Connection::updateCongestion()
+{
+   uint32_t size = static_cast<uint32_t>(
+                     dbus_connection_get_outgoing_size(mDBusConn));
+   
+   // The gap between the watermarks keeps us from flapping
+   bool congested = mCongested ? (size > mOutLowWater) :
+                                 (size >= mOutHighWater);
+   if ( congested != mCongested )
+   {
+      {
+         // Read by client threads along with the watermarks
+         ScopedLock lock(msHandleLock);
+         mCongested = congested;
+      }
+      TRACE_WARN("Connection: out-going queue %s (%u bytes)",
+                 congested ? "congested" : "drained", size);
+      if ( 0 != mOnBackpressure )
+      {
+         mOnBackpressure(mHandle, congested ? DBUSIPC_TRUE : DBUSIPC_FALSE,
+                         size, mBackpressureToken);
+      }
+   }
+}
+
+
+void Connection::checkOutgoingLimits()
+{
+   if ( !msLimitedConns.empty() )
+   {
+      // A backpressure callback could close a connection
+      std::vector<Connection*> conns(msLimitedConns.begin(),
+                                     msLimitedConns.end());
+      for ( std::vector<Connection*>::iterator it = conns.begin();
+         it != conns.end(); ++it )
+      {
+         if ( msLimitedConns.end() != msLimitedConns.find(*it) )
+         {
+            (*it)->updateCongestion();
+         }
+      }
+   }
 }
 
 
@@ -296,14 +607,38 @@ Connection::Connection
    bool              priv,
    Dispatcher*       disp
    )
-   : mDBusConn(conn)
+   : ReadyList<Connection>::Hook()
+   , mDBusConn(conn)
    , mPrivate(priv)
+   , mSharedAddress()
    , mRefCount(1)
+   , mHandle(0)
    , mDispatcher(disp)
    , mSigSubscriptions()
    , mSvcRegistrations()
    , mPendingCmds()
+   , mHelloCall(0)
+   , mCoalescedInvokes()
    , mMaxDispatchProcTime(DBUSIPC_MAX_UINT64)
+   , mDispatchPriority(DBUSIPC_CONN_PRIORITY_NORMAL)
+   , mDispatchBudget(DEFAULT_DISPATCH_BUDGET)
+   , mTeardownTimeout(DEFAULT_TEARDOWN_MSEC_TIMEOUT)
+   , mTearingDown(false)
+   , mTeardownDeadline(0U)
+   , mTeardownCalls()
+   , mPeerToPeer(false)
+   , mPeerBusNames()
+   , mPeerConns()
+   , mPeerOwner(0)
+   , mPeerBusName()
+   , mPeerUsable(false)
+   , mPeerService(0)
+   , mOutHighWater(0U)
+   , mOutLowWater(0U)
+   , mOnBackpressure(0)
+   , mBackpressureToken(0)
+   , mCongested(false)
+   , mOutRejected(0U)
 {
    std::string value = NSysDep::DBUSIPC_getenv("DBUSIPC_MAX_DISPATCH_PROC_TIME_MSEC");
    if ( !value.empty() )
@@ -312,6 +647,44 @@ Connection::Connection
       TRACE_INFO("Connection: maxDispatchProcTime=%" PRIu64, mMaxDispatchProcTime);
    }
 
+   value = NSysDep::DBUSIPC_getenv("DBUSIPC_TEARDOWN_TIMEOUT_MSEC");
+   if ( !value.empty() )
+   {
+      mTeardownTimeout = static_cast<uint64_t>(std::atol(value.c_str()));
+      TRACE_INFO("Connection: teardownTimeout=%" PRIu64, mTeardownTimeout);
+   }
+
+   // Either 1 (for every service) or the bus names of the services that
+   // peers are tried for separated by commas
+   value = NSysDep::DBUSIPC_getenv("DBUSIPC_ENABLE_PEER_TO_PEER");
+   if ( !value.empty() )
+   {
+      if ( std::string::npos == value.find_first_not_of("0123456789") )
+      {
+         mPeerToPeer = (0 != std::atol(value.c_str()));
+      }
+      else
+      {
+         std::string::size_type start(0);
+         while ( start < value.size() )
+         {
+            std::string::size_type end = value.find(',', start);
+            if ( std::string::npos == end )
+            {
+               end = value.size();
+            }
+            if ( end > start )
+            {
+               mPeerBusNames.insert(value.substr(start, end - start));
+            }
+            start = end + 1;
+         }
+         mPeerToPeer = !mPeerBusNames.empty();
+      }
+      TRACE_INFO("Connection: peerToPeer=%d (%u services)", mPeerToPeer,
+                 static_cast<uint32_t>(mPeerBusNames.size()));
+   }
+
    // We don't want the the program to exit when the connection is
    // disconnected.
    dbus_connection_set_exit_on_disconnect(mDBusConn, false);
@@ -355,11 +728,20 @@ Connection::Connection
                              "Unable to add message filter");
       }
 
+      {
+         ScopedLock lock(msHandleLock);
+         mHandle = msConnHandles.add(this);
+      }
       msConnCache[this] = mDBusConn;
+      msDBusConnIndex[mDBusConn] = this;
       mDispatcher->addPending(this);
    }
    catch ( ... )
    {
+      {
+         ScopedLock lock(msHandleLock);
+         msConnHandles.remove(mHandle);
+      }
       if ( mPrivate )
       {
          dbus_connection_close(mDBusConn);
@@ -374,31 +756,69 @@ Connection::~Connection()
    // *Try* to remove this connection from the list of connections managed
    // by the dispatcher with messages to dispatch
    mDispatcher->removePending(this);
+}
+
+
+void Connection::cleanUp()
+{
+   msLimitedConns.erase(this);
+
+   // Stop waiting on the bus (the commands waiting are cancelled below)
+   if ( 0 != mHelloCall )
+   {
+      dbus_pending_call_cancel(mHelloCall);
+      dbus_pending_call_unref(mHelloCall);
+      mHelloCall = 0;
+   }
 
    // Delete any pending commands
    while ( !mPendingCmds.empty() )
    {
-      tPendingContainer::iterator it = mPendingCmds.begin();
-      (*it)->cancel(*mDispatcher);
-      delete (*it);
-      mPendingCmds.erase(it);
+      cancelPending(*mPendingCmds.begin());
    }
    
    // Delete any subscriptions that might be left around
    while ( !mSigSubscriptions.empty() )
    {
       tSigSubContainer::iterator it = mSigSubscriptions.begin();
+      {
+         ScopedLock lock(msHandleLock);
+         msSigSubHandles.remove((*it)->getHandle());
+      }
       delete (*it);
       mSigSubscriptions.erase(it);
    }
+   
+   // Forget any results cached for this connection
+   ResponseCache::purge(mHandle);
 
    // Delete any service registrations that might be left around
    while ( !mSvcRegistrations.empty() )
    {
       tSvcRegContainer::iterator it = mSvcRegistrations.begin();
+      {
+         ScopedLock lock(msHandleLock);
+         msSvcRegHandles.remove((*it)->getHandle());
+      }
       delete (*it);
       mSvcRegistrations.erase(it);
    }
+
+   // Release any direct peer connections opened on our behalf
+   while ( !mPeerConns.empty() )
+   {
+      tPeerContainer::iterator it = mPeerConns.begin();
+      Connection* peer = (*it).second;
+      mPeerConns.erase(it);
+      if ( 0 != peer )
+      {
+         peer->mPeerOwner = 0;
+         release(peer);
+      }
+   }
+   
+   // If we're a peer connection then make sure our owner forgets us
+   detachPeer();
 }
 
 
@@ -419,54 +839,228 @@ void Connection::decRef()
    
    if ( 0 == mRefCount )
    {
-      // If this connection is still connected to the daemon
-      if ( dbus_connection_get_is_connected(mDBusConn) )
+      // Let the bus forget us (shutting down may have already asked it
+      // to). There's nothing worth waiting for before it knows us.
+      if ( !mTearingDown )
       {
-         DBusErrorHolder dbusError;
-         
-         // Remove any outstanding subscriptions
-         for ( tSigSubContainer::iterator it = mSigSubscriptions.begin();
-                     it != mSigSubscriptions.end(); ++it )
-         {
-            (void)dbus_bus_remove_match(mDBusConn, (*it)->getRule(),
-                                       dbusError.getInst());
-         }
-         
-         // Release any well-known bus names we might own
-         for ( tSvcRegContainer::iterator it = mSvcRegistrations.begin();
-            it != mSvcRegistrations.end(); ++it )
-         {
-            (void)dbus_bus_release_name(mDBusConn, (*it)->getBusName(),
-                                       dbusError.getInst());
-         }
-         
-         // Flush the out-going message queue
-         dbus_connection_flush(mDBusConn);
+         startTeardown();
       }
-      
-      dbus_connection_remove_filter(mDBusConn, Connection::messageFilter,
-                                    this);
-      if ( mPrivate )
+      if ( 0 != mHelloCall )
       {
-         dbus_connection_close(mDBusConn);
+         mTeardownDeadline = NSysDep::DBUSIPC_getSystemTime();
       }
       
+      // Once out of the cache nothing more is delivered to us although
+      // the dispatcher still dispatches the connection (see
+      // checkTeardowns())
       msConnCache.erase(this);
+      {
+         ScopedLock lock(msHandleLock);
+         msConnHandles.remove(mHandle);
+      }
+      tDBusConnIndex::iterator it = msDBusConnIndex.find(mDBusConn);
+      if ( (it != msDBusConnIndex.end()) && ((*it).second == this) )
+      {
+         msDBusConnIndex.erase(it);
+      }
+      if ( !mSharedAddress.empty() )
+      {
+         tAddressIndex::iterator addrIt = msSharedConnIndex.find(
+                                                         mSharedAddress);
+         if ( (addrIt != msSharedConnIndex.end()) &&
+            ((*addrIt).second == this) )
+         {
+            msSharedConnIndex.erase(addrIt);
+         }
+      }
+      cleanUp();
+      
+      // The answers and our last messages are waited on by the dispatch
+      // loop rather than here
+      msClosingConns.insert(this);
+      if ( finishTeardown() )
+      {
+         destroy();
+      }
    }
+   else
+   {
+      // We also need to explicitly decrement the reference count on the
+      // associated underlying D-Bus connection object (see destroy() for
+      // the last one).
+      dbus_connection_unref(mDBusConn);
+   }
+}
+
+
+void Connection::destroy()
+{
+   dbus_connection_remove_filter(mDBusConn, Connection::messageFilter,
+                                 this);
+   if ( mPrivate )
+   {
+      dbus_connection_close(mDBusConn);
+   }
+   msClosingConns.erase(this);
    
-   // We also need to explicitly decrement the reference count on the
-   // associated underlying D-Bus connection object. This *could* be
-   // the last reference to this connection object so we don't want to
-   // reference it again from this point forward (including the destructor).
+   // This *could* be the last reference to the D-Bus connection so we
+   // don't want to reference it again from this point forward (including
+   // the destructor).
    dbus_connection_unref(mDBusConn);
+   delete this;
+}
 
-   if ( 0 == mRefCount )
+
+void Connection::checkTeardowns()
+{
+   if ( !msClosingConns.empty() )
+   {
+      // Finishing deletes the connection
+      std::vector<Connection*> conns(msClosingConns.begin(),
+                                     msClosingConns.end());
+      for ( std::vector<Connection*>::iterator it = conns.begin();
+         it != conns.end(); ++it )
+      {
+         if ( (*it)->finishTeardown() )
+         {
+            (*it)->destroy();
+         }
+      }
+   }
+}
+
+
+uint64_t Connection::getTeardownDeadline()
+{
+   uint64_t deadline(0U);
+   
+   for ( tConnContainer::const_iterator it = msClosingConns.begin();
+      it != msClosingConns.end(); ++it )
+   {
+      if ( (0U == deadline) || ((*it)->mTeardownDeadline < deadline) )
+      {
+         deadline = (*it)->mTeardownDeadline;
+      }
+   }
+   
+   return deadline;
+}
+
+
+void Connection::startTeardown()
+{
+   mTearingDown = true;
+   mTeardownDeadline = NSysDep::DBUSIPC_getSystemTime() + mTeardownTimeout;
+   
+   // Closing a private connection makes the bus drop our match rules and
+   // names by itself. There's nothing to clean up either until the bus
+   // has answered our "Hello".
+   if ( !mPrivate && dbus_connection_get_is_connected(mDBusConn) &&
+      (0 == mHelloCall) )
+   {
+      // The requests are all sent before waiting on any of the answers
+      // so it only takes one round trip however many there are
+      for ( tSigSubContainer::iterator it = mSigSubscriptions.begin();
+         it != mSigSubscriptions.end(); ++it )
+      {
+         sendTeardownCall("RemoveMatch", (*it)->getRule());
+      }
+      
+      for ( tSvcRegContainer::iterator it = mSvcRegistrations.begin();
+         it != mSvcRegistrations.end(); ++it )
+      {
+         sendTeardownCall("ReleaseName", (*it)->getBusName());
+      }
+   }
+}
+
+
+void Connection::sendTeardownCall
+   (
+   DBUSIPC_tConstStr  method,
+   DBUSIPC_tConstStr  arg
+   )
+{
+   DBusPendingCall* call(0);
+   uint64_t now = NSysDep::DBUSIPC_getSystemTime();
+   int32_t msecTimeout = (mTeardownDeadline > now) ?
+            static_cast<int32_t>(std::min<uint64_t>(mTeardownDeadline - now,
+            MAX_MSEC_TIMEOUT)) : 1;
+   
+   DBusMessage* reqMsg = dbus_message_new_method_call(DBUS_SERVICE_DBUS,
+                     DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, method);
+   if ( 0 == reqMsg )
    {
-      delete this;
+      TRACE_WARN("sendTeardownCall: failed to create %s message", method);
+   }
+   else
+   {
+      if ( !dbus_message_append_args(reqMsg, DBUS_TYPE_STRING, &arg,
+         DBUS_TYPE_INVALID) ||
+         !dbus_connection_send_with_reply(mDBusConn, reqMsg, &call,
+         msecTimeout) || (0 == call) )
+      {
+         TRACE_WARN("sendTeardownCall: failed to send %s(%s)", method, arg);
+      }
+      else
+      {
+         try
+         {
+            mTeardownCalls.push_back(call);
+         }
+         catch ( ... )
+         {
+            // The request still goes out - we just won't wait on it
+            dbus_pending_call_unref(call);
+         }
+      }
+      
+      // Free the request message (finally)
+      dbus_message_unref(reqMsg);
    }
 }
 
 
+bool Connection::finishTeardown()
+{
+   // The bus answers in order so the requests sent last are answered
+   // last. The answers are matched up with their calls as the dispatcher
+   // dispatches the connection and are of no interest themselves.
+   while ( !mTeardownCalls.empty() &&
+      dbus_pending_call_get_completed(mTeardownCalls.front()) )
+   {
+      dbus_pending_call_unref(mTeardownCalls.front());
+      mTeardownCalls.pop_front();
+   }
+   
+   // Finished once everything is answered and sent or if the bus takes
+   // too long
+   bool finished = (NSysDep::DBUSIPC_getSystemTime() >= mTeardownDeadline) ||
+                   !dbus_connection_get_is_connected(mDBusConn) ||
+                   (mTeardownCalls.empty() &&
+                   !dbus_connection_has_messages_to_send(mDBusConn));
+   if ( finished )
+   {
+      if ( !mTeardownCalls.empty() ||
+         dbus_connection_has_messages_to_send(mDBusConn) )
+      {
+         TRACE_WARN("finishTeardown: dbusConn=%p closed with %u unanswered "
+                    "request(s) or unsent messages", mDBusConn,
+                    static_cast<uint32_t>(mTeardownCalls.size()));
+      }
+      
+      while ( !mTeardownCalls.empty() )
+      {
+         dbus_pending_call_cancel(mTeardownCalls.front());
+         dbus_pending_call_unref(mTeardownCalls.front());
+         mTeardownCalls.pop_front();
+      }
+   }
+   
+   return finished;
+}
+
+
 DBusHandlerResult Connection::messageFilter
    (
    DBusConnection*   dbusConn,
@@ -484,55 +1078,29 @@ DBusHandlerResult Connection::messageFilter
    Connection* conn = static_cast<Connection*>(data);
    if ( Connection::connectionExists(conn) )
    {
-      DBUSIPC_tConstStr msgType = "unknown";
-      switch ( dbus_message_get_type(msg) )
-      {
-         case DBUS_MESSAGE_TYPE_METHOD_CALL:
-            msgType = "method call";
-            break;
-         case DBUS_MESSAGE_TYPE_METHOD_RETURN:
-            msgType = "method return";
-            break;
-         case DBUS_MESSAGE_TYPE_ERROR:
-            msgType = "error";
-            break;
-         case DBUS_MESSAGE_TYPE_SIGNAL:
-            msgType = "signal";
-            break;
-         default:
-            break;
-      }
-      
-      TRACE_INFO("messageFilter: msg type = %s", msgType);
-      if ( DBUS_MESSAGE_TYPE_ERROR == dbus_message_get_type(msg) )
-      {
-         TRACE_INFO("messageFilter: errMsg = %s",
-                     dbus_message_get_error_name(msg) ?
-                     dbus_message_get_error_name(msg) : "unknown");
-      }
-      else
-      {
-         TRACE_INFO("messageFilter: interface = %s",
-                     dbus_message_get_interface(msg) ?
-                     dbus_message_get_interface(msg) : "unknown");
-         TRACE_INFO("messageFilter: path = %s",
-                     dbus_message_get_path(msg) ?
-                     dbus_message_get_path(msg) : "unknown");
-         TRACE_INFO("messageFilter: member = %s",
-                     dbus_message_get_member(msg) ?
-                     dbus_message_get_member(msg) : "unknown");
-      }
-      TRACE_INFO("messageFilter: sender = %s", dbus_message_get_sender(msg) ?
-                              dbus_message_get_sender(msg) : "unknown");
+      // Formatting the message headers costs too much to do per message
+      TRACE_EVENT(DBUSIPC_TRACE_MSG_RECEIVED, TRACE_PTR(dbusConn),
+                  dbus_message_get_type(msg), dbus_message_get_serial(msg),
+                  dbus_message_get_reply_serial(msg));
       
       if ( dbus_message_is_signal(msg, DBUS_INTERFACE_LOCAL, "Disconnected") &&
           dbus_message_has_path(msg, DBUS_PATH_LOCAL) )
       {
          TRACE_INFO("messageFilter: %p disconnected by local bus", dbusConn);
+         TRACE_EVENT(DBUSIPC_TRACE_DISCONNECTED, TRACE_PTR(dbusConn), 0U, 0U,
+                     0U);
          if ( conn->mPrivate )
          {
             dbus_connection_close(conn->mDBusConn);
          }
+         
+         // A direct peer connection is of no further use once the peer
+         // has gone away.
+         if ( (0 != conn->mPeerOwner) || (0 != conn->mPeerService) )
+         {
+            conn->detachPeer();
+            conn->scheduleRelease();
+         }
    
          result = DBUS_HANDLER_RESULT_HANDLED;
       }
@@ -571,30 +1139,73 @@ DBusHandlerResult Connection::messageFilter
          }
          else
          {
+            ServiceRegistration* target(0);
+            uint64_t deadline(0U);
+            DBusMessageIter iter;
+            
+            // Newer clients append the time they stop waiting for a reply
+            // after the payload
+            if ( dbus_message_iter_init(msg, &iter) &&
+               dbus_message_iter_next(&iter) &&
+               dbus_message_iter_next(&iter) &&
+               (DBUS_TYPE_UINT64 == dbus_message_iter_get_arg_type(&iter)) )
+            {
+               dbus_uint64_t value(0U);
+               dbus_message_iter_get_basic(&iter, &value);
+               deadline = value;
+            }
+            
             // Find the service that should receive this message
             for ( tSvcRegContainer::iterator it =
                conn->mSvcRegistrations.begin();
                it != conn->mSvcRegistrations.end(); ++it )
             {
-               ServiceRegistration* reg = (*it);
-               if ( dbus_message_has_path(msg, reg->getObjectPath()) )
+               if ( dbus_message_has_path(msg, (*it)->getObjectPath()) )
                {
-                  try
-                  {
-                     // Call the service message handler
-                     reg->dispatch(msg, msgName, payload, conn->mMaxDispatchProcTime);
-                  }
-                  catch ( const std::exception& e )
-                  {
-                     TRACE_WARN("messageFilter: caught exception => %s",
-                                 e.what());
-                  }
-                  result = DBUS_HANDLER_RESULT_HANDLED;
+                  target = (*it);
                   break;
                }
             }
+            
+            // Requests arriving over a direct peer connection are meant
+            // for the service that accepted the peer
+            if ( (0 == target) && (0 != conn->mPeerService) &&
+               dbus_message_has_path(msg, conn->mPeerService->getObjectPath()) )
+            {
+               target = conn->mPeerService;
+            }
+            
+            // If the service is saturated then turn the request away
+            // without bothering its handler
+            if ( (0 != target) && target->isBusy() )
+            {
+               target->recordShed();
+               conn->replyError(msg, DBUSIPC_ERR_NAME_BUSY,
+                                "Service is busy: request rejected");
+               result = DBUS_HANDLER_RESULT_HANDLED;
+            }
+            else if ( 0 != target )
+            {
+               try
+               {
+                  // Call the service message handler
+                  target->dispatch(conn, msg, msgName, payload, deadline,
+                                   conn->mMaxDispatchProcTime);
+               }
+               catch ( const std::exception& e )
+               {
+                  TRACE_WARN("messageFilter: caught exception => %s",
+                              e.what());
+               }
+               result = DBUS_HANDLER_RESULT_HANDLED;
+            }
          }
       }
+      else if ( dbus_message_is_method_call(msg, DBUSIPC_INTERFACE_NAME,
+         DBUSIPC_INTERFACE_PEER_ADDRESS_METHOD_NAME) )
+      {
+         result = conn->replyPeerAddress(msg);
+      }
       else if ( dbus_message_is_method_call(msg, DBUS_INTERFACE_INTROSPECTABLE,
             INTROSPECTION_INTERFACE_METHOD_NAME) )
       {
@@ -714,6 +1325,451 @@ DBusHandlerResult Connection::introspect
 }
 
 
+DBusHandlerResult Connection::replyPeerAddress
+   (
+   DBusMessage*   msg
+   )
+{
+   assert( 0 != msg );
+   
+   DBusHandlerResult result(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+   DBUSIPC_tConstStr busName = dbus_message_get_destination(msg);
+   DBUSIPC_tConstStr address = "";
+   
+   // An empty address tells the client to keep using the bus
+   if ( 0 != busName )
+   {
+      for ( tSvcRegContainer::iterator it = mSvcRegistrations.begin();
+         it != mSvcRegistrations.end(); ++it )
+      {
+         ServiceRegistration* reg = (*it);
+         if ( (0 == std::strcmp(busName, reg->getBusName())) &&
+            ('\0' != *reg->getPeerAddress()) )
+         {
+            address = reg->getPeerAddress();
+            break;
+         }
+      }
+   }
+   
+   DBusMessage* reply = dbus_message_new_method_return(msg);
+   if ( 0 != reply )
+   {
+      if ( dbus_message_append_args(reply, DBUS_TYPE_STRING, &address,
+         DBUS_TYPE_INVALID) )
+      {
+         dbus_uint32_t serialNum;
+         if ( dbus_connection_send(mDBusConn, reply, &serialNum) )
+         {
+            result = DBUS_HANDLER_RESULT_HANDLED;
+         }
+      }
+      
+      // Release the reply message
+      dbus_message_unref(reply);
+   }
+   
+   return result;
+}
+
+
+void Connection::replyError
+   (
+   DBusMessage*         msg,
+   DBUSIPC_tConstStr     errName,
+   DBUSIPC_tConstStr     errMsg
+   )
+{
+   assert( 0 != msg );
+   
+   // Nobody is listening for the error if no reply is expected
+   if ( !dbus_message_get_no_reply(msg) )
+   {
+      DBusMessage* error = dbus_message_new_error(msg, errName, errMsg);
+      if ( 0 == error )
+      {
+         TRACE_WARN("replyError: failed to create error message");
+      }
+      else
+      {
+         dbus_uint32_t serialNum;
+         if ( !dbus_connection_send(mDBusConn, error, &serialNum) )
+         {
+            TRACE_WARN("replyError: failed to send error message");
+         }
+         
+         // Release the error message
+         dbus_message_unref(error);
+      }
+   }
+}
+
+
+void Connection::requestPeerAddress
+   (
+   const std::string&   busName
+   )
+{
+   DBusPendingCall* call(0);
+   
+   // The service answers based on the destination bus name so any valid
+   // object path will do.
+   DBusMessage* reqMsg = dbus_message_new_method_call(busName.c_str(),
+                     "/", DBUSIPC_INTERFACE_NAME,
+                     DBUSIPC_INTERFACE_PEER_ADDRESS_METHOD_NAME);
+   if ( 0 == reqMsg )
+   {
+      TRACE_WARN("requestPeerAddress: failed to create request message");
+   }
+   else
+   {
+      if ( !dbus_connection_send_with_reply(mDBusConn, reqMsg, &call, -1) ||
+         (0 == call) )
+      {
+         TRACE_WARN("requestPeerAddress: failed to send request message");
+      }
+      else
+      {
+         tPeerProbe* probe = new tPeerProbe;
+         probe->conn = mHandle;
+         probe->busName = busName;
+         if ( !dbus_pending_call_set_notify(call,
+            Connection::onPeerAddressNotify, probe, Connection::freePeerProbe) )
+         {
+            TRACE_WARN("requestPeerAddress: failed to set notification");
+            delete probe;
+            dbus_pending_call_cancel(call);
+            dbus_pending_call_unref(call);
+         }
+      }
+      
+      // Free the request message (finally)
+      dbus_message_unref(reqMsg);
+   }
+}
+
+
+void Connection::onPeerAddressNotify
+   (
+   DBusPendingCall*  call,
+   void*             data
+   )
+{
+   tPeerProbe* probe = static_cast<tPeerProbe*>(data);
+   assert( 0 != probe );
+   
+   DBusMessage* reply = dbus_pending_call_steal_reply(call);
+   // The connection may have been closed while we were waiting
+   Connection* conn = fromHandle(probe->conn);
+   
+   if ( (0 != reply) && (0 != conn) &&
+      (DBUS_MESSAGE_TYPE_METHOD_RETURN == dbus_message_get_type(reply)) )
+   {
+      DBUSIPC_tConstStr address(0);
+      tPeerContainer::iterator it = conn->mPeerConns.find(probe->busName);
+      
+      // Connecting can block so it's left to the peer connector. The
+      // service stays on the bus until the peer has been adopted.
+      if ( (conn->mPeerConns.end() != it) && (0 == (*it).second) &&
+         dbus_message_get_args(reply, 0, DBUS_TYPE_STRING, &address,
+         DBUS_TYPE_INVALID) && ('\0' != *address) )
+      {
+         TRACE_INFO("onPeerAddressNotify: %s reachable at %s",
+                    probe->busName.c_str(), address);
+         conn->mDispatcher->connectPeer(conn->mHandle, probe->busName,
+                                        address);
+      }
+   }
+   
+   if ( 0 != reply )
+   {
+      dbus_message_unref(reply);
+   }
+   
+   dbus_pending_call_unref(call);
+}
+
+
+void Connection::freePeerProbe
+   (
+   void* data
+   )
+{
+   delete static_cast<tPeerProbe*>(data);
+}
+
+
+Connection* Connection::getPeerConnection
+   (
+   const std::string&   busName
+   )
+{
+   Connection* conn(this);
+   
+   if ( mPeerToPeer && (mPeerBusNames.empty() ||
+      (mPeerBusNames.end() != mPeerBusNames.find(busName))) )
+   {
+      tPeerContainer::iterator it = mPeerConns.find(busName);
+      
+      // If we've never asked this service for its peer address then ...
+      if ( mPeerConns.end() == it )
+      {
+         // Requests keep going over the bus until (if ever) the service
+         // tells us where it can be reached directly. The entry stays
+         // empty if it can't be so the service isn't asked again.
+         mPeerConns[busName] = 0;
+         requestPeerAddress(busName);
+      }
+      // Else only use the peer once it has accepted us
+      else if ( (0 != (*it).second) &&
+         dbus_connection_get_is_connected((*it).second->mDBusConn) &&
+         dbus_connection_get_is_authenticated((*it).second->mDBusConn) )
+      {
+         conn = (*it).second;
+         conn->mPeerUsable = true;
+      }
+   }
+   
+   return conn;
+}
+
+
+void Connection::failPeerRequests
+   (
+   DBusConnection*   peerConn
+   )
+{
+   std::list<BaseCommand*> lost;
+   
+   // Collect them first since failing a request also fails (and removes)
+   // the requests sharing its reply
+   for ( tPendingContainer::iterator it = mPendingCmds.begin();
+      it != mPendingCmds.end(); ++it )
+   {
+      if ( (DBUSIPC_CMD_INVOKE == (*it)->getType()) &&
+         (peerConn == static_cast<InvokeCmd*>(*it)->getCarrier()) )
+      {
+         lost.push_back(*it);
+      }
+   }
+   
+   for ( std::list<BaseCommand*>::iterator it = lost.begin();
+      it != lost.end(); ++it )
+   {
+      static_cast<InvokeCmd*>(*it)->failCarrier();
+      unregisterPending(*it);
+      delete (*it);
+   }
+}
+
+
+void Connection::adoptPeerConnection
+   (
+   const std::string&   busName,
+   DBusConnection*      dbusConn
+   )
+{
+   assert( 0 != dbusConn );
+   
+   tPeerContainer::iterator it = mPeerConns.find(busName);
+   if ( (mPeerConns.end() == it) || (0 != (*it).second) )
+   {
+      dbus_connection_close(dbusConn);
+      dbus_connection_unref(dbusConn);
+   }
+   else
+   {
+      try
+      {
+         // The connection is closed if it can't be set up
+         Connection* peer = new Connection(dbusConn, true, mDispatcher);
+         peer->mPeerOwner = this;
+         peer->mPeerBusName = busName;
+         (*it).second = peer;
+      }
+      catch ( const std::exception& e )
+      {
+         TRACE_WARN("adoptPeerConnection: cannot use peer for %s => %s",
+                    busName.c_str(), e.what());
+      }
+   }
+}
+
+
+void Connection::detachPeer()
+{
+   if ( 0 != mPeerOwner )
+   {
+      mPeerOwner->failPeerRequests(mDBusConn);
+      
+      tPeerContainer::iterator it = mPeerOwner->mPeerConns.find(mPeerBusName);
+      if ( (mPeerOwner->mPeerConns.end() != it) && (this == (*it).second) )
+      {
+         // If the peer was usable then forget it so that the service is
+         // asked for its (new) address on next use. Otherwise the peer
+         // rejected us and there's no point in trying again.
+         if ( mPeerUsable )
+         {
+            mPeerOwner->mPeerConns.erase(it);
+         }
+         else
+         {
+            (*it).second = 0;
+         }
+      }
+      mPeerOwner = 0;
+   }
+   
+   mPeerService = 0;
+}
+
+
+void Connection::scheduleRelease()
+{
+   // We can't release ourselves while D-Bus is dispatching messages to
+   // us so let the dispatcher do it once the dispatch completes.
+   std::auto_ptr<CloseConnectionCmd> cmd(new CloseConnectionCmd(this));
+   if ( DBUSIPC_INVALID_HANDLE != mDispatcher->submitCommand(cmd.get()) )
+   {
+      cmd.release();
+   }
+}
+
+
+bool Connection::registerOnBus
+   (
+   ConnectCmd* cmd
+   )
+{
+   assert( 0 != cmd );
+   bool registered(0 != dbus_bus_get_unique_name(mDBusConn));
+   
+   if ( !registered )
+   {
+      // Commands opening the same (shared) connection all wait on the
+      // first one's request
+      registerPending(cmd);
+      if ( 0 == mHelloCall )
+      {
+         DBusMessage* helloMsg = dbus_message_new_method_call(
+                     DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+                     "Hello");
+         if ( (0 == helloMsg) ||
+            !dbus_connection_send_with_reply(mDBusConn, helloMsg,
+            &mHelloCall, DBUS_TIMEOUT_USE_DEFAULT) || (0 == mHelloCall) ||
+            !dbus_pending_call_set_notify(mHelloCall,
+            Connection::onHelloNotify, this, 0) )
+         {
+            if ( 0 != mHelloCall )
+            {
+               dbus_pending_call_cancel(mHelloCall);
+               dbus_pending_call_unref(mHelloCall);
+               mHelloCall = 0;
+            }
+            if ( 0 != helloMsg )
+            {
+               dbus_message_unref(helloMsg);
+            }
+            unregisterPending(cmd);
+            throw DBusException(DBUSIPC_ERR_NAME_NO_MEMORY,
+                                "Unable to register on the bus");
+         }
+         
+         dbus_message_unref(helloMsg);
+      }
+   }
+   
+   return registered;
+}
+
+
+void Connection::onHelloNotify
+   (
+   DBusPendingCall*  call,
+   void*             data
+   )
+{
+   Connection* conn = static_cast<Connection*>(data);
+   assert( 0 != conn );
+   
+   DBUSIPC_tCallbackStatus status = {DBUSIPC_ERROR_NONE,
+                                    DBUSIPC_ERR_NAME_OK, 0};
+   DBUSIPC_tConstStr uniqueName(0);
+   DBusMessage* reply = dbus_pending_call_steal_reply(call);
+   if ( 0 == reply )
+   {
+      status.errCode = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                              DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      status.errName = DBUSIPC_ERR_NAME_INTERNAL;
+      status.errMsg = "Failed to retrieve reply message";
+   }
+   else if ( DBUS_MESSAGE_TYPE_ERROR == dbus_message_get_type(reply) )
+   {
+      status.errCode = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                              DBUSIPC_DOMAIN_DBUS_LIB, DBUSIPC_ERR_DBUS);
+      status.errName = dbus_message_get_error_name(reply);
+      if ( !dbus_message_get_args(reply, 0, DBUS_TYPE_STRING,
+         &status.errMsg, DBUS_TYPE_INVALID) )
+      {
+         status.errMsg = 0;
+      }
+   }
+   else if ( !dbus_message_get_args(reply, 0, DBUS_TYPE_STRING,
+      &uniqueName, DBUS_TYPE_INVALID) ||
+      !dbus_bus_set_unique_name(conn->mDBusConn, uniqueName) )
+   {
+      status.errCode = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                              DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      status.errName = DBUSIPC_ERR_NAME_INTERNAL;
+      status.errMsg = "Failed to set the unique bus name";
+   }
+   else
+   {
+      TRACE_INFO("onHelloNotify: dbusConn=%p registered as %s",
+                 conn->mDBusConn, uniqueName);
+   }
+   
+   dbus_pending_call_unref(conn->mHelloCall);
+   conn->mHelloCall = 0;
+   
+   // Collect the waiting commands first since completing them modifies
+   // the pending command list
+   std::list<BaseCommand*> waiting;
+   for ( tPendingContainer::iterator it = conn->mPendingCmds.begin();
+      it != conn->mPendingCmds.end(); ++it )
+   {
+      if ( (DBUSIPC_CMD_OPEN_CONNECTION == (*it)->getType()) ||
+         (DBUSIPC_CMD_GET_CONNECTION == (*it)->getType()) )
+      {
+         waiting.push_back(*it);
+      }
+   }
+   
+   for ( std::list<BaseCommand*>::iterator it = waiting.begin();
+      it != waiting.end(); ++it )
+   {
+      ConnectCmd* cmd = static_cast<ConnectCmd*>(*it);
+      conn->unregisterPending(cmd);
+      if ( DBUSIPC_ERROR_NONE == status.errCode )
+      {
+         cmd->dispatch(status, conn->mHandle);
+      }
+      else
+      {
+         // Each command holds a reference to the connection
+         conn->scheduleRelease();
+         cmd->dispatch(status, 0);
+      }
+      delete cmd;
+   }
+   
+   if ( 0 != reply )
+   {
+      dbus_message_unref(reply);
+   }
+}
+
+
 void Connection::onDispatchStatusUpdate
    (
    DBusConnection*      dbusConn,
@@ -729,7 +1785,9 @@ void Connection::onDispatchStatusUpdate
       case DBUS_DISPATCH_DATA_REMAINS:
          TRACE_INFO("onDispatchStatusUpdate: needs dispatching on dbusConn=%p",
                      dbusConn);
-         if ( connectionExists(conn) )
+         // A closing connection is dispatched for the bus's answers
+         if ( connectionExists(conn) ||
+            (0U != msClosingConns.count(conn)) )
          {
             conn->mDispatcher->addPending(conn);
          }
@@ -759,19 +1817,27 @@ bool Connection::isReadyForDispatch()
 }
 
 
-bool Connection::dispatchMessages()
+DBusDispatchStatus Connection::dispatchMessages()
 {
    DBusDispatchStatus status(DBUS_DISPATCH_COMPLETE);
    
-   // Only dispatch messages while we're connected
-   if ( dbus_connection_get_is_connected(mDBusConn) )
+   // Only dispatch messages while we're connected. A peer connection is
+   // dispatched to the end so that the requests still waiting on it fail
+   // and it's released on the "Disconnected" signal.
+   if ( dbus_connection_get_is_connected(mDBusConn) ||
+      (0 != mPeerOwner) || (0 != mPeerService) )
    {
-      // Dispatch messages while data remains to be processed
+      // Dispatch messages while data remains to be processed but leave
+      // the rest for the next pass once the budget is used up so that
+      // a flooded connection doesn't starve the others
+      uint32_t numDispatched(0U);
       do
       {
          status = dbus_connection_dispatch(mDBusConn);
+         ++numDispatched;
       }
-      while ( DBUS_DISPATCH_DATA_REMAINS == status);
+      while ( (DBUS_DISPATCH_DATA_REMAINS == status) &&
+         (numDispatched < mDispatchBudget) );
       
       // If the dispatch indicates there was an error
       //(DBUS_DISPATCH_NEED_MEMORY) then we won't say the dispatch was
@@ -779,7 +1845,31 @@ bool Connection::dispatchMessages()
       // and the messages can be delivered.
    }
    
-   return (DBUS_DISPATCH_COMPLETE == status);
+   return status;
+}
+
+
+void Connection::setDispatchPriority
+   (
+   DBUSIPC_tConnPriority   priority,
+   uint32_t                msgBudget
+   )
+{
+   // Move the connection to the ready list of its new class
+   bool ready = isLinked();
+   if ( ready )
+   {
+      mDispatcher->removePending(this);
+   }
+   
+   mDispatchPriority = priority;
+   mDispatchBudget = (0U == msgBudget) ? static_cast<uint32_t>(
+                     DEFAULT_DISPATCH_BUDGET) : msgBudget;
+   
+   if ( ready )
+   {
+      mDispatcher->addPending(this);
+   }
 }
 
 
@@ -790,6 +1880,16 @@ void Connection::subscribeSignal
 {
    assert( 0 != sigSub );
    mSigSubscriptions.insert(sigSub);
+   try
+   {
+      ScopedLock lock(msHandleLock);
+      sigSub->setHandle(msSigSubHandles.add(sigSub));
+   }
+   catch ( ... )
+   {
+      mSigSubscriptions.erase(sigSub);
+      throw;
+   }
 }
 
 void Connection::unsubscribeSignal
@@ -809,6 +1909,10 @@ void Connection::unsubscribeSignal
    else
    {
       mSigSubscriptions.erase(sigSub);
+      {
+         ScopedLock lock(msHandleLock);
+         msSigSubHandles.remove(sigSub->getHandle());
+      }
       delete sigSub;
    }
 }
@@ -821,6 +1925,31 @@ void Connection::registerService
 {   
    assert( 0 != reg );
    mSvcRegistrations.insert(reg);
+   try
+   {
+      ScopedLock lock(msHandleLock);
+      reg->setHandle(msSvcRegHandles.add(reg));
+   }
+   catch ( ... )
+   {
+      mSvcRegistrations.erase(reg);
+      throw;
+   }
+   
+   if ( DBUSIPC_REG_FLAG_PEER_LISTEN & reg->getFlags() )
+   {
+      // Peers are an optimization - the service remains reachable over
+      // the bus even if we can't listen for them.
+      try
+      {
+         reg->listenForPeers(mDispatcher);
+      }
+      catch ( const std::exception& e )
+      {
+         TRACE_WARN("registerService: cannot listen for peers => %s",
+                    e.what());
+      }
+   }
 }
 
 
@@ -843,6 +1972,10 @@ void Connection::unregisterService
    else
    {
       mSvcRegistrations.erase(reg);
+      {
+         ScopedLock lock(msHandleLock);
+         msSvcRegHandles.remove(reg->getHandle());
+      }
       delete reg;
    }
 }
@@ -854,6 +1987,16 @@ void Connection::registerPending
    )
 {
    mPendingCmds.insert(cmd);
+   try
+   {
+      // Let the dispatcher find the command by handle when cancelling
+      mDispatcher->addPendingCmd(this, cmd);
+   }
+   catch ( ... )
+   {
+      mPendingCmds.erase(cmd);
+      throw;
+   }
 }
 
 
@@ -863,5 +2006,58 @@ void Connection::unregisterPending
    )
 {
    mPendingCmds.erase(cmd);
+   mDispatcher->removePendingCmd(cmd);
+}
+
+
+void Connection::cancelPending
+   (
+   BaseCommand*   cmd
+   )
+{
+   assert( 0 != cmd );
+   
+   // Cancel the pending command
+   cmd->cancel(*mDispatcher);
+   // Remove it from the collection of pending commands
+   unregisterPending(cmd);
+   // Destroy it
+   delete cmd;
+}
+
+
+InvokeCmd* Connection::findCoalescedInvoke
+   (
+   const std::string&   key
+   ) const
+{
+   InvokeCmd* cmd(0);
+   tCoalesceContainer::const_iterator it = mCoalescedInvokes.find(key);
+   
+   if ( it != mCoalescedInvokes.end() )
+   {
+      cmd = (*it).second;
+   }
+   
+   return cmd;
+}
+
+
+void Connection::addCoalescedInvoke
+   (
+   const std::string&   key,
+   InvokeCmd*           cmd
+   )
+{
+   mCoalescedInvokes[key] = cmd;
+}
+
+
+void Connection::removeCoalescedInvoke
+   (
+   const std::string&   key
+   )
+{
+   mCoalescedInvokes.erase(key);
 }
    
@@ -1,10 +1,15 @@
 #ifndef CONNECTION_HPP_
 #define CONNECTION_HPP_
 
+#include <list>
 #include <map>
 #include <set>
+#include <string>
 #include "dbus/dbus.h"
 #include "dbusipc/dbusipc.h"
+#include "HandleTable.hpp"
+#include "MutexLock.hpp"
+#include "ReadyList.hpp"
 
 
 //
@@ -14,11 +19,15 @@ class Dispatcher;
 class SignalSubscription;
 class ServiceRegistration;
 class BaseCommand;
+class ConnectCmd;
+class InvokeCmd;
 
-class Connection
+// Connections with messages to dispatch wait on the dispatcher's ready lists
+class Connection : public ReadyList<Connection>::Hook
 {
 public:
 
+   // Connections are opened unregistered (see registerOnBus())
    static Connection* create(DBUSIPC_tConstStr address,
                              DBUSIPC_tBool openPrivate,
                              Dispatcher* disp);
@@ -26,16 +35,68 @@ public:
    static Connection* create(DBUSIPC_tConnType connType,
                              DBUSIPC_tBool openPrivate,
                              Dispatcher* disp);   
+   static Connection* adoptPeer(DBusConnection* dbusConn,
+                                ServiceRegistration* reg,
+                                Dispatcher* disp);
    static void release(Connection*);
+   static void releasePeers(ServiceRegistration* reg);
    static void forceReleaseAll();
    static DBusConnection* getDBusConnection(Connection* conn);
    static bool connectionExists(Connection* conn);
-   static DBUSIPC_tError cancelPendingByHandle(DBUSIPC_tHandle hnd);
-   static bool signalSubExists(SignalSubscription* sigSub);
-   static bool serviceRegExists(ServiceRegistration* svcReg);
+   
+   // Resolve the handles given out by the API (NULL if stale)
+   static Connection* fromHandle(DBUSIPC_tConnection hnd);
+   static SignalSubscription* findSignalSub(DBUSIPC_tSigSubHnd hnd);
+   static ServiceRegistration* findServiceReg(DBUSIPC_tSvcRegHnd hnd);
+   
+   DBUSIPC_tConnection getHandle() const;
+   DBusConnection* getDBusConn() const;
+   Dispatcher* getDispatcher() const;
+   
+   // Emits a signal from the calling thread without a dispatcher hand-off
+   // (optionally by copying a prepared signal)
+   static DBUSIPC_tError emitDirect(DBUSIPC_tSvcRegHnd regHnd,
+                                   DBUSIPC_tConstStr sigName,
+                                   DBUSIPC_tConstStr parameters,
+                                   DBusMessage* prepared = 0);
+   // Can be called from any thread
+   static bool getServiceObjectPath(DBUSIPC_tSvcRegHnd regHnd,
+                                    std::string& objPath);
+   static bool handleExists(DBUSIPC_tConnection hnd);
+   
+   // Out-going queue backpressure. The watermarks and the congested flag
+   // are only changed by the dispatcher with the handle lock held. Returns
+   // false (and counts the rejection) if a new message is refused. These
+   // can be called from any thread.
+   static bool acceptsOutgoing(DBUSIPC_tConnection hnd);
+   static bool serviceAcceptsOutgoing(DBUSIPC_tSvcRegHnd regHnd);
+   static bool getOutgoingStats(DBUSIPC_tConnection hnd,
+                                DBUSIPC_tOutgoingQueueStats& stats);
+   void setOutgoingLimits(uint32_t highWater, uint32_t lowWater,
+                          DBUSIPC_tBackpressureCallback onBackpressure,
+                          DBUSIPC_tUserToken token);
+   // Dispatcher thread only: re-evaluates the queue (notifying the
+   // backpressure callback of changes) and returns false if a new message
+   // should be refused
+   bool admitOutgoing();
+   // Re-evaluates every connection with watermarks (dispatcher thread)
+   static void checkOutgoingLimits();
+   // Destroys the released connections whose teardown is done (dispatcher
+   // thread). The deadline is that of the connection to give up first
+   // (or 0 if none is closing).
+   static void checkTeardowns();
+   static bool hasTeardowns();
+   static uint64_t getTeardownDeadline();
 	
    bool isReadyForDispatch();
-   bool dispatchMessages();
+   // Dispatches (at most the budget of) the messages waiting
+   DBusDispatchStatus dispatchMessages();
+   
+   // Which of the dispatcher's ready lists the connection waits on and how
+   // many messages it may dispatch per pass of the dispatch loop
+   DBUSIPC_tConnPriority getDispatchPriority() const;
+   void setDispatchPriority(DBUSIPC_tConnPriority priority,
+                            uint32_t msgBudget);
    
    // This can throw exceptions
    void subscribeSignal(SignalSubscription* sigSub);
@@ -44,23 +105,80 @@ public:
    void registerService(ServiceRegistration* reg);
    void unregisterService(ServiceRegistration* reg);
    
+   // Registers the connection on the bus (the "Hello" round trip)
+   // without blocking the dispatcher. Returns true if the connection is
+   // already registered. Otherwise the command is kept pending and is
+   // completed once the bus answers. This can throw exceptions.
+   bool registerOnBus(ConnectCmd* cmd);
+   
+   // Gives back a reference from a context where the connection can't
+   // be destroyed (e.g. while D-Bus is dispatching its messages)
+   void scheduleRelease();
+   
    // Tracks pending method requests
    void registerPending(BaseCommand* cmd);
    void unregisterPending(BaseCommand* cmd);
+   void cancelPending(BaseCommand* cmd);
+   
+   // Tracks in-flight invokes that identical requests may share
+   InvokeCmd* findCoalescedInvoke(const std::string& key) const;
+   void addCoalescedInvoke(const std::string& key, InvokeCmd* cmd);
+   void removeCoalescedInvoke(const std::string& key);
+   
+   // Returns the direct peer connection to the service or this
+   // connection if requests must be routed through the bus.
+   Connection* getPeerConnection(const std::string& busName);
+   // Takes over a peer connection opened by the dispatcher's peer
+   // connector (it's closed if the service no longer needs it)
+   void adoptPeerConnection(const std::string& busName,
+                            DBusConnection* dbusConn);
+   
+   // Answers a request with an error on behalf of the service
+   void replyError(DBusMessage* msg, DBUSIPC_tConstStr errName,
+                   DBUSIPC_tConstStr errMsg);
    
 private:
    
+   // Context for a pending request for a service's peer address
+   struct tPeerProbe
+   {
+      DBUSIPC_tConnection  conn;
+      std::string          busName;
+   };
+   
    Connection(DBusConnection* conn, bool priv, Dispatcher* disp);
    ~Connection();
    void incRef();
    void decRef();
 
    DBusHandlerResult introspect(DBusMessage* msg);      
+   DBusHandlerResult replyPeerAddress(DBusMessage* msg);
+   void requestPeerAddress(const std::string& busName);
+   void detachPeer();
+   // Fails the requests still waiting on a reply over the peer connection
+   void failPeerRequests(DBusConnection* peerConn);
+   // Closing asks the bus to drop our match rules and names (if it won't
+   // by itself) without waiting on each answer in turn. Finishing never
+   // blocks, it returns true once the answers are in and the connection
+   // is flushed or the deadline has passed.
+   void startTeardown();
+   void sendTeardownCall(DBUSIPC_tConstStr method, DBUSIPC_tConstStr arg);
+   bool finishTeardown();
+   // Drops what the connection holds for the API once it's released
+   void cleanUp();
+   // Closes the D-Bus connection (if private) and deletes us
+   void destroy();
+   // Only asks, the caller counts a refusal (handle lock held)
+   bool isOutgoingBlocked() const;
+   void updateCongestion();
    static DBusHandlerResult messageFilter(DBusConnection* dbusConn,
                                     DBusMessage *msg, void* data);
    static void onDispatchStatusUpdate(DBusConnection* dbusConn,
                                       DBusDispatchStatus newStatus,
                                       void* data);
+   static void onHelloNotify(DBusPendingCall* call, void* data);
+   static void onPeerAddressNotify(DBusPendingCall* call, void* data);
+   static void freePeerProbe(void* data);
    
    // (Unimplemented) private copy constructor and assignment operator
    // to prevent misuse
@@ -72,22 +190,78 @@ private:
    //
    
    typedef std::map<Connection*,DBusConnection*> tConnCache;
+   typedef std::map<DBusConnection*,Connection*> tDBusConnIndex;
+   typedef std::map<std::string,Connection*> tAddressIndex;
    typedef std::set<SignalSubscription*> tSigSubContainer;
    typedef std::set<ServiceRegistration*> tSvcRegContainer;
    typedef std::set<BaseCommand*> tPendingContainer;
+   typedef std::map<std::string,Connection*> tPeerContainer;
+   typedef std::set<std::string> tBusNameContainer;
+   typedef std::map<std::string,InvokeCmd*> tCoalesceContainer;
+   typedef std::set<Connection*> tConnContainer;
+   typedef std::list<DBusPendingCall*> tCallContainer;
+   
+   // Longest time (msec) closing waits on the bus unless configured
+   enum { DEFAULT_TEARDOWN_MSEC_TIMEOUT = 1000 };
+   // Messages dispatched per pass of the dispatch loop unless configured
+   enum { DEFAULT_DISPATCH_BUDGET = 64 };
    
 	DBusConnection*           mDBusConn;
 	bool                      mPrivate;
+	// The address we share this connection by (if any)
+	std::string               mSharedAddress;
 	uint32_t                  mRefCount;
 	static tConnCache         msConnCache;
+	static tDBusConnIndex     msDBusConnIndex;
+	// Connections opened by address and shared between our callers
+	static tAddressIndex      msSharedConnIndex;
+	static HandleTable<Connection> msConnHandles;
+	static HandleTable<SignalSubscription> msSigSubHandles;
+	static HandleTable<ServiceRegistration> msSvcRegHandles;
+	// Serializes changes to the handle tables with client thread lookups
+	static MutexLock          msHandleLock;
+	// Connections with out-going queue watermarks
+	static tConnContainer     msLimitedConns;
+	// Released connections still waiting on the bus (see finishTeardown())
+	static tConnContainer     msClosingConns;
+	DBUSIPC_tConnection       mHandle;
 	Dispatcher*               mDispatcher;
 	tSigSubContainer          mSigSubscriptions;
 	tSvcRegContainer          mSvcRegistrations;
 	tPendingContainer         mPendingCmds;
+	// The bus has yet to answer our "Hello" (if non-NULL)
+	DBusPendingCall*          mHelloCall;
+	tCoalesceContainer        mCoalescedInvokes;
 	uint64_t                  mMaxDispatchProcTime;
+	DBUSIPC_tConnPriority     mDispatchPriority;
+	uint32_t                  mDispatchBudget;
+	uint64_t                  mTeardownTimeout;
+	bool                      mTearingDown;
+	uint64_t                  mTeardownDeadline;
+	tCallContainer            mTeardownCalls;
+	bool                      mPeerToPeer;
+	// The services peers are tried for (all of them if empty)
+	tBusNameContainer         mPeerBusNames;
+	tPeerContainer            mPeerConns;
+	Connection*               mPeerOwner;
+	std::string               mPeerBusName;
+	bool                      mPeerUsable;
+	ServiceRegistration*      mPeerService;
+	uint32_t                  mOutHighWater;
+	uint32_t                  mOutLowWater;
+	DBUSIPC_tBackpressureCallback mOnBackpressure;
+	DBUSIPC_tUserToken        mBackpressureToken;
+	bool                      mCongested;
+	volatile uint32_t         mOutRejected;
 };
 
 
+inline bool Connection::hasTeardowns()
+{
+   return !msClosingConns.empty();
+}
+
+
 inline bool Connection::connectionExists
    (
    Connection* conn
@@ -96,4 +270,55 @@ inline bool Connection::connectionExists
    return 0 != getDBusConnection(conn);
 }
 
+
+inline Connection* Connection::fromHandle
+   (
+   DBUSIPC_tConnection hnd
+   )
+{
+   return msConnHandles.lookup(hnd);
+}
+
+
+inline SignalSubscription* Connection::findSignalSub
+   (
+   DBUSIPC_tSigSubHnd   hnd
+   )
+{
+   return msSigSubHandles.lookup(hnd);
+}
+
+
+inline ServiceRegistration* Connection::findServiceReg
+   (
+   DBUSIPC_tSvcRegHnd   hnd
+   )
+{
+   return msSvcRegHandles.lookup(hnd);
+}
+
+
+inline DBUSIPC_tConnection Connection::getHandle() const
+{
+   return mHandle;
+}
+
+
+inline DBusConnection* Connection::getDBusConn() const
+{
+   return mDBusConn;
+}
+
+
+inline Dispatcher* Connection::getDispatcher() const
+{
+   return mDispatcher;
+}
+
+
+inline DBUSIPC_tConnPriority Connection::getDispatchPriority() const
+{
+   return mDispatchPriority;
+}
+
 #endif /* Guard for CONNECTION_HPP_ */
@@ -1,7 +1,11 @@
 
 #include <cerrno>
 #include <algorithm>
+#include <cstring>
 #include <assert.h>
+#if OS_LINUX
+#include <sys/epoll.h>
+#endif
 #include "Exceptions.hpp"
 #include "Dispatcher.hpp"
 #include "Command.hpp"
@@ -9,17 +13,93 @@
 #include "DBusTimeoutWrapper.hpp"
 #include "DBusWatchWrapper.hpp"
 #include "PipeWatch.hpp"
+#include "PeerConnector.hpp"
 #include "Connection.hpp"
+#include "Semaphore.hpp"
 #include "trace.h"
 
+#if OS_LINUX
+//
+// Helper function for updating the descriptors behind the event descriptor
+//
+static void DBUSIPC_ctlEventFd
+   (
+   int32_t  eventFd,
+   int32_t  op,
+   int32_t  fd,
+   uint32_t events
+   )
+{
+   struct epoll_event ev;
+   memset(&ev, 0, sizeof(ev));
+   ev.events = events;
+   ev.data.fd = fd;
+
+   if ( 0 != epoll_ctl(eventFd, op, fd, &ev) )
+   {
+      // A descriptor closed behind our back drops out by itself and its
+      // number may have been reused since
+      if ( (EPOLL_CTL_ADD == op) && (EEXIST == errno) )
+      {
+         (void)epoll_ctl(eventFd, EPOLL_CTL_MOD, fd, &ev);
+      }
+      else if ( (EPOLL_CTL_MOD == op) && (ENOENT == errno) )
+      {
+         (void)epoll_ctl(eventFd, EPOLL_CTL_ADD, fd, &ev);
+      }
+   }
+}
+
+
+//
+// Helper function returning the epoll events an enabled watch waits for
+//
+static uint32_t DBUSIPC_getWatchEvents
+   (
+   Watch*   watch
+   )
+{
+   uint32_t events(0U);
+   uint32_t flags = watch->flags();
+
+   if ( 0U != (flags & DBUS_WATCH_READABLE) )
+   {
+      events |= EPOLLIN;
+   }
+   if ( 0U != (flags & DBUS_WATCH_WRITABLE) )
+   {
+      events |= EPOLLOUT;
+   }
+
+   return events;
+}
+#endif
+
 Dispatcher::Dispatcher()
    : Thread()
-   , mPendingConnList()
+   , mReadyBacklog(false)
+   , mPendingCmds()
    , mCmdHandleCounter(DBUSIPC_INVALID_HANDLE)
    , mCmdQueue()
    , mCmdQLock()
+   , mDeferredCmds()
+   , mLoopLock()
+   , mPollDeadline(0U)
+   , mWakeupNeeded(false)
+   , mNumQueued(0U)
+   , mQueueHighWater(0U)
+   , mStats()
    , mPipe()
    , mPipeWatch(0)
+   , mPollFds()
+   , mIntegrated(false)
+   , mLoopThread()
+   , mLoopActive(false)
+   , mStopSem(0)
+   , mDispatching(false)
+   , mEventFd(-1)
+   , mEventFds()
+   , mPeerConnector()
 {
    if ( !mPipe.open(true, false) )
    {
@@ -38,20 +118,138 @@ Dispatcher::Dispatcher()
 
 Dispatcher::~Dispatcher()
 {
+   // Connections the peer connector opens from now on are closed
+   mPeerConnector.reset();
+
    // Stop and wait for the dispatching thread to exit
    stop();
    wait(INFINITE_WAIT);
 
+   // Cancel and delete any commands the dispatcher left unexecuted
+   while ( !mDeferredCmds.empty() )
+   {
+      BaseCommand* cmd = mDeferredCmds.front();
+      mDeferredCmds.pop_front();
+      cmd->cancel(*this);
+      delete cmd;
+   }
+
    // Cancel and delete any remaining commands still queued
    ScopedLock lock(mCmdQLock);
    while ( !mCmdQueue.empty() )
    {
       BaseCommand* cmd = mCmdQueue.front();
       mCmdQueue.pop_front();
-      assert( 0 != cmd );
-      cmd->cancel(*this);
-      delete cmd;
+      // Wake-ups are queued as empty commands
+      if ( 0 != cmd )
+      {
+         cmd->cancel(*this);
+         delete cmd;
+      }
+   }
+
+   // The pipe's watch is removed after this
+   if ( -1 != mEventFd )
+   {
+      (void)close(mEventFd);
+      mEventFd = -1;
+   }
+}
+
+
+int32_t Dispatcher::integrate()
+{
+   int32_t rc(EOK);
+
+#if OS_LINUX
+   ScopedLock lock(mCmdQLock);
+   if ( mLoopActive || Thread::isRunning() )
+   {
+      rc = EBUSY;
+   }
+   else
+   {
+      mEventFd = epoll_create1(EPOLL_CLOEXEC);
+      if ( -1 == mEventFd )
+      {
+         rc = errno;
+      }
+      else
+      {
+         mIntegrated = true;
+         mLoopThread = pthread_self();
+         mLoopActive = true;
+         syncEventFd();
+      }
+   }
+#else
+   rc = ENOSYS;
+#endif
+
+   return rc;
+}
+
+
+bool Dispatcher::isRunning()
+{
+   bool running(false);
+   if ( mIntegrated )
+   {
+      ScopedLock lock(mCmdQLock);
+      running = mLoopActive;
+   }
+   else
+   {
+      running = Thread::isRunning();
+   }
+
+   return running;
+}
+
+
+void Dispatcher::stop()
+{
+   if ( mIntegrated )
+   {
+      ScopedLock lock(mCmdQLock);
+      mLoopActive = false;
+   }
+   Thread::stop();
+}
+
+
+void Dispatcher::stopWhenClosed
+   (
+   Semaphore* sem
+   )
+{
+   assert( 0 != sem );
+   
+   // Otherwise the dispatch loop stops once they're done
+   if ( Connection::hasTeardowns() )
+   {
+      mStopSem = sem;
    }
+   else
+   {
+      stop();
+      sem->post();
+   }
+}
+
+
+bool Dispatcher::isCurrentThread() const
+{
+   // The integrated loop's thread may block outside of it
+   return mIntegrated ? (isLoopThread() && mDispatching) :
+                        Thread::isCurrentThread();
+}
+
+
+bool Dispatcher::isLoopThread() const
+{
+   return mIntegrated ? (0 != pthread_equal(mLoopThread, pthread_self())) :
+                        Thread::isCurrentThread();
 }
 
 bool Dispatcher::onCommand
@@ -86,8 +284,8 @@ bool Dispatcher::onCommand
          disp->mCmdQueue.pop_front();
          if ( 0 != cmd )
          {
-            // Execute the command
-            cmd->execute(*disp);
+            --disp->mNumQueued;
+            disp->executeTimed(cmd);
 
             // See if the command should be destroyed after executing or
             // it's made arrangements to save itself somewhere
@@ -96,6 +294,9 @@ bool Dispatcher::onCommand
             {
                delete cmd;
             }
+
+            // Along with whatever its callback submitted
+            disp->executeDeferred();
          }
       }
    }
@@ -107,78 +308,197 @@ bool Dispatcher::onCommand
 
 bool Dispatcher::execute()
 {
+   (void)runOnce(DEFAULT_POLL_MSEC_WAIT);
+
+   return true;
+}
+
+
+bool Dispatcher::runOnce
+   (
+   int32_t  msecWait
+   )
+{
+   bool busy(false);
+
    try
    {
-      dispatchPending();
-      dispatch();
+      {
+         ScopedLock lock(mLoopLock);
+         uint64_t start = NSysDep::DBUSIPC_getSystemTimeUsec();
+         dispatchPending();
+         addSample(mStats.dispatchPending,
+                   NSysDep::DBUSIPC_getSystemTimeUsec() - start);
+      }
+      busy = dispatch(msecWait);
    }
    catch ( const std::exception& e)
    {
-      TRACE_ERROR("Dispatcher::execute - caught exception: %s", e.what());
+      TRACE_ERROR("Dispatcher::runOnce - caught exception: %s", e.what());
    }
 
-   return true;
+   return busy;
 }
 
-void Dispatcher::dispatchPending()
-{
-   tConnList::iterator it;
-   tConnList::iterator doneIt;
 
-   it = mPendingConnList.begin();
-   while ( it != mPendingConnList.end() )
+void Dispatcher::waitFor
+   (
+   Semaphore&  sem
+   )
+{
+   if ( mIntegrated && isLoopThread() )
    {
-      // If dispatching messages on this connection is NOT complete then ...
-      if ( !(*it)->dispatchMessages() )
+      // Nobody else runs the loop while the caller is blocked in here
+      bool dispatching(mDispatching);
+      mDispatching = true;
+      while ( !sem.tryWait(0) )
       {
-         // Advance to the next one
-         ++it;
+         (void)runOnce(DEFAULT_POLL_MSEC_WAIT);
       }
-      else  // Else this connection has dispatched its messages
-      {
-         // Remember the connection we want to remove
-         doneIt = it;
+      mDispatching = dispatching;
+      syncEventFd();
+   }
+   else
+   {
+      sem.wait();
+   }
+}
+
 
-         // Move to the next one in the list
-         ++it;
+DBUSIPC_tError Dispatcher::processEvents
+   (
+   uint32_t budget
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
 
-         // Remove the completed connection
-         mPendingConnList.erase(doneIt);
+   if ( !mIntegrated || !isLoopThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_NOT_SUPPORTED);
+   }
+   else if ( mDispatching )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      // Each pass serves the ready connections, the expired timeouts and
+      // the ready descriptors once (without blocking). Without a budget a
+      // single pass is made so constant load can't keep the caller here.
+      uint32_t passes = (0U == budget) ? 1U : budget;
+      bool busy(true);
+      mDispatching = true;
+      for ( uint32_t n = 0U; busy && (n < passes); ++n )
+      {
+         busy = runOnce(0) || hasBacklog();
       }
+      mDispatching = false;
+      syncEventFd();
    }
+
+   return status;
 }
 
 
-void Dispatcher::dispatch()
+DBUSIPC_tError Dispatcher::getEventFd
+   (
+   int32_t& fd
+   )
 {
-   NSysDep::DBUSIPC_tPollFd fds;
-   tWatchContainer::iterator wIt;
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
 
-   mPollFds.resize(0);
-   if ( mWatches.size() > mPollFds.capacity() )
+   if ( !mIntegrated )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_NOT_SUPPORTED);
+   }
+   else
    {
-      mPollFds.reserve(mWatches.size());
+      fd = mEventFd;
    }
 
-   for ( wIt = mWatches.begin(); wIt != mWatches.end(); ++wIt )
+   return status;
+}
+
+
+DBUSIPC_tError Dispatcher::getNextTimeout
+   (
+   int32_t& msecTimeout
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( !mIntegrated || !isLoopThread() )
    {
-      if ( (*wIt)->enabled() )
-      {
-         fds.fd = (*wIt)->descriptor();
-         fds.revents = 0;
-         fds.events = static_cast<int16_t>((*wIt)->flags());
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_NOT_SUPPORTED);
+   }
+   else
+   {
+      // Commands submitted since the last call may have changed the watches
+      syncEventFd();
 
-         mPollFds.push_back(fds);
-      }
+      ScopedLock lock(mLoopLock);
+      msecTimeout = getWait(-1, NSysDep::DBUSIPC_getSystemTime());
    }
 
-   int32_t minWait = DEFAULT_POLL_MSEC_WAIT;
-   uint64_t remaining = DEFAULT_POLL_MSEC_WAIT;
-   uint64_t now = NSysDep::DBUSIPC_getSystemTime();
+   return status;
+}
 
-   tTimeoutContainer::iterator tIt;
 
-   for ( tIt = mTimeouts.begin(); tIt != mTimeouts.end(); ++tIt )
+bool Dispatcher::hasBacklog()
+{
+   ScopedLock lock(mLoopLock);
+   bool backlog(mReadyBacklog || !mDeferredCmds.empty());
+
+   for ( uint32_t prio = 0U; !backlog &&
+      (prio < DBUSIPC_CONN_PRIORITY_NUM_CLASSES); ++prio )
+   {
+      backlog = !mReady[prio].empty();
+   }
+
+   return backlog;
+}
+
+
+int32_t Dispatcher::getWait
+   (
+   int32_t  maxWait,
+   uint64_t now
+   )
+{
+   int32_t minWait(maxWait);
+
+   // Don't block if connections still have messages to dispatch or
+   // commands were left over
+   if ( hasBacklog() )
+   {
+      minWait = 0;
+   }
+
+   // Closing connections give up on the bus at their deadline
+   uint64_t deadline = Connection::getTeardownDeadline();
+   if ( (0 != minWait) && (0U != deadline) )
+   {
+      if ( now >= deadline )
+      {
+         minWait = 0;
+      }
+      else if ( (0 > minWait) ||
+         (deadline - now < static_cast<uint64_t>(minWait)) )
+      {
+         minWait = static_cast<int32_t>(deadline - now);
+      }
+   }
+
+   for ( tTimeoutContainer::iterator tIt = mTimeouts.begin();
+      (0 != minWait) && (tIt != mTimeouts.end()); ++tIt )
    {
       // If this timeout is still enabled then ...
       if ( (*tIt)->enabled() )
@@ -189,26 +509,161 @@ void Dispatcher::dispatch()
             // We don't want to wait in the call to poll since a timeout
             // is already pending.
             minWait = 0;
-            break;
          }
          else
          {
             // Calculate the time remaining before this timeout expires
-            remaining = (*tIt)->expiry() - now;
-            if ( (int32_t)remaining < minWait )
+            uint64_t remaining = (*tIt)->expiry() - now;
+            if ( (0 > minWait) ||
+               (remaining < static_cast<uint64_t>(minWait)) )
             {
                // This is the new minimum amount of time to block in the
                // call to poll.
-               minWait = (int32_t)remaining;
+               minWait = static_cast<int32_t>(remaining);
             }
          }
       }
    }
 
+   return minWait;
+}
+
+
+void Dispatcher::syncEventFd()
+{
+#if OS_LINUX
+   if ( -1 != mEventFd )
+   {
+      ScopedLock lock(mLoopLock);
+      tEventFdContainer wanted;
+
+      for ( tWatchContainer::iterator wIt = mWatches.begin();
+         wIt != mWatches.end(); ++wIt )
+      {
+         if ( (*wIt)->enabled() )
+         {
+            // A socket may have a watch for reading and one for writing
+            wanted[(*wIt)->descriptor()] |= DBUSIPC_getWatchEvents(*wIt);
+         }
+      }
+
+      // Both are ordered by descriptor so only the differences are applied
+      tEventFdContainer::iterator oldIt = mEventFds.begin();
+      tEventFdContainer::iterator newIt = wanted.begin();
+      while ( (oldIt != mEventFds.end()) || (newIt != wanted.end()) )
+      {
+         if ( (newIt == wanted.end()) || ((oldIt != mEventFds.end()) &&
+            ((*oldIt).first < (*newIt).first)) )
+         {
+            DBUSIPC_ctlEventFd(mEventFd, EPOLL_CTL_DEL, (*oldIt).first, 0U);
+            ++oldIt;
+         }
+         else if ( (oldIt == mEventFds.end()) ||
+            ((*newIt).first < (*oldIt).first) )
+         {
+            DBUSIPC_ctlEventFd(mEventFd, EPOLL_CTL_ADD, (*newIt).first,
+                               (*newIt).second);
+            ++newIt;
+         }
+         else
+         {
+            if ( (*oldIt).second != (*newIt).second )
+            {
+               DBUSIPC_ctlEventFd(mEventFd, EPOLL_CTL_MOD, (*newIt).first,
+                                  (*newIt).second);
+            }
+            ++oldIt;
+            ++newIt;
+         }
+      }
+      mEventFds.swap(wanted);
+   }
+#endif
+}
+
+void Dispatcher::dispatchPending()
+{
+   mReadyBacklog = false;
+
+   // Serve the classes in order of priority. Each connection that is ready
+   // gets one turn (limited by its budget) per pass and goes to the back of
+   // the list if it still has messages left so one flooded connection can't
+   // hold up the others. Connections made ready by the dispatching itself
+   // wait for the next pass.
+   for ( uint32_t prio = 0U; prio < DBUSIPC_CONN_PRIORITY_NUM_CLASSES; ++prio )
+   {
+      ReadyList<Connection>& ready = mReady[prio];
+      for ( uint32_t n = ready.size(); (0U != n) && !ready.empty(); --n )
+      {
+         Connection* conn = ready.popFront();
+         DBusDispatchStatus status = conn->dispatchMessages();
+
+         // Send the replies (etc.) the handlers submitted before the next
+         // connection gets its turn
+         executeDeferred();
+         if ( DBUS_DISPATCH_COMPLETE != status )
+         {
+            // A callback may have moved it to another class meanwhile
+            if ( !conn->isLinked() )
+            {
+               mReady[conn->getDispatchPriority()].pushBack(conn);
+            }
+
+            // Messages that are already queued mustn't wait on poll()
+            if ( DBUS_DISPATCH_DATA_REMAINS == status )
+            {
+               mReadyBacklog = true;
+            }
+         }
+      }
+   }
+}
+
+
+bool Dispatcher::dispatch
+   (
+   int32_t  maxWait
+   )
+{
+   NSysDep::DBUSIPC_tPollFd fds;
+   tWatchContainer::iterator wIt;
+   tTimeoutContainer::iterator tIt;
+   int32_t minWait(maxWait);
+   uint64_t now(0U);
+
+   {
+      ScopedLock lock(mLoopLock);
+
+      mPollFds.resize(0);
+      if ( mWatches.size() > mPollFds.capacity() )
+      {
+         mPollFds.reserve(mWatches.size());
+      }
+
+      for ( wIt = mWatches.begin(); wIt != mWatches.end(); ++wIt )
+      {
+         if ( (*wIt)->enabled() )
+         {
+            fds.fd = (*wIt)->descriptor();
+            fds.revents = 0;
+            fds.events = static_cast<int16_t>((*wIt)->flags());
+
+            mPollFds.push_back(fds);
+         }
+      }
+
+      now = NSysDep::DBUSIPC_getSystemTime();
+      minWait = getWait(maxWait, now);
+      mPollDeadline = now + static_cast<uint64_t>(minWait);
+   }
+
+   // Client threads may execute commands directly while we're blocked
+   uint64_t pollStart = NSysDep::DBUSIPC_getSystemTimeUsec();
    int32_t nSelected = NSysDep::DBUSIPC_poll(mPollFds, minWait);
 
-   // If there was an error polling the file descriptors then
-   if ( 0 > nSelected )
+   // If there was an error polling the file descriptors then (being
+   // interrupted by a signal, e.g. the watchdog's, just means polling again)
+   if ( (0 > nSelected) && (EINTR != errno) )
    {
       // If we haven't waited at least a minimum amount of time then yield to
       // other threads in the system so we don't (potentially) consume all
@@ -220,8 +675,13 @@ void Dispatcher::dispatch()
       }
    }
    
+   ScopedLock lock(mLoopLock);
    now = NSysDep::DBUSIPC_getSystemTime();
 
+   // Waiting for the loop lock counts as waiting
+   uint64_t timersStart = NSysDep::DBUSIPC_getSystemTimeUsec();
+   addSample(mStats.pollWait, timersStart - pollStart);
+
    typedef std::list<Timeout*> tExpiredTimerContainer;
    tExpiredTimerContainer expiredTimers;
    
@@ -261,7 +721,11 @@ void Dispatcher::dispatch()
       // Do what needs to be done to handle this timer
       (*expTmrIt)->handle();
    }
+   executeDeferred();
    
+   uint64_t watchesStart = NSysDep::DBUSIPC_getSystemTimeUsec();
+   addSample(mStats.timerHandling, watchesStart - timersStart);
+
    // If any of the descriptors was selected then ...
    if ( 0 < nSelected )
    {
@@ -309,6 +773,25 @@ void Dispatcher::dispatch()
          }
       }
    }
+
+   // This includes executing the queued commands
+   addSample(mStats.watchHandling,
+             NSysDep::DBUSIPC_getSystemTimeUsec() - watchesStart);
+   ++mStats.iterations;
+
+   // Writing out messages may have relieved a congested connection
+   Connection::checkOutgoingLimits();
+   
+   // And may have finished closing the released connections
+   Connection::checkTeardowns();
+   if ( (0 != mStopSem) && !Connection::hasTeardowns() )
+   {
+      stop();
+      mStopSem->post();
+      mStopSem = 0;
+   }
+
+   return (0 < nSelected) || !expiredTimers.empty();
 }
 
 
@@ -317,7 +800,8 @@ void Dispatcher::addPending
    Connection*   conn
    )
 {
-   mPendingConnList.push_back(conn);
+   mReady[conn->getDispatchPriority()].pushBack(conn);
+   mWakeupNeeded = true;
 }
 
 
@@ -326,7 +810,7 @@ void Dispatcher::removePending
    Connection* conn
    )
 {
-   mPendingConnList.remove(conn);
+   mReady[conn->getDispatchPriority()].remove(conn);
 }
 
 
@@ -337,6 +821,7 @@ void Dispatcher::addWatch
 {
    assert( 0 != watch );
    mWatches.insert(watch);
+   mWakeupNeeded = true;
 
    return;
 }
@@ -349,6 +834,37 @@ void Dispatcher::removeWatch
 {
    assert( 0 != watch );
    mWatches.erase(watch);
+
+#if OS_LINUX
+   // Its descriptor may be closed and reused before the next sync so it's
+   // dropped at once unless the other watch on the socket (reading or
+   // writing) still wants it, which then keeps only its own events
+   int32_t fd = watch->descriptor();
+   tEventFdContainer::iterator fdIt = mEventFds.find(fd);
+   if ( (-1 != mEventFd) && (mEventFds.end() != fdIt) )
+   {
+      uint32_t events(0U);
+      for ( tWatchContainer::iterator wIt = mWatches.begin();
+         wIt != mWatches.end(); ++wIt )
+      {
+         if ( (*wIt)->enabled() && (fd == (*wIt)->descriptor()) )
+         {
+            events |= DBUSIPC_getWatchEvents(*wIt);
+         }
+      }
+
+      if ( 0U == events )
+      {
+         DBUSIPC_ctlEventFd(mEventFd, EPOLL_CTL_DEL, fd, 0U);
+         mEventFds.erase(fdIt);
+      }
+      else if ( (*fdIt).second != events )
+      {
+         DBUSIPC_ctlEventFd(mEventFd, EPOLL_CTL_MOD, fd, events);
+         (*fdIt).second = events;
+      }
+   }
+#endif
 }
 
 
@@ -359,6 +875,7 @@ void Dispatcher::addTimeout
 {
    assert( 0 != timeout );
    mTimeouts.insert(timeout);
+   noteTimeoutChange(timeout);
 
    return;
 }
@@ -451,6 +968,7 @@ void Dispatcher::onToggleWatchCallback
       if ( 0 != w )
       {
          w->toggle();
+         disp->mWakeupNeeded = true;
       }
       else
       {
@@ -538,6 +1056,7 @@ void Dispatcher::onToggleTimeoutCallback
       if ( 0 != t )
       {
          t->toggle();
+         disp->noteTimeoutChange(t);
       }
       else
       {
@@ -549,13 +1068,15 @@ void Dispatcher::onToggleTimeoutCallback
 
 DBUSIPC_tHandle Dispatcher::getNextHandle()
 {
-   mCmdHandleCounter++;
-   if ( DBUSIPC_INVALID_HANDLE == mCmdHandleCounter )
+   // Atomic since the dispatcher thread defers commands without taking
+   // the command queue lock
+   DBUSIPC_tHandle hnd = __sync_add_and_fetch(&mCmdHandleCounter, 1U);
+   if ( DBUSIPC_INVALID_HANDLE == hnd )
    {
-      mCmdHandleCounter++;
+      hnd = __sync_add_and_fetch(&mCmdHandleCounter, 1U);
    }
 
-   return mCmdHandleCounter;
+   return hnd;
 }
 
 
@@ -564,36 +1085,344 @@ DBUSIPC_tHandle Dispatcher::submitCommand
    BaseCommand*   cmd
    )
 {
-   ScopedLock lock(mCmdQLock);
-   DBUSIPC_tChar dummy(0);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   // A handler calling back into the library from the dispatcher thread
+   // (or the integrated loop's thread) needn't wait on the next turn of
+   // the loop
+   if ( isLoopThread() )
+   {
+      hnd = deferCommand(cmd);
+   }
+   else
+   {
+      ScopedLock lock(mCmdQLock);
+      DBUSIPC_tChar dummy(0);
+
+      // Submit a command if we have one and the dispatcher is running
+      if ( (0 != cmd) && isRunning() )
+      {
+         hnd = getNextHandle();
+         cmd->setSubmitTime(NSysDep::DBUSIPC_getSystemTimeUsec());
+         mCmdQueue.push_back(cmd);
+         TRACE_EVENT(DBUSIPC_TRACE_CMD_SUBMITTED, hnd, 0U, 0U, 0U);
 
+         int32_t nBytes = mPipe.write(&dummy, 1);
+         if ( -1 == nBytes )
+         {
+            TRACE_WARN("submitCommand: Failed to submit command!");
+            hnd = DBUSIPC_INVALID_HANDLE;
+            mCmdQueue.pop_back();
+         }
+         else if ( ++mNumQueued > mQueueHighWater )
+         {
+            mQueueHighWater = mNumQueued;
+         }
+
+         // Update the command handle
+         cmd->setHandle(hnd);
+      }
+   }
+   return hnd;
+}
+
+
+DBUSIPC_tHandle Dispatcher::deferCommand
+   (
+   BaseCommand*   cmd
+   )
+{
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
-   // Submit a command if we have one and the dispatcher is running
    if ( (0 != cmd) && isRunning() )
    {
       hnd = getNextHandle();
-      mCmdQueue.push_back(cmd);
+      cmd->setHandle(hnd);
+      cmd->setSubmitTime(NSysDep::DBUSIPC_getSystemTimeUsec());
+      mDeferredCmds.push_back(cmd);
+      TRACE_EVENT(DBUSIPC_TRACE_CMD_SUBMITTED, hnd, 0U, 0U, 0U);
+   }
+   return hnd;
+}
+
 
-      int32_t nBytes = mPipe.write(&dummy, 1);
-      if ( -1 == nBytes )
+void Dispatcher::executeDeferred()
+{
+   // Commands submitted while these execute are appended and run too
+   while ( !mDeferredCmds.empty() )
+   {
+      BaseCommand* cmd = mDeferredCmds.front();
+      mDeferredCmds.pop_front();
+      try
       {
-         TRACE_WARN("submitCommand: Failed to submit command!");
-         hnd = DBUSIPC_INVALID_HANDLE;
-         mCmdQueue.pop_back();
+         executeTimed(cmd);
+      }
+      catch ( const std::exception& e )
+      {
+         TRACE_ERROR("executeDeferred - caught exception: %s", e.what());
       }
 
-      // Update the command handle
+      if ( cmd->execAndDestroy() )
+      {
+         delete cmd;
+      }
+   }
+}
+
+
+DBUSIPC_tHandle Dispatcher::executeDirect
+   (
+   BaseCommand*   cmd
+   )
+{
+   // Keeps the dispatcher thread out of the connections (and the
+   // bookkeeping they share with it) while we're using them
+   ScopedLock loopLock(mLoopLock);
+
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+   if ( isLoopThread() )
+   {
+      // Already on the loop so this is as direct as it gets (and the
+      // callback doesn't run before the caller got the handle)
+      hnd = deferCommand(cmd);
+   }
+   else if ( (0 != cmd) && isRunning() )
+   {
+      {
+         ScopedLock lock(mCmdQLock);
+         hnd = getNextHandle();
+      }
       cmd->setHandle(hnd);
+
+      mWakeupNeeded = false;
+      try
+      {
+         executeTimed(cmd);
+      }
+      catch ( const std::exception& e )
+      {
+         TRACE_ERROR("executeDirect - caught exception: %s", e.what());
+      }
+
+      if ( cmd->execAndDestroy() )
+      {
+         delete cmd;
+      }
+
+      // Only interrupt the poll() if the command left something for it,
+      // e.g. a reply timeout expiring before it returns or a message
+      // that couldn't be written out right away.
+      if ( mWakeupNeeded )
+      {
+         wakeup();
+      }
    }
    return hnd;
 }
 
 
+bool Dispatcher::sendDirect
+   (
+   DBusConnection*   dbusConn,
+   DBusMessage*      msg,
+   dbus_uint32_t*    serial
+   )
+{
+   assert( 0 != dbusConn );
+   assert( 0 != msg );
+
+   // Sending can toggle the connection's watches which the dispatcher
+   // thread must not be walking at the same time
+   ScopedLock loopLock(mLoopLock);
+
+   bool onLoop = isLoopThread();
+   if ( !onLoop )
+   {
+      mWakeupNeeded = false;
+   }
+
+   bool sent = (0 != dbus_connection_send(dbusConn, msg, serial));
+
+   // libdbus writes out as much as it can right away. The blocked poll()
+   // only has to start watching for the socket to become writable if the
+   // message was left in the out-going queue.
+   if ( !onLoop && mWakeupNeeded )
+   {
+      wakeup();
+   }
+
+   return sent;
+}
+
+
+void Dispatcher::executeTimed
+   (
+   BaseCommand*   cmd
+   )
+{
+   assert( 0 != cmd );
+
+   // Read before executing since the command may delete itself
+   DBUSIPC_tCmdStats& stats = mStats.commands[cmd->getType()];
+   uint64_t start = NSysDep::DBUSIPC_getSystemTimeUsec();
+
+   // Commands executed directly were never queued
+   if ( 0U != cmd->getSubmitTime() )
+   {
+      addSample(stats.queueDelay, start - cmd->getSubmitTime());
+   }
+
+   TRACE_EVENT(DBUSIPC_TRACE_CMD_EXECUTED, cmd->getHandle(), 0U, 0U, 0U);
+   cmd->execute(*this);
+   addSample(stats.execTime, NSysDep::DBUSIPC_getSystemTimeUsec() - start);
+}
+
+
+void Dispatcher::addSample
+   (
+   DBUSIPC_tHistogram& hist,
+   uint64_t           usec
+   )
+{
+   uint32_t bucket(0U);
+   if ( 0U != usec )
+   {
+      // The number of significant bits picks the power of two bucket
+      bucket = 64U - static_cast<uint32_t>(__builtin_clzll(usec));
+      if ( bucket >= DBUSIPC_HISTOGRAM_NUM_BUCKETS )
+      {
+         bucket = DBUSIPC_HISTOGRAM_NUM_BUCKETS - 1U;
+      }
+   }
+
+   ++hist.buckets[bucket];
+   ++hist.count;
+   hist.totalUsec += usec;
+   if ( usec > hist.maxUsec )
+   {
+      hist.maxUsec = usec;
+   }
+}
+
+
+void Dispatcher::getStats
+   (
+   DBUSIPC_tDispatcherStats&  stats,
+   bool                      reset
+   )
+{
+   // The dispatcher (or a client thread executing a command directly)
+   // holds the loop lock while it updates the timings
+   {
+      ScopedLock loopLock(mLoopLock);
+      stats = mStats;
+      if ( reset )
+      {
+         memset(&mStats, 0, sizeof(mStats));
+      }
+   }
+
+   // Submitters update the queue counts with only the queue lock held
+   ScopedLock lock(mCmdQLock);
+   stats.queueDepth = mNumQueued;
+   stats.queueHighWater = mQueueHighWater;
+   if ( reset )
+   {
+      mQueueHighWater = mNumQueued;
+   }
+}
+
+
+void Dispatcher::noteTimeoutChange
+   (
+   const Timeout* timeout
+   )
+{
+   assert( 0 != timeout );
+   if ( timeout->enabled() && (timeout->expiry() < mPollDeadline) )
+   {
+      mWakeupNeeded = true;
+   }
+}
+
+
+void Dispatcher::wakeup()
+{
+   ScopedLock lock(mCmdQLock);
+   DBUSIPC_tChar dummy(0);
+   
+   // An empty command interrupts the poll without executing anything
+   if ( isRunning() )
+   {
+      mCmdQueue.push_back(0);
+      if ( -1 == mPipe.write(&dummy, 1) )
+      {
+         TRACE_WARN("wakeup: Failed to wake the dispatcher!");
+         mCmdQueue.pop_back();
+      }
+   }
+}
+
+
 DBUSIPC_tError Dispatcher::cancelCommand
    (
    DBUSIPC_tHandle hnd
    )
 {
-   return Connection::cancelPendingByHandle(hnd);
+   DBUSIPC_tError status(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                          DBUSIPC_DOMAIN_IPC_LIB,
+                                          DBUSIPC_ERR_NOT_FOUND));
+   
+   tPendingCmd* pending = mPendingCmds.find(hnd);
+   if ( 0 != pending )
+   {
+      pending->conn->cancelPending(pending->cmd);
+      status = DBUSIPC_ERROR_NONE;
+   }
+   
+   return status;
+}
+
+
+void Dispatcher::connectPeer
+   (
+   DBUSIPC_tConnection   owner,
+   const std::string&   busName,
+   const std::string&   address
+   )
+{
+   if ( 0 == mPeerConnector.get() )
+   {
+      mPeerConnector.reset(new PeerConnector(this));
+   }
+   mPeerConnector->connect(owner, busName, address);
+}
+
+
+void Dispatcher::addPendingCmd
+   (
+   Connection*    conn,
+   BaseCommand*   cmd
+   )
+{
+   assert( 0 != conn );
+   assert( 0 != cmd );
+   
+   tPendingCmd pending = { conn, cmd };
+   mPendingCmds.insert(cmd->getHandle(), pending);
+}
+
+
+void Dispatcher::removePendingCmd
+   (
+   BaseCommand*   cmd
+   )
+{
+   assert( 0 != cmd );
+   
+   tPendingCmd* pending = mPendingCmds.find(cmd->getHandle());
+   if ( (0 != pending) && (pending->cmd == cmd) )
+   {
+      mPendingCmds.erase(cmd->getHandle());
+   }
 }
 
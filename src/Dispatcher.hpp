@@ -2,15 +2,19 @@
 #define DISPATCHER_HPP_
 
 #include <set>
+#include <map>
 #include <list>
 #include <vector>
 #include <deque>
 #include <memory>
+#include <string>
 #include "NSysDep.hpp"
 #include "Pipe.hpp"
 #include "dbus/dbus.h"
 #include "Thread.hpp"
+#include "HandleIndex.hpp"
 #include "MutexLock.hpp"
+#include "ReadyList.hpp"
 #include "dbusipc/dbusipc.h"
 
 //
@@ -21,6 +25,8 @@ class Watch;
 class Timeout;
 class PipeWatch;
 class Connection;
+class Semaphore;
+class PeerConnector;
 
 class Dispatcher : public Thread
 {
@@ -28,6 +34,26 @@ public:
 	Dispatcher();
 	~Dispatcher();
 
+   // Makes the calling thread run the loop (see DBUSIPC_processEvents())
+   // rather than starting the dispatcher thread
+   int32_t integrate();
+   // Hide the Thread versions so an integrated loop counts as the
+   // dispatcher thread (while it's running callbacks)
+   bool isRunning();
+   void stop();
+   // Stops once the released connections have finished closing and then
+   // posts the semaphore (see ShutdownCmd)
+   void stopWhenClosed(Semaphore* sem);
+   bool isCurrentThread() const;
+   // The thread running the loop whether or not it's in a callback
+   bool isLoopThread() const;
+   // Runs the loop on the calling thread until the semaphore is posted if
+   // it's the integrated loop's thread, otherwise just waits
+   void waitFor(Semaphore& sem);
+   DBUSIPC_tError processEvents(uint32_t budget);
+   DBUSIPC_tError getEventFd(int32_t& fd);
+   DBUSIPC_tError getNextTimeout(int32_t& msecTimeout);
+
 	void addPending(Connection* conn);
 	void removePending(Connection* conn);
 	void addWatch(Watch* watch);
@@ -35,7 +61,25 @@ public:
 	void addTimeout(Timeout* timeout);
 	void removeTimeout(Timeout* timeout);
    DBUSIPC_tHandle submitCommand(BaseCommand* cmd);
+   // Executes a command on the calling thread (see mLoopLock)
+   DBUSIPC_tHandle executeDirect(BaseCommand* cmd);
+   // Queues a message on a connection from the calling thread (see
+   // mLoopLock). Returns false if libdbus ran out of memory.
+   bool sendDirect(DBusConnection* dbusConn, DBusMessage* msg,
+                   dbus_uint32_t* serial);
+   void wakeup();
    DBUSIPC_tError cancelCommand(DBUSIPC_tHandle hnd);
+   void getStats(DBUSIPC_tDispatcherStats& stats, bool reset);
+   static void addSample(DBUSIPC_tHistogram& hist, uint64_t usec);
+   
+   // Opens a direct peer connection for the owner on the peer connector's
+   // thread (see Connection::adoptPeerConnection())
+   void connectPeer(DBUSIPC_tConnection owner, const std::string& busName,
+                    const std::string& address);
+   
+   // Indexes the commands waiting on a reply by their handle
+   void addPendingCmd(Connection* conn, BaseCommand* cmd);
+   void removePendingCmd(BaseCommand* cmd);
 
    //
    // Callbacks for handling D-Bus Watch and Timeouts
@@ -56,26 +100,79 @@ private:
         };
 
    bool execute();
+   bool runOnce(int32_t msecWait);
    void dispatchPending();
-   void dispatch();
+   bool dispatch(int32_t maxWait);
+   int32_t getWait(int32_t maxWait, uint64_t now);
+   bool hasBacklog();
+   void syncEventFd();
+   DBUSIPC_tHandle deferCommand(BaseCommand* cmd);
+   void executeDeferred();
    DBUSIPC_tHandle getNextHandle();
+   void noteTimeoutChange(const Timeout* timeout);
+   void executeTimed(BaseCommand* cmd);
    static bool onCommand(uint32_t flags, void* data);
 
+   // A command waiting on a reply and the connection it's waiting on
+   struct tPendingCmd
+   {
+      Connection*    conn;
+      BaseCommand*   cmd;
+   };
+   
    // Convenient typedefs for containers
    typedef std::deque<BaseCommand*> tCmdContainer;
-   typedef std::list<Connection*> tConnList;
+   typedef HandleIndex<tPendingCmd> tPendingCmdContainer;
    typedef std::set<Watch*> tWatchContainer;
    typedef std::set<Timeout*> tTimeoutContainer;
+   typedef std::map<int32_t, uint32_t> tEventFdContainer;
 
-   tConnList                        mPendingConnList;
+   // Connections with messages to dispatch (one list per priority class)
+   ReadyList<Connection>            mReady[DBUSIPC_CONN_PRIORITY_NUM_CLASSES];
+   // Set when a connection used up its budget with messages left over
+   bool                             mReadyBacklog;
+   tPendingCmdContainer             mPendingCmds;
    DBUSIPC_tHandle                   mCmdHandleCounter;
    tCmdContainer                    mCmdQueue;
    MutexLock                        mCmdQLock;
+   // Commands submitted by the dispatcher thread itself (e.g. a reply from
+   // a handler) which are executed as soon as the current callback returns.
+   // Only the dispatcher thread touches it so it needs no lock.
+   tCmdContainer                    mDeferredCmds;
+   // Held by the dispatcher thread whenever it isn't blocked in poll() so
+   // a client thread holding it can safely drive a connection directly
+   MutexLock                        mLoopLock;
+   // When the blocked poll() returns at the latest
+   uint64_t                         mPollDeadline;
+   // Set when a direct execution left work the blocked poll() misses
+   bool                             mWakeupNeeded;
+   // Commands (not wake-ups) in the queue and the most there have been
+   // since the stats were last reset (both guarded by mCmdQLock)
+   uint32_t                         mNumQueued;
+   uint32_t                         mQueueHighWater;
+   // Updated with the loop lock held (the queue counts above are copied in
+   // by getStats())
+   DBUSIPC_tDispatcherStats          mStats;
    tWatchContainer                  mWatches;
    tTimeoutContainer                mTimeouts;
    Pipe                             mPipe;
    std::auto_ptr<PipeWatch>         mPipeWatch;
    NSysDep::DBUSIPC_tPollFdContainer mPollFds;
+   // Set when the application runs the loop instead of our own thread
+   bool                             mIntegrated;
+   NOsTypes::DBUSIPC_tThreadHnd      mLoopThread;
+   // Cleared on shutdown (with mCmdQLock held) when integrated
+   bool                             mLoopActive;
+   // Posted once stopped for shutting down (see stopWhenClosed())
+   Semaphore*                       mStopSem;
+   // Set while the integrated loop is running
+   bool                             mDispatching;
+   // Becomes readable whenever one of the watches does (when integrated)
+   int32_t                          mEventFd;
+   // The descriptors (and events) added to the event descriptor
+   tEventFdContainer                mEventFds;
+   // Started the first time a peer connection is needed
+   std::auto_ptr<PeerConnector>     mPeerConnector;
 };
 
 #endif /* Guard for DISPATCHER_HPP_ */
@@ -0,0 +1,144 @@
+#ifndef HANDLEINDEX_HPP_
+#define HANDLEINDEX_HPP_
+
+#include <vector>
+#include <assert.h>
+#include "dbusipc/dbusipc.h"
+
+//
+// Maps the (sequential) command handles given out by the dispatcher to a
+// value. Unlike the HandleTable the handles aren't minted here so a slot is
+// picked by the low bits of the handle and collisions are resolved by
+// probing the following slots. The table is kept at most half full so a
+// lookup is a mask plus, almost always, a single compare. The table is
+// *not* thread-safe and is only meant to be accessed from the dispatcher
+// thread.
+//
+template <class T>
+class HandleIndex
+{
+public:
+   HandleIndex()
+      : mSlots(MIN_SLOTS)
+      , mCount(0U)
+   {
+   }
+
+   // Replaces the value of a handle that is already present. This can
+   // throw exceptions.
+   void insert(DBUSIPC_tHandle hnd, const T& value)
+   {
+      assert( DBUSIPC_INVALID_HANDLE != hnd );
+
+      if ( (mCount + 1U) * 2U > mSlots.size() )
+      {
+         grow();
+      }
+
+      uint32_t index = probe(hnd);
+      if ( DBUSIPC_INVALID_HANDLE == mSlots[index].hnd )
+      {
+         mSlots[index].hnd = hnd;
+         ++mCount;
+      }
+      mSlots[index].value = value;
+   }
+
+   T* find(DBUSIPC_tHandle hnd)
+   {
+      T* value(0);
+      if ( DBUSIPC_INVALID_HANDLE != hnd )
+      {
+         tSlot& slot = mSlots[probe(hnd)];
+         if ( hnd == slot.hnd )
+         {
+            value = &slot.value;
+         }
+      }
+      return value;
+   }
+
+   void erase(DBUSIPC_tHandle hnd)
+   {
+      uint32_t index = probe(hnd);
+      if ( (DBUSIPC_INVALID_HANDLE != hnd) && (hnd == mSlots[index].hnd) )
+      {
+         // Shift back the entries that probed past the freed slot so no
+         // lookup stops short of its entry
+         uint32_t mask = static_cast<uint32_t>(mSlots.size()) - 1U;
+         uint32_t next = index;
+         for ( ;; )
+         {
+            next = (next + 1U) & mask;
+            if ( DBUSIPC_INVALID_HANDLE == mSlots[next].hnd )
+            {
+               break;
+            }
+
+            // An entry can only move back if that doesn't put it before
+            // its home slot
+            uint32_t home = mSlots[next].hnd & mask;
+            bool movable = (index <= next) ?
+                           ((home <= index) || (home > next)) :
+                           ((home <= index) && (home > next));
+            if ( movable )
+            {
+               mSlots[index] = mSlots[next];
+               index = next;
+            }
+         }
+         mSlots[index].hnd = DBUSIPC_INVALID_HANDLE;
+         mSlots[index].value = T();
+         --mCount;
+      }
+   }
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   HandleIndex(const HandleIndex& other);
+   HandleIndex& operator=(const HandleIndex& rhs);
+
+   // Must be a power of two
+   static const uint32_t MIN_SLOTS = 64U;
+
+   struct tSlot
+   {
+      tSlot() : hnd(DBUSIPC_INVALID_HANDLE), value() {}
+
+      DBUSIPC_tHandle   hnd;
+      T                 value;
+   };
+
+   // Returns the slot holding the handle or the free slot where it belongs
+   uint32_t probe(DBUSIPC_tHandle hnd) const
+   {
+      uint32_t mask = static_cast<uint32_t>(mSlots.size()) - 1U;
+      uint32_t index = hnd & mask;
+      while ( (DBUSIPC_INVALID_HANDLE != mSlots[index].hnd) &&
+         (hnd != mSlots[index].hnd) )
+      {
+         index = (index + 1U) & mask;
+      }
+      return index;
+   }
+
+   void grow()
+   {
+      std::vector<tSlot> old(mSlots.size() * 2U);
+      old.swap(mSlots);
+      for ( typename std::vector<tSlot>::const_iterator it = old.begin();
+         it != old.end(); ++it )
+      {
+         if ( DBUSIPC_INVALID_HANDLE != (*it).hnd )
+         {
+            mSlots[probe((*it).hnd)] = *it;
+         }
+      }
+   }
+
+   std::vector<tSlot>   mSlots;
+   uint32_t             mCount;
+};
+
+#endif /* Guard for HANDLEINDEX_HPP_ */
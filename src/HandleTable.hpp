@@ -0,0 +1,141 @@
+#ifndef HANDLETABLE_HPP_
+#define HANDLETABLE_HPP_
+
+#include <vector>
+#include <assert.h>
+#include "dbusipc/dbusipc.h"
+#include "Exceptions.hpp"
+
+//
+// Maps the opaque handles given out by the API to the objects they refer
+// to. A handle encodes the index of a slot in the table along with the
+// generation of the slot which is bumped every time the slot is freed, so
+// validating a handle is a bounds check plus a generation compare and a
+// stale handle is recognized without searching. Slots are allocated a chunk
+// at a time and recycled through a free list. The table is *not* internally
+// synchronized: the tables of the connections and service registrations are
+// also looked up from client threads, so any access from outside the
+// dispatcher thread (and any change from within it) must hold
+// Connection::msHandleLock.
+//
+template <class T>
+class HandleTable
+{
+public:
+   HandleTable()
+      : mSlots()
+      , mFreeHead(NO_SLOT)
+   {
+   }
+
+   // This can throw exceptions
+   void* add(T* obj)
+   {
+      assert( 0 != obj );
+
+      if ( NO_SLOT == mFreeHead )
+      {
+         grow();
+      }
+
+      uint32_t index = mFreeHead;
+      tSlot& slot = mSlots[index];
+      mFreeHead = slot.nextFree;
+      slot.obj = obj;
+      slot.nextFree = NO_SLOT;
+
+      return encode(index, slot.generation);
+   }
+
+   void remove(const void* hnd)
+   {
+      uint32_t index(0U);
+      if ( decode(hnd, index) )
+      {
+         tSlot& slot = mSlots[index];
+         slot.obj = 0;
+         // The generation eventually wraps so a handle that is kept
+         // around long enough *could* match a recycled slot again.
+         slot.generation = (slot.generation + 1U) & GEN_MASK;
+         slot.nextFree = mFreeHead;
+         mFreeHead = index;
+      }
+   }
+
+   T* lookup(const void* hnd) const
+   {
+      uint32_t index(0U);
+      return decode(hnd, index) ? mSlots[index].obj : 0;
+   }
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   HandleTable(const HandleTable& other);
+   HandleTable& operator=(const HandleTable& rhs);
+
+   static const uint32_t GEN_BITS = 12U;
+   static const uint32_t GEN_MASK = (1U << GEN_BITS) - 1U;
+   static const uint32_t CHUNK_SIZE = 64U;
+   // Index zero is never encoded so a handle can't be NULL
+   static const uint32_t MAX_SLOTS = (0xFFFFFFFFU >> GEN_BITS) - 1U;
+   static const uint32_t NO_SLOT = 0xFFFFFFFFU;
+
+   struct tSlot
+   {
+      T*          obj;
+      uint32_t    generation;
+      uint32_t    nextFree;
+   };
+
+   static void* encode(uint32_t index, uint32_t generation)
+   {
+      uintptr_t value = (static_cast<uintptr_t>(index + 1U) << GEN_BITS) |
+                        generation;
+      return reinterpret_cast<void*>(value);
+   }
+
+   bool decode(const void* hnd, uint32_t& index) const
+   {
+      bool valid(false);
+      uintptr_t value = reinterpret_cast<uintptr_t>(hnd);
+      uintptr_t slotNum = value >> GEN_BITS;
+
+      if ( (0U != slotNum) && (slotNum <= mSlots.size()) )
+      {
+         index = static_cast<uint32_t>(slotNum - 1U);
+         const tSlot& slot = mSlots[index];
+         valid = (0 != slot.obj) && ((value & GEN_MASK) == slot.generation);
+      }
+
+      return valid;
+   }
+
+   void grow()
+   {
+      uint32_t first = static_cast<uint32_t>(mSlots.size());
+      if ( first >= MAX_SLOTS )
+      {
+         throw DBUSIPCError(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                           DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NO_MEMORY),
+                           "Out of handles");
+      }
+
+      uint32_t count = (MAX_SLOTS - first < CHUNK_SIZE) ?
+                        MAX_SLOTS - first : CHUNK_SIZE;
+      tSlot slot = { 0, 0U, NO_SLOT };
+      mSlots.resize(first + count, slot);
+
+      // Thread the new slots onto the free list (lowest index first)
+      for ( uint32_t i = first + count; i > first; --i )
+      {
+         mSlots[i - 1U].nextFree = mFreeHead;
+         mFreeHead = i - 1U;
+      }
+   }
+
+   std::vector<tSlot>   mSlots;
+   uint32_t             mFreeHead;
+};
+
+#endif /* Guard for HANDLETABLE_HPP_ */
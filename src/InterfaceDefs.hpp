@@ -6,6 +6,7 @@
 extern DBUSIPC_tConstStr DBUSIPC_INTERFACE_NAME;
 extern DBUSIPC_tConstStr DBUSIPC_INTERFACE_SIGNAL_NAME;
 extern DBUSIPC_tConstStr DBUSIPC_INTERFACE_METHOD_NAME;
+extern DBUSIPC_tConstStr DBUSIPC_INTERFACE_PEER_ADDRESS_METHOD_NAME;
 extern DBUSIPC_tConstStr DBUSIPC_INTERFACE_ERROR_NAME;
 extern const DBUSIPC_tChar DBUSIPC_INTERFACE_SIGNAL_SIGNATURE[];
 extern DBUSIPC_tConstStr INTROSPECTION_INTERFACE_METHOD_NAME;
@@ -93,6 +93,21 @@ uint64_t DBUSIPC_getSystemTime()
 }
 
 
+uint64_t DBUSIPC_getSystemTimeUsec()
+{
+   struct timespec now;
+   uint64_t usecTime(0U);
+
+   if ( -1 != clock_gettime(CLOCK_MONOTONIC, &now) )
+   {
+      usecTime = (static_cast<uint64_t>(now.tv_sec) * 1000000U) +
+                 (now.tv_nsec / 1000U);
+   }
+
+   return usecTime;
+}
+
+
 void DBUSIPC_sleep
    (
    uint32_t msecTimeout
@@ -29,6 +29,9 @@ NOsTypes::DBUSIPC_tProcId DBUSIPC_getProcId();
 // Returns time in msec since system started.
 uint64_t DBUSIPC_getSystemTime();
 
+// Returns time in usec since system started.
+uint64_t DBUSIPC_getSystemTimeUsec();
+
 void DBUSIPC_setEnvironmentVariable();
 
 typedef enum {
@@ -0,0 +1,133 @@
+#include "PeerConnector.hpp"
+
+#include <assert.h>
+#include "dbus/dbus.h"
+#include "Command.hpp"
+#include "DBusErrorHolder.hpp"
+#include "Dispatcher.hpp"
+#include "ScopedLock.hpp"
+#include "trace.h"
+
+
+PeerConnector::PeerConnector
+   (
+   Dispatcher* disp
+   )
+   : Thread()
+   , mDispatcher(disp)
+   , mRequests()
+   , mLock()
+   , mSem(0)
+   , mStarted(false)
+   , mQuit(false)
+{
+   assert( 0 != mDispatcher );
+}
+
+
+PeerConnector::~PeerConnector()
+{
+   {
+      ScopedLock lock(mLock);
+      mQuit = true;
+      mRequests.clear();
+   }
+   mSem.post();
+
+   // Waits for a connect in progress to give up
+   stop();
+   wait(INFINITE_WAIT);
+}
+
+
+void PeerConnector::connect
+   (
+   DBUSIPC_tConnection  owner,
+   const std::string&   busName,
+   const std::string&   address
+   )
+{
+   tRequest req;
+   req.owner = owner;
+   req.busName = busName;
+   req.address = address;
+
+   {
+      ScopedLock lock(mLock);
+      mRequests.push_back(req);
+      if ( !mStarted )
+      {
+         mStarted = (EOK == start(true));
+         if ( !mStarted )
+         {
+            TRACE_WARN("connect: failed to start the peer connector");
+            mRequests.pop_back();
+         }
+      }
+   }
+
+   if ( mStarted )
+   {
+      mSem.post();
+   }
+}
+
+
+bool PeerConnector::execute()
+{
+   bool running(true);
+   bool haveReq(false);
+   tRequest req;
+
+   mSem.wait();
+   {
+      ScopedLock lock(mLock);
+      if ( mQuit )
+      {
+         running = false;
+      }
+      else if ( !mRequests.empty() )
+      {
+         req = mRequests.front();
+         mRequests.pop_front();
+         haveReq = true;
+      }
+   }
+
+   if ( haveReq )
+   {
+      open(req);
+   }
+
+   return running;
+}
+
+
+void PeerConnector::open
+   (
+   const tRequest& req
+   )
+{
+   DBusErrorHolder dbusError;
+
+   // Authentication is driven by the dispatcher's watches once the
+   // connection has been adopted
+   DBusConnection* dbusConn = dbus_connection_open_private(
+                                 req.address.c_str(), dbusError.getInst());
+   if ( 0 == dbusConn )
+   {
+      // The service stays on the bus (see Connection::getPeerConnection())
+      TRACE_WARN("open: cannot connect to %s => %s", req.address.c_str(),
+                 dbusError.getMessage());
+   }
+   else
+   {
+      PeerConnectedCmd* cmd = new PeerConnectedCmd(req.owner, req.busName,
+                                                   dbusConn);
+      if ( DBUSIPC_INVALID_HANDLE == mDispatcher->submitCommand(cmd) )
+      {
+         // The command closes the connection nobody adopted
+         delete cmd;
+      }
+   }
+}
@@ -0,0 +1,59 @@
+#ifndef PEERCONNECTOR_HPP_
+#define PEERCONNECTOR_HPP_
+
+#include <deque>
+#include <string>
+#include "dbusipc/dbusipc.h"
+#include "MutexLock.hpp"
+#include "Semaphore.hpp"
+#include "Thread.hpp"
+
+//
+// Forward Declarations
+//
+class Dispatcher;
+
+// Opens direct peer connections on its own thread. Connecting to a peer
+// can block (e.g. on a full listen backlog or a TCP handshake) so the
+// dispatcher only hands over the address and adopts the connection once
+// it has been opened (see PeerConnectedCmd).
+class PeerConnector : public Thread
+{
+public:
+   PeerConnector(Dispatcher* disp);
+   ~PeerConnector();
+
+   // Starts the connector thread on first use
+   void connect(DBUSIPC_tConnection owner, const std::string& busName,
+                const std::string& address);
+
+protected:
+   virtual bool execute();
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   PeerConnector(const PeerConnector& other);
+   PeerConnector& operator=(const PeerConnector& rhs);
+
+   struct tRequest
+   {
+      DBUSIPC_tConnection  owner;
+      std::string          busName;
+      std::string          address;
+   };
+
+   typedef std::deque<tRequest> tRequestContainer;
+
+   void open(const tRequest& req);
+
+   Dispatcher*          mDispatcher;
+   tRequestContainer    mRequests;
+   MutexLock            mLock;
+   // Posted once per request and once more to quit
+   Semaphore            mSem;
+   bool                 mStarted;
+   bool                 mQuit;
+};
+
+#endif /* Guard for PEERCONNECTOR_HPP_ */
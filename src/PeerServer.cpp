@@ -0,0 +1,137 @@
+
+#include "PeerServer.hpp"
+
+#include <assert.h>
+#include "Connection.hpp"
+#include "Dispatcher.hpp"
+#include "DBusErrorHolder.hpp"
+#include "Exceptions.hpp"
+#include "NSysDep.hpp"
+#include "ServiceRegistration.hpp"
+#include "trace.h"
+
+// The address the peer server listens on unless overridden by the
+// DBUSIPC_PEER_LISTEN_ADDRESS environment variable. On Linux this
+// results in an abstract socket so nothing is left behind in the
+// file system.
+static DBUSIPC_tConstStr DEFAULT_PEER_LISTEN_ADDRESS = "unix:tmpdir=/tmp";
+
+
+PeerServer::PeerServer
+   (
+   ServiceRegistration* reg,
+   Dispatcher*          disp
+   )
+   : mSvcReg(reg)
+   , mDispatcher(disp)
+   , mServer(0)
+   , mAddress()
+{
+   DBusErrorHolder dbusError;
+
+   assert( 0 != mSvcReg );
+   assert( 0 != mDispatcher );
+
+   std::string listenAddr = NSysDep::DBUSIPC_getenv(
+                                          "DBUSIPC_PEER_LISTEN_ADDRESS");
+   if ( listenAddr.empty() )
+   {
+      listenAddr = DEFAULT_PEER_LISTEN_ADDRESS;
+   }
+
+   mServer = dbus_server_listen(listenAddr.c_str(), dbusError.getInst());
+   if ( 0 == mServer )
+   {
+      DBusException e(dbusError.getName(), dbusError.getMessage());
+      throw e;
+   }
+
+   try
+   {
+      dbus_bool_t status(FALSE);
+      status = dbus_server_set_watch_functions(
+            mServer,
+            Dispatcher::onAddWatchCallback,
+            Dispatcher::onRemoveWatchCallBack,
+            Dispatcher::onToggleWatchCallback,
+            mDispatcher,
+            0);
+      if ( !status )
+      {
+         throw DBusException(DBUSIPC_ERR_NAME_NO_MEMORY,
+                             "Unable to 'watch' callback handlers");
+      }
+
+      status = dbus_server_set_timeout_functions(
+            mServer,
+            Dispatcher::onAddTimeoutCallback,
+            Dispatcher::onRemoveTimeoutCallback,
+            Dispatcher::onToggleTimeoutCallback,
+            mDispatcher,
+            0);
+      if ( !status )
+      {
+         throw DBusException(DBUSIPC_ERR_NAME_NO_MEMORY,
+                             "Unable to 'timeout' callback handlers");
+      }
+
+      dbus_server_set_new_connection_function(mServer,
+                                    PeerServer::onNewConnection, this, 0);
+
+      DBUSIPC_tString addr = dbus_server_get_address(mServer);
+      if ( 0 == addr )
+      {
+         throw DBusException(DBUSIPC_ERR_NAME_NO_MEMORY,
+                             "Unable to retrieve peer server address");
+      }
+      mAddress = addr;
+      dbus_free(addr);
+
+      TRACE_INFO("PeerServer: %s listening on %s", mSvcReg->getBusName(),
+                 mAddress.c_str());
+   }
+   catch ( ... )
+   {
+      dbus_server_disconnect(mServer);
+      dbus_server_unref(mServer);
+      throw;
+   }
+}
+
+
+PeerServer::~PeerServer()
+{
+   // Stop accepting new peers. Peers that have already connected are
+   // released along with the service registration they're bound to.
+   dbus_server_set_new_connection_function(mServer, 0, 0, 0);
+   dbus_server_disconnect(mServer);
+   dbus_server_unref(mServer);
+}
+
+
+void PeerServer::onNewConnection
+   (
+   DBusServer*       server,
+   DBusConnection*   dbusConn,
+   void*             data
+   )
+{
+   PeerServer* peerSrv = static_cast<PeerServer*>(data);
+   assert( 0 != peerSrv );
+
+   try
+   {
+      // If we do not take a reference to the new connection then
+      // D-Bus will close and free it after we return.
+      Connection* conn = Connection::adoptPeer(dbusConn, peerSrv->mSvcReg,
+                                               peerSrv->mDispatcher);
+      assert( 0 != conn );
+      TRACE_INFO("PeerServer: accepted peer connection=%p for %s", conn,
+                 peerSrv->mSvcReg->getBusName());
+   }
+   catch ( const std::exception& e )
+   {
+      TRACE_WARN("PeerServer: failed to accept peer connection => %s",
+                 e.what());
+   }
+}
@@ -0,0 +1,44 @@
+#ifndef PEERSERVER_HPP_
+#define PEERSERVER_HPP_
+
+#include <string>
+#include "dbus/dbus.h"
+#include "dbusipc/dbusipc.h"
+
+//
+// Forward Declarations
+//
+class Dispatcher;
+class ServiceRegistration;
+
+class PeerServer
+{
+public:
+   PeerServer(ServiceRegistration* reg, Dispatcher* disp);
+   ~PeerServer();
+
+   const char* getAddress() const;
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   PeerServer(const PeerServer& other);
+   PeerServer& operator=(const PeerServer& rhs);
+
+   static void onNewConnection(DBusServer* server,
+                               DBusConnection* dbusConn,
+                               void* data);
+
+   ServiceRegistration*    mSvcReg;
+   Dispatcher*             mDispatcher;
+   DBusServer*             mServer;
+   std::string             mAddress;
+};
+
+
+inline const char* PeerServer::getAddress() const
+{
+   return mAddress.c_str();
+}
+
+#endif /* Guard for PEERSERVER_HPP_ */
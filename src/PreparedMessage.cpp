@@ -0,0 +1,115 @@
+
+#include "PreparedMessage.hpp"
+
+#include <assert.h>
+#include "Connection.hpp"
+#include "Exceptions.hpp"
+#include "InterfaceDefs.hpp"
+#include "NUtil.hpp"
+
+
+PreparedMessage* PreparedMessage::createInvoke
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath
+   )
+{
+   assert( 0 != busName );
+   
+   std::string path((0 == objPath) ? NUtil::busNameToObjPath(busName)
+                                   : std::string(objPath));
+   
+   // This is the validation we don't want to repeat for every request
+   if ( !dbus_validate_bus_name(busName, 0) ||
+      !dbus_validate_path(path.c_str(), 0) )
+   {
+      throw DBUSIPCError(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                        DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_BAD_ARGS),
+                        "Invalid bus name or object path");
+   }
+   
+   DBusMessage* msg = dbus_message_new_method_call(busName, path.c_str(),
+                                             DBUSIPC_INTERFACE_NAME,
+                                             DBUSIPC_INTERFACE_METHOD_NAME);
+   if ( 0 == msg )
+   {
+      throw DBUSIPCError(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                        DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NO_MEMORY),
+                        "Cannot allocate method call");
+   }
+   
+   PreparedMessage* prepared(0);
+   try
+   {
+      prepared = new PreparedMessage(conn, busName, path, msg);
+   }
+   catch ( ... )
+   {
+      dbus_message_unref(msg);
+      throw;
+   }
+   
+   return prepared;
+}
+
+
+PreparedMessage* PreparedMessage::createEmit
+   (
+   DBUSIPC_tSvcRegHnd   regHnd
+   )
+{
+   std::string path;
+   if ( !Connection::getServiceObjectPath(regHnd, path) )
+   {
+      throw DBUSIPCError(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                        DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND),
+                        "Service registration does not exist");
+   }
+   
+   DBusMessage* msg = dbus_message_new_signal(path.c_str(),
+                                             DBUSIPC_INTERFACE_NAME,
+                                             DBUSIPC_INTERFACE_SIGNAL_NAME);
+   if ( 0 == msg )
+   {
+      throw DBUSIPCError(DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                        DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NO_MEMORY),
+                        "Cannot allocate signal");
+   }
+   
+   PreparedMessage* prepared(0);
+   try
+   {
+      prepared = new PreparedMessage(regHnd, "", path, msg);
+   }
+   catch ( ... )
+   {
+      dbus_message_unref(msg);
+      throw;
+   }
+   
+   return prepared;
+}
+
+
+PreparedMessage::PreparedMessage
+   (
+   void*                hnd,
+   DBUSIPC_tConstStr    busName,
+   const std::string&   objPath,
+   DBusMessage*         msg
+   )
+   : mHandle(hnd)
+   , mBusName(busName)
+   , mObjectPath(objPath)
+   , mTemplate(msg)
+{
+   assert( 0 != mTemplate );
+}
+
+
+PreparedMessage::~PreparedMessage()
+{
+   // Requests made from the template hold their own reference
+   dbus_message_unref(mTemplate);
+}
@@ -0,0 +1,73 @@
+#ifndef PREPAREDMESSAGE_HPP_
+#define PREPAREDMESSAGE_HPP_
+
+#include <string>
+#include "dbus/dbus.h"
+#include "dbusipc/dbusipc.h"
+
+//
+// A method call or signal whose header has been built (and validated) once
+// so repeated invokes and emits only have to copy it and append their own
+// arguments. The template is never modified once it's built so copies can
+// be made from any thread.
+//
+class PreparedMessage
+{
+public:
+   // These can throw exceptions
+   static PreparedMessage* createInvoke(DBUSIPC_tConnection conn,
+                                        DBUSIPC_tConstStr busName,
+                                        DBUSIPC_tConstStr objPath);
+   static PreparedMessage* createEmit(DBUSIPC_tSvcRegHnd regHnd);
+   
+   ~PreparedMessage();
+   
+   bool isSignal() const;
+   // The connection of a method call or the registration of a signal
+   void* getHandle() const;
+   const std::string& getBusName() const;
+   const std::string& getObjectPath() const;
+   DBusMessage* getTemplate() const;
+   
+private:
+   PreparedMessage(void* hnd, DBUSIPC_tConstStr busName,
+                   const std::string& objPath, DBusMessage* msg);
+   
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   PreparedMessage(const PreparedMessage& other);
+   PreparedMessage& operator=(const PreparedMessage& rhs);
+   
+   void*          mHandle;
+   std::string    mBusName;
+   std::string    mObjectPath;
+   DBusMessage*   mTemplate;
+};
+
+
+inline bool PreparedMessage::isSignal() const
+{
+   return DBUS_MESSAGE_TYPE_SIGNAL == dbus_message_get_type(mTemplate);
+}
+
+inline void* PreparedMessage::getHandle() const
+{
+   return mHandle;
+}
+
+inline const std::string& PreparedMessage::getBusName() const
+{
+   return mBusName;
+}
+
+inline const std::string& PreparedMessage::getObjectPath() const
+{
+   return mObjectPath;
+}
+
+inline DBusMessage* PreparedMessage::getTemplate() const
+{
+   return mTemplate;
+}
+
+#endif /* Guard for PREPAREDMESSAGE_HPP_ */
@@ -0,0 +1,140 @@
+#ifndef READYLIST_HPP_
+#define READYLIST_HPP_
+
+#include <assert.h>
+#include "dbusipc/dbusipc.h"
+
+//
+// An intrusive FIFO of the objects waiting on the dispatcher. The links are
+// embedded in the objects themselves (which derive from the Hook) so an
+// object is on at most one list at a time, adding an object that is already
+// on the list does nothing and removing one takes constant time. Nothing is
+// allocated. The list is *not* thread-safe and is only meant to be accessed
+// from the dispatcher thread.
+//
+template <class T>
+class ReadyList
+{
+public:
+   class Hook
+   {
+   public:
+      Hook()
+         : mPrev(0)
+         , mNext(0)
+         , mList(0)
+      {
+      }
+
+      ~Hook()
+      {
+         // The owner must take the object off the list first
+         assert( 0 == mList );
+      }
+
+      bool isLinked() const { return 0 != mList; }
+
+   private:
+      friend class ReadyList;
+
+      // (Unimplemented) private copy constructor and assignment operator
+      // to prevent misuse
+      Hook(const Hook& other);
+      Hook& operator=(const Hook& rhs);
+
+      Hook*       mPrev;
+      Hook*       mNext;
+      ReadyList*  mList;
+   };
+
+   ReadyList()
+      : mHead(0)
+      , mTail(0)
+      , mSize(0U)
+   {
+   }
+
+   bool empty() const { return 0 == mHead; }
+   uint32_t size() const { return mSize; }
+
+   // Appends the object unless it's already on a list
+   void pushBack(T* obj)
+   {
+      Hook* hook = obj;
+      assert( 0 != hook );
+
+      if ( !hook->isLinked() )
+      {
+         hook->mPrev = mTail;
+         hook->mNext = 0;
+         hook->mList = this;
+         if ( 0 == mTail )
+         {
+            mHead = hook;
+         }
+         else
+         {
+            mTail->mNext = hook;
+         }
+         mTail = hook;
+         ++mSize;
+      }
+   }
+
+   // Returns NULL if the list is empty
+   T* popFront()
+   {
+      Hook* hook = mHead;
+      if ( 0 != hook )
+      {
+         remove(static_cast<T*>(hook));
+      }
+
+      return static_cast<T*>(hook);
+   }
+
+   // Does nothing unless the object is on this list
+   void remove(T* obj)
+   {
+      Hook* hook = obj;
+      assert( 0 != hook );
+
+      if ( this == hook->mList )
+      {
+         if ( 0 == hook->mPrev )
+         {
+            mHead = hook->mNext;
+         }
+         else
+         {
+            hook->mPrev->mNext = hook->mNext;
+         }
+
+         if ( 0 == hook->mNext )
+         {
+            mTail = hook->mPrev;
+         }
+         else
+         {
+            hook->mNext->mPrev = hook->mPrev;
+         }
+
+         hook->mPrev = 0;
+         hook->mNext = 0;
+         hook->mList = 0;
+         --mSize;
+      }
+   }
+
+private:
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   ReadyList(const ReadyList& other);
+   ReadyList& operator=(const ReadyList& rhs);
+
+   Hook*       mHead;
+   Hook*       mTail;
+   uint32_t    mSize;
+};
+
+#endif /* Guard for READYLIST_HPP_ */
@@ -1,18 +1,28 @@
 
 
 #include "RequestContext.hpp"
+#include <new>
 #include "Exceptions.hpp"
 #include "Connection.hpp"
+#include "ServiceRegistration.hpp"
 #include "dbus/dbus.h"
 #include "trace.h"
 
+void* RequestContext::msPool = 0;
+uint32_t RequestContext::msNumPooled = 0U;
+
 RequestContext::RequestContext
    (
    Connection*    conn,
-   DBusMessage*   request
+   DBusMessage*   request,
+   uint64_t       deadline,
+   ServiceRegistration* svcReg
    )
    : mConn(conn)
    , mReqMsg(dbus_message_ref(request))
+   , mDeadline(deadline)
+   , mSvcReg((0 != svcReg) ? svcReg->getHandle() : 0)
+   , mDone(false)
 {
    if ( 0 == mReqMsg )
    {
@@ -25,13 +35,88 @@ RequestContext::RequestContext
    
 RequestContext::~RequestContext()
 {
+   markDone();
    dbus_message_unref(mReqMsg);
 }
 
 
+void* RequestContext::operator new
+   (
+   std::size_t size
+   )
+{
+   void* mem(0);
+
+   // Reuse a freed context if there is one
+   if ( 0 != msPool )
+   {
+      mem = msPool;
+      msPool = *static_cast<void**>(mem);
+      --msNumPooled;
+   }
+   else
+   {
+      mem = ::operator new(size);
+   }
+
+   return mem;
+}
+
+
+void RequestContext::operator delete
+   (
+   void* mem
+   )
+{
+   if ( 0 != mem )
+   {
+      if ( msNumPooled < MAX_POOLED )
+      {
+         *static_cast<void**>(mem) = msPool;
+         msPool = mem;
+         ++msNumPooled;
+      }
+      else
+      {
+         ::operator delete(mem);
+      }
+   }
+}
+
+
+void RequestContext::purgePool()
+{
+   while ( 0 != msPool )
+   {
+      void* mem = msPool;
+      msPool = *static_cast<void**>(mem);
+      ::operator delete(mem);
+   }
+   msNumPooled = 0U;
+}
+
+
+void RequestContext::markDone()
+{
+   // The first reply (or freeing the context unanswered) releases the
+   // in-flight slot this request holds with its service registration.
+   // The registration may have been unregistered in the meantime.
+   if ( !mDone )
+   {
+      mDone = true;
+      ServiceRegistration* svcReg = Connection::findServiceReg(mSvcReg);
+      if ( 0 != svcReg )
+      {
+         svcReg->onRequestDone();
+      }
+   }
+}
+
+
 DBUSIPC_tError RequestContext::sendReply
    (
-   DBUSIPC_tConstStr  result
+   DBUSIPC_tConstStr  result,
+   uint32_t          msecTtl
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
@@ -56,9 +141,13 @@ DBUSIPC_tError RequestContext::sendReply
       }
       else
       {
+         // A TTL tells clients for how long they may cache the result
          DBUSIPC_tConstStr empty = "";
+         dbus_uint32_t ttl = msecTtl;
          if ( !dbus_message_append_args(reply, DBUS_TYPE_STRING,
-            result ? &result : &empty, DBUS_TYPE_INVALID) )
+            result ? &result : &empty, DBUS_TYPE_INVALID) ||
+            ((0U != ttl) && !dbus_message_append_args(reply,
+            DBUS_TYPE_UINT32, &ttl, DBUS_TYPE_INVALID)) )
          {
             TRACE_WARN("sendReply: failed to append arguments");
             status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
@@ -75,6 +164,8 @@ DBUSIPC_tError RequestContext::sendReply
                                           DBUSIPC_DOMAIN_IPC_LIB,
                                           DBUSIPC_ERR_NO_MEMORY);
             }
+            TRACE_EVENT(DBUSIPC_TRACE_REPLY_SENT,
+                        dbus_message_get_serial(mReqMsg), status, 0U, 0U);
             
             // Free up the reply message
             dbus_message_unref(reply);
@@ -82,6 +173,7 @@ DBUSIPC_tError RequestContext::sendReply
       }
    }
    
+   markDone();
    return status;
 }
 
@@ -123,12 +215,15 @@ DBUSIPC_tError RequestContext::sendError
                                        DBUSIPC_DOMAIN_IPC_LIB,
                                        DBUSIPC_ERR_NO_MEMORY);
          }
+         TRACE_EVENT(DBUSIPC_TRACE_REPLY_SENT,
+                     dbus_message_get_serial(mReqMsg), status, 0U, 0U);
 
          // Free up the error message
          dbus_message_unref(error);
       }
    }
    
+   markDone();
    return status;
 }
 
@@ -1,30 +1,59 @@
 #ifndef REQUESTCONTEXT_HPP_
 #define REQUESTCONTEXT_HPP_
 
+#include <cstddef>
 #include "dbusipc/dbusipc.h"
 //
 // Forward Declarations
 //
 struct DBusMessage;
 class Connection;
+class ServiceRegistration;
 
 class RequestContext
 {
 public:
-	RequestContext(Connection* conn, DBusMessage* request);
+	RequestContext(Connection* conn, DBusMessage* request,
+	               uint64_t deadline = 0U,
+	               ServiceRegistration* svcReg = 0);
 	~RequestContext();
 
-	DBUSIPC_tError sendReply(DBUSIPC_tConstStr result);
+	// Returns the time (msec) the client stops waiting for a reply or
+	// zero if the client didn't specify one.
+	uint64_t getDeadline() const { return mDeadline; }
+
+	DBUSIPC_tError sendReply(DBUSIPC_tConstStr result,
+	                        uint32_t msecTtl = 0U);
 	DBUSIPC_tError sendError(DBUSIPC_tConstStr errName, DBUSIPC_tConstStr errMsg);
 	
+	// Freed contexts are kept for the requests that follow. They're only
+	// allocated and freed on the dispatcher thread (or with its loop lock
+	// held) so the pool needs no lock of its own.
+	static void* operator new(std::size_t size);
+	static void operator delete(void* mem);
+	// Releases the contexts kept in the pool
+	static void purgePool();
+	
 private:
    // (Unimplemented) private copy constructor and assignment operator
    // to prevent misuse
    RequestContext(const RequestContext& other);
    RequestContext& operator=(const RequestContext& rhs);
    
-   Connection*    mConn;
-   DBusMessage*   mReqMsg;
+   void markDone();
+   
+   // Most contexts kept in the pool
+   enum { MAX_POOLED = 64 };
+   
+   // The free contexts are linked through their first word
+   static void*            msPool;
+   static uint32_t         msNumPooled;
+   
+   Connection*             mConn;
+   DBusMessage*            mReqMsg;
+   uint64_t                mDeadline;
+   DBUSIPC_tSvcRegHnd       mSvcReg;
+   bool                    mDone;
 };
 
 #endif /* Guard for REQUESTCONTEXT_HPP_ */
@@ -0,0 +1,434 @@
+
+#include "ResponseCache.hpp"
+
+#include <assert.h>
+#include "Connection.hpp"
+#include "NSysDep.hpp"
+#include "NUtil.hpp"
+#include "ScopedLock.hpp"
+#include "trace.h"
+
+// The parameters assumed when none are given (see InvokeCmd)
+static DBUSIPC_tConstStr EMPTY_OBJECT = "{}";
+
+ResponseCache::tCacheContainer ResponseCache::msCaches;
+MutexLock ResponseCache::msLock;
+
+
+std::string ResponseCache::makePrefix
+   (
+   DBUSIPC_tConstStr  busName,
+   DBUSIPC_tConstStr  objPath
+   )
+{
+   assert( 0 != busName );
+
+   // None of the names can contain a newline so it's safe as a separator
+   std::string prefix(busName);
+   prefix += '\n';
+   prefix += (0 == objPath) ? NUtil::busNameToObjPath(busName) : objPath;
+   prefix += '\n';
+
+   return prefix;
+}
+
+
+void ResponseCache::evict
+   (
+   tConnCache&                cache,
+   tEntryContainer::iterator  it
+   )
+{
+   cache.usedBytes -= static_cast<uint32_t>((*it).first.size() +
+                                            (*it).second.result.size());
+   cache.lru.erase((*it).second.lru);
+   cache.entries.erase(it);
+}
+
+
+ResponseCache::tConnCache* ResponseCache::getCache
+   (
+   DBUSIPC_tConnection  conn
+   )
+{
+   tConnCache* cache(0);
+   tCacheContainer::iterator it = msCaches.find(conn);
+
+   if ( it != msCaches.end() )
+   {
+      cache = &(*it).second;
+   }
+   // A connection's handle is removed before its cache is purged so an
+   // entry created here can't outlive the connection
+   else if ( Connection::handleExists(conn) )
+   {
+      cache = &msCaches[conn];
+   }
+
+   return cache;
+}
+
+
+ResponseCache::tInvalidatorContainer::iterator ResponseCache::findInvalidator
+   (
+   tConnCache&          cache,
+   const std::string&   busName,
+   const std::string&   objPath,
+   const std::string&   sigName
+   )
+{
+   tInvalidatorContainer::iterator it = cache.invalidators.begin();
+   while ( (it != cache.invalidators.end()) &&
+      (((*it)->busName != busName) || ((*it)->objPath != objPath) ||
+      ((*it)->sigName != sigName)) )
+   {
+      ++it;
+   }
+
+   return it;
+}
+
+
+bool ResponseCache::setLimit
+   (
+   DBUSIPC_tConnection  conn,
+   uint32_t             maxBytes
+   )
+{
+   ScopedLock lock(msLock);
+   tConnCache* cache = getCache(conn);
+
+   if ( 0 != cache )
+   {
+      cache->maxBytes = maxBytes;
+      while ( cache->usedBytes > cache->maxBytes )
+      {
+         evict(*cache, cache->entries.find(cache->lru.back()));
+      }
+   }
+
+   return 0 != cache;
+}
+
+
+bool ResponseCache::setCacheable
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath,
+   DBUSIPC_tConstStr    method,
+   uint32_t             msecTtl
+   )
+{
+   assert( 0 != method );
+
+   std::string key = makePrefix(busName, objPath) + method;
+   ScopedLock lock(msLock);
+   tConnCache* cache = getCache(conn);
+
+   if ( 0 == cache )
+   {
+      // Nothing to do
+   }
+   else if ( 0U == msecTtl )
+   {
+      cache->rules.erase(key);
+   }
+   else
+   {
+      cache->rules[key] = msecTtl;
+   }
+
+   return 0 != cache;
+}
+
+
+ResponseCache::tInvalidator* ResponseCache::addInvalidator
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath,
+   DBUSIPC_tConstStr    sigName,
+   bool&                isNew
+   )
+{
+   assert( (0 != busName) && (0 != sigName) );
+
+   tInvalidator* inv(0);
+   std::string path((0 == objPath) ? NUtil::busNameToObjPath(busName) :
+                                     objPath);
+   ScopedLock lock(msLock);
+   tConnCache* cache = getCache(conn);
+
+   isNew = false;
+   if ( 0 != cache )
+   {
+      tInvalidatorContainer::iterator it = findInvalidator(*cache, busName,
+                                                           path, sigName);
+      if ( it != cache->invalidators.end() )
+      {
+         inv = *it;
+      }
+      else
+      {
+         inv = new tInvalidator;
+         inv->conn = conn;
+         inv->busName = busName;
+         inv->objPath.swap(path);
+         inv->sigName = sigName;
+         inv->subHnd = 0;
+         cache->invalidators.push_back(inv);
+         isNew = true;
+      }
+   }
+
+   return inv;
+}
+
+
+void ResponseCache::setSubscription
+   (
+   tInvalidator*        inv,
+   DBUSIPC_tSigSubHnd   subHnd
+   )
+{
+   assert( 0 != inv );
+
+   // The invalidator is gone if the connection was purged while
+   // subscribing so it's only touched if it's still listed
+   ScopedLock lock(msLock);
+   for ( tCacheContainer::iterator cacheIt = msCaches.begin();
+      cacheIt != msCaches.end(); ++cacheIt )
+   {
+      tInvalidatorContainer& invalidators = (*cacheIt).second.invalidators;
+      for ( tInvalidatorContainer::iterator it = invalidators.begin();
+         it != invalidators.end(); ++it )
+      {
+         if ( (*it) == inv )
+         {
+            inv->subHnd = subHnd;
+         }
+      }
+   }
+}
+
+
+void ResponseCache::removeInvalidator
+   (
+   tInvalidator*  inv
+   )
+{
+   assert( 0 != inv );
+
+   ScopedLock lock(msLock);
+   for ( tCacheContainer::iterator cacheIt = msCaches.begin();
+      cacheIt != msCaches.end(); ++cacheIt )
+   {
+      tInvalidatorContainer& invalidators = (*cacheIt).second.invalidators;
+      tInvalidatorContainer::iterator it = invalidators.begin();
+      while ( it != invalidators.end() )
+      {
+         if ( (*it) == inv )
+         {
+            delete inv;
+            it = invalidators.erase(it);
+         }
+         else
+         {
+            ++it;
+         }
+      }
+   }
+}
+
+
+ResponseCache::tInvalidator* ResponseCache::takeInvalidator
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath,
+   DBUSIPC_tConstStr    sigName
+   )
+{
+   assert( (0 != busName) && (0 != sigName) );
+
+   tInvalidator* inv(0);
+   std::string path((0 == objPath) ? NUtil::busNameToObjPath(busName) :
+                                     objPath);
+   ScopedLock lock(msLock);
+   tCacheContainer::iterator cacheIt = msCaches.find(conn);
+
+   if ( cacheIt != msCaches.end() )
+   {
+      tConnCache& cache = (*cacheIt).second;
+      tInvalidatorContainer::iterator it = findInvalidator(cache, busName,
+                                                           path, sigName);
+      // One still being subscribed is left to whoever is subscribing it
+      if ( (it != cache.invalidators.end()) && (0 != (*it)->subHnd) )
+      {
+         inv = *it;
+         cache.invalidators.erase(it);
+      }
+   }
+
+   return inv;
+}
+
+
+bool ResponseCache::lookup
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   std::string&         result
+   )
+{
+   bool found(false);
+   ScopedLock lock(msLock);
+   tCacheContainer::iterator cacheIt = msCaches.find(conn);
+
+   if ( (cacheIt != msCaches.end()) && (0U != (*cacheIt).second.maxBytes) &&
+      !(*cacheIt).second.entries.empty() )
+   {
+      tConnCache& cache = (*cacheIt).second;
+      std::string key = makePrefix(busName, objPath) + method + '\n' +
+                        ((0 == parms) ? EMPTY_OBJECT : parms);
+      tEntryContainer::iterator it = cache.entries.find(key);
+      if ( it != cache.entries.end() )
+      {
+         if ( NSysDep::DBUSIPC_getSystemTime() >= (*it).second.expiry )
+         {
+            evict(cache, it);
+         }
+         else
+         {
+            // Keep recently used results around the longest
+            cache.lru.splice(cache.lru.begin(), cache.lru, (*it).second.lru);
+            result = (*it).second.result;
+            found = true;
+         }
+      }
+   }
+
+   return found;
+}
+
+
+void ResponseCache::store
+   (
+   DBUSIPC_tConnection  conn,
+   DBUSIPC_tConstStr    busName,
+   DBUSIPC_tConstStr    objPath,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tConstStr    result,
+   uint32_t             msecTtl
+   )
+{
+   ScopedLock lock(msLock);
+   tCacheContainer::iterator cacheIt = msCaches.find(conn);
+
+   // Nothing is cached unless the connection has been given a budget
+   if ( (cacheIt != msCaches.end()) && (0U != (*cacheIt).second.maxBytes) )
+   {
+      tConnCache& cache = (*cacheIt).second;
+      std::string key = makePrefix(busName, objPath) + method;
+
+      // A TTL the client configured takes precedence over the service's
+      tRuleContainer::const_iterator ruleIt = cache.rules.find(key);
+      if ( ruleIt != cache.rules.end() )
+      {
+         msecTtl = (*ruleIt).second;
+      }
+
+      key += '\n';
+      key += (0 == parms) ? EMPTY_OBJECT : parms;
+      std::string value((0 == result) ? "" : result);
+      uint32_t size = static_cast<uint32_t>(key.size() + value.size());
+
+      if ( (0U != msecTtl) && (size <= cache.maxBytes) )
+      {
+         tEntryContainer::iterator it = cache.entries.find(key);
+         if ( it != cache.entries.end() )
+         {
+            evict(cache, it);
+         }
+
+         // Make room by dropping the least recently used results
+         while ( (cache.maxBytes - cache.usedBytes) < size )
+         {
+            evict(cache, cache.entries.find(cache.lru.back()));
+         }
+
+         cache.lru.push_front(key);
+         tEntry& entry = cache.entries[key];
+         entry.result.swap(value);
+         entry.expiry = NSysDep::DBUSIPC_getSystemTime() + msecTtl;
+         entry.lru = cache.lru.begin();
+         cache.usedBytes += size;
+      }
+   }
+}
+
+
+void ResponseCache::invalidate
+   (
+   DBUSIPC_tConnection  conn,
+   const std::string&   busName,
+   const std::string&   objPath
+   )
+{
+   std::string prefix = makePrefix(busName.c_str(), objPath.c_str());
+   ScopedLock lock(msLock);
+   tCacheContainer::iterator cacheIt = msCaches.find(conn);
+
+   if ( cacheIt != msCaches.end() )
+   {
+      tConnCache& cache = (*cacheIt).second;
+      tEntryContainer::iterator it = cache.entries.lower_bound(prefix);
+      while ( (it != cache.entries.end()) &&
+         (0 == (*it).first.compare(0, prefix.size(), prefix)) )
+      {
+         evict(cache, it++);
+      }
+   }
+}
+
+
+void ResponseCache::purge
+   (
+   DBUSIPC_tConnection  conn
+   )
+{
+   ScopedLock lock(msLock);
+   tCacheContainer::iterator cacheIt = msCaches.find(conn);
+
+   if ( cacheIt != msCaches.end() )
+   {
+      tInvalidatorContainer& invalidators = (*cacheIt).second.invalidators;
+      for ( tInvalidatorContainer::iterator it = invalidators.begin();
+         it != invalidators.end(); ++it )
+      {
+         delete (*it);
+      }
+      msCaches.erase(cacheIt);
+   }
+}
+
+
+void ResponseCache::onInvalidate
+   (
+   DBUSIPC_tConstStr  sigName,
+   DBUSIPC_tConstStr  data,
+   DBUSIPC_tUserToken token
+   )
+{
+   tInvalidator* inv = static_cast<tInvalidator*>(token);
+   assert( 0 != inv );
+
+   TRACE_INFO("ResponseCache: %s evicts cached results of %s", sigName,
+              inv->busName.c_str());
+   invalidate(inv->conn, inv->busName, inv->objPath);
+}
@@ -0,0 +1,127 @@
+#ifndef RESPONSECACHE_HPP_
+#define RESPONSECACHE_HPP_
+
+#include <map>
+#include <list>
+#include <string>
+#include "dbusipc/dbusipc.h"
+#include "MutexLock.hpp"
+
+//
+// Caches the results of idempotent method invocations on a per-connection
+// basis. Lookups are made from client threads so every operation is
+// serialized by a single lock and connections are keyed by their handle
+// (never resolved).
+//
+class ResponseCache
+{
+public:
+   // Context for a signal that evicts the cached results of a service
+   struct tInvalidator
+   {
+      DBUSIPC_tConnection  conn;
+      std::string          busName;
+      std::string          objPath;
+      std::string          sigName;
+      DBUSIPC_tSigSubHnd   subHnd;
+   };
+
+   // These return false if the connection has been closed (or never
+   // existed)
+   static bool setLimit(DBUSIPC_tConnection conn, uint32_t maxBytes);
+   static bool setCacheable(DBUSIPC_tConnection conn,
+                            DBUSIPC_tConstStr busName,
+                            DBUSIPC_tConstStr objPath,
+                            DBUSIPC_tConstStr method,
+                            uint32_t msecTtl);
+
+   // Invalidators are unique per connection, service and signal. The one
+   // returned is new (and has yet to be subscribed) only if isNew is set.
+   // Returns NULL if the connection has been closed.
+   static tInvalidator* addInvalidator(DBUSIPC_tConnection conn,
+                                       DBUSIPC_tConstStr busName,
+                                       DBUSIPC_tConstStr objPath,
+                                       DBUSIPC_tConstStr sigName,
+                                       bool& isNew);
+   static void setSubscription(tInvalidator* inv, DBUSIPC_tSigSubHnd subHnd);
+   static void removeInvalidator(tInvalidator* inv);
+   // Unlinks the matching (subscribed) invalidator and hands it to the
+   // caller which unsubscribes and then deletes it. Returns NULL if there
+   // is none.
+   static tInvalidator* takeInvalidator(DBUSIPC_tConnection conn,
+                                        DBUSIPC_tConstStr busName,
+                                        DBUSIPC_tConstStr objPath,
+                                        DBUSIPC_tConstStr sigName);
+
+   static bool lookup(DBUSIPC_tConnection conn, DBUSIPC_tConstStr busName,
+                      DBUSIPC_tConstStr objPath, DBUSIPC_tConstStr method,
+                      DBUSIPC_tConstStr parms, std::string& result);
+   static void store(DBUSIPC_tConnection conn, DBUSIPC_tConstStr busName,
+                     DBUSIPC_tConstStr objPath, DBUSIPC_tConstStr method,
+                     DBUSIPC_tConstStr parms, DBUSIPC_tConstStr result,
+                     uint32_t msecTtl);
+   static void invalidate(DBUSIPC_tConnection conn,
+                          const std::string& busName,
+                          const std::string& objPath);
+   static void purge(DBUSIPC_tConnection conn);
+
+   // Signal callback used for invalidation subscriptions
+   static void onInvalidate(DBUSIPC_tConstStr sigName,
+                            DBUSIPC_tConstStr data,
+                            DBUSIPC_tUserToken token);
+
+private:
+   // (Unimplemented) private constructor, copy constructor and assignment
+   // operator since this class is never instantiated
+   ResponseCache();
+   ResponseCache(const ResponseCache& other);
+   ResponseCache& operator=(const ResponseCache& rhs);
+
+   // Keys of cached results with the most recently used at the front
+   typedef std::list<std::string> tLruList;
+
+   struct tEntry
+   {
+      std::string          result;
+      uint64_t             expiry;
+      tLruList::iterator   lru;
+   };
+
+   typedef std::map<std::string, tEntry> tEntryContainer;
+   typedef std::map<std::string, uint32_t> tRuleContainer;
+   typedef std::list<tInvalidator*> tInvalidatorContainer;
+
+   struct tConnCache
+   {
+      tConnCache()
+         : maxBytes(0U), usedBytes(0U), entries(), lru(), rules()
+         , invalidators()
+      {
+      }
+
+      uint32_t                maxBytes;
+      uint32_t                usedBytes;
+      tEntryContainer         entries;
+      tLruList                lru;
+      tRuleContainer          rules;
+      tInvalidatorContainer   invalidators;
+   };
+
+   typedef std::map<DBUSIPC_tConnection, tConnCache> tCacheContainer;
+
+   static std::string makePrefix(DBUSIPC_tConstStr busName,
+                                 DBUSIPC_tConstStr objPath);
+   // Must be called with the lock held
+   static tConnCache* getCache(DBUSIPC_tConnection conn);
+   static tInvalidatorContainer::iterator findInvalidator(
+                                             tConnCache& cache,
+                                             const std::string& busName,
+                                             const std::string& objPath,
+                                             const std::string& sigName);
+   static void evict(tConnCache& cache, tEntryContainer::iterator it);
+
+   static tCacheContainer  msCaches;
+   static MutexLock        msLock;
+};
+
+#endif /* Guard for RESPONSECACHE_HPP_ */
@@ -1,16 +1,22 @@
 
 
 #include <assert.h>
+#include <cstring>
 #include "ServiceRegistration.hpp"
 #include "Connection.hpp"
 #include "NUtil.hpp"
 #include "RequestContext.hpp"
 #include "NSysDep.hpp"
+#include "PeerServer.hpp"
+#include "Watchdog.hpp"
+#include "Dispatcher.hpp"
+#include "Command.hpp"
 #include "dbus/dbus.h"
+#include "trace.h"
 
 ServiceRegistration::ServiceRegistration
    (
-   Connection*             conn,
+   DBUSIPC_tConnection      conn,
    const std::string&      busName,
    const std::string&      objPath,
    uint32_t                flag,
@@ -18,12 +24,22 @@ ServiceRegistration::ServiceRegistration
    DBUSIPC_tUserToken       token
    )
    : mConn(conn)
+   , mHandle(0)
    , mBusName(busName)
    , mObjectPath(objPath)
    , mFlags(flag)
    , mOnRequest(onRequest)
    , mUserToken(token)
+   , mPeerServer()
+   , mMaxInFlight(0U)
+   , mMaxQueued(0U)
+   , mInFlight(0U)
+   , mQueue()
+   , mDrainScheduled(false)
+   , mMethods()
 {
+   std::memset(&mStats, 0, sizeof(mStats));
+
    if ( mObjectPath.empty() )
    {
       mObjectPath = NUtil::busNameToObjPath(busName.c_str());
@@ -31,31 +47,150 @@ ServiceRegistration::ServiceRegistration
 
 }
 
+Connection* ServiceRegistration::getConnection()
+{
+   return Connection::fromHandle(mConn);
+}
+
+
 ServiceRegistration::~ServiceRegistration()
 {
+   // Requests still waiting their turn will never be delivered so tell
+   // their clients rather than leaving them to time out
+   while ( !mQueue.empty() )
+   {
+      tQueuedRequest req = mQueue.front();
+      mQueue.pop_front();
+      Connection* conn = Connection::fromHandle(req.conn);
+      if ( 0 != conn )
+      {
+         conn->replyError(req.msg, DBUSIPC_ERR_NAME_NOT_FOUND,
+                          "Service unregistered: request dropped");
+      }
+      dbus_message_unref(req.msg);
+   }
+   
+   if ( 0 != mPeerServer.get() )
+   {
+      // Stop listening and drop any peers still connected to us
+      mPeerServer.reset();
+      Connection::releasePeers(this);
+   }
+}
+
+
+const char* ServiceRegistration::getPeerAddress() const
+{
+   return (0 != mPeerServer.get()) ? mPeerServer->getAddress() : "";
+}
+
+
+void ServiceRegistration::listenForPeers
+   (
+   Dispatcher* disp
+   )
+{
+   if ( 0 == mPeerServer.get() )
+   {
+      mPeerServer.reset(new PeerServer(this, disp));
+   }
 }
 
 
 void ServiceRegistration::dispatch
    (
+   Connection*       conn,
    DBusMessage*      reqMsg,
    DBUSIPC_tConstStr  method,
    DBUSIPC_tConstStr  parms,
+   uint64_t          deadline,
    uint64_t          timeout
    )
 {
-   // If there is a callback to invoke then ...
-   if ( 0 != mOnRequest )
+   // Nobody would ever answer a request for a method without a handler
+   if ( !hasHandler(method) )
+   {
+      rejectUnknown(conn, reqMsg, method);
+   }
+   // Else if all the in-flight slots are taken then the request has to
+   // wait its turn. The caller is expected to have checked isBusy() first.
+   else if ( (0U != mMaxInFlight) && (mInFlight >= mMaxInFlight) )
    {
+      tQueuedRequest req = { conn->getHandle(), dbus_message_ref(reqMsg),
+                             deadline, timeout };
+      mQueue.push_back(req);
+   }
+   else
+   {
+      deliver(conn, reqMsg, method, parms, deadline, timeout);
+   }
+}
+
+
+void ServiceRegistration::deliver
+   (
+   Connection*       conn,
+   DBusMessage*      reqMsg,
+   DBUSIPC_tConstStr  method,
+   DBUSIPC_tConstStr  parms,
+   uint64_t          deadline,
+   uint64_t          timeout
+   )
+{
+   uint64_t now = NSysDep::DBUSIPC_getSystemTime();
+   
+   // If the client has already given up waiting for the reply then
+   // (if asked to) don't waste any more time on the request.
+   if ( (DBUSIPC_REG_FLAG_DROP_EXPIRED & mFlags) && (0U != deadline) &&
+      (now >= deadline) )
+   {
+      TRACE_WARN("dispatch: dropped expired request for method (%s)",
+                 method);
+      ++mStats.expired;
+   }
+   // Else if the handler went away while the request was queued then ...
+   else if ( !hasHandler(method) )
+   {
+      rejectUnknown(conn, reqMsg, method);
+   }
+   else
+   {
+      // Methods registered on their own go straight to their handler
+      tMethod* entry = findMethod(method);
+      DBUSIPC_tRequestCallback onRequest = (0 != entry) ? entry->onRequest :
+                                          mOnRequest;
+      DBUSIPC_tUserToken token = (0 != entry) ? entry->token : mUserToken;
+      
       // The owner of the callback will own the request context and it's
-      // their responsibility to free it.
-      RequestContext* reqCtx = new RequestContext(mConn, reqMsg);
+      // their responsibility to free it. The reply goes back over the
+      // connection the request arrived on (which may be a direct peer).
+      RequestContext* reqCtx = new RequestContext(conn, reqMsg, deadline,
+                                                  this);
       assert( 0 != reqCtx );
       assert( 0 != method );
       assert( 0 != parms );
-      uint64_t now = NSysDep::DBUSIPC_getSystemTime();
-      mOnRequest(reqCtx, method, parms, dbus_message_get_no_reply(reqMsg),
-                 mUserToken);
+      ++mInFlight;
+      ++mStats.accepted;
+      TRACE_EVENT(DBUSIPC_TRACE_REQUEST_RECEIVED, TRACE_PTR(mHandle),
+                  dbus_message_get_serial(reqMsg), 0U, 0U);
+      uint64_t start = NSysDep::DBUSIPC_getSystemTimeUsec();
+      {
+         Watchdog::Scope watch(Watchdog::KIND_METHOD, mObjectPath.c_str(),
+                               method, timeout);
+         onRequest(reqCtx, method, parms, dbus_message_get_no_reply(reqMsg),
+                   token);
+      }
+      
+      // The handler may have unregistered the method (but not the
+      // service) so look it up again
+      entry = findMethod(method);
+      if ( 0 != entry )
+      {
+         ++entry->stats.calls;
+         Dispatcher::addSample(entry->stats.handlerTime,
+                               NSysDep::DBUSIPC_getSystemTimeUsec() - start);
+      }
+      
       uint64_t elapsed = NSysDep::DBUSIPC_getSystemTime() - now;
       if (  elapsed > timeout )
       {
@@ -67,6 +202,187 @@ void ServiceRegistration::dispatch
 }
 
 
+ServiceRegistration::tMethod* ServiceRegistration::findMethod
+   (
+   DBUSIPC_tConstStr  method
+   )
+{
+   tMethod* entry(0);
+   
+   if ( !mMethods.empty() )
+   {
+      tMethodContainer::iterator it = mMethods.find(method);
+      if ( it != mMethods.end() )
+      {
+         entry = &(*it).second;
+      }
+   }
+   
+   return entry;
+}
+
+
+bool ServiceRegistration::hasHandler
+   (
+   DBUSIPC_tConstStr  method
+   )
+{
+   return (0 != mOnRequest) || (0 != findMethod(method));
+}
+
+
+void ServiceRegistration::rejectUnknown
+   (
+   Connection*       conn,
+   DBusMessage*      reqMsg,
+   DBUSIPC_tConstStr  method
+   )
+{
+   TRACE_WARN("dispatch: no handler for method (%s)", method);
+   ++mStats.unknown;
+   conn->replyError(reqMsg, DBUSIPC_ERR_NAME_UNKNOWN_METHOD,
+                    "No handler for the method: request rejected");
+}
+
+
+void ServiceRegistration::setMethod
+   (
+   const std::string&         method,
+   DBUSIPC_tRequestCallback    onRequest,
+   DBUSIPC_tUserToken          token
+   )
+{
+   if ( 0 == onRequest )
+   {
+      mMethods.erase(method);
+   }
+   else
+   {
+      // Re-registering a method replaces its handler but keeps its stats
+      tMethodContainer::iterator it = mMethods.find(method);
+      if ( it == mMethods.end() )
+      {
+         tMethod entry;
+         std::memset(&entry.stats, 0, sizeof(entry.stats));
+         it = mMethods.insert(std::make_pair(method, entry)).first;
+      }
+      (*it).second.onRequest = onRequest;
+      (*it).second.token = token;
+   }
+}
+
+
+bool ServiceRegistration::getMethodStats
+   (
+   const std::string&      method,
+   DBUSIPC_tMethodStats&    stats
+   ) const
+{
+   bool found(false);
+   
+   tMethodContainer::const_iterator it = mMethods.find(method);
+   if ( it != mMethods.end() )
+   {
+      stats = (*it).second.stats;
+      found = true;
+   }
+   
+   return found;
+}
+
+
+void ServiceRegistration::setLimits
+   (
+   uint32_t maxInFlight,
+   uint32_t maxQueued
+   )
+{
+   mMaxInFlight = maxInFlight;
+   mMaxQueued = maxQueued;
+   
+   // The new limits may let some of the waiting requests through
+   drainQueue();
+}
+
+
+void ServiceRegistration::getStats
+   (
+   DBUSIPC_tServiceStats&   stats
+   ) const
+{
+   stats = mStats;
+   stats.inFlight = mInFlight;
+   stats.queued = static_cast<DBUSIPC_tUInt32>(mQueue.size());
+}
+
+
+bool ServiceRegistration::isBusy() const
+{
+   // Zero for either limit means unlimited
+   return (0U != mMaxInFlight) && (mInFlight >= mMaxInFlight) &&
+          (0U != mMaxQueued) && (mQueue.size() >= mMaxQueued);
+}
+
+
+void ServiceRegistration::recordShed()
+{
+   ++mStats.shed;
+}
+
+
+void ServiceRegistration::onRequestDone()
+{
+   if ( 0U < mInFlight )
+   {
+      --mInFlight;
+   }
+   
+   // This is called while replying to (or freeing) a request, often from
+   // inside the service's own handler, so the next request is delivered
+   // on the next pass of the dispatcher rather than re-entering it
+   Connection* conn = getConnection();
+   if ( !mQueue.empty() && !mDrainScheduled && (0 != conn) )
+   {
+      DrainQueueCmd* cmd = new DrainQueueCmd(mHandle);
+      if ( DBUSIPC_INVALID_HANDLE ==
+         conn->getDispatcher()->submitCommand(cmd) )
+      {
+         delete cmd;
+      }
+      else
+      {
+         mDrainScheduled = true;
+      }
+   }
+}
+
+
+void ServiceRegistration::drainQueue()
+{
+   mDrainScheduled = false;
+   
+   // Hand waiting requests to the service as in-flight slots free up
+   while ( !mQueue.empty() &&
+      ((0U == mMaxInFlight) || (mInFlight < mMaxInFlight)) )
+   {
+      tQueuedRequest req = mQueue.front();
+      mQueue.pop_front();
+      
+      DBUSIPC_tConstStr method(0);
+      DBUSIPC_tConstStr parms(0);
+      // The peer the request arrived on may have gone away meanwhile
+      Connection* conn = Connection::fromHandle(req.conn);
+      if ( (0 != conn) &&
+         dbus_message_get_args(req.msg, 0, DBUS_TYPE_STRING, &method,
+         DBUS_TYPE_STRING, &parms, DBUS_TYPE_INVALID) )
+      {
+         deliver(conn, req.msg, method, parms, req.deadline, req.timeout);
+      }
+      dbus_message_unref(req.msg);
+   }
+}
+
+
 void ServiceRegistration::introspect
    (
    std::string&   xml
@@ -77,8 +393,16 @@ void ServiceRegistration::introspect
       "      <method name=\"Invoke\">\n"
       "         <arg name=\"method\" type=\"s\" direction=\"in\"/>\n"
       "         <arg name=\"parameters\" type=\"s\" direction=\"in\"/>\n"
+      "         <!-- Optional: only sent with a finite timeout -->\n"
+      "         <arg name=\"deadline\" type=\"t\" direction=\"in\">\n"
+      "            <annotation name=\"com.hsae.ServiceIpc.Optional\" "
+      "value=\"true\"/>\n"
+      "         </arg>\n"
       "         <arg name=\"result\" type=\"s\" direction=\"out\"/>\n"
       "      </method>\n"
+      "      <method name=\"GetPeerAddress\">\n"
+      "         <arg name=\"address\" type=\"s\" direction=\"out\"/>\n"
+      "      </method>\n"
       "      <signal name=\"Emit\">\n"
       "         <arg name=\"name\" type=\"s\"/>\n"
       "         <arg name=\"data\" type=\"s\"/>\n"
@@ -2,18 +2,23 @@
 #define SERVICEREGISTRATION_HPP_
 
 #include <string>
+#include <memory>
+#include <deque>
+#include <map>
 #include "dbusipc/dbusipc.h"
 
 //
 // Forward Declaration
 //
 class Connection;
+class Dispatcher;
+class PeerServer;
 struct DBusMessage;
 
 class ServiceRegistration
 {
 public:
-   ServiceRegistration(Connection* conn,
+   ServiceRegistration(DBUSIPC_tConnection conn,
             const std::string& busName,
             const std::string& objPath,
             uint32_t flag,
@@ -25,25 +30,88 @@ public:
 	const char* getBusName() const;
 	const char* getObjectPath() const;
 	Connection* getConnection();
+	DBUSIPC_tSvcRegHnd getHandle() const;
+	void setHandle(DBUSIPC_tSvcRegHnd hnd);
 	uint32_t getFlags() const;
+	const char* getPeerAddress() const;
 
-	void dispatch(DBusMessage* reqMsg, DBUSIPC_tConstStr method,
+	// This can throw exceptions
+	void listenForPeers(Dispatcher* disp);
+
+	void dispatch(Connection* conn, DBusMessage* reqMsg,
+                 DBUSIPC_tConstStr method,
                  DBUSIPC_tConstStr parms,
+                 uint64_t deadline = 0U,
                  uint64_t timeout = DBUSIPC_MAX_UINT64);
 	void introspect(std::string& xml);
 
+	// Routes requests for the method to their own handler rather than
+	// the one the service was registered with (a NULL handler removes it)
+	void setMethod(const std::string& method,
+	               DBUSIPC_tRequestCallback onRequest,
+	               DBUSIPC_tUserToken token);
+	bool getMethodStats(const std::string& method,
+	                    DBUSIPC_tMethodStats& stats) const;
+
+	// Admission control
+	void setLimits(uint32_t maxInFlight, uint32_t maxQueued);
+	void getStats(DBUSIPC_tServiceStats& stats) const;
+	bool isBusy() const;
+	void recordShed();
+	// Frees the request's in-flight slot and schedules the queue to drain
+	void onRequestDone();
+	void drainQueue();
+
 private:
    // (Unimplemented) private copy constructor and assignment operator
    // to prevent misuse
    ServiceRegistration(const ServiceRegistration& other);
    ServiceRegistration& operator=(const ServiceRegistration& rhs);
    
-   Connection*             mConn;
+   // A request waiting for an in-flight slot to free up
+   struct tQueuedRequest
+   {
+      DBUSIPC_tConnection  conn;
+      DBusMessage*         msg;
+      uint64_t             deadline;
+      uint64_t             timeout;
+   };
+   typedef std::deque<tQueuedRequest> tRequestQueue;
+   
+   // The handler of a registered method
+   struct tMethod
+   {
+      DBUSIPC_tRequestCallback onRequest;
+      DBUSIPC_tUserToken       token;
+      DBUSIPC_tMethodStats     stats;
+   };
+   typedef std::map<std::string, tMethod> tMethodContainer;
+   
+   void deliver(Connection* conn, DBusMessage* reqMsg,
+                DBUSIPC_tConstStr method, DBUSIPC_tConstStr parms,
+                uint64_t deadline, uint64_t timeout);
+   // Returns NULL if the method is handled by the service's own handler
+   tMethod* findMethod(DBUSIPC_tConstStr method);
+   bool hasHandler(DBUSIPC_tConstStr method);
+   void rejectUnknown(Connection* conn, DBusMessage* reqMsg,
+                      DBUSIPC_tConstStr method);
+   
+   DBUSIPC_tConnection      mConn;
+   DBUSIPC_tSvcRegHnd       mHandle;
    std::string             mBusName;
    std::string             mObjectPath;
    uint32_t                mFlags;
    DBUSIPC_tRequestCallback mOnRequest;
    DBUSIPC_tUserToken       mUserToken;
+   std::auto_ptr<PeerServer> mPeerServer;
+   uint32_t                mMaxInFlight;
+   uint32_t                mMaxQueued;
+   uint32_t                mInFlight;
+   tRequestQueue           mQueue;
+   // Set while a DrainQueueCmd is waiting to run
+   bool                    mDrainScheduled;
+   tMethodContainer        mMethods;
+   DBUSIPC_tServiceStats    mStats;
 };
 
 inline const char* ServiceRegistration::getBusName() const
@@ -63,9 +131,17 @@ inline uint32_t ServiceRegistration::getFlags() const
    return mFlags;
 }
 
-inline Connection* ServiceRegistration::getConnection()
+inline DBUSIPC_tSvcRegHnd ServiceRegistration::getHandle() const
+{
+   return mHandle;
+}
+
+inline void ServiceRegistration::setHandle
+   (
+   DBUSIPC_tSvcRegHnd   hnd
+   )
 {
-   return mConn;
+   mHandle = hnd;
 }
 
 #endif /* Guard for SERVICEREGISTRATION_HPP_ */
@@ -7,12 +7,15 @@
 
 #include "InterfaceDefs.hpp"
 #include "NSysDep.hpp"
+#include "Connection.hpp"
+#include "Watchdog.hpp"
 
 SignalSubscription::SignalSubscription
    (
-   Connection* conn
+   DBUSIPC_tConnection conn
    )
    : mConn(conn)
+   , mHandle(0)
 {
    
 }
@@ -23,9 +26,15 @@ SignalSubscription::~SignalSubscription()
 }
 
 
+Connection* SignalSubscription::getConnection() const
+{
+   return Connection::fromHandle(mConn);
+}
+
+
 NameOwnerChangedSubscription::NameOwnerChangedSubscription
    (
-   Connection*                      conn,
+   DBUSIPC_tConnection               conn,
    const std::string&               busName,
    DBUSIPC_tNameOwnerChangedCallback onNameChange,
    DBUSIPC_tUserToken                token
@@ -101,10 +110,14 @@ bool NameOwnerChangedSubscription::dispatchIfMatch
    if ( match && ( 0 != mOnNameChange) )
    {
       uint64_t now = NSysDep::DBUSIPC_getSystemTime();
-      mOnNameChange(newName ? newName : "",
-                    oldOwner ? oldOwner : "",
-                    newOwner ? newOwner : "",
-                    mUserToken);
+      {
+         Watchdog::Scope watch(Watchdog::KIND_NAME_CHANGE, DBUS_PATH_DBUS,
+                               newName, timeout);
+         mOnNameChange(newName ? newName : "",
+                       oldOwner ? oldOwner : "",
+                       newOwner ? newOwner : "",
+                       mUserToken);
+      }
       uint64_t elapsed = NSysDep::DBUSIPC_getSystemTime() - now;
       if (  elapsed > timeout )
       {
@@ -120,7 +133,7 @@ bool NameOwnerChangedSubscription::dispatchIfMatch
 
 DBUSIPCSubscription::DBUSIPCSubscription
    (
-   Connection*             conn,
+   DBUSIPC_tConnection      conn,
    const std::string&      objPath,
    const std::string&      sigName,
    DBUSIPC_tSignalCallback  onSignal,
@@ -178,9 +191,14 @@ bool DBUSIPCSubscription::dispatchIfMatch
             if ( 0!= mOnSignal )
             {
                uint64_t now = NSysDep::DBUSIPC_getSystemTime();
-               mOnSignal(mSignalName.c_str(),
-                         data ? data : "",
-                         mUserToken);
+               {
+                  Watchdog::Scope watch(Watchdog::KIND_SIGNAL,
+                                        mObjectPath.c_str(),
+                                        mSignalName.c_str(), timeout);
+                  mOnSignal(mSignalName.c_str(),
+                            data ? data : "",
+                            mUserToken);
+               }
                uint64_t elapsed = NSysDep::DBUSIPC_getSystemTime() - now;
                if (  elapsed > timeout )
                {
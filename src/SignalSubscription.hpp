@@ -14,31 +14,43 @@ struct DBusMessage;
 class SignalSubscription
 {
 public:
-   SignalSubscription(Connection* conn);
+   SignalSubscription(DBUSIPC_tConnection conn);
    
    virtual ~SignalSubscription();
 
    Connection* getConnection() const;
+   DBUSIPC_tSigSubHnd getHandle() const;
+   void setHandle(DBUSIPC_tSigSubHnd hnd);
    virtual const char* getRule() const = 0;
 
    virtual bool dispatchIfMatch(DBusMessage* msg,
                 uint64_t timeout = DBUSIPC_MAX_UINT64) = 0;
    
 private:
-   Connection* mConn;
+   DBUSIPC_tConnection  mConn;
+   DBUSIPC_tSigSubHnd   mHandle;
 };
 
 
-inline Connection* SignalSubscription::getConnection() const
+inline DBUSIPC_tSigSubHnd SignalSubscription::getHandle() const
 {
-   return mConn;
+   return mHandle;
+}
+
+
+inline void SignalSubscription::setHandle
+   (
+   DBUSIPC_tSigSubHnd   hnd
+   )
+{
+   mHandle = hnd;
 }
 
 
 class NameOwnerChangedSubscription : public SignalSubscription
 {
 public:
-   NameOwnerChangedSubscription(Connection* conn,
+   NameOwnerChangedSubscription(DBUSIPC_tConnection conn,
                                 const std::string& busName,
                                 DBUSIPC_tNameOwnerChangedCallback onNameChange,
                                 DBUSIPC_tUserToken token);
@@ -66,7 +78,7 @@ private:
 class DBUSIPCSubscription : public SignalSubscription
 {
 public:
-	DBUSIPCSubscription(Connection* conn,
+	DBUSIPCSubscription(DBUSIPC_tConnection conn,
 	                  const std::string& objPath,
 	                  const std::string& sigName,
                      DBUSIPC_tSignalCallback onSignal,
@@ -0,0 +1,203 @@
+
+#include "TraceRing.hpp"
+
+#include <memory>
+#include <time.h>
+#include <string.h>
+#include "ScopedLock.hpp"
+#include "trace.h"
+
+TraceRing::tRingContainer TraceRing::msRings;
+MutexLock TraceRing::msLock;
+pthread_key_t TraceRing::msKey;
+pthread_once_t TraceRing::msKeyOnce = PTHREAD_ONCE_INIT;
+
+
+void TraceRing::createKey()
+{
+   if ( 0 != pthread_key_create(&msKey, TraceRing::releaseRing) )
+   {
+      TRACE_ERROR("TraceRing: cannot create thread key");
+   }
+}
+
+
+void TraceRing::releaseRing
+   (
+   void* data
+   )
+{
+   tRing* ring = static_cast<tRing*>(data);
+   
+   // The events stay around (for dumps) until another thread takes it
+   ScopedLock lock(msLock);
+   ring->inUse = false;
+}
+
+
+TraceRing::tRing* TraceRing::getThreadRing()
+{
+   (void)pthread_once(&msKeyOnce, TraceRing::createKey);
+   tRing* ring = static_cast<tRing*>(pthread_getspecific(msKey));
+   
+   // Only the first event a thread records gets here
+   if ( 0 == ring )
+   {
+      try
+      {
+         ScopedLock lock(msLock);
+         for ( tRingContainer::iterator it = msRings.begin();
+            (0 == ring) && (it != msRings.end()); ++it )
+         {
+            if ( !(*it)->inUse )
+            {
+               ring = *it;
+            }
+         }
+         
+         // The events of the thread that exited would otherwise be
+         // dumped as the new owner's
+         if ( 0 != ring )
+         {
+            ring->next = 0U;
+            memset(ring->records, 0, sizeof(ring->records));
+         }
+         
+         if ( 0 == ring )
+         {
+            std::auto_ptr<tRing> newRing(new tRing);
+            memset(newRing.get(), 0, sizeof(tRing));
+            msRings.push_back(newRing.get());
+            ring = newRing.release();
+         }
+         
+         ring->threadId = static_cast<uint64_t>(pthread_self());
+         ring->inUse = true;
+         if ( 0 != pthread_setspecific(msKey, ring) )
+         {
+            ring->inUse = false;
+            ring = 0;
+         }
+      }
+      catch ( ... )
+      {
+         // Events are simply not recorded for this thread
+         ring = 0;
+      }
+   }
+   
+   return ring;
+}
+
+
+void TraceRing::record
+   (
+   uint16_t event,
+   uint64_t arg0,
+   uint64_t arg1,
+   uint64_t arg2,
+   uint64_t arg3
+   )
+{
+   tRing* ring = getThreadRing();
+   if ( 0 != ring )
+   {
+      struct timespec now;
+      uint32_t seq = ring->next;
+      DBUSIPC_tTraceRecord& rec = ring->records[seq & (NUM_RECORDS - 1U)];
+      
+      rec.timestamp = 0U;
+      if ( -1 != clock_gettime(CLOCK_MONOTONIC, &now) )
+      {
+         rec.timestamp = (static_cast<uint64_t>(now.tv_sec) * 1000000000U) +
+                         static_cast<uint64_t>(now.tv_nsec);
+      }
+      rec.sequence = seq;
+      rec.event = event;
+      rec.reserved = 0U;
+      rec.args[0] = arg0;
+      rec.args[1] = arg1;
+      rec.args[2] = arg2;
+      rec.args[3] = arg3;
+      
+      // The record must be complete before a dump can see it
+      __sync_synchronize();
+      ring->next = seq + 1U;
+   }
+}
+
+
+bool TraceRing::dump
+   (
+   FILE* fp
+   )
+{
+   bool ok(true);
+   std::vector<DBUSIPC_tTraceRecord> records(NUM_RECORDS);
+   ScopedLock lock(msLock);
+   
+   DBUSIPC_tTraceFileHeader header;
+   header.magic = DBUSIPC_TRACE_FILE_MAGIC;
+   header.version = DBUSIPC_TRACE_FILE_VERSION;
+   header.recordSize = sizeof(DBUSIPC_tTraceRecord);
+   header.numThreads = static_cast<uint32_t>(msRings.size());
+   ok = (1U == fwrite(&header, sizeof(header), 1U, fp));
+   
+   for ( tRingContainer::const_iterator it = msRings.begin();
+      ok && (it != msRings.end()); ++it )
+   {
+      const tRing* ring = *it;
+      
+      // The owner keeps recording while we copy. Whatever it may have
+      // overwritten by the time we're done is dropped.
+      uint32_t end = ring->next;
+      __sync_synchronize();
+      for ( uint32_t seq = end - NUM_RECORDS; seq != end; ++seq )
+      {
+         records[seq & (NUM_RECORDS - 1U)] =
+                                 ring->records[seq & (NUM_RECORDS - 1U)];
+      }
+      __sync_synchronize();
+      uint32_t after = ring->next;
+      
+      // Count the events still intact (the one being recorded as we
+      // finished may have been half written) and not from before the ring
+      // was ever filled.
+      uint32_t intact(0U);
+      if ( (after - end) < (NUM_RECORDS - 1U) )
+      {
+         intact = NUM_RECORDS - 1U - (after - end);
+      }
+      if ( end < intact )
+      {
+         intact = end;
+      }
+      
+      DBUSIPC_tTraceThread thread;
+      thread.threadId = ring->threadId;
+      thread.numRecords = intact;
+      thread.numLost = end - intact;
+      ok = (1U == fwrite(&thread, sizeof(thread), 1U, fp));
+      
+      for ( uint32_t seq = end - intact; ok && (seq != end); ++seq )
+      {
+         ok = (1U == fwrite(&records[seq & (NUM_RECORDS - 1U)],
+                            sizeof(DBUSIPC_tTraceRecord), 1U, fp));
+      }
+   }
+   
+   return ok;
+}
+
+
+void DBUSIPC_traceEvent
+   (
+   uint32_t event,
+   uint64_t arg0,
+   uint64_t arg1,
+   uint64_t arg2,
+   uint64_t arg3
+   )
+{
+   TraceRing::record(static_cast<uint16_t>(event), arg0, arg1, arg2, arg3);
+}
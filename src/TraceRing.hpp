@@ -0,0 +1,58 @@
+#ifndef TRACERING_HPP_
+#define TRACERING_HPP_
+
+#include <stdio.h>
+#include <vector>
+#include <pthread.h>
+#include "dbusipc/dbusipc.h"
+#include "dbusipc/dbusipc_trace.h"
+#include "MutexLock.hpp"
+
+//
+// Records binary trace events in a fixed size ring per thread. Only the
+// owning thread ever writes to a ring so recording an event takes no lock
+// and costs little more than a clock read and a few stores. The rings are
+// only formatted offline from a dump (see DBUSIPC_dumpTrace()). A ring
+// is emptied and handed to a new thread once its owner exits.
+//
+class TraceRing
+{
+public:
+   static void record(uint16_t event, uint64_t arg0, uint64_t arg1,
+                      uint64_t arg2, uint64_t arg3);
+   
+   // Can be called from any thread. Returns false if writing failed.
+   static bool dump(FILE* fp);
+   
+private:
+   // (Unimplemented) private constructor, copy constructor and assignment
+   // operator since this class is never instantiated
+   TraceRing();
+   TraceRing(const TraceRing& other);
+   TraceRing& operator=(const TraceRing& rhs);
+   
+   // Must be a power of two
+   enum { NUM_RECORDS = 1024 };
+   
+   struct tRing
+   {
+      uint64_t                threadId;
+      volatile bool           inUse;
+      // Sequence number of the next event (only written by the owner)
+      volatile uint32_t       next;
+      DBUSIPC_tTraceRecord     records[NUM_RECORDS];
+   };
+   
+   typedef std::vector<tRing*> tRingContainer;
+   
+   static tRing* getThreadRing();
+   static void createKey();
+   static void releaseRing(void* data);
+   
+   static tRingContainer   msRings;
+   static MutexLock        msLock;
+   static pthread_key_t    msKey;
+   static pthread_once_t   msKeyOnce;
+};
+
+#endif /* Guard for TRACERING_HPP_ */
@@ -0,0 +1,442 @@
+
+#include "Watchdog.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <unwind.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "NSysDep.hpp"
+#include "ScopedLock.hpp"
+#include "trace.h"
+
+// Offset from SIGRTMIN of the signal used to interrupt the dispatcher
+// unless another one is given by DBUSIPC_WATCHDOG_SIGNAL
+static const int32_t DEFAULT_SIGNAL_OFFSET = 4;
+
+Watchdog* volatile Watchdog::msWatchdog = 0;
+Watchdog::tSlot Watchdog::msSlot;
+void* volatile Watchdog::msFrames[Watchdog::MAX_FRAMES];
+volatile sig_atomic_t Watchdog::msNumFrames = 0;
+volatile sig_atomic_t Watchdog::msCaptured = 0;
+Watchdog::tReport Watchdog::msReports[Watchdog::NUM_REPORTS];
+uint32_t Watchdog::msNumReports = 0U;
+MutexLock Watchdog::msLock;
+
+// State of a stack walk made by the signal handler
+struct tUnwindState
+{
+   void* volatile*   frames;
+   uint32_t          count;
+   uint32_t          max;
+};
+
+
+static _Unwind_Reason_Code onUnwindFrame
+   (
+   struct _Unwind_Context* ctx,
+   void*                   arg
+   )
+{
+   tUnwindState* state = static_cast<tUnwindState*>(arg);
+   _Unwind_Reason_Code rc(_URC_NO_REASON);
+
+   uintptr_t ip = static_cast<uintptr_t>(_Unwind_GetIP(ctx));
+   if ( state->count >= state->max )
+   {
+      rc = _URC_END_OF_STACK;
+   }
+   else if ( 0U != ip )
+   {
+      state->frames[state->count++] = reinterpret_cast<void*>(ip);
+   }
+
+   return rc;
+}
+
+
+Watchdog::Scope::Scope
+   (
+   tKind       kind,
+   const char* path,
+   const char* name,
+   uint64_t    msecBudget
+   )
+   : mWatched(false)
+{
+   // A nested callback (should there ever be one) is covered by the
+   // callback that is already being watched.
+   if ( (DBUSIPC_MAX_UINT64 != msecBudget) && !msSlot.active && activate() )
+   {
+      ++msSlot.generation;
+      __sync_synchronize();
+      msSlot.kind = kind;
+      msSlot.thread = pthread_self();
+      msSlot.start = NSysDep::DBUSIPC_getSystemTime();
+      msSlot.budget = msecBudget;
+      copyName(msSlot.path, path);
+      copyName(msSlot.name, name);
+      msSlot.active = true;
+      __sync_synchronize();
+      ++msSlot.generation;
+      mWatched = true;
+   }
+}
+
+
+Watchdog::Scope::~Scope()
+{
+   if ( mWatched )
+   {
+      ++msSlot.generation;
+      __sync_synchronize();
+      msSlot.active = false;
+      __sync_synchronize();
+      ++msSlot.generation;
+   }
+}
+
+
+Watchdog::Watchdog()
+   : Thread()
+   , mReported(0U)
+   , mSignal(SIGRTMIN + DEFAULT_SIGNAL_OFFSET)
+   , mCanCapture(false)
+   , mOldAction()
+{
+   std::string value = NSysDep::DBUSIPC_getenv("DBUSIPC_WATCHDOG_SIGNAL");
+   if ( !value.empty() )
+   {
+      mSignal = std::atoi(value.c_str());
+   }
+
+   // Don't take over a signal the application is using
+   if ( (0 == sigaction(mSignal, 0, &mOldAction)) &&
+      (0 == (SA_SIGINFO & mOldAction.sa_flags)) &&
+      (SIG_DFL == mOldAction.sa_handler) )
+   {
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_handler = Watchdog::onSignal;
+      action.sa_flags = SA_RESTART;
+      (void)sigemptyset(&action.sa_mask);
+      mCanCapture = (0 == sigaction(mSignal, &action, 0));
+   }
+
+   if ( !mCanCapture )
+   {
+      TRACE_WARN("Watchdog: signal %d unavailable, stacks won't be captured",
+                 mSignal);
+   }
+   else
+   {
+      // The first walk loads the unwinder (and its unwind tables) which
+      // allocates and takes locks. Doing it now leaves the signal handler
+      // with only the walk itself.
+      void* volatile frames[MAX_FRAMES];
+      tUnwindState state = { frames, 0U, MAX_FRAMES };
+      (void)_Unwind_Backtrace(onUnwindFrame, &state);
+   }
+}
+
+
+Watchdog::~Watchdog()
+{
+   stop();
+   wait(INFINITE_WAIT);
+
+   if ( mCanCapture )
+   {
+      (void)sigaction(mSignal, &mOldAction, 0);
+   }
+}
+
+
+bool Watchdog::activate()
+{
+   if ( 0 == msWatchdog )
+   {
+      try
+      {
+         ScopedLock lock(msLock);
+         if ( 0 == msWatchdog )
+         {
+            std::auto_ptr<Watchdog> watchdog(new Watchdog());
+            if ( EOK != watchdog->start(true) )
+            {
+               TRACE_ERROR("Watchdog: failed to start thread");
+            }
+            else
+            {
+               msWatchdog = watchdog.release();
+            }
+         }
+      }
+      catch ( const std::exception& e )
+      {
+         TRACE_ERROR("Watchdog: caught exception: %s", e.what());
+      }
+   }
+
+   return 0 != msWatchdog;
+}
+
+
+void Watchdog::shutdown()
+{
+   Watchdog* watchdog(0);
+   {
+      ScopedLock lock(msLock);
+      watchdog = msWatchdog;
+      msWatchdog = 0;
+   }
+
+   // The thread takes the lock when it reports a stall
+   delete watchdog;
+}
+
+
+void Watchdog::onSignal
+   (
+   int32_t sigNum
+   )
+{
+   // Only async-signal-safe work can be done here. Walking the stack isn't
+   // guaranteed to be but the unwinder was primed when we were installed
+   // (see the constructor) so it no longer allocates.
+   int32_t savedErrno = errno;
+   tUnwindState state = { msFrames, 0U, MAX_FRAMES };
+
+   (void)_Unwind_Backtrace(onUnwindFrame, &state);
+   msNumFrames = static_cast<sig_atomic_t>(state.count);
+   __sync_synchronize();
+   msCaptured = 1;
+
+   errno = savedErrno;
+}
+
+
+bool Watchdog::snapshot
+   (
+   tSlot&   copy
+   )
+{
+   bool consistent(false);
+
+   // The dispatcher never holds the slot for long so retry a few times
+   for ( uint32_t attempt = 0U; !consistent && (attempt < 3U); ++attempt )
+   {
+      uint32_t generation = msSlot.generation;
+      if ( 0U == (generation & 1U) )
+      {
+         __sync_synchronize();
+         copy = msSlot;
+         __sync_synchronize();
+         consistent = (generation == msSlot.generation);
+         copy.generation = generation;
+      }
+   }
+
+   return consistent;
+}
+
+
+bool Watchdog::execute()
+{
+   uint64_t interval(MAX_CHECK_INTERVAL);
+   tSlot slot;
+
+   if ( snapshot(slot) && slot.active )
+   {
+      uint64_t now = NSysDep::DBUSIPC_getSystemTime();
+      uint64_t elapsed = now - slot.start;
+
+      if ( elapsed > slot.budget )
+      {
+         // A stalled callback is only reported once
+         if ( mReported != slot.generation )
+         {
+            capture(slot, now);
+            mReported = slot.generation;
+         }
+      }
+      else if ( (slot.budget - elapsed) < interval )
+      {
+         // Wake up right after the callback is due to finish
+         interval = slot.budget - elapsed + 1U;
+      }
+   }
+
+   NSysDep::DBUSIPC_sleep(static_cast<uint32_t>(interval));
+
+   return true;
+}
+
+
+void Watchdog::capture
+   (
+   const tSlot&   slot,
+   uint64_t       now
+   )
+{
+   bool captured(false);
+
+   if ( mCanCapture )
+   {
+      msCaptured = 0;
+      msNumFrames = 0;
+      __sync_synchronize();
+      if ( 0 == pthread_kill(slot.thread, mSignal) )
+      {
+         for ( uint32_t waited = 0U;
+            (0 == msCaptured) && (waited < CAPTURE_TIMEOUT); ++waited )
+         {
+            NSysDep::DBUSIPC_sleep(1U);
+         }
+         __sync_synchronize();
+
+         // The stack is only of interest if it was walked before the
+         // callback returned
+         tSlot after;
+         captured = (0 != msCaptured) && snapshot(after) && after.active &&
+                    (after.generation == slot.generation);
+      }
+   }
+
+   ScopedLock lock(msLock);
+   tReport& report = msReports[msNumReports & (NUM_REPORTS - 1U)];
+   ++msNumReports;
+   report.timestamp = now;
+   report.elapsed = now - slot.start;
+   report.budget = slot.budget;
+   report.kind = slot.kind;
+   (void)memcpy(report.path, slot.path, sizeof(report.path));
+   (void)memcpy(report.name, slot.name, sizeof(report.name));
+   report.numFrames = 0U;
+   if ( captured )
+   {
+      report.numFrames = static_cast<uint32_t>(msNumFrames);
+      for ( uint32_t i = 0U; i < report.numFrames; ++i )
+      {
+         report.frames[i] = msFrames[i];
+      }
+   }
+
+   TRACE_WARN("Watchdog: %s (%s) on %s exceeded %llu msec budget",
+              kindToString(slot.kind), slot.name, slot.path,
+              static_cast<unsigned long long>(slot.budget));
+   TRACE_EVENT(DBUSIPC_TRACE_HANDLER_STALLED, slot.kind, report.elapsed,
+               slot.budget, report.numFrames);
+}
+
+
+bool Watchdog::dump
+   (
+   FILE* fp
+   )
+{
+   std::vector<tReport> reports;
+   uint32_t numReports(0U);
+   {
+      ScopedLock lock(msLock);
+      numReports = msNumReports;
+      uint32_t first = (numReports > NUM_REPORTS) ?
+                        numReports - NUM_REPORTS : 0U;
+      for ( uint32_t i = first; i < numReports; ++i )
+      {
+         reports.push_back(msReports[i & (NUM_REPORTS - 1U)]);
+      }
+   }
+
+   (void)fprintf(fp, "%u stalled callback(s), %u lost\n", numReports,
+                 numReports - static_cast<uint32_t>(reports.size()));
+   for ( std::vector<tReport>::const_iterator it = reports.begin();
+      it != reports.end(); ++it )
+   {
+      // PRIu64 may be our own (see NOsTypes.hpp) rather than the one
+      // matching uint64_t so the values are printed as long longs
+      (void)fprintf(fp, "\n[%llu] %s (%s) on %s still running after "
+                    "%llu msec (budget %llu msec)\n",
+                    static_cast<unsigned long long>((*it).timestamp),
+                    kindToString((*it).kind), (*it).name, (*it).path,
+                    static_cast<unsigned long long>((*it).elapsed),
+                    static_cast<unsigned long long>((*it).budget));
+      if ( 0U == (*it).numFrames )
+      {
+         (void)fprintf(fp, "   (no stack captured)\n");
+      }
+
+      for ( uint32_t i = 0U; i < (*it).numFrames; ++i )
+      {
+         // Symbols are resolved here rather than in the signal handler
+         Dl_info info;
+         const char* module("??");
+         const char* symbol("??");
+         uintptr_t offset = reinterpret_cast<uintptr_t>((*it).frames[i]);
+         if ( 0 != dladdr((*it).frames[i], &info) )
+         {
+            module = (0 != info.dli_fname) ? info.dli_fname : module;
+            if ( 0 != info.dli_sname )
+            {
+               symbol = info.dli_sname;
+               offset -= reinterpret_cast<uintptr_t>(info.dli_saddr);
+            }
+            else
+            {
+               offset -= reinterpret_cast<uintptr_t>(info.dli_fbase);
+            }
+         }
+         (void)fprintf(fp, "   #%-2u %p %s(%s+0x%lx)\n", i, (*it).frames[i],
+                       module, symbol, static_cast<unsigned long>(offset));
+      }
+   }
+
+   return 0 == ferror(fp);
+}
+
+
+void Watchdog::copyName
+   (
+   char*       dst,
+   const char* src
+   )
+{
+   if ( 0 == src )
+   {
+      dst[0] = '\0';
+   }
+   else
+   {
+      (void)strncpy(dst, src, NAME_SIZE - 1U);
+      dst[NAME_SIZE - 1U] = '\0';
+   }
+}
+
+
+const char* Watchdog::kindToString
+   (
+   tKind kind
+   )
+{
+   const char* str("unknown");
+
+   switch ( kind )
+   {
+      case KIND_METHOD:
+         str = "method";
+         break;
+      case KIND_SIGNAL:
+         str = "signal";
+         break;
+      case KIND_NAME_CHANGE:
+         str = "name change";
+         break;
+      default:
+         break;
+   }
+
+   return str;
+}
@@ -0,0 +1,131 @@
+#ifndef WATCHDOG_HPP_
+#define WATCHDOG_HPP_
+
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include "dbusipc/dbusipc.h"
+#include "Thread.hpp"
+#include "MutexLock.hpp"
+
+//
+// Watches the user callbacks run by the dispatcher. The dispatcher publishes
+// the identity and start time of the callback it is running and a separate
+// thread checks it periodically. When a callback runs past its budget the
+// watchdog interrupts the dispatcher with a signal, the signal handler walks
+// the dispatcher's stack and the stack is stored along with the identity of
+// the callback in a small ring of stall reports (see DBUSIPC_dumpStalls()).
+// Only one callback is watched at a time which is fine since they are only
+// ever run with the dispatcher loop lock held. Nothing is watched (and the
+// thread is never started) unless a budget is configured.
+//
+class Watchdog : public Thread
+{
+public:
+   // The kind of callback being run
+   enum tKind
+   {
+      KIND_NONE = 0,
+      KIND_METHOD,
+      KIND_SIGNAL,
+      KIND_NAME_CHANGE
+   };
+
+   // Publishes a callback for the lifetime of the object
+   class Scope
+   {
+   public:
+      Scope(tKind kind, const char* path, const char* name,
+            uint64_t msecBudget);
+      ~Scope();
+
+   private:
+      // (Unimplemented) private copy constructor and assignment operator
+      // to prevent misuse
+      Scope(const Scope& other);
+      Scope& operator=(const Scope& rhs);
+
+      bool  mWatched;
+   };
+
+   virtual ~Watchdog();
+
+   // Stops the watchdog thread (if it was started)
+   static void shutdown();
+
+   // Can be called from any thread. Returns false if writing failed.
+   static bool dump(FILE* fp);
+
+protected:
+   virtual bool execute();
+
+private:
+   Watchdog();
+
+   // (Unimplemented) private copy constructor and assignment operator
+   // to prevent misuse
+   Watchdog(const Watchdog& other);
+   Watchdog& operator=(const Watchdog& rhs);
+
+   enum { NAME_SIZE = 64 };
+   enum { MAX_FRAMES = 32 };
+   // Must be a power of two
+   enum { NUM_REPORTS = 16 };
+   // Longest time (msec) between two checks of the running callback
+   enum { MAX_CHECK_INTERVAL = 100 };
+   // Longest time (msec) to wait for the dispatcher to walk its stack
+   enum { CAPTURE_TIMEOUT = 200 };
+
+   // The callback currently being run (written by the dispatcher). The
+   // generation is odd while the slot is being updated.
+   struct tSlot
+   {
+      volatile uint32_t    generation;
+      volatile bool        active;
+      tKind                kind;
+      pthread_t            thread;
+      uint64_t             start;
+      uint64_t             budget;
+      char                 path[NAME_SIZE];
+      char                 name[NAME_SIZE];
+   };
+
+   struct tReport
+   {
+      uint64_t             timestamp;
+      uint64_t             elapsed;
+      uint64_t             budget;
+      tKind                kind;
+      uint32_t             numFrames;
+      char                 path[NAME_SIZE];
+      char                 name[NAME_SIZE];
+      void*                frames[MAX_FRAMES];
+   };
+
+   static bool activate();
+   static void onSignal(int32_t sigNum);
+   static bool snapshot(tSlot& copy);
+   void capture(const tSlot& slot, uint64_t now);
+   static void copyName(char* dst, const char* src);
+   static const char* kindToString(tKind kind);
+
+   static Watchdog* volatile     msWatchdog;
+   static tSlot                  msSlot;
+
+   // Written by the signal handler
+   static void* volatile         msFrames[MAX_FRAMES];
+   static volatile sig_atomic_t  msNumFrames;
+   static volatile sig_atomic_t  msCaptured;
+
+   static tReport                msReports[NUM_REPORTS];
+   static uint32_t               msNumReports;
+   static MutexLock              msLock;
+
+   // The generation of the last callback reported
+   uint32_t                      mReported;
+   int32_t                       mSignal;
+   bool                          mCanCapture;
+   struct sigaction              mOldAction;
+};
+
+#endif /* Guard for WATCHDOG_HPP_ */
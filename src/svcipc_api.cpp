@@ -1,6 +1,8 @@
 
 #include <memory>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <errno.h>
 #include "dbusipc/dbusipc.h"
 #include "dbus/dbus.h"
@@ -10,6 +12,13 @@
 #include "Command.hpp"
 #include "Connection.hpp"
 #include "Semaphore.hpp"
+#include "RequestContext.hpp"
+#include "PreparedMessage.hpp"
+#include "ResponseCache.hpp"
+#include "TraceRing.hpp"
+#include "Watchdog.hpp"
+#include "NSysDep.hpp"
+#include "NUtil.hpp"
 #include "trace.h"
 
 
@@ -63,7 +72,62 @@ static DBUSIPC_tError DBUSIPC_submitCmd
 }
 
 
+//
+// Helper function for executing commands on the calling thread
+//
+static DBUSIPC_tError DBUSIPC_executeCmd
+   (
+   BaseCommand*      cmd,
+   DBUSIPC_tHandle&   hnd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   try
+   {
+      hnd = gDispatcher.get()->executeDirect(cmd);
+      // If the handle was valid then ...
+      if ( hnd != DBUSIPC_INVALID_HANDLE )
+      {
+         // The command has been consumed
+         cmd = 0;
+      }
+      else
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_CMD_SUBMISSION);
+      }
+   }
+   catch (const DBUSIPCError& e)
+   {
+      status = e.getError();
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+   }
+
+   if ( 0 != cmd )
+   {
+      delete cmd;
+   }
+
+   return status;
+}
+
+
 DBUSIPC_tError DBUSIPC_initialize(void)
+{
+   return DBUSIPC_initializeWithFlags(0U);
+}
+
+
+DBUSIPC_tError DBUSIPC_initializeWithFlags
+   (
+   DBUSIPC_tUInt32   flags
+   )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    
@@ -84,8 +148,21 @@ DBUSIPC_tError DBUSIPC_initialize(void)
    {
       try
       {
-         // If the dispatcher is not already running then ...
-         if ( !gDispatcher.get()->isRunning() )
+         if ( gDispatcher.get()->isRunning() )
+         {
+            // Already initialized
+         }
+         else if ( 0U != (flags & DBUSIPC_INIT_FLAG_INTEGRATED) )
+         {
+            // The calling thread runs the loop from now on
+            int32_t rc = gDispatcher.get()->integrate();
+            if ( EOK != rc )
+            {
+               status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_C_LIB, rc);
+            }
+         }
+         else
          {
             // Start the thread and block until it's running
             int32_t rc = gDispatcher.get()->start(true);
@@ -150,7 +227,7 @@ void DBUSIPC_shutdown(void)
          if ( !DBUSIPC_IS_ERROR(status) )
          {
             // Block waiting for the shutdown request to complete
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
          }
       }
       catch ( const std::exception& e )
@@ -162,6 +239,9 @@ void DBUSIPC_shutdown(void)
       gDispatcher.get()->wait(Thread::INFINITE_WAIT);
    }
 
+   // No more callbacks will be run so stop watching for them
+   Watchdog::shutdown();
+
    // Release D-Bus related resources
    dbus_shutdown();
 
@@ -184,11 +264,93 @@ void DBUSIPC_shutdown(void)
                  "dispatcher: %s", e.what());
    }
 
+   // Nothing allocates request contexts any more
+   RequestContext::purgePool();
+
    // Shutdown the network stack if necessary
    (void)NSysDep::DBUSIPC_shutdownNetworkStack();
 }
 
 
+DBUSIPC_tError DBUSIPC_getEventFd
+   (
+   DBUSIPC_tInt32* fd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   int32_t eventFd(-1);
+
+   if ( 0 == fd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      status = gDispatcher.get()->getEventFd(eventFd);
+      *fd = eventFd;
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_getNextTimeout
+   (
+   DBUSIPC_tInt32* msecTimeout
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   int32_t timeout(-1);
+
+   if ( 0 == msecTimeout )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         status = gDispatcher.get()->getNextTimeout(timeout);
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_INTERNAL);
+      }
+      *msecTimeout = timeout;
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_processEvents
+   (
+   DBUSIPC_tUInt32   budget
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   try
+   {
+      status = gDispatcher.get()->processEvents(budget);
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_INTERNAL);
+   }
+
+   return status;
+}
+
+
 DBUSIPC_tError DBUSIPC_asyncOpenConnection
    (
    DBUSIPC_tConstStr           address,
@@ -259,7 +421,7 @@ DBUSIPC_tError DBUSIPC_openConnection
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -348,7 +510,7 @@ DBUSIPC_tError DBUSIPC_getConnection
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -419,7 +581,7 @@ DBUSIPC_tError DBUSIPC_closeConnection
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -451,6 +613,26 @@ DBUSIPC_tError DBUSIPC_asyncInvoke
    DBUSIPC_tHandle*         handle,
    DBUSIPC_tUserToken       token
    )
+{
+   return DBUSIPC_asyncInvokeWithFlags(conn, busName, objPath, method,
+            parameters, noReplyExpected ? DBUSIPC_INVOKE_FLAG_NO_REPLY :
+            DBUSIPC_INVOKE_FLAG_NONE, msecTimeout, onResult, handle, token);
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncInvokeWithFlags
+   (
+   DBUSIPC_tConnection      conn,
+   DBUSIPC_tConstStr        busName,
+   DBUSIPC_tConstStr        objPath,
+   DBUSIPC_tConstStr        method,
+   DBUSIPC_tConstStr        parameters,
+   DBUSIPC_tUInt32          flags,
+   DBUSIPC_tUInt32          msecTimeout,
+   DBUSIPC_tResultCallback  onResult,
+   DBUSIPC_tHandle*         handle,
+   DBUSIPC_tUserToken       token
+   )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
@@ -466,15 +648,141 @@ DBUSIPC_tError DBUSIPC_asyncInvoke
                                  DBUSIPC_DOMAIN_IPC_LIB,
                                  DBUSIPC_ERR_BAD_ARGS);
    }
+   else if ( !Connection::acceptsOutgoing(conn) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_WOULD_BLOCK);
+   }
    else
    {
       try
       {
          std::auto_ptr<InvokeCmd> cmd(new InvokeCmd(conn, busName, objPath,
-               method, parameters, noReplyExpected, msecTimeout, onResult,
-               token));
+               method, parameters,
+               0U != (flags & DBUSIPC_INVOKE_FLAG_NO_REPLY), msecTimeout,
+               onResult, token, 0U != (flags & DBUSIPC_INVOKE_FLAG_COALESCE)));
 
-         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( 0U != (flags & DBUSIPC_INVOKE_FLAG_DIRECT) )
+         {
+            status = DBUSIPC_executeCmd(cmd.release(), hnd);
+         }
+         else
+         {
+            status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         }
+         if ( (0 != handle) && !DBUSIPC_IS_ERROR(status) )
+         {
+            *handle = hnd;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_prepareInvoke
+   (
+   DBUSIPC_tConnection      conn,
+   DBUSIPC_tConstStr        busName,
+   DBUSIPC_tConstStr        objPath,
+   DBUSIPC_tPreparedMsg*    prepared
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( (0 == busName) || (0 == prepared) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      *prepared = 0;
+      try
+      {
+         *prepared = PreparedMessage::createInvoke(conn, busName, objPath);
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncInvokePrepared
+   (
+   DBUSIPC_tPreparedMsg     prepared,
+   DBUSIPC_tConstStr        method,
+   DBUSIPC_tConstStr        parameters,
+   DBUSIPC_tUInt32          flags,
+   DBUSIPC_tUInt32          msecTimeout,
+   DBUSIPC_tResultCallback  onResult,
+   DBUSIPC_tHandle*         handle,
+   DBUSIPC_tUserToken       token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+   PreparedMessage* prep = static_cast<PreparedMessage*>(prepared);
+
+   if ( 0 != handle )
+   {
+      *handle = DBUSIPC_INVALID_HANDLE;
+   }
+
+   if ( (0 == prep) || prep->isSignal() || (0 == method) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( !Connection::acceptsOutgoing(prep->getHandle()) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_WOULD_BLOCK);
+   }
+   else
+   {
+      try
+      {
+         std::auto_ptr<InvokeCmd> cmd(new InvokeCmd(prep->getHandle(),
+               prep->getBusName().c_str(), prep->getObjectPath().c_str(),
+               method, parameters,
+               0U != (flags & DBUSIPC_INVOKE_FLAG_NO_REPLY), msecTimeout,
+               onResult, token, 0U != (flags & DBUSIPC_INVOKE_FLAG_COALESCE)));
+         cmd->usePrepared(prep->getTemplate());
+
+         if ( 0U != (flags & DBUSIPC_INVOKE_FLAG_DIRECT) )
+         {
+            status = DBUSIPC_executeCmd(cmd.release(), hnd);
+         }
+         else
+         {
+            status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         }
          if ( (0 != handle) && !DBUSIPC_IS_ERROR(status) )
          {
             *handle = hnd;
@@ -526,15 +834,15 @@ DBUSIPC_tError DBUSIPC_invoke
    {
       try
       {
-         Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<InvokeCmd> cmd(new InvokeCmd(conn, busName, objPath,
-               method, parameters, msecTimeout, response, &sem));
-
-         status = DBUSIPC_submitCmd(cmd.release(), hnd);
-         if ( !DBUSIPC_IS_ERROR(status) )
+         std::string cached;
+         
+         // A cached result completes the request without involving the
+         // dispatcher thread
+         if ( ResponseCache::lookup(conn, busName, objPath, method,
+            parameters, cached) )
          {
-            // Block waiting for the request to complete
-            sem.wait();
+            *response = static_cast<DBUSIPC_tResponse*>
+                              (std::calloc(1, sizeof(DBUSIPC_tResponse)));
             if ( 0 == *response )
             {
                status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
@@ -543,7 +851,32 @@ DBUSIPC_tError DBUSIPC_invoke
             }
             else
             {
-               status = (*response)->status.errCode;
+               (*response)->status.errCode = DBUSIPC_ERROR_NONE;
+               (*response)->status.errName = strdup(DBUSIPC_ERR_NAME_OK);
+               (*response)->result = strdup(cached.c_str());
+            }
+         }
+         else
+         {
+            Semaphore sem(0 /* initially locked */);
+            std::auto_ptr<InvokeCmd> cmd(new InvokeCmd(conn, busName,
+                  objPath, method, parameters, msecTimeout, response, &sem));
+
+            status = DBUSIPC_submitCmd(cmd.release(), hnd);
+            if ( !DBUSIPC_IS_ERROR(status) )
+            {
+               // Block waiting for the request to complete
+               gDispatcher.get()->waitFor(sem);
+               if ( 0 == *response )
+               {
+                  status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                             DBUSIPC_DOMAIN_IPC_LIB,
+                                             DBUSIPC_ERR_NO_MEMORY);
+               }
+               else
+               {
+                  status = (*response)->status.errCode;
+               }
             }
          }
       }
@@ -595,17 +928,210 @@ void DBUSIPC_freeResponse
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncCancel
+DBUSIPC_tError DBUSIPC_setResponseCacheLimit
    (
-   DBUSIPC_tHandle handle
+   DBUSIPC_tConnection   conn,
+   DBUSIPC_tUInt32       maxBytes
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
-   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   try
+   if ( 0 == conn )
    {
-      std::auto_ptr<CancelCmd> cmd(new CancelCmd(handle));
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         if ( !ResponseCache::setLimit(conn, maxBytes) )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NOT_CONNECTED);
+         }
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_NO_MEMORY);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_setCacheable
+   (
+   DBUSIPC_tConnection   conn,
+   DBUSIPC_tConstStr     busName,
+   DBUSIPC_tConstStr     objPath,
+   DBUSIPC_tConstStr     method,
+   DBUSIPC_tUInt32       msecTtl
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( (0 == conn) || (0 == busName) || (0 == method) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         if ( !ResponseCache::setCacheable(conn, busName, objPath, method,
+                                           msecTtl) )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NOT_CONNECTED);
+         }
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_NO_MEMORY);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_setCacheInvalidationSignal
+   (
+   DBUSIPC_tConnection   conn,
+   DBUSIPC_tConstStr     busName,
+   DBUSIPC_tConstStr     objPath,
+   DBUSIPC_tConstStr     sigName
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tSigSubHnd subHnd(0);
+
+   if ( (0 == conn) || (0 == busName) || (0 == sigName) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         // The cache owns the invalidation context and frees it along
+         // with the connection (which also drops the subscription)
+         bool isNew(false);
+         ResponseCache::tInvalidator* inv = ResponseCache::addInvalidator(
+                                    conn, busName, objPath, sigName, isNew);
+         if ( 0 == inv )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NOT_CONNECTED);
+         }
+         // Naming the same signal again doesn't subscribe twice
+         else if ( isNew )
+         {
+            std::string path((0 == objPath) ?
+                              NUtil::busNameToObjPath(busName) : objPath);
+            status = DBUSIPC_subscribe(conn, path.c_str(), sigName,
+                                      ResponseCache::onInvalidate, inv,
+                                      &subHnd);
+            if ( DBUSIPC_IS_ERROR(status) )
+            {
+               ResponseCache::removeInvalidator(inv);
+            }
+            else
+            {
+               ResponseCache::setSubscription(inv, subHnd);
+            }
+         }
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_NO_MEMORY);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_clearCacheInvalidationSignal
+   (
+   DBUSIPC_tConnection   conn,
+   DBUSIPC_tConstStr     busName,
+   DBUSIPC_tConstStr     objPath,
+   DBUSIPC_tConstStr     sigName
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( (0 == conn) || (0 == busName) || (0 == sigName) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         ResponseCache::tInvalidator* inv = ResponseCache::takeInvalidator(
+                                          conn, busName, objPath, sigName);
+         if ( 0 == inv )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NOT_FOUND);
+         }
+         else
+         {
+            // No callback refers to the context once this returns
+            status = DBUSIPC_unsubscribe(inv->subHnd);
+            delete inv;
+         }
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_NO_MEMORY);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncCancel
+   (
+   DBUSIPC_tHandle handle
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   try
+   {
+      std::auto_ptr<CancelCmd> cmd(new CancelCmd(handle));
 
       status = DBUSIPC_submitCmd(cmd.release(), hnd);
    }
@@ -648,7 +1174,7 @@ DBUSIPC_tError DBUSIPC_cancel
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -678,39 +1204,793 @@ DBUSIPC_tError DBUSIPC_asyncEmit
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   try
+   // Fail fast rather than queue behind a backed up connection
+   if ( !Connection::serviceAcceptsOutgoing(regHnd) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_WOULD_BLOCK);
+   }
+   else
    {
-      std::auto_ptr<EmitCmd> cmd(new EmitCmd
-                     (regHnd, sigName, parameters, onStatus, token));
+      try
+      {
+         std::auto_ptr<EmitCmd> cmd(new EmitCmd
+                        (regHnd, sigName, parameters, onStatus, token));
 
-      status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
    }
-   catch (const DBUSIPCError& e)
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_emit
+   (
+   DBUSIPC_tSvcRegHnd regHnd,
+   DBUSIPC_tConstStr  sigName,
+   DBUSIPC_tConstStr  parameters
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == regHnd )
    {
-      status = e.getError();
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
    }
-   catch (const std::exception&)
+   else if ( gDispatcher.get()->isCurrentThread() )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<EmitCmd> cmd(new EmitCmd(regHnd, sigName, parameters,
+                                                &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_emitDirect
+   (
+   DBUSIPC_tSvcRegHnd regHnd,
+   DBUSIPC_tConstStr  sigName,
+   DBUSIPC_tConstStr  parameters
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( 0 == regHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         // The signal never passes through the dispatcher thread
+         status = Connection::emitDirect(regHnd, sigName, parameters);
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_prepareEmit
+   (
+   DBUSIPC_tSvcRegHnd     regHnd,
+   DBUSIPC_tPreparedMsg*  prepared
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( (0 == regHnd) || (0 == prepared) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      *prepared = 0;
+      try
+      {
+         *prepared = PreparedMessage::createEmit(regHnd);
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB,
+                                    DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_emitPrepared
+   (
+   DBUSIPC_tPreparedMsg prepared,
+   DBUSIPC_tConstStr    sigName,
+   DBUSIPC_tConstStr    parameters
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   PreparedMessage* prep = static_cast<PreparedMessage*>(prepared);
+
+   if ( (0 == prep) || !prep->isSignal() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
+      {
+         status = Connection::emitDirect(prep->getHandle(), sigName,
+                                         parameters, prep->getTemplate());
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+void DBUSIPC_freePrepared
+   (
+   DBUSIPC_tPreparedMsg prepared
+   )
+{
+   // Requests still using the prepared message hold their own reference
+   delete static_cast<PreparedMessage*>(prepared);
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncSubscribe
+   (
+   DBUSIPC_tConnection            conn,
+   DBUSIPC_tConstStr              objPath,
+   DBUSIPC_tConstStr              sigName,
+   DBUSIPC_tSignalCallback        onSignal,
+   DBUSIPC_tSubscriptionCallback  onSubscription,
+   DBUSIPC_tUserToken             token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   try
+   {
+      if ( 0 == objPath )
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_BAD_ARGS);
+      }
+      else
+      {
+         std::auto_ptr<SubscribeCmd> cmd(new SubscribeCmd(conn, objPath,
+                                         sigName, onSignal, onSubscription,
+                                         token));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+      }
+   }
+   catch (const DBUSIPCError& e)
+   {
+      status = e.getError();
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_subscribe
+   (
+   DBUSIPC_tConnection      conn,
+   DBUSIPC_tConstStr        objPath,
+   DBUSIPC_tConstStr        sigName,
+   DBUSIPC_tSignalCallback  onSignal,
+   DBUSIPC_tUserToken       token,
+   DBUSIPC_tSigSubHnd*      subHnd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == subHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<SubscribeCmd> cmd(new SubscribeCmd(conn, objPath,
+                                   sigName, onSignal, token, &sem, &opStatus,
+                                   subHnd));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncUnsubscribe
+   (
+   DBUSIPC_tSigSubHnd       subHnd,
+   DBUSIPC_tStatusCallback  onStatus,
+   DBUSIPC_tUserToken       token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   try
+   {
+      std::auto_ptr<UnsubscribeCmd> cmd(new UnsubscribeCmd(subHnd,
+                                                           onStatus, token));
+
+      status = DBUSIPC_submitCmd(cmd.release(), hnd);
+   }
+   catch (const DBUSIPCError& e)
+   {
+      status = e.getError();
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_unsubscribe
+   (
+   DBUSIPC_tSigSubHnd subHnd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == subHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<UnsubscribeCmd> cmd(new UnsubscribeCmd(subHnd, &sem,
+                                                              &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncRegisterService
+   (
+   DBUSIPC_tConnection            conn,
+   DBUSIPC_tConstStr              busName,
+   DBUSIPC_tConstStr              objPath,
+   DBUSIPC_tUInt32                flag,
+   DBUSIPC_tRequestCallback       onRequest,
+   DBUSIPC_tRegistrationCallback  onRegister,
+   DBUSIPC_tUserToken             token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   try
+   {
+      std::auto_ptr<RegisterServiceCmd> cmd(new RegisterServiceCmd
+                     (conn, busName, objPath, flag, onRequest,
+                     onRegister, token));
+
+      status = DBUSIPC_submitCmd(cmd.release(), hnd);
+   }
+   catch (const DBUSIPCError& e)
+   {
+      status = e.getError();
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_registerService
+   (
+   DBUSIPC_tConnection      conn,
+   DBUSIPC_tConstStr        busName,
+   DBUSIPC_tConstStr        objPath,
+   DBUSIPC_tUInt32          flag,
+   DBUSIPC_tRequestCallback onRequest,
+   DBUSIPC_tUserToken       token,
+   DBUSIPC_tSvcRegHnd*      regHnd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == regHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<RegisterServiceCmd> cmd(new RegisterServiceCmd
+                              (conn, busName, objPath, flag, onRequest,
+                              token, &sem, &opStatus, regHnd));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncUnregisterService
+   (
+   DBUSIPC_tSvcRegHnd       regHnd,
+   DBUSIPC_tStatusCallback  onStatus,
+   DBUSIPC_tUserToken       token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   try
+   {
+      std::auto_ptr<UnregisterServiceCmd> cmd(new UnregisterServiceCmd
+                     (regHnd, onStatus, token));
+
+      status = DBUSIPC_submitCmd(cmd.release(), hnd);
+   }
+   catch (const DBUSIPCError& e)
+   {
+      status = e.getError();
+   }
+   catch (const std::exception&)
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_unregisterService
+   (
+   DBUSIPC_tSvcRegHnd regHnd
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == regHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<UnregisterServiceCmd> cmd(new UnregisterServiceCmd(
+               regHnd, &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_setServiceLimits
+   (
+   DBUSIPC_tSvcRegHnd regHnd,
+   DBUSIPC_tUInt32    maxInFlight,
+   DBUSIPC_tUInt32    maxQueued
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( 0 == regHnd )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<ServiceLimitsCmd> cmd(new ServiceLimitsCmd(regHnd,
+                              maxInFlight, maxQueued, &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_getServiceStats
+   (
+   DBUSIPC_tSvcRegHnd     regHnd,
+   DBUSIPC_tServiceStats* stats
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( (0 == regHnd) || (0 == stats) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<ServiceStatsCmd> cmd(new ServiceStatsCmd(regHnd,
+                              stats, &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_registerMethod
+   (
+   DBUSIPC_tSvcRegHnd        regHnd,
+   DBUSIPC_tConstStr         method,
+   DBUSIPC_tRequestCallback  onRequest,
+   DBUSIPC_tUserToken        token
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( (0 == regHnd) || (0 == method) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<RegisterMethodCmd> cmd(new RegisterMethodCmd(regHnd,
+                              method, onRequest, token, &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_getMethodStats
+   (
+   DBUSIPC_tSvcRegHnd     regHnd,
+   DBUSIPC_tConstStr      method,
+   DBUSIPC_tMethodStats*  stats
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
+   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
+
+   if ( (0 == regHnd) || (0 == method) || (0 == stats) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( gDispatcher.get()->isCurrentThread() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_DEADLOCK);
+   }
+   else
+   {
+      try
+      {
+         Semaphore sem(0 /* initially locked */);
+         std::auto_ptr<MethodStatsCmd> cmd(new MethodStatsCmd(regHnd,
+                              method, stats, &sem, &opStatus));
+
+         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         if ( !DBUSIPC_IS_ERROR(status) )
+         {
+            gDispatcher.get()->waitFor(sem);
+            status = opStatus;
+         }
+      }
+      catch (const DBUSIPCError& e)
+      {
+         status = e.getError();
+      }
+      catch (const std::exception&)
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
+      }
    }
 
    return status;
 }
 
 
-DBUSIPC_tError DBUSIPC_emit
+DBUSIPC_tError DBUSIPC_getDispatcherStats
    (
-   DBUSIPC_tSvcRegHnd regHnd,
-   DBUSIPC_tConstStr  sigName,
-   DBUSIPC_tConstStr  parameters
+   DBUSIPC_tDispatcherStats* stats,
+   DBUSIPC_tBool             reset
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   if ( 0 == regHnd )
+   if ( 0 == stats )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                                  DBUSIPC_DOMAIN_IPC_LIB,
@@ -727,13 +2007,13 @@ DBUSIPC_tError DBUSIPC_emit
       try
       {
          Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<EmitCmd> cmd(new EmitCmd(regHnd, sigName, parameters,
-                                                &sem, &opStatus));
+         std::auto_ptr<DispatcherStatsCmd> cmd(new DispatcherStatsCmd(stats,
+                              DBUSIPC_FALSE != reset, &sem, &opStatus));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -752,64 +2032,57 @@ DBUSIPC_tError DBUSIPC_emit
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncSubscribe
+DBUSIPC_tError DBUSIPC_getOutgoingQueueStats
    (
-   DBUSIPC_tConnection            conn,
-   DBUSIPC_tConstStr              objPath,
-   DBUSIPC_tConstStr              sigName,
-   DBUSIPC_tSignalCallback        onSignal,
-   DBUSIPC_tSubscriptionCallback  onSubscription,
-   DBUSIPC_tUserToken             token
+   DBUSIPC_tConnection           conn,
+   DBUSIPC_tOutgoingQueueStats*  stats
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
-   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   try
+   if ( 0 == stats )
    {
-      if ( 0 == objPath )
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      try
       {
-         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_BAD_ARGS);
+         // libdbus guards its queue so this doesn't need the dispatcher
+         if ( !Connection::getOutgoingStats(conn, *stats) )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_NOT_FOUND);
+         }
       }
-      else
+      catch (const std::exception&)
       {
-         std::auto_ptr<SubscribeCmd> cmd(new SubscribeCmd(conn, objPath,
-                                         sigName, onSignal, onSubscription,
-                                         token));
-
-         status = DBUSIPC_submitCmd(cmd.release(), hnd);
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
       }
    }
-   catch (const DBUSIPCError& e)
-   {
-      status = e.getError();
-   }
-   catch (const std::exception&)
-   {
-      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
-   }
 
    return status;
 }
 
 
-DBUSIPC_tError DBUSIPC_subscribe
+DBUSIPC_tError DBUSIPC_setOutgoingQueueLimits
    (
-   DBUSIPC_tConnection      conn,
-   DBUSIPC_tConstStr        objPath,
-   DBUSIPC_tConstStr        sigName,
-   DBUSIPC_tSignalCallback  onSignal,
-   DBUSIPC_tUserToken       token,
-   DBUSIPC_tSigSubHnd*      subHnd
+   DBUSIPC_tConnection           conn,
+   DBUSIPC_tUInt32               highWater,
+   DBUSIPC_tUInt32               lowWater,
+   DBUSIPC_tBackpressureCallback onBackpressure,
+   DBUSIPC_tUserToken            token
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   if ( 0 == subHnd )
+   if ( (0 == conn) || (lowWater > highWater) )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                                  DBUSIPC_DOMAIN_IPC_LIB,
@@ -826,14 +2099,14 @@ DBUSIPC_tError DBUSIPC_subscribe
       try
       {
          Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<SubscribeCmd> cmd(new SubscribeCmd(conn, objPath,
-                                   sigName, onSignal, token, &sem, &opStatus,
-                                   subHnd));
+         std::auto_ptr<OutgoingLimitsCmd> cmd(new OutgoingLimitsCmd(conn,
+                              highWater, lowWater, onBackpressure, token,
+                              &sem, &opStatus));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -852,48 +2125,19 @@ DBUSIPC_tError DBUSIPC_subscribe
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncUnsubscribe
-   (
-   DBUSIPC_tSigSubHnd       subHnd,
-   DBUSIPC_tStatusCallback  onStatus,
-   DBUSIPC_tUserToken       token
-   )
-{
-   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
-   DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
-
-   try
-   {
-      std::auto_ptr<UnsubscribeCmd> cmd(new UnsubscribeCmd(
-            static_cast<SignalSubscription*>(subHnd),
-            onStatus, token));
-
-      status = DBUSIPC_submitCmd(cmd.release(), hnd);
-   }
-   catch (const DBUSIPCError& e)
-   {
-      status = e.getError();
-   }
-   catch (const std::exception&)
-   {
-      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_INTERNAL);
-   }
-
-   return status;
-}
-
-
-DBUSIPC_tError DBUSIPC_unsubscribe
+DBUSIPC_tError DBUSIPC_setConnectionPriority
    (
-   DBUSIPC_tSigSubHnd subHnd
+   DBUSIPC_tConnection    conn,
+   DBUSIPC_tConnPriority  priority,
+   DBUSIPC_tUInt32        msgBudget
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   if ( 0 == subHnd )
+   if ( (0 == conn) || (priority < DBUSIPC_CONN_PRIORITY_CONTROL) ||
+      (priority >= DBUSIPC_CONN_PRIORITY_NUM_CLASSES) )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                                  DBUSIPC_DOMAIN_IPC_LIB,
@@ -910,13 +2154,13 @@ DBUSIPC_tError DBUSIPC_unsubscribe
       try
       {
          Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<UnsubscribeCmd> cmd(new UnsubscribeCmd(
-               static_cast<SignalSubscription*>(subHnd), &sem, &opStatus));
+         std::auto_ptr<ConnectionPriorityCmd> cmd(new ConnectionPriorityCmd(
+                              conn, priority, msgBudget, &sem, &opStatus));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -935,15 +2179,26 @@ DBUSIPC_tError DBUSIPC_unsubscribe
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncRegisterService
+DBUSIPC_tError DBUSIPC_asyncReturnResult
    (
-   DBUSIPC_tConnection            conn,
-   DBUSIPC_tConstStr              busName,
-   DBUSIPC_tConstStr              objPath,
-   DBUSIPC_tUInt32                flag,
-   DBUSIPC_tRequestCallback       onRequest,
-   DBUSIPC_tRegistrationCallback  onRegister,
-   DBUSIPC_tUserToken             token
+   DBUSIPC_tReqContext      context,
+   DBUSIPC_tConstStr        result,
+   DBUSIPC_tStatusCallback  onStatus,
+   DBUSIPC_tUserToken       token
+   )
+{
+   return DBUSIPC_asyncReturnCacheableResult(context, result, 0U, onStatus,
+                                            token);
+}
+
+
+DBUSIPC_tError DBUSIPC_asyncReturnCacheableResult
+   (
+   DBUSIPC_tReqContext      context,
+   DBUSIPC_tConstStr        result,
+   DBUSIPC_tUInt32          msecTtl,
+   DBUSIPC_tStatusCallback  onStatus,
+   DBUSIPC_tUserToken       token
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
@@ -951,9 +2206,8 @@ DBUSIPC_tError DBUSIPC_asyncRegisterService
 
    try
    {
-      std::auto_ptr<RegisterServiceCmd> cmd(new RegisterServiceCmd
-                     (conn, busName, objPath, flag, onRequest,
-                     onRegister, token));
+      std::auto_ptr<ReturnResultCmd> cmd(new ReturnResultCmd(context,
+                                          result, onStatus, token, msecTtl));
 
       status = DBUSIPC_submitCmd(cmd.release(), hnd);
    }
@@ -971,28 +2225,28 @@ DBUSIPC_tError DBUSIPC_asyncRegisterService
 }
 
 
-DBUSIPC_tError DBUSIPC_registerService
+DBUSIPC_tError DBUSIPC_returnResult
    (
-   DBUSIPC_tConnection      conn,
-   DBUSIPC_tConstStr        busName,
-   DBUSIPC_tConstStr        objPath,
-   DBUSIPC_tUInt32          flag,
-   DBUSIPC_tRequestCallback onRequest,
-   DBUSIPC_tUserToken       token,
-   DBUSIPC_tSvcRegHnd*      regHnd
+   DBUSIPC_tReqContext   context,
+   DBUSIPC_tConstStr     result
+   )
+{
+   return DBUSIPC_returnCacheableResult(context, result, 0U);
+}
+
+
+DBUSIPC_tError DBUSIPC_returnCacheableResult
+   (
+   DBUSIPC_tReqContext   context,
+   DBUSIPC_tConstStr     result,
+   DBUSIPC_tUInt32       msecTtl
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   if ( 0 == regHnd )
-   {
-      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB,
-                                 DBUSIPC_ERR_BAD_ARGS);
-   }
-   else if ( gDispatcher.get()->isCurrentThread() )
+   if ( gDispatcher.get()->isCurrentThread() )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                                        DBUSIPC_DOMAIN_IPC_LIB,
@@ -1003,14 +2257,13 @@ DBUSIPC_tError DBUSIPC_registerService
       try
       {
          Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<RegisterServiceCmd> cmd(new RegisterServiceCmd
-                              (conn, busName, objPath, flag, onRequest,
-                              token, &sem, &opStatus, regHnd));
+         std::auto_ptr<ReturnResultCmd> cmd(new ReturnResultCmd(
+                                 context, result, &sem, &opStatus, msecTtl));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1029,9 +2282,11 @@ DBUSIPC_tError DBUSIPC_registerService
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncUnregisterService
+DBUSIPC_tError DBUSIPC_asyncReturnError
    (
-   DBUSIPC_tSvcRegHnd       regHnd,
+   DBUSIPC_tReqContext      context,
+   DBUSIPC_tConstStr        name,
+   DBUSIPC_tConstStr        msg,
    DBUSIPC_tStatusCallback  onStatus,
    DBUSIPC_tUserToken       token
    )
@@ -1041,9 +2296,9 @@ DBUSIPC_tError DBUSIPC_asyncUnregisterService
 
    try
    {
-      std::auto_ptr<UnregisterServiceCmd> cmd(new UnregisterServiceCmd
-                     (static_cast<ServiceRegistration*>(regHnd), onStatus,
-                     token));
+      std::auto_ptr<ReturnErrorCmd> cmd(new ReturnErrorCmd(context,
+                                    name ? name : DBUSIPC_INTERFACE_ERROR_NAME,
+                                    msg, onStatus, token));
 
       status = DBUSIPC_submitCmd(cmd.release(), hnd);
    }
@@ -1061,22 +2316,18 @@ DBUSIPC_tError DBUSIPC_asyncUnregisterService
 }
 
 
-DBUSIPC_tError DBUSIPC_unregisterService
+DBUSIPC_tError DBUSIPC_returnError
    (
-   DBUSIPC_tSvcRegHnd regHnd
+   DBUSIPC_tReqContext   context,
+   DBUSIPC_tConstStr     name,
+   DBUSIPC_tConstStr     msg
    )
 {
    DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
    DBUSIPC_tError opStatus(DBUSIPC_ERROR_NONE);
    DBUSIPC_tHandle hnd(DBUSIPC_INVALID_HANDLE);
 
-   if ( 0 == regHnd )
-   {
-      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
-                                 DBUSIPC_DOMAIN_IPC_LIB,
-                                 DBUSIPC_ERR_BAD_ARGS);
-   }
-   else if ( gDispatcher.get()->isCurrentThread() )
+   if ( gDispatcher.get()->isCurrentThread() )
    {
       status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
                                        DBUSIPC_DOMAIN_IPC_LIB,
@@ -1087,13 +2338,15 @@ DBUSIPC_tError DBUSIPC_unregisterService
       try
       {
          Semaphore sem(0 /* initially locked */);
-         std::auto_ptr<UnregisterServiceCmd> cmd(new UnregisterServiceCmd(
-               static_cast<ServiceRegistration*>(regHnd), &sem, &opStatus));
+         std::auto_ptr<ReturnErrorCmd> cmd(new ReturnErrorCmd(
+                                    context,
+                                    name ? name : DBUSIPC_INTERFACE_ERROR_NAME,
+                                    msg, &sem, &opStatus));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1112,7 +2365,7 @@ DBUSIPC_tError DBUSIPC_unregisterService
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncReturnResult
+DBUSIPC_tError DBUSIPC_asyncReturnResultAndFree
    (
    DBUSIPC_tReqContext      context,
    DBUSIPC_tConstStr        result,
@@ -1126,7 +2379,7 @@ DBUSIPC_tError DBUSIPC_asyncReturnResult
    try
    {
       std::auto_ptr<ReturnResultCmd> cmd(new ReturnResultCmd(context,
-                                          result, onStatus, token));
+                                          result, onStatus, token, 0U, true));
 
       status = DBUSIPC_submitCmd(cmd.release(), hnd);
    }
@@ -1144,7 +2397,7 @@ DBUSIPC_tError DBUSIPC_asyncReturnResult
 }
 
 
-DBUSIPC_tError DBUSIPC_returnResult
+DBUSIPC_tError DBUSIPC_returnResultAndFree
    (
    DBUSIPC_tReqContext   context,
    DBUSIPC_tConstStr     result
@@ -1166,12 +2419,12 @@ DBUSIPC_tError DBUSIPC_returnResult
       {
          Semaphore sem(0 /* initially locked */);
          std::auto_ptr<ReturnResultCmd> cmd(new ReturnResultCmd(
-                                 context, result, &sem, &opStatus));
+                                 context, result, &sem, &opStatus, 0U, true));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1190,7 +2443,7 @@ DBUSIPC_tError DBUSIPC_returnResult
 }
 
 
-DBUSIPC_tError DBUSIPC_asyncReturnError
+DBUSIPC_tError DBUSIPC_asyncReturnErrorAndFree
    (
    DBUSIPC_tReqContext      context,
    DBUSIPC_tConstStr        name,
@@ -1206,7 +2459,7 @@ DBUSIPC_tError DBUSIPC_asyncReturnError
    {
       std::auto_ptr<ReturnErrorCmd> cmd(new ReturnErrorCmd(context,
                                     name ? name : DBUSIPC_INTERFACE_ERROR_NAME,
-                                    msg, onStatus, token));
+                                    msg, onStatus, token, true));
 
       status = DBUSIPC_submitCmd(cmd.release(), hnd);
    }
@@ -1224,7 +2477,7 @@ DBUSIPC_tError DBUSIPC_asyncReturnError
 }
 
 
-DBUSIPC_tError DBUSIPC_returnError
+DBUSIPC_tError DBUSIPC_returnErrorAndFree
    (
    DBUSIPC_tReqContext   context,
    DBUSIPC_tConstStr     name,
@@ -1249,12 +2502,12 @@ DBUSIPC_tError DBUSIPC_returnError
          std::auto_ptr<ReturnErrorCmd> cmd(new ReturnErrorCmd(
                                     context,
                                     name ? name : DBUSIPC_INTERFACE_ERROR_NAME,
-                                    msg, &sem, &opStatus));
+                                    msg, &sem, &opStatus, true));
 
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1300,6 +2553,43 @@ void DBUSIPC_freeReqContext
 }
 
 
+DBUSIPC_tError DBUSIPC_getReqDeadline
+   (
+   DBUSIPC_tReqContext   context,
+   DBUSIPC_tUInt32*      msecRemaining
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+   RequestContext* reqCtx = static_cast<RequestContext*>(context);
+
+   if ( (0 == reqCtx) || (0 == msecRemaining) )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_BAD_ARGS);
+   }
+   else if ( 0U == reqCtx->getDeadline() )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB, DBUSIPC_ERR_NOT_FOUND);
+   }
+   else
+   {
+      // The deadline is immutable so there's no need to involve the
+      // dispatcher thread
+      uint64_t now = NSysDep::DBUSIPC_getSystemTime();
+      uint64_t deadline = reqCtx->getDeadline();
+      *msecRemaining = 0U;
+      if ( deadline > now )
+      {
+         *msecRemaining = static_cast<DBUSIPC_tUInt32>(
+                              std::min<uint64_t>(deadline - now, 0xFFFFFFFFU));
+      }
+   }
+
+   return status;
+}
+
+
 DBUSIPC_tError DBUSIPC_nameHasOwner
    (
    DBUSIPC_tConnection   conn,
@@ -1334,7 +2624,7 @@ DBUSIPC_tError DBUSIPC_nameHasOwner
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1422,7 +2712,7 @@ DBUSIPC_tError DBUSIPC_subscribeOwnerChanged
          status = DBUSIPC_submitCmd(cmd.release(), hnd);
          if ( !DBUSIPC_IS_ERROR(status) )
          {
-            sem.wait();
+            gDispatcher.get()->waitFor(sem);
             status = opStatus;
          }
       }
@@ -1489,3 +2779,72 @@ DBUSIPC_tError DBUSIPC_validateUtf8
                              DBUSIPC_DOMAIN_DBUS_LIB, DBUSIPC_ERR_FORMAT);
 }
 
+
+// Writes a dump to the named file using the given writer
+static DBUSIPC_tError DBUSIPC_dumpToFile
+   (
+   DBUSIPC_tConstStr            fileName,
+   bool                         (*writer)(FILE*)
+   )
+{
+   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);
+
+   if ( 0 == fileName )
+   {
+      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                 DBUSIPC_DOMAIN_IPC_LIB,
+                                 DBUSIPC_ERR_BAD_ARGS);
+   }
+   else
+   {
+      FILE* fp = fopen(fileName, "wb");
+      if ( 0 == fp )
+      {
+         status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                    DBUSIPC_DOMAIN_C_LIB, errno);
+      }
+      else
+      {
+         try
+         {
+            if ( !writer(fp) )
+            {
+               status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                          DBUSIPC_DOMAIN_C_LIB, errno);
+            }
+         }
+         catch (const std::exception&)
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_IPC_LIB,
+                                       DBUSIPC_ERR_INTERNAL);
+         }
+
+         if ( (0 != fclose(fp)) && !DBUSIPC_IS_ERROR(status) )
+         {
+            status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,
+                                       DBUSIPC_DOMAIN_C_LIB, errno);
+         }
+      }
+   }
+
+   return status;
+}
+
+
+DBUSIPC_tError DBUSIPC_dumpTrace
+   (
+   DBUSIPC_tConstStr            fileName
+   )
+{
+   return DBUSIPC_dumpToFile(fileName, TraceRing::dump);
+}
+
+
+DBUSIPC_tError DBUSIPC_dumpStalls
+   (
+   DBUSIPC_tConstStr            fileName
+   )
+{
+   return DBUSIPC_dumpToFile(fileName, Watchdog::dump);
+}
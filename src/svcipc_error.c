@@ -27,5 +27,11 @@ DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_DEADLOCK =
                         "com.hsae.dbusipc.error.Deadlock";
 DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_FORMAT =
                         "com.hsae.dbusipc.error.Format";
+DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_BUSY =
+                        "com.hsae.dbusipc.error.Busy";
+DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_WOULD_BLOCK =
+                        "com.hsae.dbusipc.error.WouldBlock";
+DBUSIPC_API DBUSIPC_tConstStr DBUSIPC_ERR_NAME_UNKNOWN_METHOD =
+                        "com.hsae.dbusipc.error.UnknownMethod";
 
 
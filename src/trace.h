@@ -8,9 +8,20 @@ extern "C" {
 #include <stdio.h>
 #include <stdarg.h>
 #include "dbusipc/dbusipc_types.h"
+#include "dbusipc/dbusipc_trace.h"
    
 
    
+/*
+ * Binary trace events are always recorded (see dbusipc_trace.h). They're
+ * cheap enough to leave on in release builds.
+ */
+void DBUSIPC_traceEvent(uint32_t event, uint64_t arg0, uint64_t arg1,
+                       uint64_t arg2, uint64_t arg3);
+
+#define TRACE_EVENT  DBUSIPC_traceEvent
+#define TRACE_PTR(p) ((uint64_t)(uintptr_t)(p))
+
 #ifdef DBUSIPC_DEBUG
 
 void DBUSIPC_trace(FILE* fp, DBUSIPC_tConstStr name,
@@ -0,0 +1,222 @@
+// Admission control: in-flight limit, queueing and load shedding
+// (DBUSIPC_setServiceLimits())
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "testutil.hpp"
+
+static const char* SVC = "com.test.admission.Svc";
+static const int NUM_REQUESTS = 8;
+
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+// Requests the handler has been given (and not yet answered) in order
+static std::vector<DBUSIPC_tReqContext> gHeld;
+static std::vector<int> gDelivered;
+static pthread_t gHandlerThread;
+static bool gHandlerThreadSet = false;
+static bool gWrongThread = false;
+// Results by request index
+static DBUSIPC_tError gResults[NUM_REQUESTS];
+static bool gAnswered[NUM_REQUESTS];
+
+static void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   pthread_mutex_lock(&gLock);
+   // Requests are only ever delivered on the dispatcher thread
+   if ( !gHandlerThreadSet )
+   {
+      gHandlerThread = pthread_self();
+      gHandlerThreadSet = true;
+   }
+   else if ( !pthread_equal(gHandlerThread, pthread_self()) )
+   {
+      gWrongThread = true;
+   }
+   gHeld.push_back(context);
+   gDelivered.push_back(std::atoi(parms));
+   pthread_mutex_unlock(&gLock);
+}
+
+
+static void onResult
+   (
+   const DBUSIPC_tCallbackStatus*  status,
+   DBUSIPC_tConstStr               result,
+   DBUSIPC_tUserToken              token
+   )
+{
+   int idx = static_cast<int>(reinterpret_cast<long>(token));
+   pthread_mutex_lock(&gLock);
+   gResults[idx] = status->errCode;
+   gAnswered[idx] = true;
+   pthread_mutex_unlock(&gLock);
+}
+
+
+static int gWantHeld = 0;
+static bool heldReached()
+{
+   pthread_mutex_lock(&gLock);
+   bool reached = static_cast<int>(gHeld.size()) >= gWantHeld;
+   pthread_mutex_unlock(&gLock);
+   return reached;
+}
+
+
+static int gWantAnswered = 0;
+static bool answeredReached()
+{
+   int n(0);
+   pthread_mutex_lock(&gLock);
+   for ( int i = 0; i < NUM_REQUESTS; ++i )
+   {
+      n += gAnswered[i] ? 1 : 0;
+   }
+   pthread_mutex_unlock(&gLock);
+   return n >= gWantAnswered;
+}
+
+
+static void reset()
+{
+   pthread_mutex_lock(&gLock);
+   gHeld.clear();
+   gDelivered.clear();
+   std::memset(gResults, 0, sizeof(gResults));
+   std::memset(gAnswered, 0, sizeof(gAnswered));
+   pthread_mutex_unlock(&gLock);
+}
+
+
+static void invoke
+   (
+   DBUSIPC_tConnection  conn,
+   int                  idx
+   )
+{
+   char parms[16];
+   std::snprintf(parms, sizeof(parms), "%d", idx);
+   CHECK_STATUS(DBUSIPC_asyncInvoke(conn, SVC, 0, "work", parms,
+                DBUSIPC_FALSE, 5000, onResult, 0,
+                reinterpret_cast<DBUSIPC_tUserToken>(static_cast<long>(idx))),
+                DBUSIPC_ERROR_NONE);
+}
+
+
+// Answers the oldest request the handler is holding
+static void answerOldest()
+{
+   DBUSIPC_tReqContext context(0);
+   pthread_mutex_lock(&gLock);
+   if ( !gHeld.empty() )
+   {
+      context = gHeld.front();
+      gHeld.erase(gHeld.begin());
+   }
+   pthread_mutex_unlock(&gLock);
+   CHECK(0 != context);
+   CHECK_STATUS(DBUSIPC_returnResultAndFree(context, "{}"),
+                DBUSIPC_ERROR_NONE);
+}
+
+
+int main()
+{
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tConnection cliConn(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   DBUSIPC_tServiceStats stats;
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, SVC, 0, 0, onRequest, 0,
+                &reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &cliConn), DBUSIPC_ERROR_NONE);
+
+   // One request in flight, two waiting and the rest turned away
+   reset();
+   CHECK_STATUS(DBUSIPC_setServiceLimits(reg, 1U, 2U), DBUSIPC_ERROR_NONE);
+   for ( int i = 0; i < 4; ++i )
+   {
+      invoke(cliConn, i);
+   }
+   gWantHeld = 1;
+   CHECK(testWaitFor(heldReached, 2000UL));
+   gWantAnswered = 1;
+   CHECK(testWaitFor(answeredReached, 2000UL));
+   CHECK(gAnswered[3] && (LIB_ERROR(DBUSIPC_ERR_BUSY) == gResults[3]));
+   CHECK_STATUS(DBUSIPC_getServiceStats(reg, &stats), DBUSIPC_ERROR_NONE);
+   CHECK(1U == stats.inFlight);
+   CHECK(2U == stats.queued);
+   CHECK(1U == stats.shed);
+
+   // Answering frees the slot for the next request in arrival order
+   for ( int i = 0; i < 3; ++i )
+   {
+      gWantHeld = 1;
+      CHECK(testWaitFor(heldReached, 2000UL));
+      answerOldest();
+   }
+   gWantAnswered = 4;
+   CHECK(testWaitFor(answeredReached, 2000UL));
+   CHECK((3U == gDelivered.size()) && (0 == gDelivered[0]) &&
+         (1 == gDelivered[1]) && (2 == gDelivered[2]));
+   CHECK((DBUSIPC_ERROR_NONE == gResults[0]) &&
+         (DBUSIPC_ERROR_NONE == gResults[1]) &&
+         (DBUSIPC_ERROR_NONE == gResults[2]));
+
+   // Zero queued means the queue is unbounded
+   reset();
+   CHECK_STATUS(DBUSIPC_setServiceLimits(reg, 1U, 0U), DBUSIPC_ERROR_NONE);
+   for ( int i = 0; i < NUM_REQUESTS; ++i )
+   {
+      invoke(cliConn, i);
+   }
+   gWantHeld = 1;
+   CHECK(testWaitFor(heldReached, 2000UL));
+   usleep(100000);
+   CHECK_STATUS(DBUSIPC_getServiceStats(reg, &stats), DBUSIPC_ERROR_NONE);
+   CHECK(1U == stats.inFlight);
+   CHECK(static_cast<DBUSIPC_tUInt32>(NUM_REQUESTS - 1) == stats.queued);
+   CHECK(1U == stats.shed);
+
+   // Unregistering answers the waiting requests rather than leaving their
+   // clients to time out
+   unsigned long start = testNowMsec();
+   CHECK_STATUS(DBUSIPC_unregisterService(reg), DBUSIPC_ERROR_NONE);
+   gWantAnswered = NUM_REQUESTS - 1;
+   CHECK(testWaitFor(answeredReached, 2000UL));
+   CHECK(testNowMsec() - start < 2000UL);
+   for ( int i = 1; i < NUM_REQUESTS; ++i )
+   {
+      CHECK(gAnswered[i] && DBUSIPC_IS_ERROR(gResults[i]));
+   }
+
+   pthread_mutex_lock(&gLock);
+   std::vector<DBUSIPC_tReqContext> held(gHeld);
+   gHeld.clear();
+   pthread_mutex_unlock(&gLock);
+   for ( size_t i = 0; i < held.size(); ++i )
+   {
+      DBUSIPC_freeReqContext(held[i]);
+   }
+   CHECK(!gWrongThread);
+
+   CHECK_STATUS(DBUSIPC_closeConnection(cliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_admission");
+}
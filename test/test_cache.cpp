@@ -0,0 +1,115 @@
+// Client-side response cache: expiry, invalidation signals and validation
+// of the connection
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "testutil.hpp"
+
+static const char* SVC = "com.test.cache.Svc";
+
+// Only touched by the dispatcher thread
+static int gCount = 0;
+
+static void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   char result[32];
+   std::snprintf(result, sizeof(result), "{\"n\":%d}", ++gCount);
+   (void)DBUSIPC_asyncReturnResultAndFree(context, result, 0, 0);
+}
+
+
+static DBUSIPC_tConnection gCliConn = 0;
+
+static std::string get()
+{
+   std::string result;
+   DBUSIPC_tResponse* resp(0);
+   CHECK_STATUS(DBUSIPC_invoke(gCliConn, SVC, 0, "get", 0, 2000, &resp),
+                DBUSIPC_ERROR_NONE);
+   if ( (0 != resp) && (0 != resp->result) )
+   {
+      result = resp->result;
+   }
+   DBUSIPC_freeResponse(resp);
+   return result;
+}
+
+
+static std::string gLast;
+static bool resultChanged()
+{
+   return get() != gLast;
+}
+
+
+int main()
+{
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, SVC, 0, 0, onRequest, 0,
+                &reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &gCliConn), DBUSIPC_ERROR_NONE);
+
+   // Results are kept for their TTL and then fetched again
+   CHECK_STATUS(DBUSIPC_setResponseCacheLimit(gCliConn, 4096U),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_setCacheable(gCliConn, SVC, 0, "get", 200U),
+                DBUSIPC_ERROR_NONE);
+   std::string first = get();
+   CHECK(first == "{\"n\":1}");
+   CHECK(get() == first);
+   usleep(300000);
+   CHECK(get() == "{\"n\":2}");
+
+   // The invalidation signal drops the cached result early
+   CHECK_STATUS(DBUSIPC_setCacheable(gCliConn, SVC, 0, "get", 60000U),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_setCacheInvalidationSignal(gCliConn, SVC, 0,
+                "changed"), DBUSIPC_ERROR_NONE);
+   // Naming it again doesn't subscribe twice (see below)
+   CHECK_STATUS(DBUSIPC_setCacheInvalidationSignal(gCliConn, SVC, 0,
+                "changed"), DBUSIPC_ERROR_NONE);
+   gLast = get();
+   CHECK(get() == gLast);
+   CHECK_STATUS(DBUSIPC_emit(reg, "changed", 0), DBUSIPC_ERROR_NONE);
+   CHECK(testWaitFor(resultChanged, 2000UL));
+
+   // One clear undoes both calls above so the signal is ignored
+   CHECK_STATUS(DBUSIPC_clearCacheInvalidationSignal(gCliConn, SVC, 0,
+                "changed"), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_clearCacheInvalidationSignal(gCliConn, SVC, 0,
+                "changed"), LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+   gLast = get();
+   CHECK_STATUS(DBUSIPC_emit(reg, "changed", 0), DBUSIPC_ERROR_NONE);
+   usleep(200000);
+   CHECK(get() == gLast);
+
+   // Closed (or made up) connections are refused rather than given a cache
+   CHECK_STATUS(DBUSIPC_closeConnection(gCliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_setResponseCacheLimit(gCliConn, 4096U),
+                LIB_ERROR(DBUSIPC_ERR_NOT_CONNECTED));
+   CHECK_STATUS(DBUSIPC_setCacheable(gCliConn, SVC, 0, "get", 100U),
+                LIB_ERROR(DBUSIPC_ERR_NOT_CONNECTED));
+   CHECK_STATUS(DBUSIPC_setCacheInvalidationSignal(gCliConn, SVC, 0,
+                "changed"), LIB_ERROR(DBUSIPC_ERR_NOT_CONNECTED));
+   CHECK_STATUS(DBUSIPC_setResponseCacheLimit(
+                reinterpret_cast<DBUSIPC_tConnection>(0x7FFFF000), 4096U),
+                LIB_ERROR(DBUSIPC_ERR_NOT_CONNECTED));
+
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_cache");
+}
@@ -0,0 +1,80 @@
+// Stale and bogus API handles are rejected rather than dereferenced
+#include "testutil.hpp"
+
+static const char* SVC = "com.test.handles.Svc";
+
+static void onSignal
+   (
+   DBUSIPC_tConstStr    sigName,
+   DBUSIPC_tConstStr    data,
+   DBUSIPC_tUserToken   token
+   )
+{
+}
+
+
+static void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   DBUSIPC_freeReqContext(context);
+}
+
+
+int main()
+{
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection conn(0);
+   DBUSIPC_tSigSubHnd sub(0);
+   DBUSIPC_tSigSubHnd reusedSub(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &conn), DBUSIPC_ERROR_NONE);
+
+   // A subscription handle goes stale once unsubscribed, even when its
+   // slot is handed out again
+   CHECK_STATUS(DBUSIPC_subscribe(conn, "/com/test/handles", "sig", onSignal,
+                0, &sub), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_unsubscribe(sub), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_unsubscribe(sub), LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+   CHECK_STATUS(DBUSIPC_subscribe(conn, "/com/test/handles", "sig", onSignal,
+                0, &reusedSub), DBUSIPC_ERROR_NONE);
+   CHECK(reusedSub != sub);
+   CHECK_STATUS(DBUSIPC_unsubscribe(sub), LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+   CHECK_STATUS(DBUSIPC_unsubscribe(reusedSub), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_unsubscribe(
+                reinterpret_cast<DBUSIPC_tSigSubHnd>(0x12345678)),
+                LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+
+   // Likewise for a service registration
+   CHECK_STATUS(DBUSIPC_registerService(conn, SVC, 0, 0, onRequest, 0, &reg),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_emit(reg, "sig", 0), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_unregisterService(reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_emit(reg, "sig", 0), LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+   CHECK(DBUSIPC_IS_ERROR(DBUSIPC_unregisterService(reg)));
+
+   // And for a connection that has been closed and replaced
+   CHECK_STATUS(DBUSIPC_closeConnection(conn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_tConnection newConn(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &newConn), DBUSIPC_ERROR_NONE);
+   CHECK(newConn != conn);
+   CHECK_STATUS(DBUSIPC_subscribe(conn, "/com/test/handles", "sig", onSignal,
+                0, &sub), LIB_ERROR(DBUSIPC_ERR_NOT_CONNECTED));
+   DBUSIPC_tResponse* resp(0);
+   CHECK(DBUSIPC_IS_ERROR(DBUSIPC_invoke(conn, SVC, 0, "get", 0, 500,
+         &resp)));
+   DBUSIPC_freeResponse(resp);
+
+   CHECK_STATUS(DBUSIPC_closeConnection(newConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_handles");
+}
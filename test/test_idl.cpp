@@ -0,0 +1,163 @@
+// Code generated by dbusipc-idlgen from test_idl.xml: the JSON it puts on
+// the wire, doubles JSON can't carry and independence from the locale
+#include <clocale>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "testutil.hpp"
+#include "dbusipc/dbusipc_idl.hpp"
+#include "Calc.hpp"
+
+// Locales that write "0,5" for a half (whichever is installed)
+static const char* COMMA_LOCALES[] =
+{
+   "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8",
+   "fr_FR"
+};
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+static const double INF = std::numeric_limits<double>::infinity();
+
+class CalcService : public Calc::Skeleton
+{
+public:
+   CalcService() : mReplyStatus(DBUSIPC_ERROR_NONE) {}
+
+   // Only touched by the dispatcher thread until the test reads it
+   volatile DBUSIPC_tError mReplyStatus;
+
+protected:
+   virtual void onScale
+      (
+      DBUSIPC_tReqContext  context,
+      double               value,
+      double               factor
+      )
+   {
+      mReplyStatus = replyScale(context, value * factor);
+   }
+};
+
+
+static volatile bool gAsyncDone = false;
+static volatile double gAsyncResult = 0.0;
+
+static void onScaled
+   (
+   const DBUSIPC_tCallbackStatus*   status,
+   double                           result,
+   DBUSIPC_tUserToken               token
+   )
+{
+   if ( !DBUSIPC_IS_ERROR(status->errCode) )
+   {
+      gAsyncResult = result;
+   }
+   gAsyncDone = true;
+}
+
+
+static bool asyncDone()
+{
+   return gAsyncDone;
+}
+
+
+static std::string encode(double value)
+{
+   std::string json;
+   return dbusipc::idl::append(json, value) ? json : std::string("<none>");
+}
+
+
+static bool decode(const char* json, double& value)
+{
+   dbusipc::idl::Reader reader(json);
+   std::string key;
+   return reader.nextKey(key) && reader.read(value);
+}
+
+
+int main()
+{
+   // Numbers are written with a '.' whatever the locale says
+   const char* commaLocale(0);
+   for ( size_t i = 0U; (0 == commaLocale) &&
+      (i < sizeof(COMMA_LOCALES) / sizeof(COMMA_LOCALES[0])); ++i )
+   {
+      commaLocale = std::setlocale(LC_NUMERIC, COMMA_LOCALES[i]);
+   }
+   if ( 0 == commaLocale )
+   {
+      std::printf("test_idl: no locale with a decimal comma installed\n");
+   }
+
+   double value(0.0);
+   CHECK(encode(0.5) == "0.5");
+   CHECK(encode(-1.25e-300) == "-1.25e-300");
+   CHECK(decode("{\"v\":0.5}", value) && (0.5 == value));
+
+   // NaN and the infinities are neither written nor read
+   CHECK(encode(NaN) == "<none>");
+   CHECK(encode(INF) == "<none>");
+   CHECK(encode(-INF) == "<none>");
+   CHECK(!decode("{\"v\":nan}", value));
+   CHECK(!decode("{\"v\":-inf}", value));
+   CHECK(!decode("{\"v\":1e999}", value));
+
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tConnection cliConn(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &cliConn), DBUSIPC_ERROR_NONE);
+   CalcService service;
+   CHECK_STATUS(service.registerService(svcConn), DBUSIPC_ERROR_NONE);
+   Calc::Proxy proxy(cliConn, Calc::BUS_NAME, Calc::OBJ_PATH, 2000U);
+
+   // The generated classes talk to each other...
+   double result(0.0);
+   CHECK_STATUS(proxy.scale(1.5, 2.0, result), DBUSIPC_ERROR_NONE);
+   CHECK(3.0 == result);
+   CHECK_STATUS(proxy.asyncScale(0.25, 0.5, onScaled, 0, 0),
+                DBUSIPC_ERROR_NONE);
+   CHECK(testWaitFor(asyncDone, 2000UL));
+   CHECK(0.125 == gAsyncResult);
+
+   // ...and to hand-written code in plain JSON
+   DBUSIPC_tResponse* resp(0);
+   CHECK_STATUS(DBUSIPC_invoke(cliConn, Calc::BUS_NAME, Calc::OBJ_PATH,
+                Calc::METHOD_SCALE, "{\"value\":0.5,\"factor\":0.5}", 2000U,
+                &resp), DBUSIPC_ERROR_NONE);
+   CHECK((0 != resp) && (0 != resp->result) &&
+         (0 == std::strcmp(resp->result, "{\"result\":0.25}")));
+   DBUSIPC_freeResponse(resp);
+
+   // Arguments that can't be encoded are refused before anything is sent
+   gAsyncDone = false;
+   CHECK_STATUS(proxy.scale(NaN, 1.0, result),
+                LIB_ERROR(DBUSIPC_ERR_BAD_ARGS));
+   CHECK_STATUS(proxy.asyncScale(1.0, INF, onScaled, 0, 0),
+                LIB_ERROR(DBUSIPC_ERR_BAD_ARGS));
+   usleep(100000);
+   CHECK(!gAsyncDone);
+
+   // A result that can't be encoded is answered with a Format error
+   resp = 0;
+   CHECK(DBUSIPC_IS_ERROR(DBUSIPC_invoke(cliConn, Calc::BUS_NAME,
+         Calc::OBJ_PATH, Calc::METHOD_SCALE,
+         "{\"value\":1e300,\"factor\":1e300}", 2000U, &resp)));
+   CHECK((0 != resp) && (0 != resp->status.errName) &&
+         (0 == std::strcmp(resp->status.errName, DBUSIPC_ERR_NAME_FORMAT)));
+   DBUSIPC_freeResponse(resp);
+   CHECK(LIB_ERROR(DBUSIPC_ERR_BAD_ARGS) == service.mReplyStatus);
+
+   CHECK_STATUS(service.unregisterService(), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(cliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_idl");
+}
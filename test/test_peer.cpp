@@ -0,0 +1,90 @@
+// Invokes over direct peer connections (DBUSIPC_REG_FLAG_PEER_LISTEN)
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "testutil.hpp"
+
+static const char* DIRECT_SVC = "com.test.peer.Direct";
+static const char* BUS_SVC = "com.test.peer.Bus";
+
+static void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   (void)DBUSIPC_asyncReturnResultAndFree(context, parms, 0, 0);
+}
+
+
+static void invokeEcho
+   (
+   DBUSIPC_tConnection  conn,
+   const char*          busName
+   )
+{
+   for ( int i = 0; i < 5; ++i )
+   {
+      DBUSIPC_tResponse* resp(0);
+      CHECK_STATUS(DBUSIPC_invoke(conn, busName, 0, "echo", "{\"i\":1}",
+                   2000, &resp), DBUSIPC_ERROR_NONE);
+      CHECK((0 != resp) && (0 != resp->result) &&
+            (0 == std::strcmp(resp->result, "{\"i\":1}")));
+      DBUSIPC_freeResponse(resp);
+      
+      // Give the peer connection time to authenticate
+      usleep(20000);
+   }
+}
+
+
+int main()
+{
+   // Only the first service is reached directly
+   setenv("DBUSIPC_ENABLE_PEER_TO_PEER", DIRECT_SVC, 1);
+   
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+   
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tConnection cliConn(0);
+   DBUSIPC_tSvcRegHnd directReg(0);
+   DBUSIPC_tSvcRegHnd busReg(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, DIRECT_SVC, 0,
+                DBUSIPC_REG_FLAG_PEER_LISTEN, onRequest, 0, &directReg),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, BUS_SVC, 0,
+                DBUSIPC_REG_FLAG_PEER_LISTEN, onRequest, 0, &busReg),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &cliConn), DBUSIPC_ERROR_NONE);
+   
+   invokeEcho(cliConn, DIRECT_SVC);
+   invokeEcho(cliConn, BUS_SVC);
+   
+   // A request racing the peer going away fails rather than waiting
+   // on a reply that can't arrive
+   CHECK_STATUS(DBUSIPC_unregisterService(directReg), DBUSIPC_ERROR_NONE);
+   unsigned long start = testNowMsec();
+   DBUSIPC_tResponse* resp(0);
+   DBUSIPC_tError status = DBUSIPC_invoke(cliConn, DIRECT_SVC, 0, "echo",
+                                        "{}", 500, &resp);
+   unsigned long elapsed = testNowMsec() - start;
+   CHECK(DBUSIPC_IS_ERROR(status));
+   CHECK(elapsed < 2000UL);
+   DBUSIPC_freeResponse(resp);
+   
+   // The bus keeps working for the other service
+   invokeEcho(cliConn, BUS_SVC);
+   
+   CHECK_STATUS(DBUSIPC_unregisterService(busReg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(cliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+   
+   return testResult("test_peer");
+}
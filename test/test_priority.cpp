@@ -0,0 +1,227 @@
+// Dispatch priority classes: ready connections of a higher class are
+// serviced first (DBUSIPC_setConnectionPriority())
+#include <cstdlib>
+#include <string>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "testutil.hpp"
+
+static const char* SRC_SVC = "com.test.priority.Src";
+static const char* SRC_PATH = "/com/test/priority/Src";
+static const char* BLOCKER_SVC = "com.test.priority.Blocker";
+// Few enough signals for libdbus to read them in one go
+static const int NUM_SIGNALS = 5;
+static const int NUM_ROUNDS = 2;
+
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+// Which connection ('A' or 'B') each signal was delivered on in order
+static std::string gOrder;
+static volatile bool gBlocked = false;
+static volatile bool gRelease = false;
+
+static void onSignal
+   (
+   DBUSIPC_tConstStr    sigName,
+   DBUSIPC_tConstStr    data,
+   DBUSIPC_tUserToken   token
+   )
+{
+   pthread_mutex_lock(&gLock);
+   gOrder += static_cast<char>(reinterpret_cast<long>(token));
+   pthread_mutex_unlock(&gLock);
+}
+
+
+// Holds up the dispatcher until released so that the signals pile up on
+// both connections and they become ready in the same pass
+static void onBlock
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   gBlocked = true;
+   while ( !gRelease )
+   {
+      usleep(1000);
+   }
+   gBlocked = false;
+   (void)DBUSIPC_asyncReturnResultAndFree(context, "{}", 0, 0);
+}
+
+
+static bool isBlocked()
+{
+   return gBlocked;
+}
+
+
+static bool allDelivered()
+{
+   pthread_mutex_lock(&gLock);
+   bool done = gOrder.size() >= 2U * NUM_SIGNALS;
+   pthread_mutex_unlock(&gLock);
+   return done;
+}
+
+
+// The emitting side runs in its own process since the dispatcher of this
+// one is held up while the signals are sent
+static void runSource
+   (
+   int   goFd
+   )
+{
+   DBUSIPC_tConnection conn(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   char go(0);
+
+   if ( DBUSIPC_IS_ERROR(DBUSIPC_initialize()) ||
+      DBUSIPC_IS_ERROR(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+      DBUSIPC_TRUE, &conn)) ||
+      DBUSIPC_IS_ERROR(DBUSIPC_registerService(conn, SRC_SVC, 0, 0, 0, 0,
+      &reg)) )
+   {
+      _exit(1);
+   }
+
+   for ( int round = 0; round < NUM_ROUNDS; ++round )
+   {
+      if ( 1 != read(goFd, &go, 1) )
+      {
+         _exit(1);
+      }
+      for ( int i = 0; i < NUM_SIGNALS; ++i )
+      {
+         (void)DBUSIPC_emit(reg, "tick", "{}");
+      }
+      // Tells the test the round is over
+      (void)DBUSIPC_emit(reg, "done", "{}");
+   }
+
+   (void)DBUSIPC_closeConnection(conn);
+   DBUSIPC_shutdown();
+   _exit(0);
+}
+
+
+static volatile int gRoundsDone = 0;
+static void onDone
+   (
+   DBUSIPC_tConstStr    sigName,
+   DBUSIPC_tConstStr    data,
+   DBUSIPC_tUserToken   token
+   )
+{
+   ++gRoundsDone;
+}
+
+
+static int gWantRounds = 0;
+static bool roundDone()
+{
+   return gRoundsDone >= gWantRounds;
+}
+
+
+int main()
+{
+   int goPipe[2];
+   CHECK(0 == pipe(goPipe));
+
+   // Forked before the library starts any threads
+   pid_t child = fork();
+   if ( 0 == child )
+   {
+      close(goPipe[1]);
+      runSource(goPipe[0]);
+   }
+   close(goPipe[0]);
+
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection connA(0);
+   DBUSIPC_tConnection connB(0);
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tConnection cliConn(0);
+   DBUSIPC_tSigSubHnd subA(0);
+   DBUSIPC_tSigSubHnd subB(0);
+   DBUSIPC_tSigSubHnd subDone(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &connA), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &connB), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_subscribe(connA, SRC_PATH, "tick", onSignal,
+                reinterpret_cast<DBUSIPC_tUserToken>('A'), &subA),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_subscribe(connB, SRC_PATH, "tick", onSignal,
+                reinterpret_cast<DBUSIPC_tUserToken>('B'), &subB),
+                DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, BLOCKER_SVC, 0, 0, onBlock,
+                0, &reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &cliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_subscribe(cliConn, SRC_PATH, "done", onDone, 0,
+                &subDone), DBUSIPC_ERROR_NONE);
+
+   // Whichever connection is the control one goes first, whatever the
+   // order the two became ready in
+   for ( int round = 0; round < NUM_ROUNDS; ++round )
+   {
+      bool aFirst = (0 == round);
+      CHECK_STATUS(DBUSIPC_setConnectionPriority(connA, aFirst ?
+                   DBUSIPC_CONN_PRIORITY_CONTROL : DBUSIPC_CONN_PRIORITY_BULK,
+                   0U), DBUSIPC_ERROR_NONE);
+      CHECK_STATUS(DBUSIPC_setConnectionPriority(connB, aFirst ?
+                   DBUSIPC_CONN_PRIORITY_BULK : DBUSIPC_CONN_PRIORITY_CONTROL,
+                   0U), DBUSIPC_ERROR_NONE);
+
+      pthread_mutex_lock(&gLock);
+      gOrder.clear();
+      pthread_mutex_unlock(&gLock);
+      gRelease = false;
+      CHECK_STATUS(DBUSIPC_asyncInvoke(cliConn, BLOCKER_SVC, 0, "block", 0,
+                   DBUSIPC_TRUE, 5000, 0, 0, 0), DBUSIPC_ERROR_NONE);
+      CHECK(testWaitFor(isBlocked, 2000UL));
+
+      // Let the bus deliver everything before the dispatcher looks again
+      char go('g');
+      CHECK(1 == write(goPipe[1], &go, 1));
+      usleep(300000);
+      gRelease = true;
+
+      gWantRounds = round + 1;
+      CHECK(testWaitFor(roundDone, 2000UL));
+      CHECK(testWaitFor(allDelivered, 2000UL));
+      std::string expected = std::string(NUM_SIGNALS, aFirst ? 'A' : 'B') +
+                             std::string(NUM_SIGNALS, aFirst ? 'B' : 'A');
+      pthread_mutex_lock(&gLock);
+      if ( gOrder != expected )
+      {
+         std::printf("round %d: delivered %s (expected %s)\n", round,
+                     gOrder.c_str(), expected.c_str());
+      }
+      CHECK(gOrder == expected);
+      pthread_mutex_unlock(&gLock);
+   }
+
+   close(goPipe[1]);
+   int childStatus(0);
+   CHECK(child == waitpid(child, &childStatus, 0));
+   CHECK(WIFEXITED(childStatus) && (0 == WEXITSTATUS(childStatus)));
+
+   CHECK_STATUS(DBUSIPC_closeConnection(cliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(connB), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(connA), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_priority");
+}
@@ -0,0 +1,122 @@
+// Per-method request routing (DBUSIPC_registerMethod()) and the library's
+// answer to methods without a handler
+#include <cstring>
+#include <string>
+#include "testutil.hpp"
+
+static const char* SVC = "com.test.routing.Svc";
+static const char* METHODS_SVC = "com.test.routing.Methods";
+
+// Answers with the name of the handler that got the request
+static void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   std::string result = std::string("{\"by\":\"") +
+                        static_cast<const char*>(token) + "\",\"method\":\"" +
+                        method + "\"}";
+   (void)DBUSIPC_asyncReturnResultAndFree(context, result.c_str(), 0, 0);
+}
+
+
+static DBUSIPC_tConnection gCliConn = 0;
+
+static std::string call
+   (
+   const char* busName,
+   const char* method
+   )
+{
+   std::string result;
+   DBUSIPC_tResponse* resp(0);
+   CHECK_STATUS(DBUSIPC_invoke(gCliConn, busName, 0, method, 0, 2000, &resp),
+                DBUSIPC_ERROR_NONE);
+   if ( (0 != resp) && (0 != resp->result) )
+   {
+      result = resp->result;
+   }
+   DBUSIPC_freeResponse(resp);
+   return result;
+}
+
+
+int main()
+{
+   CHECK_STATUS(DBUSIPC_initialize(), DBUSIPC_ERROR_NONE);
+
+   DBUSIPC_tConnection svcConn(0);
+   DBUSIPC_tSvcRegHnd reg(0);
+   DBUSIPC_tSvcRegHnd methodsReg(0);
+   DBUSIPC_tMethodStats methodStats;
+   DBUSIPC_tServiceStats svcStats;
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &svcConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_getConnection(DBUSIPC_CONNECTION_SESSION,
+                DBUSIPC_TRUE, &gCliConn), DBUSIPC_ERROR_NONE);
+
+   // A method with a handler of its own bypasses the service's handler
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, SVC, 0, 0, onRequest,
+                const_cast<char*>("service"), &reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerMethod(reg, "add", onRequest,
+                const_cast<char*>("add")), DBUSIPC_ERROR_NONE);
+   CHECK(call(SVC, "add") == "{\"by\":\"add\",\"method\":\"add\"}");
+   CHECK(call(SVC, "sub") == "{\"by\":\"service\",\"method\":\"sub\"}");
+
+   // Registering it again replaces the handler and NULL removes it
+   CHECK_STATUS(DBUSIPC_registerMethod(reg, "add", onRequest,
+                const_cast<char*>("add2")), DBUSIPC_ERROR_NONE);
+   CHECK(call(SVC, "add") == "{\"by\":\"add2\",\"method\":\"add\"}");
+   CHECK_STATUS(DBUSIPC_registerMethod(reg, "add", 0, 0),
+                DBUSIPC_ERROR_NONE);
+   CHECK(call(SVC, "add") == "{\"by\":\"service\",\"method\":\"add\"}");
+   CHECK_STATUS(DBUSIPC_getMethodStats(reg, "add", &methodStats),
+                LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+
+   // Without a service handler the library answers unknown methods itself
+   // (at once rather than leaving the client to time out)
+   CHECK_STATUS(DBUSIPC_registerService(svcConn, METHODS_SVC, 0, 0, 0, 0,
+                &methodsReg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerMethod(methodsReg, "ping", onRequest,
+                const_cast<char*>("ping")), DBUSIPC_ERROR_NONE);
+   for ( int i = 0; i < 3; ++i )
+   {
+      CHECK(call(METHODS_SVC, "ping") ==
+            "{\"by\":\"ping\",\"method\":\"ping\"}");
+   }
+   unsigned long start = testNowMsec();
+   DBUSIPC_tResponse* resp(0);
+   CHECK_STATUS(DBUSIPC_invoke(gCliConn, METHODS_SVC, 0, "pong", 0, 5000,
+                &resp), LIB_ERROR(DBUSIPC_ERR_UNKNOWN_METHOD));
+   CHECK(testNowMsec() - start < 2000UL);
+   CHECK((0 != resp) && (0 != resp->status.errName) &&
+         (0 == std::strcmp(resp->status.errName,
+                           DBUSIPC_ERR_NAME_UNKNOWN_METHOD)));
+   DBUSIPC_freeResponse(resp);
+
+   // Each method counts its own calls
+   CHECK_STATUS(DBUSIPC_getMethodStats(methodsReg, "ping", &methodStats),
+                DBUSIPC_ERROR_NONE);
+   CHECK(3U == methodStats.calls);
+   CHECK_STATUS(DBUSIPC_getServiceStats(methodsReg, &svcStats),
+                DBUSIPC_ERROR_NONE);
+   CHECK(1U == svcStats.unknown);
+
+   // Stale registrations are refused
+   CHECK_STATUS(DBUSIPC_unregisterService(methodsReg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_registerMethod(methodsReg, "ping", onRequest, 0),
+                LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+   CHECK_STATUS(DBUSIPC_getMethodStats(methodsReg, "ping", &methodStats),
+                LIB_ERROR(DBUSIPC_ERR_NOT_FOUND));
+
+   CHECK_STATUS(DBUSIPC_unregisterService(reg), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(gCliConn), DBUSIPC_ERROR_NONE);
+   CHECK_STATUS(DBUSIPC_closeConnection(svcConn), DBUSIPC_ERROR_NONE);
+   DBUSIPC_shutdown();
+
+   return testResult("test_routing");
+}
@@ -0,0 +1,73 @@
+#ifndef TESTUTIL_HPP_
+#define TESTUTIL_HPP_
+
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+#include "dbusipc/dbusipc.h"
+
+// Failed checks are reported and counted but the test carries on so that
+// one run shows every failure
+static int gFailures = 0;
+
+#define CHECK(cond) \
+   do { \
+      if ( !(cond) ) \
+      { \
+         std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                     #cond); \
+         ++gFailures; \
+      } \
+   } while ( 0 )
+
+#define CHECK_STATUS(expr, expected) \
+   do { \
+      DBUSIPC_tError status_ = (expr); \
+      if ( (expected) != status_ ) \
+      { \
+         std::printf("%s:%d: %s returned 0x%x (expected 0x%x)\n", \
+                     __FILE__, __LINE__, #expr, \
+                     static_cast<unsigned>(status_), \
+                     static_cast<unsigned>(expected)); \
+         ++gFailures; \
+      } \
+   } while ( 0 )
+
+// The library's error code for a failure in its own domain
+#define LIB_ERROR(code) \
+   DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR, DBUSIPC_DOMAIN_IPC_LIB, code)
+
+inline unsigned long testNowMsec()
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return static_cast<unsigned long>(now.tv_sec) * 1000UL +
+          static_cast<unsigned long>(now.tv_nsec) / 1000000UL;
+}
+
+// Polls the condition until it holds or the time runs out
+template <typename Cond>
+bool testWaitFor(Cond cond, unsigned long msecTimeout)
+{
+   unsigned long deadline = testNowMsec() + msecTimeout;
+   while ( !cond() && (testNowMsec() < deadline) )
+   {
+      usleep(1000);
+   }
+   return cond();
+}
+
+inline int testResult(const char* name)
+{
+   if ( 0 == gFailures )
+   {
+      std::printf("PASS %s\n", name);
+   }
+   else
+   {
+      std::printf("FAIL %s (%d failures)\n", name, gFailures);
+   }
+   return (0 == gFailures) ? 0 : 1;
+}
+
+#endif /* Guard for TESTUTIL_HPP_ */
@@ -0,0 +1,220 @@
+//
+// Benchmark of the dispatch jitter caused by opening and closing
+// connections. A client repeatedly calls a service in the same process
+// (both served by the one dispatcher) and the round trip times are
+// measured first on their own and then while another thread keeps
+// opening and closing private connections to the bus. Opening a connection
+// should never hold up the dispatcher so the two should hardly differ.
+//
+// Usage: dbusipc-connchurn [calls] [session|system]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+#include "dbusipc/dbusipc.h"
+
+namespace
+{
+
+const char* const BUS_NAME = "com.hsae.dbusipc.bench.ConnChurn";
+
+volatile bool gChurning = false;
+uint32_t gNumOpened = 0U;
+uint32_t gNumFailed = 0U;
+
+uint64_t nowUsec()
+{
+   struct timespec ts;
+   (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+   return static_cast<uint64_t>(ts.tv_sec) * 1000000U +
+          static_cast<uint64_t>(ts.tv_nsec) / 1000U;
+}
+
+void onRequest
+   (
+   DBUSIPC_tReqContext  context,
+   DBUSIPC_tConstStr    method,
+   DBUSIPC_tConstStr    parms,
+   DBUSIPC_tBool        noReplyExpected,
+   DBUSIPC_tUserToken   token
+   )
+{
+   if ( !noReplyExpected )
+   {
+      (void)DBUSIPC_asyncReturnResultAndFree(context, parms, 0, 0);
+   }
+   else
+   {
+      DBUSIPC_freeReqContext(context);
+   }
+}
+
+void* churn
+   (
+   void* arg
+   )
+{
+   DBUSIPC_tConnType connType = *static_cast<DBUSIPC_tConnType*>(arg);
+
+   while ( gChurning )
+   {
+      DBUSIPC_tConnection conn(0);
+      if ( DBUSIPC_IS_ERROR(DBUSIPC_getConnection(connType, DBUSIPC_TRUE,
+         &conn)) )
+      {
+         ++gNumFailed;
+      }
+      else
+      {
+         ++gNumOpened;
+         (void)DBUSIPC_closeConnection(conn);
+      }
+   }
+
+   return 0;
+}
+
+// Returns false if any of the calls failed
+bool measure
+   (
+   DBUSIPC_tConnection     conn,
+   uint32_t                numCalls,
+   std::vector<uint64_t>&  rtt
+   )
+{
+   bool ok(true);
+
+   rtt.clear();
+   for ( uint32_t i = 0U; ok && (i < numCalls); ++i )
+   {
+      DBUSIPC_tResponse* response(0);
+      uint64_t start = nowUsec();
+      DBUSIPC_tError err = DBUSIPC_invoke(conn, BUS_NAME, 0, "ping", 0,
+                                        5000U, &response);
+      rtt.push_back(nowUsec() - start);
+      if ( DBUSIPC_IS_ERROR(err) || (0 == response) ||
+         DBUSIPC_IS_ERROR(response->status.errCode) )
+      {
+         fprintf(stderr, "Call %u failed (0x%x)\n", i, err);
+         ok = false;
+      }
+      DBUSIPC_freeResponse(response);
+   }
+
+   return ok;
+}
+
+void report
+   (
+   const char*             label,
+   std::vector<uint64_t>&  rtt
+   )
+{
+   if ( !rtt.empty() )
+   {
+      std::sort(rtt.begin(), rtt.end());
+      uint64_t total(0U);
+      for ( std::vector<uint64_t>::const_iterator it = rtt.begin();
+         it != rtt.end(); ++it )
+      {
+         total += *it;
+      }
+      printf("%-10s calls=%-6u avg=%-6llu p50=%-6llu p99=%-6llu "
+             "max=%llu usec\n", label, static_cast<uint32_t>(rtt.size()),
+             static_cast<unsigned long long>(total / rtt.size()),
+             static_cast<unsigned long long>(rtt[rtt.size() / 2U]),
+             static_cast<unsigned long long>(rtt[(rtt.size() * 99U) / 100U]),
+             static_cast<unsigned long long>(rtt.back()));
+   }
+}
+
+void reportCmd
+   (
+   const char*                label,
+   const DBUSIPC_tHistogram&  hist
+   )
+{
+   printf("%-10s count=%-6u avg=%-6llu max=%llu usec\n", label, hist.count,
+          (0U == hist.count) ? 0ULL :
+          static_cast<unsigned long long>(hist.totalUsec / hist.count),
+          static_cast<unsigned long long>(hist.maxUsec));
+}
+
+} // namespace
+
+
+int main
+   (
+   int   argc,
+   char* argv[]
+   )
+{
+   uint32_t numCalls = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) :
+                       10000U;
+   DBUSIPC_tConnType connType = ((argc > 2) && (0 == strcmp(argv[2],
+                               "system"))) ? DBUSIPC_CONNECTION_SYSTEM :
+                               DBUSIPC_CONNECTION_SESSION;
+   DBUSIPC_tConnection service(0);
+   DBUSIPC_tConnection client(0);
+   DBUSIPC_tSvcRegHnd regHnd(0);
+   std::vector<uint64_t> rtt;
+   int rc(1);
+
+   if ( DBUSIPC_IS_ERROR(DBUSIPC_initialize()) ||
+      DBUSIPC_IS_ERROR(DBUSIPC_getConnection(connType, DBUSIPC_TRUE,
+                                           &service)) ||
+      DBUSIPC_IS_ERROR(DBUSIPC_getConnection(connType, DBUSIPC_TRUE,
+                                           &client)) ||
+      DBUSIPC_IS_ERROR(DBUSIPC_registerService(service, BUS_NAME, 0, 0,
+                                             onRequest, 0, &regHnd)) )
+   {
+      fprintf(stderr, "Failed to set up the service\n");
+   }
+   else
+   {
+      DBUSIPC_tDispatcherStats stats;
+      pthread_t thread;
+
+      if ( measure(client, numCalls, rtt) )
+      {
+         report("idle", rtt);
+
+         (void)DBUSIPC_getDispatcherStats(&stats, DBUSIPC_TRUE);
+         gChurning = true;
+         if ( 0 != pthread_create(&thread, 0, churn, &connType) )
+         {
+            fprintf(stderr, "Failed to start the churn thread\n");
+         }
+         else
+         {
+            bool ok = measure(client, numCalls, rtt);
+            gChurning = false;
+            (void)pthread_join(thread, 0);
+            report("churn", rtt);
+            printf("%u connection(s) opened, %u failed\n", gNumOpened,
+                   gNumFailed);
+
+            // How long the dispatcher was busy with the connections
+            if ( !DBUSIPC_IS_ERROR(DBUSIPC_getDispatcherStats(&stats,
+               DBUSIPC_FALSE)) )
+            {
+               reportCmd("open", stats.commands[
+                         DBUSIPC_CMD_GET_CONNECTION].execTime);
+               reportCmd("close", stats.commands[
+                         DBUSIPC_CMD_CLOSE_CONNECTION].execTime);
+            }
+            rc = ok ? 0 : 1;
+         }
+      }
+      (void)DBUSIPC_unregisterService(regHnd);
+   }
+
+   DBUSIPC_shutdown();
+
+   return rc;
+}
@@ -0,0 +1,1457 @@
+//
+// Generates typed C++ proxy and skeleton classes for a service described by
+// an IDL. The IDL uses the D-Bus introspection format (like dbusipc.xml) but
+// describes the methods carried *inside* Invoke() rather than Invoke()
+// itself:
+//
+//    <node name="/com/hsae/Calculator">
+//       <interface name="com.hsae.Calculator">
+//          <method name="add">
+//             <arg name="a" type="i" direction="in"/>
+//             <arg name="b" type="i" direction="in"/>
+//             <arg name="sum" type="i" direction="out"/>
+//          </method>
+//       </interface>
+//    </node>
+//
+// The interface name is the default bus name of the service and the node
+// name (if any) its default object path. The arguments of each method are
+// encoded as the members of a flat JSON object so the generated classes
+// interoperate with hand-written clients and services. The supported types
+// are b (bool), i (int32), u (uint32), x (int64), t (uint64), d (double)
+// and s (string). Signals are ignored.
+//
+// The generator writes <Name>.hpp and <Name>.cpp where <Name> is the last
+// component of the interface name unless another one is given. Everything
+// is generated in a namespace of that name:
+//
+//    METHOD_<NAME>, METHOD_<NAME>_ID - The method name and its hash
+//    Proxy - Invokes the methods synchronously or asynchronously
+//    Skeleton - Dispatches requests to a virtual function per method
+//
+// The generated code needs dbusipc/dbusipc_idl.hpp but no other library.
+//
+// Usage: dbusipc-idlgen [-n name] [-o dir] idl.xml
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "dbusipc/dbusipc_idl.hpp"
+
+namespace
+{
+
+struct tType
+{
+   char        code;
+   const char* type;     // Stored (and out argument) type
+   const char* param;    // Type of an in argument
+   const char* init;     // Initial value of a local (empty if none)
+};
+
+const tType TYPES[] =
+{
+   { 'b', "bool", "bool", "false" },
+   { 'i', "DBUSIPC_tInt32", "DBUSIPC_tInt32", "0" },
+   { 'u', "DBUSIPC_tUInt32", "DBUSIPC_tUInt32", "0U" },
+   { 'x', "int64_t", "int64_t", "0" },
+   { 't', "uint64_t", "uint64_t", "0U" },
+   { 'd', "double", "double", "0.0" },
+   { 's', "std::string", "const std::string&", "" }
+};
+
+// Names used by the generated functions themselves
+const char* const RESERVED[] =
+{
+   "call", "context", "decoded", "handle", "json", "key", "known", "method",
+   "onResult", "parms", "reader", "response", "seen", "status", "token",
+   "valid"
+};
+
+struct tArg
+{
+   std::string    name;
+   const tType*   type;
+};
+
+struct tMethod
+{
+   std::string       name;
+   DBUSIPC_tUInt32   id;
+   std::vector<tArg> in;
+   std::vector<tArg> out;
+};
+
+struct tInterface
+{
+   std::string          name;
+   std::string          objPath;
+   std::vector<tMethod> methods;
+};
+
+typedef std::map<std::string, std::string> tAttrs;
+
+
+std::string format
+   (
+   const char* fmt,
+   ...
+   )
+{
+   char buf[512];
+   va_list args;
+
+   va_start(args, fmt);
+   int32_t len = vsnprintf(buf, sizeof(buf), fmt, args);
+   va_end(args);
+
+   std::string str;
+   if ( len >= static_cast<int32_t>(sizeof(buf)) )
+   {
+      std::vector<char> big(static_cast<size_t>(len) + 1U);
+      va_start(args, fmt);
+      (void)vsnprintf(&big[0], big.size(), fmt, args);
+      va_end(args);
+      str.assign(&big[0], static_cast<size_t>(len));
+   }
+   else if ( len > 0 )
+   {
+      str.assign(buf, static_cast<size_t>(len));
+   }
+
+   return str;
+}
+
+
+bool isIdentifier
+   (
+   const std::string&   name
+   )
+{
+   bool valid(!name.empty() && !isdigit(static_cast<unsigned char>(name[0])));
+   for ( std::string::const_iterator it = name.begin();
+      valid && (it != name.end()); ++it )
+   {
+      valid = (0 != isalnum(static_cast<unsigned char>(*it))) || ('_' == *it);
+   }
+
+   return valid;
+}
+
+
+// "getValue" => "GetValue"
+std::string capitalize
+   (
+   const std::string&   name
+   )
+{
+   std::string str(name);
+   str[0] = static_cast<char>(toupper(static_cast<unsigned char>(str[0])));
+   return str;
+}
+
+
+// "getValue" => "GET_VALUE"
+std::string toConstant
+   (
+   const std::string&   name
+   )
+{
+   std::string str;
+   for ( std::string::size_type i = 0U; i < name.size(); ++i )
+   {
+      unsigned char c = static_cast<unsigned char>(name[i]);
+      if ( (0U != i) && isupper(c) &&
+         !isupper(static_cast<unsigned char>(name[i - 1U])) &&
+         ('_' != name[i - 1U]) )
+      {
+         str.push_back('_');
+      }
+      str.push_back(static_cast<char>(toupper(c)));
+   }
+
+   return str;
+}
+
+
+//
+// Just enough of an XML scanner for introspection data: returns the tags
+// one at a time, skipping the declaration, comments and text.
+//
+class Scanner
+{
+public:
+   explicit Scanner(const std::string& text)
+      : mText(text)
+      , mPos(0U)
+      , mLine(1U)
+   {
+   }
+
+   uint32_t line() const { return mLine; }
+
+   // Returns false at the end of the document or on a syntax error (in
+   // which case error is set)
+   bool next(std::string& tag, bool& closing, bool& empty, tAttrs& attrs,
+             std::string& error)
+   {
+      bool found(false);
+      bool done(false);
+
+      while ( !done )
+      {
+         std::string::size_type open = mText.find('<', mPos);
+         if ( std::string::npos == open )
+         {
+            done = true;
+         }
+         else if ( 0 == mText.compare(open, 4U, "<!--") )
+         {
+            done = !skipTo(open, "-->", error);
+         }
+         else if ( ('?' == at(open + 1U)) || ('!' == at(open + 1U)) )
+         {
+            done = !skipTo(open, ">", error);
+         }
+         else
+         {
+            found = parseTag(open, tag, closing, empty, attrs, error);
+            done = true;
+         }
+      }
+
+      return found;
+   }
+
+private:
+   char at(std::string::size_type pos) const
+   {
+      return (pos < mText.size()) ? mText[pos] : '\0';
+   }
+
+   void advance(std::string::size_type pos)
+   {
+      for ( ; mPos < pos; ++mPos )
+      {
+         if ( '\n' == mText[mPos] )
+         {
+            ++mLine;
+         }
+      }
+   }
+
+   void skipSpace()
+   {
+      while ( isspace(static_cast<unsigned char>(at(mPos))) )
+      {
+         advance(mPos + 1U);
+      }
+   }
+
+   std::string name()
+   {
+      std::string str;
+      while ( (0 != isalnum(static_cast<unsigned char>(at(mPos)))) ||
+         (('\0' != at(mPos)) && (0 != strchr("_-:.", at(mPos)))) )
+      {
+         str.push_back(at(mPos));
+         advance(mPos + 1U);
+      }
+
+      return str;
+   }
+
+   bool skipTo(std::string::size_type pos, const char* end,
+               std::string& error)
+   {
+      std::string::size_type close = mText.find(end, pos);
+      bool ok(std::string::npos != close);
+      if ( ok )
+      {
+         advance(close + strlen(end));
+      }
+      else
+      {
+         advance(pos);
+         error = "unterminated markup";
+      }
+
+      return ok;
+   }
+
+   bool parseTag(std::string::size_type open, std::string& tag,
+                 bool& closing, bool& empty, tAttrs& attrs,
+                 std::string& error)
+   {
+      advance(open + 1U);
+      closing = ('/' == at(mPos));
+      if ( closing )
+      {
+         advance(mPos + 1U);
+      }
+      empty = false;
+      attrs.clear();
+      tag = name();
+
+      bool ok(!tag.empty());
+      bool done(false);
+      while ( ok && !done )
+      {
+         skipSpace();
+         if ( '>' == at(mPos) )
+         {
+            done = true;
+         }
+         else if ( ('/' == at(mPos)) && ('>' == at(mPos + 1U)) )
+         {
+            empty = true;
+            advance(mPos + 1U);
+            done = true;
+         }
+         else
+         {
+            std::string attr = name();
+            skipSpace();
+            ok = !attr.empty() && ('=' == at(mPos));
+            advance(mPos + 1U);
+            skipSpace();
+            char quote = at(mPos);
+            ok = ok && (('"' == quote) || ('\'' == quote));
+            std::string::size_type close = ok ?
+                                 mText.find(quote, mPos + 1U) :
+                                 std::string::npos;
+            ok = ok && (std::string::npos != close);
+            if ( ok )
+            {
+               attrs[attr] = mText.substr(mPos + 1U, close - mPos - 1U);
+               advance(close + 1U);
+            }
+         }
+      }
+
+      if ( ok )
+      {
+         advance(mPos + 1U);
+      }
+      else
+      {
+         error = "malformed tag";
+      }
+
+      return ok;
+   }
+
+   const std::string&      mText;
+   std::string::size_type  mPos;
+   uint32_t                mLine;
+};
+
+
+const tType* findType
+   (
+   const std::string&   code
+   )
+{
+   const tType* type(0);
+   for ( size_t i = 0U; (0 == type) && (1U == code.size()) &&
+      (i < sizeof(TYPES) / sizeof(TYPES[0])); ++i )
+   {
+      if ( TYPES[i].code == code[0] )
+      {
+         type = &TYPES[i];
+      }
+   }
+
+   return type;
+}
+
+
+// Returns an empty string if the argument is valid
+std::string checkArg
+   (
+   const tMethod&       method,
+   const std::string&   name
+   )
+{
+   std::string error;
+
+   if ( !isIdentifier(name) )
+   {
+      error = format("invalid argument name '%s'", name.c_str());
+   }
+   for ( size_t i = 0U; error.empty() &&
+      (i < sizeof(RESERVED) / sizeof(RESERVED[0])); ++i )
+   {
+      if ( name == RESERVED[i] )
+      {
+         error = format("argument name '%s' is reserved", name.c_str());
+      }
+   }
+
+   const std::vector<tArg>* lists[] = { &method.in, &method.out };
+   for ( size_t l = 0U; error.empty() && (l < 2U); ++l )
+   {
+      for ( std::vector<tArg>::const_iterator it = lists[l]->begin();
+         error.empty() && (it != lists[l]->end()); ++it )
+      {
+         if ( it->name == name )
+         {
+            error = format("duplicate argument '%s'", name.c_str());
+         }
+      }
+   }
+
+   return error;
+}
+
+
+bool parse
+   (
+   const char* fileName,
+   const std::string&   text,
+   tInterface&          iface
+   )
+{
+   Scanner scanner(text);
+   std::string tag;
+   std::string error;
+   bool closing(false);
+   bool empty(false);
+   tAttrs attrs;
+   bool inInterface(false);
+   bool inMethod(false);
+   std::map<DBUSIPC_tUInt32, std::string> ids;
+   std::map<std::string, std::string> constants;
+
+   while ( error.empty() &&
+      scanner.next(tag, closing, empty, attrs, error) )
+   {
+      if ( ("node" == tag) && !closing && !inInterface )
+      {
+         // Only the outer most node names the object
+         if ( iface.objPath.empty() )
+         {
+            iface.objPath = attrs["name"];
+         }
+      }
+      else if ( "interface" == tag )
+      {
+         if ( closing )
+         {
+            inInterface = false;
+         }
+         else if ( !iface.name.empty() )
+         {
+            error = "only one interface per IDL is supported";
+         }
+         else if ( attrs["name"].empty() )
+         {
+            error = "interface has no name";
+         }
+         else
+         {
+            iface.name = attrs["name"];
+            inInterface = !empty;
+         }
+      }
+      else if ( ("method" == tag) && inInterface )
+      {
+         if ( closing )
+         {
+            inMethod = false;
+         }
+         else
+         {
+            tMethod method;
+            method.name = attrs["name"];
+            method.id = dbusipc::idl::hash(method.name.c_str());
+            std::string constant = toConstant(method.name);
+            if ( !isIdentifier(method.name) )
+            {
+               error = format("invalid method name '%s'",
+                              method.name.c_str());
+            }
+            else if ( constants.end() != constants.find(constant) )
+            {
+               error = format("methods '%s' and '%s' have the same name",
+                              constants[constant].c_str(),
+                              method.name.c_str());
+            }
+            else if ( ids.end() != ids.find(method.id) )
+            {
+               error = format("methods '%s' and '%s' have the same hash",
+                              ids[method.id].c_str(), method.name.c_str());
+            }
+            else
+            {
+               ids[method.id] = method.name;
+               constants[constant] = method.name;
+               iface.methods.push_back(method);
+               inMethod = !empty;
+            }
+         }
+      }
+      else if ( ("arg" == tag) && inMethod && !closing )
+      {
+         tMethod& method = iface.methods.back();
+         tArg arg;
+         arg.name = attrs["name"];
+         arg.type = findType(attrs["type"]);
+         std::string direction = attrs["direction"];
+         error = checkArg(method, arg.name);
+         if ( !error.empty() )
+         {
+            // Already reported
+         }
+         else if ( 0 == arg.type )
+         {
+            error = format("unsupported type '%s' for argument '%s'",
+                           attrs["type"].c_str(), arg.name.c_str());
+         }
+         else if ( (method.in.size() >= 32U) || (method.out.size() >= 32U) )
+         {
+            error = "too many arguments";
+         }
+         else if ( direction.empty() || ("in" == direction) )
+         {
+            method.in.push_back(arg);
+         }
+         else if ( "out" == direction )
+         {
+            method.out.push_back(arg);
+         }
+         else
+         {
+            error = format("invalid direction '%s'", direction.c_str());
+         }
+      }
+   }
+
+   if ( error.empty() && iface.name.empty() )
+   {
+      error = "no interface found";
+   }
+
+   if ( !error.empty() )
+   {
+      fprintf(stderr, "%s:%u: %s\n", fileName, scanner.line(),
+              error.c_str());
+   }
+
+   return error.empty();
+}
+
+
+//
+// Helpers formatting the argument lists of the generated functions
+//
+enum tListStyle
+{
+   LIST_PARAMS,      // "DBUSIPC_tInt32 a, const std::string& s"
+   LIST_REFS,        // "DBUSIPC_tInt32& a, std::string& s"
+   LIST_NAMES        // "a, s"
+};
+
+std::string argList
+   (
+   const std::vector<tArg>&   args,
+   tListStyle                 style
+   )
+{
+   std::string str;
+   for ( std::vector<tArg>::const_iterator it = args.begin();
+      it != args.end(); ++it )
+   {
+      if ( !str.empty() )
+      {
+         str.append(", ");
+      }
+
+      if ( LIST_PARAMS == style )
+      {
+         str.append(format("%s %s", it->type->param, it->name.c_str()));
+      }
+      else if ( LIST_REFS == style )
+      {
+         str.append(format("%s& %s", it->type->type, it->name.c_str()));
+      }
+      else
+      {
+         str.append(it->name);
+      }
+   }
+
+   return str;
+}
+
+std::string join
+   (
+   const std::string&   first,
+   const std::string&   second
+   )
+{
+   return (first.empty() || second.empty()) ? first + second :
+          first + ", " + second;
+}
+
+std::string declareLocals
+   (
+   const std::vector<tArg>&   args,
+   const char*                indent
+   )
+{
+   std::string str;
+   for ( std::vector<tArg>::const_iterator it = args.begin();
+      it != args.end(); ++it )
+   {
+      if ( '\0' == it->type->init[0] )
+      {
+         str.append(format("%s%s %s;\n", indent, it->type->type,
+                           it->name.c_str()));
+      }
+      else
+      {
+         str.append(format("%s%s %s(%s);\n", indent, it->type->type,
+                           it->name.c_str(), it->type->init));
+      }
+   }
+
+   return str;
+}
+
+
+//
+// Generates the header with the constants and class declarations
+//
+std::string generateHeader
+   (
+   const tInterface&    iface,
+   const std::string&   name,
+   const std::string&   source
+   )
+{
+   std::string guard = toConstant(name) + "_HPP_";
+   std::string str;
+
+   str.append(format(
+      "//\n"
+      "// Generated by dbusipc-idlgen from %s. Do not edit.\n"
+      "//\n"
+      "\n"
+      "#ifndef %s\n"
+      "#define %s\n"
+      "\n"
+      "#include <string>\n"
+      "#include \"dbusipc/dbusipc.h\"\n"
+      "\n"
+      "namespace %s\n"
+      "{\n"
+      "\n"
+      "// The bus name and object path of the service\n"
+      "const char* const BUS_NAME = \"%s\";\n"
+      "const char* const OBJ_PATH = \"%s\";\n"
+      "\n"
+      "// The method names and their hashes (see dbusipc::idl::hash())\n",
+      source.c_str(), guard.c_str(), guard.c_str(), name.c_str(),
+      iface.name.c_str(), iface.objPath.c_str()));
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string constant = toConstant(it->name);
+      str.append(format(
+         "const char* const METHOD_%s = \"%s\";\n"
+         "const DBUSIPC_tUInt32 METHOD_%s_ID = 0x%08xU;\n",
+         constant.c_str(), it->name.c_str(), constant.c_str(),
+         static_cast<uint32_t>(it->id)));
+   }
+
+   str.append(
+      "\n"
+      "\n"
+      "//\n"
+      "// Invokes the methods of the service. The synchronous methods return\n"
+      "// the status of the call and only set the out arguments on success.\n"
+      "// The asynchronous ones call back with the out arguments once the\n"
+      "// result (or an error) arrives. A result that can't be decoded is\n"
+      "// reported as a DBUSIPC_ERR_FORMAT error. Arguments JSON can't carry\n"
+      "// (a NaN or infinite double) are refused with DBUSIPC_ERR_BAD_ARGS.\n"
+      "//\n"
+      "class Proxy\n"
+      "{\n"
+      "public:\n"
+      "   // Selects the library's default timeout\n"
+      "   static const DBUSIPC_tUInt32 DEFAULT_TIMEOUT = 0xFFFFFFFFU;\n"
+      "\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      str.append(format(
+         "   typedef void (*t%sCallback)(const DBUSIPC_tCallbackStatus* "
+         "status,\n"
+         "%s"
+         "                  DBUSIPC_tUserToken token);\n",
+         capitalize(it->name).c_str(),
+         it->out.empty() ? "" : format("                  %s,\n",
+         argList(it->out, LIST_PARAMS).c_str()).c_str()));
+   }
+
+   str.append(
+      "\n"
+      "   explicit Proxy(DBUSIPC_tConnection conn,\n"
+      "                  const char* busName = BUS_NAME,\n"
+      "                  const char* objPath = OBJ_PATH,\n"
+      "                  DBUSIPC_tUInt32 msecTimeout = DEFAULT_TIMEOUT);\n"
+      "\n"
+      "   void setTimeout(DBUSIPC_tUInt32 msecTimeout) "
+      "{ mMsecTimeout = msecTimeout; }\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string cap = capitalize(it->name);
+      str.append(format(
+         "\n"
+         "   DBUSIPC_tError %s(%s);\n"
+         "   DBUSIPC_tError async%s(%s);\n",
+         it->name.c_str(), join(argList(it->in, LIST_PARAMS),
+         argList(it->out, LIST_REFS)).c_str(), cap.c_str(),
+         join(argList(it->in, LIST_PARAMS), format("t%sCallback onResult, "
+         "DBUSIPC_tHandle* handle, DBUSIPC_tUserToken token",
+         cap.c_str())).c_str()));
+   }
+
+   str.append(
+      "\n"
+      "private:\n"
+      "   const char* objPath() const;\n"
+      "\n"
+      "   DBUSIPC_tConnection  mConn;\n"
+      "   std::string          mBusName;\n"
+      "   std::string          mObjPath;\n"
+      "   DBUSIPC_tUInt32      mMsecTimeout;\n"
+      "};\n"
+      "\n"
+      "\n"
+      "//\n"
+      "// Implements the service by overriding a handler per method. The\n"
+      "// handlers are called on the dispatcher thread and must eventually\n"
+      "// answer each request with the matching reply function (or\n"
+      "// replyError()) which also frees the request context. Requests for\n"
+      "// other methods are rejected with an UnknownMethod error and ones\n"
+      "// whose parameters can't be decoded with a Format error. A reply\n"
+      "// whose result can't be encoded is sent as a Format error instead\n"
+      "// and returns DBUSIPC_ERR_BAD_ARGS.\n"
+      "//\n"
+      "class Skeleton\n"
+      "{\n"
+      "public:\n"
+      "   Skeleton();\n"
+      "   virtual ~Skeleton();\n"
+      "\n"
+      "   DBUSIPC_tError registerService(DBUSIPC_tConnection conn,\n"
+      "                                  const char* busName = BUS_NAME,\n"
+      "                                  const char* objPath = OBJ_PATH,\n"
+      "                                  DBUSIPC_tUInt32 flag = 0U);\n"
+      "   DBUSIPC_tError unregisterService();\n"
+      "   DBUSIPC_tSvcRegHnd getRegHnd() const { return mRegHnd; }\n"
+      "\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      str.append(format(
+         "   static DBUSIPC_tError reply%s(%s);\n",
+         capitalize(it->name).c_str(), join("DBUSIPC_tReqContext context",
+         argList(it->out, LIST_PARAMS)).c_str()));
+   }
+
+   str.append(
+      "   static DBUSIPC_tError replyError(DBUSIPC_tReqContext context,\n"
+      "                                    const char* errName,\n"
+      "                                    const char* errMsg);\n"
+      "\n"
+      "protected:\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      str.append(format(
+         "   virtual void on%s(%s) = 0;\n",
+         capitalize(it->name).c_str(), join("DBUSIPC_tReqContext context",
+         argList(it->in, LIST_PARAMS)).c_str()));
+   }
+
+   str.append(format(
+      "\n"
+      "private:\n"
+      "   // (Unimplemented) private copy constructor and assignment operator\n"
+      "   // to prevent misuse\n"
+      "   Skeleton(const Skeleton& other);\n"
+      "   Skeleton& operator=(const Skeleton& rhs);\n"
+      "\n"
+      "   static void onRequest(DBUSIPC_tReqContext context,\n"
+      "                         DBUSIPC_tConstStr method,\n"
+      "                         DBUSIPC_tConstStr parms,\n"
+      "                         DBUSIPC_tBool noReplyExpected,\n"
+      "                         DBUSIPC_tUserToken token);\n"
+      "   void dispatch(DBUSIPC_tReqContext context, DBUSIPC_tConstStr "
+      "method,\n"
+      "                 DBUSIPC_tConstStr parms);\n"
+      "\n"
+      "   DBUSIPC_tSvcRegHnd   mRegHnd;\n"
+      "};\n"
+      "\n"
+      "} // namespace %s\n"
+      "\n"
+      "#endif /* Guard for %s */\n",
+      name.c_str(), guard.c_str()));
+
+   return str;
+}
+
+
+// Emits the function encoding the arguments as a JSON object. It returns an
+// empty string if an argument can't be encoded (a NaN or infinite double).
+std::string generateEncoder
+   (
+   const std::string&         func,
+   const std::vector<tArg>&   args
+   )
+{
+   std::string str(format(
+      "std::string %s(%s)\n"
+      "{\n"
+      "   bool valid(true);\n",
+      func.c_str(), argList(args, LIST_PARAMS).c_str()));
+
+   // The member names are known so only the values are formatted
+   for ( std::vector<tArg>::const_iterator it = args.begin();
+      it != args.end(); ++it )
+   {
+      const char* prefix = (args.begin() == it) ? "{" : ",";
+      if ( args.begin() == it )
+      {
+         str.append(format("   std::string json(\"%s\\\"%s\\\":\");\n",
+                           prefix, it->name.c_str()));
+      }
+      else
+      {
+         str.append(format("   json.append(\"%s\\\"%s\\\":\");\n", prefix,
+                           it->name.c_str()));
+      }
+      str.append(format(
+         "   valid = dbusipc::idl::append(json, %s) && valid;\n",
+         it->name.c_str()));
+   }
+
+   str.append(
+      "   json.push_back('}');\n"
+      "\n"
+      "   return valid ? json : std::string();\n"
+      "}\n"
+      "\n"
+      "\n");
+
+   return str;
+}
+
+
+// Emits the function decoding the arguments from a JSON object. It fails
+// unless every argument is present.
+std::string generateDecoder
+   (
+   const std::string&         func,
+   const std::vector<tArg>&   args
+   )
+{
+   std::string str(format(
+      "bool %s(%s)\n"
+      "{\n"
+      "   dbusipc::idl::Reader reader(json);\n"
+      "   std::string key;\n"
+      "   DBUSIPC_tUInt32 seen(0U);\n"
+      "\n"
+      "   while ( reader.nextKey(key) )\n"
+      "   {\n",
+      func.c_str(), join("DBUSIPC_tConstStr json",
+      argList(args, LIST_REFS)).c_str()));
+
+   DBUSIPC_tUInt32 bit(1U);
+   for ( std::vector<tArg>::const_iterator it = args.begin();
+      it != args.end(); ++it, bit <<= 1U )
+   {
+      str.append(format(
+         "      %sif ( \"%s\" == key )\n"
+         "      {\n"
+         "         seen |= reader.read(%s) ? 0x%xU : 0U;\n"
+         "      }\n",
+         (args.begin() == it) ? "" : "else ", it->name.c_str(),
+         it->name.c_str(), static_cast<uint32_t>(bit)));
+   }
+
+   str.append(format(
+      "      else\n"
+      "      {\n"
+      "         (void)reader.skip();\n"
+      "      }\n"
+      "   }\n"
+      "\n"
+      "   return reader.ok() && (0x%xU == seen);\n"
+      "}\n"
+      "\n"
+      "\n",
+      static_cast<uint32_t>(bit - 1U)));
+
+   return str;
+}
+
+
+//
+// Generates the implementation of the classes
+//
+std::string generateSource
+   (
+   const tInterface&    iface,
+   const std::string&   name,
+   const std::string&   source
+   )
+{
+   std::string str;
+
+   str.append(format(
+      "//\n"
+      "// Generated by dbusipc-idlgen from %s. Do not edit.\n"
+      "//\n"
+      "\n"
+      "#include \"%s.hpp\"\n"
+      "\n"
+      "#include <string.h>\n"
+      "#include <memory>\n"
+      "#include \"dbusipc/dbusipc_idl.hpp\"\n"
+      "\n"
+      "namespace %s\n"
+      "{\n"
+      "\n"
+      "namespace\n"
+      "{\n"
+      "\n"
+      "const DBUSIPC_tError FORMAT_ERROR = DBUSIPC_MAKE_ERROR(\n"
+      "                                       DBUSIPC_ERROR_LEVEL_ERROR,\n"
+      "                                       DBUSIPC_DOMAIN_IPC_LIB,\n"
+      "                                       DBUSIPC_ERR_FORMAT);\n"
+      "\n"
+      "const DBUSIPC_tError BAD_ARGS_ERROR = DBUSIPC_MAKE_ERROR(\n"
+      "                                       DBUSIPC_ERROR_LEVEL_ERROR,\n"
+      "                                       DBUSIPC_DOMAIN_IPC_LIB,\n"
+      "                                       DBUSIPC_ERR_BAD_ARGS);\n"
+      "\n"
+      "\n",
+      source.c_str(), name.c_str(), name.c_str()));
+
+   // Per method (de)serialisation and the adapters for the asynchronous
+   // callbacks
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string cap = capitalize(it->name);
+      if ( !it->in.empty() )
+      {
+         str.append(generateEncoder("encode" + cap + "In", it->in));
+         str.append(generateDecoder("decode" + cap + "In", it->in));
+      }
+      if ( !it->out.empty() )
+      {
+         str.append(generateEncoder("encode" + cap + "Out", it->out));
+         str.append(generateDecoder("decode" + cap + "Out", it->out));
+      }
+
+      str.append(format(
+         "struct t%sCall\n"
+         "{\n"
+         "   Proxy::t%sCallback onResult;\n"
+         "   DBUSIPC_tUserToken token;\n"
+         "};\n"
+         "\n"
+         "void on%sResult\n"
+         "   (\n"
+         "   const DBUSIPC_tCallbackStatus*   status,\n"
+         "   DBUSIPC_tConstStr                json,\n"
+         "   DBUSIPC_tUserToken               token\n"
+         "   )\n"
+         "{\n"
+         "   std::auto_ptr<t%sCall> call(static_cast<t%sCall*>(token));\n"
+         "   DBUSIPC_tCallbackStatus decoded = *status;\n"
+         "%s",
+         cap.c_str(), cap.c_str(), cap.c_str(), cap.c_str(), cap.c_str(),
+         declareLocals(it->out, "   ").c_str()));
+
+      if ( it->out.empty() )
+      {
+         str.append("   (void)json;\n");
+      }
+      else
+      {
+         str.append(format(
+            "\n"
+            "   if ( !DBUSIPC_IS_ERROR(decoded.errCode) &&\n"
+            "      !decode%sOut(%s) )\n"
+            "   {\n"
+            "      decoded.errCode = FORMAT_ERROR;\n"
+            "      decoded.errName = DBUSIPC_ERR_NAME_FORMAT;\n"
+            "      decoded.errMsg = \"Malformed result\";\n"
+            "   }\n",
+            cap.c_str(), join("json", argList(it->out,
+            LIST_NAMES)).c_str()));
+      }
+
+      str.append(format(
+         "\n"
+         "   if ( 0 != call->onResult )\n"
+         "   {\n"
+         "      call->onResult(%s);\n"
+         "   }\n"
+         "}\n"
+         "\n"
+         "\n",
+         join(join("&decoded", argList(it->out, LIST_NAMES)),
+         "call->token").c_str()));
+   }
+
+   str.append(
+      "} // namespace\n"
+      "\n"
+      "\n"
+      "Proxy::Proxy\n"
+      "   (\n"
+      "   DBUSIPC_tConnection  conn,\n"
+      "   const char*          busName,\n"
+      "   const char*          objPath,\n"
+      "   DBUSIPC_tUInt32      msecTimeout\n"
+      "   )\n"
+      "   : mConn(conn)\n"
+      "   , mBusName((0 != busName) ? busName : BUS_NAME)\n"
+      "   , mObjPath((0 != objPath) ? objPath : \"\")\n"
+      "   , mMsecTimeout(msecTimeout)\n"
+      "{\n"
+      "}\n"
+      "\n"
+      "\n"
+      "const char* Proxy::objPath() const\n"
+      "{\n"
+      "   // The library synthesizes the path from the bus name\n"
+      "   return mObjPath.empty() ? 0 : mObjPath.c_str();\n"
+      "}\n"
+      "\n"
+      "\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string cap = capitalize(it->name);
+      std::string constant = toConstant(it->name);
+      // Arguments that can't be encoded are refused before sending
+      std::string parms = it->in.empty() ? std::string("(\"{}\")") :
+                          format(" = encode%sIn(%s)", cap.c_str(),
+                          argList(it->in, LIST_NAMES).c_str());
+
+      str.append(format(
+         "DBUSIPC_tError Proxy::%s(%s)\n"
+         "{\n"
+         "   std::string parms%s;\n"
+         "   DBUSIPC_tResponse* response(0);\n"
+         "   DBUSIPC_tError status(BAD_ARGS_ERROR);\n"
+         "\n"
+         "   if ( !parms.empty() )\n"
+         "   {\n"
+         "      status = DBUSIPC_invoke(mConn, mBusName.c_str(), objPath(),\n"
+         "                              METHOD_%s, parms.c_str(),\n"
+         "                              mMsecTimeout, &response);\n"
+         "   }\n"
+         "   if ( !DBUSIPC_IS_ERROR(status) && (0 != response) )\n"
+         "   {\n"
+         "      status = response->status.errCode;\n",
+         it->name.c_str(), join(argList(it->in, LIST_PARAMS),
+         argList(it->out, LIST_REFS)).c_str(), parms.c_str(),
+         constant.c_str()));
+
+      if ( !it->out.empty() )
+      {
+         str.append(format(
+            "      if ( !DBUSIPC_IS_ERROR(status) &&\n"
+            "         !decode%sOut(%s) )\n"
+            "      {\n"
+            "         status = FORMAT_ERROR;\n"
+            "      }\n",
+            cap.c_str(), join("response->result", argList(it->out,
+            LIST_NAMES)).c_str()));
+      }
+
+      str.append(format(
+         "   }\n"
+         "   DBUSIPC_freeResponse(response);\n"
+         "\n"
+         "   return status;\n"
+         "}\n"
+         "\n"
+         "\n"
+         "DBUSIPC_tError Proxy::async%s(%s)\n"
+         "{\n"
+         "   std::string parms%s;\n"
+         "   DBUSIPC_tError status(BAD_ARGS_ERROR);\n"
+         "\n"
+         "   if ( !parms.empty() )\n"
+         "   {\n"
+         "      t%sCall* call = new t%sCall;\n"
+         "      call->onResult = onResult;\n"
+         "      call->token = token;\n"
+         "\n"
+         "      status = DBUSIPC_asyncInvoke(mConn, mBusName.c_str(),\n"
+         "                              objPath(), METHOD_%s,\n"
+         "                              parms.c_str(), DBUSIPC_FALSE,\n"
+         "                              mMsecTimeout, on%sResult, handle,\n"
+         "                              call);\n"
+         "      // The callback is only made if the call was submitted\n"
+         "      if ( DBUSIPC_IS_ERROR(status) )\n"
+         "      {\n"
+         "         delete call;\n"
+         "      }\n"
+         "   }\n"
+         "\n"
+         "   return status;\n"
+         "}\n"
+         "\n"
+         "\n",
+         cap.c_str(), join(argList(it->in, LIST_PARAMS), format(
+         "t%sCallback onResult, DBUSIPC_tHandle* handle, "
+         "DBUSIPC_tUserToken token", cap.c_str())).c_str(), parms.c_str(),
+         cap.c_str(), cap.c_str(), constant.c_str(), cap.c_str()));
+   }
+
+   str.append(
+      "Skeleton::Skeleton()\n"
+      "   : mRegHnd(0)\n"
+      "{\n"
+      "}\n"
+      "\n"
+      "\n"
+      "Skeleton::~Skeleton()\n"
+      "{\n"
+      "   (void)unregisterService();\n"
+      "}\n"
+      "\n"
+      "\n"
+      "DBUSIPC_tError Skeleton::registerService\n"
+      "   (\n"
+      "   DBUSIPC_tConnection  conn,\n"
+      "   const char*          busName,\n"
+      "   const char*          objPath,\n"
+      "   DBUSIPC_tUInt32      flag\n"
+      "   )\n"
+      "{\n"
+      "   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);\n"
+      "\n"
+      "   if ( 0 != mRegHnd )\n"
+      "   {\n"
+      "      status = DBUSIPC_MAKE_ERROR(DBUSIPC_ERROR_LEVEL_ERROR,\n"
+      "                                 DBUSIPC_DOMAIN_IPC_LIB,\n"
+      "                                 DBUSIPC_ERR_BAD_ARGS);\n"
+      "   }\n"
+      "   else\n"
+      "   {\n"
+      "      status = DBUSIPC_registerService(conn,\n"
+      "                     (0 != busName) ? busName : BUS_NAME, objPath,\n"
+      "                     flag, onRequest, this, &mRegHnd);\n"
+      "   }\n"
+      "\n"
+      "   return status;\n"
+      "}\n"
+      "\n"
+      "\n"
+      "DBUSIPC_tError Skeleton::unregisterService()\n"
+      "{\n"
+      "   DBUSIPC_tError status(DBUSIPC_ERROR_NONE);\n"
+      "\n"
+      "   if ( 0 != mRegHnd )\n"
+      "   {\n"
+      "      status = DBUSIPC_unregisterService(mRegHnd);\n"
+      "      mRegHnd = 0;\n"
+      "   }\n"
+      "\n"
+      "   return status;\n"
+      "}\n"
+      "\n"
+      "\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string cap = capitalize(it->name);
+      std::string json = it->out.empty() ? std::string("(\"{}\")") :
+                         format(" = encode%sOut(%s)", cap.c_str(),
+                         argList(it->out, LIST_NAMES).c_str());
+      str.append(format(
+         "DBUSIPC_tError Skeleton::reply%s(%s)\n"
+         "{\n"
+         "   std::string json%s;\n"
+         "   DBUSIPC_tError status(BAD_ARGS_ERROR);\n"
+         "\n"
+         "   if ( json.empty() )\n"
+         "   {\n"
+         "      // The client is still answered rather than left to time out\n"
+         "      (void)replyError(context, DBUSIPC_ERR_NAME_FORMAT,\n"
+         "                       \"Result can't be encoded\");\n"
+         "   }\n"
+         "   else\n"
+         "   {\n"
+         "      status = DBUSIPC_asyncReturnResultAndFree(context,\n"
+         "                                 json.c_str(), 0, 0);\n"
+         "   }\n"
+         "\n"
+         "   return status;\n"
+         "}\n"
+         "\n"
+         "\n",
+         cap.c_str(), join("DBUSIPC_tReqContext context",
+         argList(it->out, LIST_PARAMS)).c_str(), json.c_str()));
+   }
+
+   str.append(
+      "DBUSIPC_tError Skeleton::replyError\n"
+      "   (\n"
+      "   DBUSIPC_tReqContext  context,\n"
+      "   const char*          errName,\n"
+      "   const char*          errMsg\n"
+      "   )\n"
+      "{\n"
+      "   return DBUSIPC_asyncReturnErrorAndFree(context, errName, errMsg, 0, "
+      "0);\n"
+      "}\n"
+      "\n"
+      "\n"
+      "void Skeleton::onRequest\n"
+      "   (\n"
+      "   DBUSIPC_tReqContext  context,\n"
+      "   DBUSIPC_tConstStr    method,\n"
+      "   DBUSIPC_tConstStr    parms,\n"
+      "   DBUSIPC_tBool        noReplyExpected,\n"
+      "   DBUSIPC_tUserToken   token\n"
+      "   )\n"
+      "{\n"
+      "   // A reply the client doesn't expect is simply discarded\n"
+      "   (void)noReplyExpected;\n"
+      "   static_cast<Skeleton*>(token)->dispatch(context, method, parms);\n"
+      "}\n"
+      "\n"
+      "\n"
+      "void Skeleton::dispatch\n"
+      "   (\n"
+      "   DBUSIPC_tReqContext  context,\n"
+      "   DBUSIPC_tConstStr    method,\n"
+      "   DBUSIPC_tConstStr    parms\n"
+      "   )\n"
+      "{\n"
+      "   bool known(false);\n"
+      "\n"
+      "   // The hash picks the method, the name comparison confirms it\n"
+      "   switch ( dbusipc::idl::hash(method) )\n"
+      "   {\n");
+
+   for ( std::vector<tMethod>::const_iterator it = iface.methods.begin();
+      it != iface.methods.end(); ++it )
+   {
+      std::string cap = capitalize(it->name);
+      std::string constant = toConstant(it->name);
+      str.append(format(
+         "      case METHOD_%s_ID:\n"
+         "         known = (0 == strcmp(method, METHOD_%s));\n"
+         "         if ( known )\n"
+         "         {\n",
+         constant.c_str(), constant.c_str()));
+
+      if ( it->in.empty() )
+      {
+         str.append(format(
+            "            on%s(context);\n",
+            cap.c_str()));
+      }
+      else
+      {
+         str.append(format(
+            "%s"
+            "            if ( decode%sIn(%s) )\n"
+            "            {\n"
+            "               on%s(%s);\n"
+            "            }\n"
+            "            else\n"
+            "            {\n"
+            "               (void)replyError(context, DBUSIPC_ERR_NAME_FORMAT,\n"
+            "                                \"Malformed parameters\");\n"
+            "            }\n",
+            declareLocals(it->in, "            ").c_str(), cap.c_str(),
+            join("parms", argList(it->in, LIST_NAMES)).c_str(), cap.c_str(),
+            join("context", argList(it->in, LIST_NAMES)).c_str()));
+      }
+
+      str.append(
+         "         }\n"
+         "         break;\n");
+   }
+
+   str.append(format(
+      "      default:\n"
+      "         break;\n"
+      "   }\n"
+      "\n"
+      "   if ( !known )\n"
+      "   {\n"
+      "      (void)replyError(context, DBUSIPC_ERR_NAME_UNKNOWN_METHOD, "
+      "method);\n"
+      "   }\n"
+      "}\n"
+      "\n"
+      "} // namespace %s\n",
+      name.c_str()));
+
+   return str;
+}
+
+
+bool readFile
+   (
+   const char*    fileName,
+   std::string&   text
+   )
+{
+   FILE* fp = fopen(fileName, "r");
+   bool ok(0 != fp);
+
+   if ( ok )
+   {
+      char buf[4096];
+      size_t n(0U);
+      while ( 0U != (n = fread(buf, 1U, sizeof(buf), fp)) )
+      {
+         text.append(buf, n);
+      }
+      ok = (0 == ferror(fp));
+      (void)fclose(fp);
+   }
+
+   if ( !ok )
+   {
+      fprintf(stderr, "Failed to read %s\n", fileName);
+   }
+
+   return ok;
+}
+
+
+bool writeFile
+   (
+   const std::string&   fileName,
+   const std::string&   text
+   )
+{
+   FILE* fp = fopen(fileName.c_str(), "w");
+   bool ok(0 != fp);
+
+   if ( ok )
+   {
+      ok = (text.size() == fwrite(text.data(), 1U, text.size(), fp));
+      ok = (0 == fclose(fp)) && ok;
+   }
+
+   if ( !ok )
+   {
+      fprintf(stderr, "Failed to write %s\n", fileName.c_str());
+   }
+
+   return ok;
+}
+
+
+void usage()
+{
+   fprintf(stderr, "Usage: dbusipc-idlgen [-n name] [-o dir] idl.xml\n");
+}
+
+} // namespace
+
+
+int main
+   (
+   int   argc,
+   char* argv[]
+   )
+{
+   const char* idlFile(0);
+   std::string name;
+   std::string outDir(".");
+   bool ok(true);
+
+   for ( int i = 1; ok && (i < argc); ++i )
+   {
+      if ( (0 == strcmp(argv[i], "-n")) && (i + 1 < argc) )
+      {
+         name = argv[++i];
+      }
+      else if ( (0 == strcmp(argv[i], "-o")) && (i + 1 < argc) )
+      {
+         outDir = argv[++i];
+      }
+      else if ( ('-' != argv[i][0]) && (0 == idlFile) )
+      {
+         idlFile = argv[i];
+      }
+      else
+      {
+         ok = false;
+      }
+   }
+
+   std::string text;
+   tInterface iface;
+   if ( !ok || (0 == idlFile) )
+   {
+      usage();
+      ok = false;
+   }
+   else
+   {
+      ok = readFile(idlFile, text) && parse(idlFile, text, iface);
+   }
+
+   if ( ok && name.empty() )
+   {
+      std::string::size_type dot = iface.name.rfind('.');
+      name = (std::string::npos == dot) ? iface.name :
+             iface.name.substr(dot + 1U);
+   }
+
+   if ( ok && !isIdentifier(name) )
+   {
+      fprintf(stderr, "Invalid name '%s' (use -n)\n", name.c_str());
+      ok = false;
+   }
+
+   if ( ok )
+   {
+      // Only the file name is recorded so the output doesn't depend on
+      // where it was generated
+      const char* source = strrchr(idlFile, '/');
+      source = (0 != source) ? source + 1 : idlFile;
+      std::string base = outDir + "/" + name;
+      ok = writeFile(base + ".hpp", generateHeader(iface, name, source)) &&
+           writeFile(base + ".cpp", generateSource(iface, name, source));
+   }
+
+   return ok ? 0 : 1;
+}
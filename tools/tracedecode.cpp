@@ -0,0 +1,147 @@
+//
+// Offline decoder for the binary traces written by DBUSIPC_dumpTrace().
+// The events of all the threads are merged in time order and printed one
+// per line:
+//
+//    <usec since first event> T<thread> <event> <arguments>
+//
+// Usage: dbusipc-tracedecode <trace file>
+//
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include "dbusipc/dbusipc_trace.h"
+
+namespace
+{
+
+struct tEvent
+{
+   uint32_t                thread;
+   DBUSIPC_tTraceRecord     record;
+};
+
+bool earlier(const tEvent& lhs, const tEvent& rhs)
+{
+   return lhs.record.timestamp < rhs.record.timestamp;
+}
+
+// Argument names (NULL if unused) for each event
+const char* const EVENTS[DBUSIPC_TRACE_NUM_EVENTS][DBUSIPC_TRACE_NUM_ARGS + 1] =
+{
+   { "NONE", 0, 0, 0, 0 },
+   { "MSG_RECEIVED", "conn", "type", "serial", "replySerial" },
+   { "DISCONNECTED", "conn", 0, 0, 0 },
+   { "CMD_SUBMITTED", "handle", 0, 0, 0 },
+   { "CMD_EXECUTED", "handle", 0, 0, 0 },
+   { "INVOKE_SENT", "handle", "serial", 0, 0 },
+   { "INVOKE_DONE", "handle", "error", 0, 0 },
+   { "REQUEST_RECEIVED", "reg", "serial", 0, 0 },
+   { "REPLY_SENT", "replySerial", "error", 0, 0 },
+   { "SIGNAL_EMITTED", "reg", "serial", 0, 0 },
+   { "HANDLER_STALLED", "kind", "elapsed", "budget", "frames" }
+};
+
+void print(const tEvent& ev, uint64_t start)
+{
+   const DBUSIPC_tTraceRecord& rec = ev.record;
+   printf("%12.3f T%u ", static_cast<double>(rec.timestamp - start) / 1000.0,
+          ev.thread);
+   
+   if ( rec.event >= DBUSIPC_TRACE_NUM_EVENTS )
+   {
+      printf("EVENT_%u", rec.event);
+      for ( uint32_t i = 0U; i < DBUSIPC_TRACE_NUM_ARGS; ++i )
+      {
+         printf(" 0x%llx", static_cast<unsigned long long>(rec.args[i]));
+      }
+   }
+   else
+   {
+      printf("%s", EVENTS[rec.event][0]);
+      for ( uint32_t i = 0U; (i < DBUSIPC_TRACE_NUM_ARGS) &&
+         (0 != EVENTS[rec.event][i + 1U]); ++i )
+      {
+         printf(" %s=0x%llx", EVENTS[rec.event][i + 1U],
+                static_cast<unsigned long long>(rec.args[i]));
+      }
+   }
+   printf("\n");
+}
+
+}  // End anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+   int rc(1);
+   FILE* fp = (2 == argc) ? fopen(argv[1], "rb") : 0;
+   DBUSIPC_tTraceFileHeader header;
+   
+   if ( 2 != argc )
+   {
+      fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+   }
+   else if ( 0 == fp )
+   {
+      perror(argv[1]);
+   }
+   else if ( (1U != fread(&header, sizeof(header), 1U, fp)) ||
+      (DBUSIPC_TRACE_FILE_MAGIC != header.magic) ||
+      (DBUSIPC_TRACE_FILE_VERSION != header.version) ||
+      (sizeof(DBUSIPC_tTraceRecord) != header.recordSize) )
+   {
+      fprintf(stderr, "%s: not a (supported) trace file\n", argv[1]);
+   }
+   else
+   {
+      std::vector<tEvent> events;
+      bool ok(true);
+      
+      for ( uint32_t t = 0U; ok && (t < header.numThreads); ++t )
+      {
+         DBUSIPC_tTraceThread thread;
+         ok = (1U == fread(&thread, sizeof(thread), 1U, fp));
+         if ( ok )
+         {
+            printf("T%u: thread 0x%llx, %u events (%u lost)\n", t,
+                   static_cast<unsigned long long>(thread.threadId),
+                   thread.numRecords, thread.numLost);
+         }
+         
+         for ( uint32_t i = 0U; ok && (i < thread.numRecords); ++i )
+         {
+            tEvent ev;
+            ev.thread = t;
+            ok = (1U == fread(&ev.record, sizeof(ev.record), 1U, fp));
+            if ( ok )
+            {
+               events.push_back(ev);
+            }
+         }
+      }
+      
+      if ( !ok )
+      {
+         fprintf(stderr, "%s: truncated trace file\n", argv[1]);
+      }
+      else
+      {
+         std::stable_sort(events.begin(), events.end(), earlier);
+         for ( std::vector<tEvent>::const_iterator it = events.begin();
+            it != events.end(); ++it )
+         {
+            print(*it, events.front().record.timestamp);
+         }
+         rc = 0;
+      }
+   }
+   
+   if ( 0 != fp )
+   {
+      fclose(fp);
+   }
+   
+   return rc;
+}